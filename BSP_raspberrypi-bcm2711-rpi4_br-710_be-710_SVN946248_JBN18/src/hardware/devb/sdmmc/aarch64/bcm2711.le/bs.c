@@ -26,20 +26,64 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <hw/inout.h>
 #include <sys/mman.h>
 
 #include <sdhci.h>
 
+/*
+ * The SD slot's I/O supply is switched between 3.3V and 1.8V by a GPIO on
+ * the firmware's expander, SD_VDDIO on the RPi4, which is set through the
+ * VideoCore property mailbox.
+ */
+#define MBOX_BASE					0xfe00b880
+#define MBOX_SIZE					0x40
+#define MBOX0_READ					0x00		// from VC
+#define MBOX0_STATUS				0x18
+#define MBOX1_WRITE					0x20		// to VC
+#define MBOX1_STATUS				0x38
+#define MBOX_STATUS_FULL			0x80000000
+#define MBOX_STATUS_EMPTY			0x40000000
+#define MBOX_CHAN_PROP				8
+#define MBOX_TIMEOUT				100			// ms
+
+#define MBOX_PROCESS_REQUEST		0
+#define MBOX_REQ_SUCCESS			0x80000000
+#define MBOX_TAG_REQUEST			0
+#define MBOX_TAG_RESPONSE			0x80000000
+#define MBOX_TAG_NULL				0
+#define MBOX_TAG_SET_GPIO_STATE		0x00038041
+
+#define BCM2711_VSEL_GPIO			132			// SD_VDDIO, expander GPIO 4
+#define BCM2711_VSEL_MIN			128			// the firmware's expander GPIOs
+#define BCM2711_VSEL_MAX			135
+#define BCM2711_VSEL_NONE			-1
+
+typedef struct _bcm2711_bs {
+	uintptr_t		mbox;
+	uint32_t		*msg;						// property message, below 1G
+	paddr64_t		msg_paddr;					// as the VC sees it
+	int				vsel;						// expander GPIO high for 1.8V I/O
+	int				v18;						// its state, -1 unknown
+	int				(*signal_voltage)(sdio_hc_t *hc, int sv);
+	int				(*pwr)(sdio_hc_t *hc, int vdd);
+} bcm2711_bs_t;
+
 static int bcm2711_bs_args(sdio_hc_t *hc, char *options)
 {
 	char	*value;
+	char	*end;
+	long	gpio;
 	int		opt;
 	sdio_hc_cfg_t	*cfg = &hc->cfg;
+	bcm2711_bs_t	*bs = hc->bs_hdl;
 
 	static char     *opts[] = {
 #define BUSMASTER_BASE		0
 	"bmstr_base",
+#define VSEL				1
+	"vsel",
 	NULL};
 
 	while (options && *options != '\0') {
@@ -52,6 +96,19 @@ static int bcm2711_bs_args(sdio_hc_t *hc, char *options)
 			case BUSMASTER_BASE:
 				cfg->bmstr_xlat = strtoull(value, NULL, 0);
 				break;
+			case VSEL:
+				if (value != NULL && !strcmp(value, "none")) {
+					bs->vsel = BCM2711_VSEL_NONE;
+				} else if (value != NULL) {
+					gpio = strtol(value, &end, 0);
+					if (end == value || *end != '\0' || gpio < BCM2711_VSEL_MIN || gpio > BCM2711_VSEL_MAX) {
+						sdio_slogf( _SLOGC_SDIODI, _SLOG_ERROR, hc->cfg.verbosity, 0, "%s: vsel %s not an expander GPIO (%d-%d)",
+							__func__, value, BCM2711_VSEL_MIN, BCM2711_VSEL_MAX);
+						return EINVAL;
+					}
+					bs->vsel = gpio;
+				}
+				break;
 			default:
 				break;
 		}
@@ -60,12 +117,178 @@ static int bcm2711_bs_args(sdio_hc_t *hc, char *options)
 	return EOK;
 }
 
+static int bcm2711_mbox_gpio(sdio_hc_t *hc, int gpio, int state)
+{
+	bcm2711_bs_t		*bs = hc->bs_hdl;
+	volatile uint32_t	*msg = bs->msg;
+	uint32_t			rd;
+	int					tmo;
+
+	msg[0] = 8 * sizeof(uint32_t);
+	msg[1] = MBOX_PROCESS_REQUEST;
+	msg[2] = MBOX_TAG_SET_GPIO_STATE;
+	msg[3] = 2 * sizeof(uint32_t);
+	msg[4] = MBOX_TAG_REQUEST;
+	msg[5] = gpio;
+	msg[6] = state;
+	msg[7] = MBOX_TAG_NULL;
+
+	for (tmo = MBOX_TIMEOUT * 10; in32(bs->mbox + MBOX1_STATUS) & MBOX_STATUS_FULL; tmo--) {
+		if (!tmo) {
+			return ETIMEDOUT;
+		}
+		nanospin_ns(100000);
+	}
+
+	out32(bs->mbox + MBOX1_WRITE, ((uint32_t)bs->msg_paddr & ~0xf) | MBOX_CHAN_PROP);
+
+	// replies for other channels count against the timeout too
+	for (tmo = MBOX_TIMEOUT * 10; tmo; tmo--) {
+		if (in32(bs->mbox + MBOX0_STATUS) & MBOX_STATUS_EMPTY) {
+			nanospin_ns(100000);
+			continue;
+		}
+		rd = in32(bs->mbox + MBOX0_READ);
+		if ((rd & 0xf) == MBOX_CHAN_PROP) {
+			break;
+		}
+	}
+
+	if (!tmo) {
+		return ETIMEDOUT;
+	}
+
+	// the firmware answers in place, 0 in the gpio word if the pin was set
+	if (msg[1] != MBOX_REQ_SUCCESS || !(msg[4] & MBOX_TAG_RESPONSE) || msg[5] != 0) {
+		return EIO;
+	}
+
+	return EOK;
+}
+
+static int bcm2711_vsel(sdio_hc_t *hc, int v18)
+{
+	bcm2711_bs_t	*bs = hc->bs_hdl;
+	int				status;
+
+	if (bs->v18 == v18) {
+		return EOK;
+	}
+
+	if ((status = bcm2711_mbox_gpio(hc, bs->vsel, v18))) {
+		sdio_slogf(_SLOGC_SDIODI, _SLOG_ERROR, hc->cfg.verbosity, 0, "%s: I/O supply to %s failed %d", __func__, v18 ? "1.8V" : "3.3V", status);
+		bs->v18 = -1;
+		return status;
+	}
+
+	bs->v18 = v18;
+
+	return EOK;
+}
+
+/* Supply first, then the host's own switch: clock stop, 1.8V enable and the DAT[3:0] check */
+static int bcm2711_signal_voltage(sdio_hc_t *hc, int signal_voltage)
+{
+	bcm2711_bs_t	*bs = hc->bs_hdl;
+	int				status;
+
+	if (signal_voltage != SIGNAL_VOLTAGE_1_8 && signal_voltage != SIGNAL_VOLTAGE_3_3) {
+		return EINVAL;
+	}
+
+	if ((status = bcm2711_vsel(hc, signal_voltage == SIGNAL_VOLTAGE_1_8))) {
+		return status;
+	}
+
+	if ((status = bs->signal_voltage(hc, signal_voltage)) && signal_voltage == SIGNAL_VOLTAGE_1_8) {
+		bcm2711_vsel(hc, 0);
+	}
+
+	return status;
+}
+
+/* Back to 3.3V I/O while the card is off, so it powers up at what it expects */
+static int bcm2711_pwr(sdio_hc_t *hc, int vdd)
+{
+	if (!vdd) {
+		bcm2711_vsel(hc, 0);
+	}
+
+	return ((bcm2711_bs_t *)hc->bs_hdl)->pwr(hc, vdd);
+}
+
+static int bcm2711_dinit(sdio_hc_t *hc)
+{
+	bcm2711_bs_t	*bs = hc->bs_hdl;
+	int				status;
+
+	status = sdhci_dinit(hc);
+
+	if (bs) {
+		if (bs->msg) {
+			sdio_free(bs->msg, MBOX_SIZE);
+		}
+		if (bs->mbox && bs->mbox != (uintptr_t)MAP_FAILED) {
+			munmap_device_io(bs->mbox, MBOX_SIZE);
+		}
+		free(bs);
+		hc->bs_hdl = NULL;
+	}
+
+	return status;
+}
+
+/* UHS-I on the SD slot, needs the I/O supply switched with the signal voltage */
+static int bcm2711_uhs_init(sdio_hc_t *hc)
+{
+	bcm2711_bs_t	*bs = hc->bs_hdl;
+	int				status;
+
+	if (bs->vsel == BCM2711_VSEL_NONE || hc->version < SDHCI_SPEC_VER_3) {
+		return ENOTSUP;
+	}
+
+	bs->mbox = mmap_device_io(MBOX_SIZE, MBOX_BASE);
+	if (bs->mbox == (uintptr_t)MAP_FAILED) {
+		status = errno;
+		sdio_slogf(_SLOGC_SDIODI, _SLOG_ERROR, hc->cfg.verbosity, 0, "%s: mailbox map %s", __func__, strerror(status));
+		return status;
+	}
+
+	if ((bs->msg = sdio_alloc(MBOX_SIZE)) == NULL) {
+		return ENOMEM;
+	}
+	bs->msg_paddr = sdio_vtop(bs->msg) + hc->cfg.bmstr_xlat;	// VC bus address, as for DMA
+
+		// start from 3.3V, and find out whether the firmware answers at all
+	if ((status = bcm2711_vsel(hc, 0))) {
+		return status;
+	}
+
+	bs->signal_voltage = hc->entry.signal_voltage;
+	bs->pwr = hc->entry.pwr;
+	hc->entry.signal_voltage = bcm2711_signal_voltage;
+	hc->entry.pwr = bcm2711_pwr;
+
+	return EOK;
+}
+
 static int bcm2711_bs_init(sdio_hc_t *hc)
 {
 	int    status = EOK;
 	sdio_hc_cfg_t  *cfg = &hc->cfg;
+	bcm2711_bs_t   *bs;
+
+	if ((bs = calloc(1, sizeof(*bs))) == NULL) {
+		return ENOMEM;
+	}
+	bs->vsel = BCM2711_VSEL_GPIO;
+	bs->v18 = -1;
+	hc->bs_hdl = bs;
 
 	if (bcm2711_bs_args(hc, cfg->options)) {
+		free(bs);
+		hc->bs_hdl = NULL;
 		return EINVAL;
 	}
 
@@ -75,13 +298,22 @@ static int bcm2711_bs_init(sdio_hc_t *hc)
 
 	status = sdhci_init(hc);
 	if( status != EOK ) {
+		free(bs);
+		hc->bs_hdl = NULL;
 		return status;
 	}
+	hc->entry.dinit = bcm2711_dinit;
 
 	if(!(hc->caps & HC_CAP_SLOT_TYPE_EMBEDDED)) {
 		/* Overwrite some of the capabilities that are set by sdhci_init() */
 		hc->caps &= ~HC_CAP_CD_INTR;
-		hc->caps &= ~HC_CAP_SV_1_8V;
+
+		if (bcm2711_uhs_init(hc) == EOK) {
+			hc->caps |= HC_CAP_SDR12 | HC_CAP_SDR25 | HC_CAP_SDR50 | HC_CAP_SDR104 | HC_CAP_DDR50;
+			hc->caps &= cfg->caps;		// reconcile command line options
+		} else {
+			hc->caps &= ~HC_CAP_SV_1_8V;
+		}
 	}
 	return status;
 }
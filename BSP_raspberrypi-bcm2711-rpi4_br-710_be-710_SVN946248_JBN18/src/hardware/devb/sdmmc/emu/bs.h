@@ -0,0 +1,30 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * The board header with SOC support turned back on: the target finds the
+ * controller through the HWI tables, the emulator hands sdio_soc_scan()
+ * and sdio_soc_device() the modelled one instead (emu_sdhci.c).
+ */
+
+#include "../aarch64/bcm2711.le/bs.h"
+
+#define SDIO_SOC_SUPPORT
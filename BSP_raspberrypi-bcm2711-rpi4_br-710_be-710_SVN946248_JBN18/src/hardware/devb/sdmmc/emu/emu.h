@@ -0,0 +1,414 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * Host stand-ins for the QNX interfaces used by the SIM, sdiodi and the
+ * SDHCI host driver, so they build and run unchanged on Linux.  The
+ * Makefile force includes this file ahead of every source, and each QNX
+ * only header the driver includes is generated as a one line wrapper
+ * around it.
+ *
+ * Channels, pulses, timers and interrupt events are emulated in emu_os.c,
+ * register accesses through in32()/out32() go to the controller model in
+ * emu_sdhci.c and physical addresses are host addresses, so DMA is a
+ * memcpy.  Thread priorities and scheduling policies aren't modelled,
+ * every thread inherits the policy of the harness.
+ */
+
+#ifndef EMU_H_
+#define EMU_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#define EOK                 0
+
+#define __PTR_BITS__        64
+#define __LITTLEENDIAN__    1
+
+typedef uint8_t             _Uint8t;
+typedef uint16_t            _Uint16t;
+typedef uint32_t            _Uint32t;
+typedef uint64_t            _Uint64t;
+typedef int8_t              _Int8t;
+typedef int16_t             _Int16t;
+typedef int32_t             _Int32t;
+typedef int64_t             _Int64t;
+typedef uintptr_t           _Uintptrt;
+typedef uint8_t             _uint8;
+typedef uint16_t            _uint16;
+typedef uint32_t            _uint32;
+typedef uint64_t            _uint64;
+typedef int32_t             _int32;
+typedef unsigned char       uchar_t;
+typedef unsigned short      ushort_t;
+typedef uint64_t            paddr64_t;
+typedef uint64_t            paddr_t;
+
+#ifndef min
+#define min(a, b)           ((a) < (b) ? (a) : (b))
+#define max(a, b)           ((a) > (b) ? (a) : (b))
+#endif
+
+void delay(unsigned int msec);
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+/* gulliver.h */
+#define ENDIAN_LE16(x)      ((uint16_t) (x))
+#define ENDIAN_LE32(x)      ((uint32_t) (x))
+#define ENDIAN_LE64(x)      ((uint64_t) (x))
+#define ENDIAN_BE16(x)      __builtin_bswap16((uint16_t) (x))
+#define ENDIAN_BE32(x)      __builtin_bswap32((uint32_t) (x))
+#define ENDIAN_BE64(x)      __builtin_bswap64((uint64_t) (x))
+#define ENDIAN_RET16(x)     ENDIAN_LE16(x)
+#define ENDIAN_RET32(x)     ENDIAN_LE32(x)
+#define ENDIAN_RET64(x)     ENDIAN_LE64(x)
+#define ENDIAN_SWAP16(p)    (*(uint16_t *) (p) = __builtin_bswap16(*(uint16_t *) (p)))
+#define ENDIAN_SWAP32(p)    (*(uint32_t *) (p) = __builtin_bswap32(*(uint32_t *) (p)))
+
+static inline uint16_t emu_get16(const void *p) { uint16_t v; memcpy(&v, p, 2); return v; }
+static inline uint32_t emu_get32(const void *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static inline uint64_t emu_get64(const void *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+
+#define UNALIGNED_RET16(p)      emu_get16(p)
+#define UNALIGNED_RET32(p)      emu_get32(p)
+#define UNALIGNED_RET64(p)      emu_get64(p)
+#define UNALIGNED_PUT16(p, v)   do { uint16_t _v = (v); memcpy((p), &_v, 2); } while (0)
+#define UNALIGNED_PUT32(p, v)   do { uint32_t _v = (v); memcpy((p), &_v, 4); } while (0)
+#define UNALIGNED_PUT64(p, v)   do { uint64_t _v = (v); memcpy((p), &_v, 8); } while (0)
+
+/* atomic.h */
+#define atomic_set(p, v)        ((void) __atomic_fetch_or((p), (v), __ATOMIC_SEQ_CST))
+#define atomic_clr(p, v)        ((void) __atomic_fetch_and((p), ~(v), __ATOMIC_SEQ_CST))
+#define atomic_add(p, v)        ((void) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST))
+#define atomic_sub(p, v)        ((void) __atomic_fetch_sub((p), (v), __ATOMIC_SEQ_CST))
+#define atomic_set_value(p, v)  __atomic_fetch_or((p), (v), __ATOMIC_SEQ_CST)
+#define atomic_clr_value(p, v)  __atomic_fetch_and((p), ~(v), __ATOMIC_SEQ_CST)
+#define atomic_add_value(p, v)  __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define atomic_sub_value(p, v)  __atomic_fetch_sub((p), (v), __ATOMIC_SEQ_CST)
+
+/* sys/slogcodes.h */
+#define _SLOG_SETCODE(m, s)     ((m) + (s))
+#define _SLOGC_SIM_MMC          _SLOG_SETCODE(6, 0)
+#define _SLOG_SHUTDOWN          0
+#define _SLOG_CRITICAL          1
+#define _SLOG_ERROR             2
+#define _SLOG_WARNING           3
+#define _SLOG_NOTICE            4
+#define _SLOG_INFO              5
+#define _SLOG_DEBUG1            6
+#define _SLOG_DEBUG2            7
+
+int slogf(int opcode, int severity, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+int vslogf(int opcode, int severity, const char *fmt, va_list ap);
+
+/* sys/trace.h */
+#define _NTO_TRACE_DELALLCLASSES        0
+#define _NTO_TRACE_CLRCLASSPID          0
+#define _NTO_TRACE_CLRCLASSTID          0
+#define _NTO_TRACE_ADDALLCLASSES        0
+#define _NTO_TRACE_ADDCLASS             0
+#define _NTO_TRACE_START                0
+#define _NTO_TRACE_STOP                 0
+#define _NTO_TRACE_INSERTUSRSTREVENT    0
+#define _NTO_TRACE_KERCALL              0
+#define _NTO_TRACE_THREAD               0
+#define _NTO_TRACE_CONTROL              0
+#define _NTO_TRACE_INT                  0
+#define _NTO_TRACE_PROCESS              0
+#define TraceEvent(...)                 ((void) 0)
+
+/* sys/neutrino.h, sys/syspage.h */
+#define _NTO_CHF_UNBLOCK        0x0002
+#define _NTO_CHF_DISCONNECT     0x0004
+#define _NTO_CHF_PRIVATE        0x0100
+#define _NTO_SIDE_CHANNEL       0x40000000
+#define _NTO_INTR_FLAGS_TRK_MSK 0x0008
+#define _NTO_TCTL_IO            14
+#define _NTO_TCTL_IO_PRIV       25
+#define _NTO_VERSION            710
+
+#define _PULSE_CODE_MINAVAIL    0
+#define _PULSE_CODE_MAXAVAIL    127
+#define _PULSE_CODE_DISCONNECT  (-33)
+#define _PULSE_CODE_UNBLOCK     (-32)
+
+struct _pulse {
+    uint16_t        type;
+    uint16_t        subtype;
+    int8_t          code;
+    uint8_t         zero[3];
+    union sigval    value;
+    int32_t         scoid;
+};
+
+/*
+ * Only pulse events are used.  The host struct sigevent is left alone for
+ * the host headers, which are all included above.
+ */
+#define sigevent                emu_sigevent
+
+struct emu_sigevent {
+    int             sigev_notify;
+    int             sigev_coid;
+    int             sigev_priority;
+    int             sigev_code;
+    union sigval    sigev_value;
+};
+
+#define SIGEV_PULSE             4
+#define SIGEV_PULSE_INIT(e, c, p, cd, v) \
+    ((e)->sigev_notify = SIGEV_PULSE, (e)->sigev_coid = (c), (e)->sigev_priority = (p), \
+     (e)->sigev_code = (cd), (e)->sigev_value.sival_ptr = (void *) (v))
+
+int ChannelCreate(unsigned flags);
+int ChannelDestroy(int chid);
+int ConnectAttach(uint32_t nd, pid_t pid, int chid, unsigned index, int flags);
+int ConnectDetach(int coid);
+int MsgSendPulse(int coid, int priority, int code, int value);
+int MsgSendPulsePtr(int coid, int priority, int code, void *value);
+int MsgSendPulse_r(int coid, int priority, int code, int value);
+int MsgSendPulsePtr_r(int coid, int priority, int code, void *value);
+int MsgReceivePulse(int chid, void *pulse, size_t bytes, void *info);
+int InterruptAttachEvent(int intr, const struct sigevent *event, unsigned flags);
+int InterruptDetach(int id);
+int InterruptMask(int intr, int id);
+int InterruptUnmask(int intr, int id);
+int ThreadCtl(int cmd, void *data);
+uint64_t ClockCycles(void);
+int nanospin_ns(unsigned long nsec);
+
+#define timer_create            emu_timer_create
+#define timer_settime           emu_timer_settime
+#define timer_delete            emu_timer_delete
+#define timer_t                 int
+
+int emu_timer_create(clockid_t clock_id, struct sigevent *event, int *timerid);
+int emu_timer_settime(int timerid, int flags, const struct itimerspec *value, struct itimerspec *ovalue);
+int emu_timer_delete(int timerid);
+
+struct qtime_entry {
+    uint64_t        cycles_per_sec;
+    uint64_t        nsec;
+};
+
+extern struct qtime_entry emu_qtime;
+
+#define SYSPAGE_ENTRY(e)        (&emu_##e)
+#define _syspage_time(c)        emu_time_ns()
+
+uint64_t emu_time_ns(void);
+void nsec2timespec(struct timespec *ts, uint64_t nsec);
+uint64_t timespec2nsec(const struct timespec *ts);
+
+/* pthread_sleepon_*() share one mutex and condition variable */
+int pthread_sleepon_lock(void);
+int pthread_sleepon_unlock(void);
+int pthread_sleepon_wait(const volatile void *addr);
+int pthread_sleepon_signal(const volatile void *addr);
+int pthread_sleepon_broadcast(const volatile void *addr);
+
+#define pthread_attr_setinheritsched(a, i)  pthread_attr_setinheritsched((a), PTHREAD_INHERIT_SCHED)
+
+/*
+ * Thread ids are small integers as on QNX, sdiodi keeps some of them in
+ * an int.  emu_os.c maps them to host threads, 0 is any thread it didn't
+ * create.
+ */
+#define pthread_t               emu_pthread_t
+#define pthread_create          emu_pthread_create
+#define pthread_join            emu_pthread_join
+#define pthread_self            emu_pthread_self
+#define pthread_cancel          emu_pthread_cancel
+#define pthread_getschedparam   emu_pthread_getschedparam
+#define pthread_setname_np      emu_pthread_setname_np
+
+typedef int                     emu_pthread_t;
+
+int emu_pthread_create(emu_pthread_t *tid, const pthread_attr_t *attr, void *(*func)(void *), void *arg);
+int emu_pthread_join(emu_pthread_t tid, void **value);
+emu_pthread_t emu_pthread_self(void);
+int emu_pthread_cancel(emu_pthread_t tid);
+int emu_pthread_getschedparam(emu_pthread_t tid, int *policy, struct sched_param *param);
+int emu_pthread_setname_np(emu_pthread_t tid, const char *name);
+
+/* sys/mman.h */
+#define PROT_NOCACHE            0
+#define MAP_PHYS                0x40000000
+#define NOFD                    (-1)
+
+#define mmap                    emu_mmap
+#define munmap                  emu_munmap
+
+void *emu_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off);
+int emu_munmap(void *addr, size_t len);
+void *mmap_device_memory(void *addr, size_t len, int prot, int flags, uint64_t physical);
+int munmap_device_memory(void *addr, size_t len);
+uintptr_t mmap_device_io(size_t len, uint64_t io);
+int munmap_device_io(uintptr_t io, size_t len);
+int mem_offset64(const void *addr, int fd, size_t len, off64_t *offset, size_t *contig_len);
+
+/* hw/inout.h, all accesses go to the controller model */
+uint8_t in8(uintptr_t port);
+uint16_t in16(uintptr_t port);
+uint32_t in32(uintptr_t port);
+void out8(uintptr_t port, uint8_t val);
+void out16(uintptr_t port, uint16_t val);
+void out32(uintptr_t port, uint32_t val);
+void *in32s(void *buff, unsigned len, uintptr_t port);
+void *out32s(const void *buff, unsigned len, uintptr_t port);
+
+/* sys/cache.h */
+struct cache_ctrl {
+    int             fd;
+};
+
+#define CACHE_INIT(fd, c, f)        ((c)->fd = 0)
+#define CACHE_FINI(c)               ((void) (c))
+#define CACHE_INVAL(c, v, p, l)     ((void) (c), (void) (v), (void) (p), (void) (l))
+#define CACHE_FLUSH(c, v, p, l)     ((void) (c), (void) (v), (void) (p), (void) (l))
+
+/* sys/resmgr.h, sys/iomsg.h, io-blk, only ever seen through pointers */
+typedef struct _resmgr_context  resmgr_context_t;
+typedef union _io_msg           io_msg_t;
+typedef struct _io_entry        io_entry_t;
+typedef struct _ioreq           ioreq_t;
+typedef struct _mdl             mdl_t;
+typedef struct _io_vu_data      IO_VU_DATA;
+typedef uint64_t                baddr_t;
+
+struct _ioreq   { int rsvd; };
+struct _mdl     { int rsvd; };
+
+typedef struct _ioque {
+    void            *head;
+    void            *tail;
+} ioque_t;
+
+/* pci/pci.h, the PCI glue in sdiodi isn't built */
+typedef void                    *pci_devhdl_t;
+typedef uint32_t                pci_bdf_t;
+typedef uint32_t                pci_cap_t;
+
+/* sys/cam_device.h */
+typedef struct _cam_devinfo {
+    uint32_t        flags;
+    uint32_t        type;
+    uint32_t        sectorsize;
+    uint32_t        rsvd;
+    uint64_t        num_sectors;
+} cam_devinfo_t;
+
+/* devctl.h, sys/dcmd_cam.h */
+#define _POSIX_DEVDIR_NONE      0
+#define _POSIX_DEVDIR_TO        0x80000000
+#define _POSIX_DEVDIR_FROM      0x40000000
+#define _POSIX_DEVDIR_TOFROM    (_POSIX_DEVDIR_TO | _POSIX_DEVDIR_FROM)
+#define __DIOF(class, cmd, data)    ((sizeof(data) << 16) + ((class) << 8) + (cmd) + _POSIX_DEVDIR_FROM)
+#define __DIOT(class, cmd, data)    ((sizeof(data) << 16) + ((class) << 8) + (cmd) + _POSIX_DEVDIR_TO)
+#define __DIOTF(class, cmd, data)   ((sizeof(data) << 16) + ((class) << 8) + (cmd) + _POSIX_DEVDIR_TOFROM)
+#define __DION(class, cmd)          (((class) << 8) + (cmd) + _POSIX_DEVDIR_NONE)
+
+#define _DCMD_CAM               0x0a00
+#define _DCMD_BLK               0x0300
+#define _SIM_SDMMC              0x80
+
+#define D_DIR_ACC               0x00
+
+#define CAM_MODULE_SIM          0x02
+
+typedef struct _cam_verbosity {
+    uint32_t        modules;
+    uint32_t        flags;
+    uint32_t        verbosity;
+    uint32_t        rsvd;
+} CAM_VERBOSITY;
+
+#define DSM_OPT_TRIM            0x01
+#define DSM_OPT_DISCARD         0x02
+
+typedef struct _data_set_mgnt_range {
+    uint64_t        lba;
+    uint32_t        nlba;
+    uint32_t        rsvd;
+} DATA_SET_MGNT_RANGE;
+
+typedef struct _data_set_mgnt {
+    uint32_t        opt;
+    uint32_t        nranges;
+    uint32_t        rsvd[2];
+} DATA_SET_MGNT;
+
+#define DCMD_CAM_VERBOSITY          __DIOT(_DCMD_CAM, 0x20, CAM_VERBOSITY)
+#define DCMD_CAM_DEV_SERIAL_NUMBER  __DIOF(_DCMD_CAM, 0x21, char[64])
+#define DCMD_CAM_DATA_SET_MGNT      __DIOT(_DCMD_CAM, 0x22, DATA_SET_MGNT)
+
+/* sys/rpmb.h */
+#define RPMB_FRAME_SIZE         512
+#define RPMB_DTYPE_EMMC         1
+#define RPMB_FLAG_WP            0x01
+#define RPMB_FLG_READ           0
+#define RPMB_FLG_WRITE          1
+#define RPMB_FLG_RL_WRITE       2
+#define RPMB_READ_RESULT        0x0005
+
+typedef struct _rpmb_info {
+    uint32_t        dtype;
+    uint32_t        flags;
+    uint32_t        maxio;
+    uint32_t        rsvd;
+    uint64_t        start_lba;
+    uint64_t        num_lba;
+} RPMB_INFO;
+
+typedef struct _rpmb_cmdhdr {
+    uint32_t        flags;
+    uint32_t        nframes;
+} RPMB_CMDHDR;
+
+typedef struct _rpmb_frame_jedec {
+    uint8_t         stuff_bytes[196];
+    uint8_t         key_mac[32];
+    uint8_t         data[256];
+    uint8_t         nonce[16];
+    uint32_t        write_counter;
+    uint16_t        address;
+    uint16_t        block_count;
+    uint16_t        result;
+    uint16_t        req_resp;
+} rpmb_frame_jedec_t;
+
+#define DCMD_RPMB_INFO          __DIOF(_DCMD_CAM, 0x30, RPMB_INFO)
+#define DCMD_RPMB_CMD           __DIOTF(_DCMD_CAM, 0x31, RPMB_CMDHDR)
+
+#endif /* EMU_H_ */
@@ -0,0 +1,541 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * The parts of libcam the SIM links against, on the host.
+ *
+ * cam_configure() runs the SIM's args and attach entries the way io-blk
+ * does, then hands over to the harness instead of serving requests. The
+ * harness drives the SIM through the sim_action entry registered with
+ * xpt_bus_register(), completions come back through cam_cbfcnp from
+ * simq_post_ccb() on the driver thread.
+ *
+ * The SIM queue is a single FIFO. Targets, luns and tags aren't modelled,
+ * the harness only uses target 0 lun 0.
+ */
+
+#include <stdarg.h>
+#include <module.h>
+#include <ntocam.h>
+#include <sim.h>
+#include "emu_os.h"
+#include "emu_cam.h"
+
+#define EMU_CAM_PATHS       4
+#define EMU_SIMQ_TIMER      1           // seconds between SIM_TIMER pulses
+
+typedef struct emu_simq_t
+{
+    SIM_QUEUE       q;                  // first, the SIM only sees this
+    pthread_mutex_t mutex;
+    CCB_SCSIIO      *head;
+    CCB_SCSIIO      *tail;
+} emu_simq_t;
+
+#define SIMQ_PRIV(ccb)  ((SIMQ_DATA *) (ccb)->cam_sim_priv)
+
+static struct {
+    CAM_SIM_ENTRY   *entry;
+    SIM_HBA         *hba;
+} paths[EMU_CAM_PATHS];
+
+static int (*cam_main)(void *);
+static void *cam_main_arg;
+static uint64_t allocated;
+
+void emu_cam_set_main(int (*func)(void *), void *arg)
+{
+    cam_main = func;
+    cam_main_arg = arg;
+}
+
+int emu_cam_path(int path, CAM_SIM_ENTRY **entry, SIM_HBA **hba)
+{
+    if (path < 0 || path >= EMU_CAM_PATHS || paths[path].entry == NULL) {
+        return 0;
+    }
+    *entry = paths[path].entry;
+    *hba = paths[path].hba;
+    return 1;
+}
+
+uint64_t emu_cam_allocated(void)
+{
+    return __atomic_load_n(&allocated, __ATOMIC_RELAXED);
+}
+
+/*
+ * Module options follow the module name on the command line, as in
+ * "devb-sdmmc sdmmc busno=0 sdio hc=...". A module that isn't named gets
+ * an empty option string, which is how io-blk asks it to scan.
+ */
+int cam_configure(const MODULE_ENTRY *sim_entry, int nsims, int argc, char *argv[])
+{
+    static CAM_ENTRY cam_entry;
+    int i, named = 0, status;
+
+    (void) nsims;
+    memset(paths, 0, sizeof(paths));
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], sim_entry->name) == 0) {
+            named = 1;
+            if (sim_entry->args(i + 1 < argc ? argv[i + 1] : (char *) "") == -1) {
+                return 1;
+            }
+        }
+    }
+    if (!named) {
+        sim_entry->args((char *) "");
+    }
+
+    if (sim_entry->attach(&cam_entry) != CAM_SUCCESS) {
+        return 1;
+    }
+    status = cam_main ? cam_main(cam_main_arg) : 0;
+    sim_entry->detach();
+    return status;
+}
+
+ssize_t cam_slogf(int opcode, int severity, int verbosity, int vlevel, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (verbosity < vlevel) {
+        return 0;
+    }
+    va_start(ap, fmt);
+    vslogf(opcode, severity, fmt, ap);
+    va_end(ap);
+    return 0;
+}
+
+void cam_dump(char *buffer, int cnt)
+{
+    int i;
+
+    if (!emu_verbose) {
+        return;
+    }
+    for (i = 0; i < cnt; i++) {
+        fprintf(stderr, "%02x%s", (uint8_t) buffer[i], (i % 16) == 15 || i == cnt - 1 ? "\n" : " ");
+    }
+}
+
+int cam_parse_number(const char *str)
+{
+    char *end;
+    long val;
+
+    if (str == NULL || *str == '\0') {
+        return CAM_INVALID_NUM;
+    }
+    val = strtol(str, &end, 0);
+    switch (*end) {
+    case 'k': case 'K': val *= 1024; end++; break;
+    case 'm': case 'M': val *= 1024 * 1024; end++; break;
+    default: break;
+    }
+    return *end == '\0' ? (int) val : CAM_INVALID_NUM;
+}
+
+int cam_set_thread_state(uint32_t *tstate, int state)
+{
+    pthread_sleepon_lock();
+    *tstate = state;
+    pthread_sleepon_broadcast(tstate);
+    pthread_sleepon_unlock();
+    return EOK;
+}
+
+/* As sdio_create_thread(), waits for the thread to report how its init went */
+int cam_create_thread(pthread_t *tid, pthread_attr_t *aattr, void *(*func)(void *), void *arg, int priority,
+        uint32_t *tstate, char *name)
+{
+    pthread_t _tid;
+    int status;
+
+    (void) priority;
+    if (tid == NULL) {
+        tid = &_tid;
+    }
+    if (tstate) {
+        *tstate = CAM_TSTATE_CREATING;
+    }
+    if ((status = pthread_create(tid, aattr, func, arg)) != EOK) {
+        return status;
+    }
+    if (name) {
+        pthread_setname_np(*tid, name);
+    }
+    if (tstate) {
+        pthread_sleepon_lock();
+        while (*tstate == CAM_TSTATE_CREATING) {
+            pthread_sleepon_wait(tstate);
+        }
+        pthread_sleepon_unlock();
+        status = *tstate == CAM_TSTATE_INITIALIZED ? EOK : EIO;
+    }
+    return status;
+}
+
+/* xpt */
+
+void xpt_async(int opcode, path_id_t path_id, target_id_t target_id, lun_id_t lun, void *buffer_ptr, int data_cnt)
+{
+    (void) opcode;
+    (void) path_id;
+    (void) target_id;
+    (void) lun;
+    (void) buffer_ptr;
+    (void) data_cnt;
+}
+
+int xpt_bus_register(CAM_SIM_ENTRY *sim_entry, SIM_HBA *sim_data)
+{
+    int path;
+
+    for (path = 0; path < EMU_CAM_PATHS; path++) {
+        if (paths[path].entry == NULL) {
+            paths[path].entry = sim_entry;
+            paths[path].hba = sim_data;
+            sim_entry->sim_init(sim_data, path);
+            return path;
+        }
+    }
+    return -1;
+}
+
+int xpt_bus_deregister(path_id_t path_id)
+{
+    if (path_id >= EMU_CAM_PATHS || paths[path_id].entry == NULL) {
+        return CAM_FAILURE;
+    }
+    paths[path_id].entry = NULL;
+    paths[path_id].hba = NULL;
+    return CAM_SUCCESS;
+}
+
+int xpt_device_register(XPT_DEVICE *dev, unsigned flgs, int (*cbf)(XPT_DEVICE *dev, XPT_DEVICE_EVENT *ev))
+{
+    (void) dev;
+    (void) flgs;
+    (void) cbf;
+    return EOK;
+}
+
+int xpt_device_deregister(XPT_DEVICE *dev)
+{
+    (void) dev;
+    return EOK;
+}
+
+/* Physical addresses are host addresses, see emu.h */
+CAM_PM_OFFSET xpt_vtop(CAM_VM_OFFSET addr, CAM_VM_OFFSET cam_map)
+{
+    (void) cam_map;
+    return (CAM_PM_OFFSET) (uintptr_t) addr;
+}
+
+int xpt_vtop_sg(SG_ELEM *vsg, SG_ELEM *psg, int nsg, CAM_VM_OFFSET cam_map)
+{
+    (void) cam_map;
+    for (; nsg; nsg--, vsg++, psg++) {
+        psg->cam_sg_address = vsg->cam_sg_address;
+        psg->cam_sg_count = vsg->cam_sg_count;
+    }
+    return EOK;
+}
+
+/*
+ * Below 4G where the host allows it, the bs hands the firmware 32 bit bus
+ * addresses through the mailbox.
+ */
+void *xpt_alloc(int alfg, size_t size, paddr64_t *paddr)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void *p;
+
+    (void) alfg;
+#ifdef MAP_32BIT
+    flags |= MAP_32BIT;
+#endif
+    if ((p = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE, flags, -1, 0)) == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    if (paddr) {
+        *paddr = (uintptr_t) p;
+    }
+    __atomic_add_fetch(&allocated, size, __ATOMIC_RELAXED);
+    return p;
+}
+
+int xpt_free(CAM_VM_OFFSET addr, size_t size)
+{
+    if (addr != NULL && addr != MAP_FAILED) {
+        munmap(addr, size ? size : 1);
+        __atomic_sub_fetch(&allocated, size, __ATOMIC_RELAXED);
+    }
+    return EOK;
+}
+
+void xpt_cache_inval(void *vaddr, paddr64_t paddr, size_t count)
+{
+    (void) vaddr;
+    (void) paddr;
+    (void) count;
+}
+
+void xpt_cache_flush(void *vaddr, paddr64_t paddr, size_t count)
+{
+    (void) vaddr;
+    (void) paddr;
+    (void) count;
+}
+
+void xpt_display_ccb(CCB *ccb_ptr, int verbosity)
+{
+    CCB_SCSIIO *ccb = (CCB_SCSIIO *) ccb_ptr;
+
+    if (!emu_verbose || verbosity < 2) {
+        return;
+    }
+    fprintf(stderr, "ccb %p func %#x status %#x flags %#x cdb %02x len %u\n", (void *) ccb,
+            ccb->cam_ch.cam_func_code, ccb->cam_ch.cam_status, ccb->cam_ch.cam_flags,
+            ccb->cam_cdb_io.cam_cdb_bytes[0], ccb->cam_dxfer_len);
+}
+
+/* hba */
+
+SIM_HBA *sim_alloc_hba(int ext_size)
+{
+    SIM_HBA *hba;
+    SIM_HBA_EXT *ext;
+
+    if ((hba = calloc(1, sizeof(*hba))) == NULL) {
+        return NULL;
+    }
+    if ((ext = calloc(1, ext_size)) == NULL) {
+        free(hba);
+        return NULL;
+    }
+    ext->hba = hba;
+    hba->ext = ext;
+    return hba;
+}
+
+void sim_free_hba(SIM_HBA *hba)
+{
+    if (hba) {
+        free(hba->ext);
+        free(hba);
+    }
+}
+
+int sim_drvr_options(SIM_HBA *hba, char *options)
+{
+    (void) hba;
+    (void) options;
+    return EINVAL;
+}
+
+/* simq */
+
+SIM_QUEUE *simq_init(int coid, void *hba, int ntargs, int nluns, int max_non_tagged, int max_tagged, int mactive,
+        int timeout)
+{
+    struct itimerspec its;
+    struct sigevent event;
+    emu_simq_t *sq;
+
+    if ((sq = calloc(1, sizeof(*sq))) == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&sq->mutex, NULL);
+    sq->q.hba = hba;
+    sq->q.ntargs = ntargs;
+    sq->q.nluns = nluns;
+    sq->q.max_non_tagged = max_non_tagged;
+    sq->q.max_tagged = max_tagged;
+    sq->q.mactive = mactive;
+    sq->q.timeout = timeout;
+    sq->q.timerid = -1;
+    sq->q.systime = SYSPAGE_ENTRY(qtime);
+
+    // the SIM runs its background work off the queue's timer
+    if (timeout) {
+        SIGEV_PULSE_INIT(&event, coid, SIM_PRIORITY, SIM_TIMER, NULL);
+        if (timer_create(CLOCK_MONOTONIC, &event, &sq->q.timerid) == -1) {
+            free(sq);
+            return NULL;
+        }
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec = its.it_interval.tv_sec = EMU_SIMQ_TIMER;
+        timer_settime(sq->q.timerid, 0, &its, NULL);
+    }
+    return &sq->q;
+}
+
+int simq_dinit(SIM_QUEUE *simq)
+{
+    emu_simq_t *sq = (emu_simq_t *) simq;
+
+    if (sq == NULL) {
+        return EOK;
+    }
+    if (sq->q.timerid != -1) {
+        timer_delete(sq->q.timerid);
+    }
+    pthread_mutex_destroy(&sq->mutex);
+    free(sq);
+    return EOK;
+}
+
+int simq_ccb_enqueue(SIM_QUEUE *simq, CCB_SCSIIO *ccb)
+{
+    emu_simq_t *sq = (emu_simq_t *) simq;
+
+    SIMQ_PRIV(ccb)->state = SIM_CCB_READY;
+    SIMQ_PRIV(ccb)->nccb = NULL;
+    pthread_mutex_lock(&sq->mutex);
+    SIMQ_PRIV(ccb)->pccb = sq->tail;
+    if (sq->tail) {
+        SIMQ_PRIV(sq->tail)->nccb = ccb;
+    } else {
+        sq->head = ccb;
+    }
+    sq->tail = ccb;
+    sq->q.qcnt++;
+    pthread_mutex_unlock(&sq->mutex);
+    return CAM_SUCCESS;
+}
+
+/* Back to the front of the queue, a dequeued ccb the SIM couldn't start */
+void simq_ccb_requeue(SIM_QUEUE *simq, CCB_SCSIIO *ccb)
+{
+    emu_simq_t *sq = (emu_simq_t *) simq;
+
+    SIMQ_PRIV(ccb)->state = SIM_CCB_READY;
+    SIMQ_PRIV(ccb)->pccb = NULL;
+    pthread_mutex_lock(&sq->mutex);
+    SIMQ_PRIV(ccb)->nccb = sq->head;
+    if (sq->head) {
+        SIMQ_PRIV(sq->head)->pccb = ccb;
+    } else {
+        sq->tail = ccb;
+    }
+    sq->head = ccb;
+    sq->q.qcnt++;
+    if (sq->q.actcnt) {
+        sq->q.actcnt--;
+    }
+    pthread_mutex_unlock(&sq->mutex);
+}
+
+CCB_SCSIIO *simq_ccb_dequeue(SIM_QUEUE *simq)
+{
+    emu_simq_t *sq = (emu_simq_t *) simq;
+    CCB_SCSIIO *ccb = NULL;
+
+    pthread_mutex_lock(&sq->mutex);
+    if ((ccb = sq->head) != NULL && sq->q.actcnt < sq->q.mactive) {
+        if ((sq->head = SIMQ_PRIV(ccb)->nccb) != NULL) {
+            SIMQ_PRIV(sq->head)->pccb = NULL;
+        } else {
+            sq->tail = NULL;
+        }
+        SIMQ_PRIV(ccb)->nccb = NULL;
+        SIMQ_PRIV(ccb)->state = SIM_CCB_NEXUS;
+        sq->q.qcnt--;
+        sq->q.actcnt++;
+    } else {
+        ccb = NULL;
+    }
+    pthread_mutex_unlock(&sq->mutex);
+    return ccb;
+}
+
+void simq_post_ccb(SIM_QUEUE *simq, CCB_SCSIIO *ccb)
+{
+    emu_simq_t *sq = (emu_simq_t *) simq;
+
+    pthread_mutex_lock(&sq->mutex);
+    if (sq->q.actcnt) {
+        sq->q.actcnt--;
+    }
+    pthread_mutex_unlock(&sq->mutex);
+
+    SIMQ_PRIV(ccb)->state = SIM_CCB_DONE;
+    if (!(ccb->cam_ch.cam_flags & CAM_DIS_CALLBACK) && ccb->cam_cbfcnp) {
+        ccb->cam_cbfcnp(ccb);
+    }
+}
+
+/* Fails everything still queued, nothing here is in flight on a bus */
+static void simq_flush(emu_simq_t *sq, int target, int status)
+{
+    CCB_SCSIIO *ccb, *next, *done = NULL, **tail = &done;
+
+    pthread_mutex_lock(&sq->mutex);
+    for (ccb = sq->head, sq->head = sq->tail = NULL; ccb; ccb = next) {
+        next = SIMQ_PRIV(ccb)->nccb;
+        SIMQ_PRIV(ccb)->nccb = NULL;
+        if (target == -1 || ccb->cam_ch.cam_target_id == target) {
+            *tail = ccb;
+            tail = &SIMQ_PRIV(ccb)->nccb;
+            sq->q.qcnt--;
+        } else {
+            SIMQ_PRIV(ccb)->pccb = sq->tail;
+            if (sq->tail) {
+                SIMQ_PRIV(sq->tail)->nccb = ccb;
+            } else {
+                sq->head = ccb;
+            }
+            sq->tail = ccb;
+        }
+    }
+    pthread_mutex_unlock(&sq->mutex);
+
+    for (ccb = done; ccb; ccb = next) {
+        next = SIMQ_PRIV(ccb)->nccb;
+        ccb->cam_ch.cam_status = status;
+        SIMQ_PRIV(ccb)->state = SIM_CCB_DONE;
+        if (!(ccb->cam_ch.cam_flags & CAM_DIS_CALLBACK) && ccb->cam_cbfcnp) {
+            ccb->cam_cbfcnp(ccb);
+        }
+    }
+}
+
+void simq_scsi_reset(SIM_QUEUE *simq)
+{
+    simq_flush((emu_simq_t *) simq, -1, CAM_SCSI_BUS_RESET);
+}
+
+void simq_reset_dev(SIM_QUEUE *simq, CCB_RESETDEV *ccb)
+{
+    simq_flush((emu_simq_t *) simq, ccb->cam_ch.cam_target_id, CAM_BDR_SENT);
+}
+
+int simq_rel_simq(SIM_QUEUE *simq, CCB_RELSIM *ccb)
+{
+    (void) simq;
+    (void) ccb;
+    return CAM_REQ_CMP;
+}
@@ -0,0 +1,44 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/* Harness side of emu_cam.c: the SIM bus io-blk would talk to */
+
+#ifndef EMU_CAM_H_
+#define EMU_CAM_H_
+
+#include <stdint.h>
+
+struct _sim_hba;
+struct cam_sim_entry;
+
+/*
+ * Called by cam_configure() between the SIM attach and detach, in place of
+ * io-blk serving requests. Its return value is cam_configure()'s.
+ */
+void emu_cam_set_main(int (*func)(void *), void *arg);
+
+/* The SIM registered on a path, 0 if there is none */
+int emu_cam_path(int path, struct cam_sim_entry **entry, struct _sim_hba **hba);
+
+/* Bytes from xpt_alloc() not yet given back */
+uint64_t emu_cam_allocated(void);
+
+#endif /* EMU_CAM_H_ */
@@ -0,0 +1,1163 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * The card end of the bus: an SD memory card or an eMMC device keeping its
+ * data in host memory.
+ *
+ * Only what devb-sdmmc uses is modelled: identification, the SD function
+ * switch and registers, the eMMC EXT_CSD and SWITCH, single and multi block
+ * transfers with or without CMD23, erase, tuning, the eMMC bus test, eMMC
+ * packed writes and the eMMC command queue (CMD44 - CMD48, the QSR through
+ * CMD13). The
+ * card doesn't keep time itself, the controller model passes the bus time
+ * of each command in and gets back how long the card takes.
+ *
+ * Commands a card wouldn't accept in its current state get no response,
+ * the host sees a command timeout as it would on the bus.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <mmc.h>
+#include <sd.h>
+#include "emu_os.h"
+#include "emu_card.h"
+
+#define ST_IDLE     0
+#define ST_READY    1
+#define ST_IDENT    2
+#define ST_STBY     3
+#define ST_TRAN     4
+#define ST_DATA     5
+#define ST_RCV      6
+#define ST_PRG      7
+#define ST_DIS      8
+#define ST_SLP      10      // eMMC sleep
+#define ST_INA      15      // never answers again until power off
+
+#define CARD_OCR        0x00ff8000      // 2.7 - 3.6V
+#define CARD_OCR_MMC    0x00ff8080      // and 1.7 - 1.95V
+#define CARD_OCR_SECTOR 0x40000000      // eMMC access mode, sector addressed
+#define CARD_OCR_POLLS  2               // ACMD41/CMD1 report busy this often after reset
+#define CARD_RCA        0x4567
+#define CARD_BLKSZ      512
+#define CARD_MMC_BYTE   0x400000        // eMMC up to 2GB is byte addressed
+
+#define SD_SWITCH_VER   1
+
+#define PACKED_ENT_MAX  63
+
+#define TM_OPCODE(a)    ((a) & 0xf)             // CMD48
+#define TASK_ID(a)      (((a) >> 16) & 0x1f)    // CMD44, CMD46 - CMD48
+
+/* A command queue task, queued by CMD44/CMD45 */
+typedef struct card_task
+{
+    int                 state;          // TASK_*
+    int                 dir;
+    uint32_t            blks;
+    uint64_t            addr;
+    uint64_t            ready_at;       // reported in the QSR from then on
+} card_task_t;
+
+enum { TASK_FREE, TASK_PARAMS, TASK_QUEUED };
+
+struct emu_card
+{
+    emu_card_cfg_t      cfg;
+    emu_card_stats_t    stats;
+    uint8_t             *media;
+    uint64_t            size;
+
+    int                 powered;
+    int                 state;
+    int                 app;            // previous command was CMD55
+    uint32_t            status;         // error bits for the next R1
+    uint16_t            rca;
+    int                 polls;          // op cond busy responses left
+    int                 hcs;            // block addressed
+    int                 s18;            // signalling at 1.8V
+    int                 vswitch;        // CMD11 accepted, switch pending
+    int                 vio;            // board I/O supply at 1.8V, -1 follows the host
+    int                 width;
+    uint32_t            blkcnt;         // CMD23, 0 if open ended
+    uint64_t            erase_start;
+    uint64_t            erase_end;
+    uint8_t             func[6];        // SD switch function per group
+    uint64_t            busy_until;
+    int                 busy_state;     // state reported while busy
+    card_task_t         tasks[MMC_CMDQ_TASKS_MAX];
+
+        // current transfer
+    int                 packed;         // CMD23 with the packed bit, header block first
+    uint32_t            pk_bytes;       // of the packed write so far, header included
+    uint32_t            pk_nent;        // entries in the header
+    uint32_t            pk_ent;         // entry being written
+    uint32_t            pk_left;        // bytes left in it
+    struct {
+        uint32_t        blks;
+        uint64_t        addr;
+    } pk[PACKED_ENT_MAX];
+    int                 dir;
+    int                 multi;
+    int                 regdata;        // from/to reg[] instead of the media
+    int                 bustest;        // eMMC CMD19, the written pattern is kept
+    uint64_t            addr;
+    uint32_t            blocks;
+    uint32_t            reg_len;
+    uint32_t            reg_pos;
+    uint8_t             reg[MMC_EXT_CSD_SIZE];
+
+    uint32_t            cid[4];         // least significant word first
+    uint32_t            csd[4];
+    uint8_t             scr[8];
+    uint8_t             ssr[SD_STATUS_SIZE];
+    uint8_t             ext_csd[MMC_EXT_CSD_SIZE];
+    uint8_t             bus_pattern[8];
+    uint32_t            data_cmds;
+    uint32_t            write_cmds;
+};
+
+static void set_bits(uint32_t *v, int start, int size, uint32_t val)
+{
+    int i;
+
+    for (i = 0; i < size; i++, start++) {
+        if (val & (1u << i)) {
+            v[start / 32] |= 1u << (start % 32);
+        } else {
+            v[start / 32] &= ~(1u << (start % 32));
+        }
+    }
+}
+
+/* Bit fields of the registers sent as data, most significant byte first */
+static void set_be_bits(uint8_t *buf, int nbits, int start, int size, uint32_t val)
+{
+    int i, bit;
+
+    for (i = 0; i < size; i++) {
+        bit = start + i;
+        if (val & (1u << i)) {
+            buf[(nbits - 1 - bit) / 8] |= 1u << (bit % 8);
+        } else {
+            buf[(nbits - 1 - bit) / 8] &= ~(1u << (bit % 8));
+        }
+    }
+}
+
+static void card_sd_regs(emu_card_t *card)
+{
+    static const char pnm[] = "EMUSD";
+    int i;
+
+    set_bits(card->cid, 120, 8, 0x03);              // MID
+    set_bits(card->cid, 104, 16, 0x5344);           // OID "SD"
+    for (i = 0; i < 5; i++) {
+        set_bits(card->cid, 96 - i * 8, 8, pnm[i]);
+    }
+    set_bits(card->cid, 56, 8, 0x10);               // PRV 1.0
+    set_bits(card->cid, 24, 32, 0x12345678);        // PSN
+    set_bits(card->cid, 8, 12, (20 << 4) | 1);      // MDT 2020/01
+
+    set_bits(card->csd, 126, 2, 1);                 // CSD version 2.0
+    set_bits(card->csd, 112, 8, 0x0e);              // TAAC 1ms
+    set_bits(card->csd, 96, 8, 0x32);               // TRAN_SPEED 25MHz
+    set_bits(card->csd, 84, 12, 0x5b5);             // CCC, with switch and app commands
+    set_bits(card->csd, 80, 4, 9);                  // READ_BL_LEN 512
+    set_bits(card->csd, 48, 22, card->cfg.sectors / 1024 - 1);
+    set_bits(card->csd, 46, 1, 1);                  // ERASE_BLK_EN
+    set_bits(card->csd, 39, 7, 0x7f);               // SECTOR_SIZE
+    set_bits(card->csd, 26, 3, 2);                  // R2W_FACTOR
+    set_bits(card->csd, 22, 4, 9);                  // WRITE_BL_LEN 512
+
+    set_be_bits(card->scr, 64, 56, 4, 2);           // SD_SPEC 2.0/3.0
+    set_be_bits(card->scr, 64, 52, 3, 3);           // SD_SECURITY SDHC
+    set_be_bits(card->scr, 64, 48, 4, SCR_BUS_WIDTH_1 | SCR_BUS_WIDTH_4);
+    set_be_bits(card->scr, 64, 47, 1, 1);           // SD_SPEC3
+    set_be_bits(card->scr, 64, 32, 2, card->cfg.no_cmd23 ? 0 : SCR_CMD23_SUP);
+
+    set_be_bits(card->ssr, 512, 510, 2, 0);         // DAT_BUS_WIDTH, filled in on read
+    set_be_bits(card->ssr, 512, 440, 8, 4);         // SPEED_CLASS 10
+    set_be_bits(card->ssr, 512, 428, 4, 9);         // AU_SIZE 4MB
+    set_be_bits(card->ssr, 512, 408, 16, 1);        // ERASE_SIZE 1 AU
+    set_be_bits(card->ssr, 512, 402, 6, 1);         // ERASE_TIMEOUT 1s
+    set_be_bits(card->ssr, 512, 396, 4, card->cfg.uhs ? 1 : 0);
+}
+
+static void card_mmc_regs(emu_card_t *card)
+{
+    static const char pnm[] = "EMUMMC";
+    uint8_t *ecsd = card->ext_csd;
+    uint32_t csize;
+    int i;
+
+    set_bits(card->cid, 120, 8, 0x15);              // MID
+    set_bits(card->cid, 112, 2, 1);                 // CBX BGA
+    set_bits(card->cid, 104, 8, 0x01);              // OID
+    for (i = 0; i < 6; i++) {
+        set_bits(card->cid, 96 - i * 8, 8, pnm[i]);
+    }
+    set_bits(card->cid, 48, 8, 0x10);               // PRV
+    set_bits(card->cid, 16, 32, 0x87654321);        // PSN
+    set_bits(card->cid, 8, 8, (1 << 4) | 7);        // MDT 01/2020
+
+        // CSD capacity only counts up to 2GB, larger devices use SEC_CNT
+    csize = card->hcs ? 0xfff : card->cfg.sectors / 512 - 1;
+    set_bits(card->csd, 126, 2, 3);                 // CSD_STRUCTURE in EXT_CSD
+    set_bits(card->csd, 122, 4, 4);                 // SPEC_VERS 4.x
+    set_bits(card->csd, 112, 8, 0x27);              // TAAC
+    set_bits(card->csd, 96, 8, 0x32);               // TRAN_SPEED 26MHz
+    set_bits(card->csd, 84, 12, 0x8f5);             // CCC
+    set_bits(card->csd, 80, 4, 9);                  // READ_BL_LEN 512
+    set_bits(card->csd, 62, 12, csize);
+    set_bits(card->csd, 47, 3, 7);                  // C_SIZE_MULT 512
+    set_bits(card->csd, 42, 5, 31);                 // ERASE_GRP_SIZE
+    set_bits(card->csd, 37, 5, 31);                 // ERASE_GRP_MULT
+    set_bits(card->csd, 32, 5, 15);                 // WP_GRP_SIZE
+    set_bits(card->csd, 26, 3, 2);                  // R2W_FACTOR
+    set_bits(card->csd, 22, 4, 9);                  // WRITE_BL_LEN 512
+
+    ecsd[ECSD_REV]                      = ECSD_REV_V5;
+    ecsd[194]                           = 2;        // CSD_STRUCTURE 1.2
+    ecsd[ECSD_CARD_TYPE]                = ECSD_CARD_TYPE_26 | ECSD_CARD_TYPE_52 |
+                                          ECSD_CARD_TYPE_DDR_1_8V | ECSD_CARD_TYPE_HS200_1_8V;
+    ecsd[ECSD_DRIVER_STRENGTH]          = 0x01;
+    ecsd[ECSD_OUT_OF_INTERRUPT_TIME]    = 1;        // 10ms
+    ecsd[ECSD_PARTITION_SWITCH_TIME]    = 1;
+    ecsd[ECSD_SEC_CNT + 0]              = card->cfg.sectors >> 0;
+    ecsd[ECSD_SEC_CNT + 1]              = card->cfg.sectors >> 8;
+    ecsd[ECSD_SEC_CNT + 2]              = card->cfg.sectors >> 16;
+    ecsd[ECSD_SEC_CNT + 3]              = card->cfg.sectors >> 24;
+    ecsd[ECSD_S_A_TIMEOUT]              = 0x10;
+    ecsd[ECSD_HC_WP_GRP_SIZE]           = 1;
+    ecsd[ECSD_ERASE_MULT]               = 1;        // 300ms
+    ecsd[ECSD_ERASE_GRP_SIZE]           = 1;        // 512K
+    ecsd[ECSD_SEC_FEATURE_SUPPORT]      = ECSD_SEC_GB_CL_EN;
+    ecsd[ECSD_TRIM_MULT]                = 1;
+    ecsd[248]                           = 1;        // GENERIC_CMD6_TIME 10ms
+    ecsd[ECSD_S_CMD_SET]                = 1;
+    ecsd[ECSD_MAX_PACKED_WRITES]        = card->cfg.packed_wr;
+    if (card->cfg.cmdq_depth) {
+        ecsd[ECSD_REV]                  = ECSD_REV_V5_1;
+        ecsd[ECSD_CMDQ_SUPPORT]         = ECSD_CMDQ_SUP;
+        ecsd[ECSD_CMDQ_DEPTH]           = (card->cfg.cmdq_depth - 1) & ECSD_CMDQ_DEPTH_MSK;
+    }
+}
+
+emu_card_t *emu_card_create(const emu_card_cfg_t *cfg)
+{
+    emu_card_t *card;
+
+    if ((card = calloc(1, sizeof(*card))) == NULL) {
+        return NULL;
+    }
+    card->cfg = *cfg;
+    if (card->cfg.type != EMU_CARD_EMMC || card->cfg.cmdq_depth > MMC_CMDQ_TASKS_MAX) {
+        card->cfg.cmdq_depth = 0;
+    }
+    if (card->cfg.type != EMU_CARD_EMMC || card->cfg.packed_wr > PACKED_ENT_MAX) {
+        card->cfg.packed_wr = 0;
+    }
+    card->vio = -1;
+    card->size = (uint64_t) cfg->sectors * CARD_BLKSZ;
+    if ((card->media = calloc(cfg->sectors, CARD_BLKSZ)) == NULL) {
+        free(card);
+        return NULL;
+    }
+    if (cfg->type == EMU_CARD_SD) {
+        card->hcs = 1;
+        card_sd_regs(card);
+    } else {
+        card->hcs = cfg->sectors > CARD_MMC_BYTE;
+        card_mmc_regs(card);
+    }
+    return card;
+}
+
+void emu_card_destroy(emu_card_t *card)
+{
+    free(card->media);
+    free(card);
+}
+
+uint8_t *emu_card_media(emu_card_t *card)
+{
+    return card->media;
+}
+
+void emu_card_stats(emu_card_t *card, emu_card_stats_t *stats)
+{
+    *stats = card->stats;
+}
+
+static void card_reset(emu_card_t *card)
+{
+    card->state = ST_IDLE;
+    card->app = 0;
+    card->status = 0;
+    card->rca = 0;
+    card->polls = CARD_OCR_POLLS;
+    card->width = 1;
+    card->blkcnt = 0;
+    card->packed = 0;
+    card->busy_until = 0;
+    card->dir = EMU_DATA_NONE;
+    memset(card->func, 0, sizeof(card->func));
+    memset(card->tasks, 0, sizeof(card->tasks));
+    if (card->cfg.type == EMU_CARD_EMMC) {
+        card->ext_csd[ECSD_HS_TIMING] = 0;
+        card->ext_csd[ECSD_BUS_WIDTH] = 0;
+        card->ext_csd[ECSD_ERASE_GRP_DEF] = 0;
+        card->ext_csd[ECSD_PART_CONFIG] = 0;
+        card->ext_csd[ECSD_CMDQ_MODE_EN] = 0;
+    }
+}
+
+void emu_card_power(emu_card_t *card, int on)
+{
+    if (on == card->powered) {
+        return;
+    }
+    card->powered = on;
+    card->s18 = 0;
+    card->vswitch = 0;
+    card_reset(card);
+}
+
+static int card_state(emu_card_t *card, uint64_t now)
+{
+    return now < card->busy_until ? card->busy_state : card->state;
+}
+
+/* R1, the state is the one the command found the card in */
+static uint32_t card_r1(emu_card_t *card, uint64_t now)
+{
+    uint32_t r1;
+    int state;
+
+    state = card_state(card, now);
+    r1 = card->status | (state << 9);
+    if (now >= card->busy_until) {
+        r1 |= CDS_READY_FOR_DATA;
+    }
+    if (card->app) {
+        r1 |= CDS_APP_CMD_S;
+    }
+    card->status = 0;
+    return r1;
+}
+
+static void card_busy(emu_card_t *card, uint64_t now, uint64_t ns, int state, emu_card_rsp_t *rsp)
+{
+    if (ns) {
+        card->busy_until = now + ns;
+        card->busy_state = state;
+    }
+    rsp->busy_ns = ns;
+}
+
+/* Data commands wait for the card to finish programming */
+static uint64_t card_ready_in(emu_card_t *card, uint64_t now)
+{
+    return now < card->busy_until ? card->busy_until - now : 0;
+}
+
+static void card_reg_xfer(emu_card_t *card, uint64_t now, int dir, uint32_t len, emu_card_rsp_t *rsp)
+{
+    card->dir = dir;
+    card->multi = 0;
+    card->regdata = 1;
+    card->bustest = 0;
+    card->reg_len = len;
+    card->reg_pos = 0;
+    card->state = dir == EMU_DATA_READ ? ST_DATA : ST_RCV;
+    rsp->data = dir;
+    rsp->blksz = len;
+    rsp->access_ns = card_ready_in(card, now);
+}
+
+static int cmdq_on(emu_card_t *card)
+{
+    return card->cfg.cmdq_depth && (card->ext_csd[ECSD_CMDQ_MODE_EN] & ECSD_CMDQ_ENABLE);
+}
+
+/* Start a media transfer, a task's data has been fetched when it's ready */
+static void card_media_xfer(emu_card_t *card, uint64_t now, int dir, uint64_t addr, int fetched,
+        emu_card_rsp_t *rsp)
+{
+    card->dir = dir;
+    card->regdata = 0;
+    card->addr = addr;
+    card->blocks = 0;
+    card->state = dir == EMU_DATA_READ ? ST_DATA : ST_RCV;
+    if (!card->multi) {
+        card->blkcnt = 0;
+        card->packed = 0;
+    }
+    card->pk_bytes = 0;
+    rsp->data = dir;
+    rsp->blksz = CARD_BLKSZ;
+    rsp->access_ns = card_ready_in(card, now);
+    if (dir == EMU_DATA_READ) {
+        rsp->access_ns += fetched ? 0 : card->cfg.read_ns;
+        card->stats.reads++;
+    } else {
+        card->stats.writes++;
+        card->write_cmds++;
+    }
+    if (card->cfg.err_every && ++card->data_cmds % card->cfg.err_every == 0) {
+        rsp->crc_err = 1;
+        card->stats.errors++;
+    }
+}
+
+static int card_rw(emu_card_t *card, uint64_t now, unsigned op, uint32_t arg, emu_card_rsp_t *rsp)
+{
+    int dir;
+
+    if (card->state != ST_TRAN || cmdq_on(card)) {      // only tasks while queueing
+        return 0;
+    }
+    dir = (op == MMC_READ_SINGLE_BLOCK || op == MMC_READ_MULTIPLE_BLOCK) ? EMU_DATA_READ : EMU_DATA_WRITE;
+    if (card->packed && op != MMC_WRITE_MULTIPLE_BLOCK) {     // no packed reads
+        return 0;
+    }
+    card->multi = (op == MMC_READ_MULTIPLE_BLOCK || op == MMC_WRITE_MULTIPLE_BLOCK);
+    card_media_xfer(card, now, dir, card->hcs ? (uint64_t) arg * CARD_BLKSZ : arg, 0, rsp);
+    return 1;
+}
+
+/* QSR, the queued tasks the card is ready to transfer */
+static uint32_t cmdq_qsr(emu_card_t *card, uint64_t now)
+{
+    uint32_t qsr = 0;
+    unsigned t;
+
+    for (t = 0; t < card->cfg.cmdq_depth; t++) {
+        if (card->tasks[t].state == TASK_QUEUED && now >= card->tasks[t].ready_at) {
+            qsr |= 1u << t;
+        }
+    }
+    return qsr;
+}
+
+/*
+ * CMD44 - CMD48. A queued task is ready once the card is done with what
+ * it's programming and, for a read, has fetched the data, so the read
+ * latency overlaps the transfers of other tasks.
+ */
+static int cmdq_cmd(emu_card_t *card, uint64_t now, unsigned op, uint32_t arg, emu_card_rsp_t *rsp)
+{
+    card_task_t *task = &card->tasks[TASK_ID(arg)];
+    unsigned t;
+
+    if (card->state != ST_TRAN || !cmdq_on(card) || TASK_ID(arg) >= card->cfg.cmdq_depth) {
+        return 0;
+    }
+    switch (op) {
+        case MMC_QUEUED_TASK_PARAMS:
+            if (task->state != TASK_FREE || (arg & 0xffff) == 0) {
+                card->status |= CDS_ERROR;
+            } else {
+                task->state = TASK_PARAMS;
+                task->dir = (arg & MMC_QTP_DIR_READ) ? EMU_DATA_READ : EMU_DATA_WRITE;
+                task->blks = arg & 0xffff;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            return 1;
+
+        case MMC_QUEUED_TASK_ADDRESS:
+                // the task ID is in the CMD44 before it, the argument is the address
+            for (t = 0; t < card->cfg.cmdq_depth && card->tasks[t].state != TASK_PARAMS; t++) {
+                ;
+            }
+            if (t == card->cfg.cmdq_depth) {
+                return 0;
+            }
+            task = &card->tasks[t];
+            task->addr = card->hcs ? (uint64_t) arg * CARD_BLKSZ : arg;
+            if (task->addr + (uint64_t) task->blks * CARD_BLKSZ > card->size) {
+                card->status |= CDS_OUT_OF_RANGE;
+                task->state = TASK_FREE;
+            } else {
+                task->state = TASK_QUEUED;
+                task->ready_at = now + card_ready_in(card, now) +
+                        (task->dir == EMU_DATA_READ ? card->cfg.read_ns : 0);
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            return 1;
+
+        case MMC_EXECUTE_READ_TASK:
+        case MMC_EXECUTE_WRITE_TASK:
+            if (!(cmdq_qsr(card, now) & (1u << TASK_ID(arg))) ||
+                    (task->dir == EMU_DATA_READ) != (op == MMC_EXECUTE_READ_TASK)) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            task->state = TASK_FREE;
+            card->multi = 1;
+            card->blkcnt = task->blks;
+            card_media_xfer(card, now, task->dir, task->addr, 1, rsp);
+            card->stats.tasks++;
+            return 1;
+
+        case MMC_CMDQ_TASK_MGMT:
+            if (TM_OPCODE(arg) == MMC_CMDQ_TM_DISCARD_QUEUE) {
+                memset(card->tasks, 0, sizeof(card->tasks));
+            } else if (TM_OPCODE(arg) == MMC_CMDQ_TM_DISCARD_TASK) {
+                task->state = TASK_FREE;
+            } else {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            return 1;
+    }
+    return 0;
+}
+
+static uint64_t card_program_ns(emu_card_t *card)
+{
+    uint64_t ns;
+
+    ns = card->cfg.write_ns + (uint64_t) card->cfg.write_blk_ns * card->blocks;
+    if (card->cfg.stall_every && card->write_cmds % card->cfg.stall_every == 0) {
+        ns += card->cfg.stall_ns;
+        card->stats.stalls++;
+    }
+    return ns;
+}
+
+static int card_erase(emu_card_t *card, uint64_t now, emu_card_rsp_t *rsp)
+{
+    uint64_t start, end;
+
+    if (card->state != ST_TRAN) {
+        return 0;
+    }
+    start = card->hcs ? card->erase_start * CARD_BLKSZ : card->erase_start;
+    end = (card->hcs ? card->erase_end * CARD_BLKSZ : card->erase_end) + CARD_BLKSZ;
+    if (start >= end || end > card->size) {
+        card->status |= CDS_ERASE_PARAM;
+        end = start;
+    } else {
+        memset(card->media + start, 0, end - start);
+        card->stats.erases++;
+    }
+    rsp->rsp[0] = card_r1(card, now);
+    card_busy(card, now, card->cfg.erase_ns + (uint64_t) card->cfg.erase_blk_ns * ((end - start) / CARD_BLKSZ),
+            ST_PRG, rsp);
+    return 1;
+}
+
+/* CMD6 status: support per group, then the function each group ends up in */
+static void sd_switch_status(emu_card_t *card, uint32_t arg)
+{
+    uint16_t support[6];
+    uint8_t *ss = card->reg;
+    unsigned grp, fn, sel[6];
+    int set;
+
+    support[0] = (card->s18 && card->cfg.uhs) ?
+        (SD_BUS_MODE_SDR12 | SD_BUS_MODE_SDR25 | SD_BUS_MODE_UHS) :
+        (SD_BUS_MODE_SDR12 | SD_BUS_MODE_HS);
+    support[1] = 1;
+    support[2] = SD_DRV_TYPE_B;
+    support[3] = (card->s18 && card->cfg.uhs) ? SD_CURR_LIMIT_MSK : SD_CURR_LIMIT_200;
+    support[4] = 1;
+    support[5] = 1;
+
+    set = !!(arg & 0x80000000);
+    for (grp = 0; grp < 6; grp++) {
+        fn = (arg >> (grp * 4)) & 0xf;
+        if (fn == SD_SF_CUR_FCN) {
+            sel[grp] = card->func[grp];
+        } else if (fn < 16 && (support[grp] & (1u << fn))) {
+            sel[grp] = fn;
+            if (set) {
+                card->func[grp] = fn;
+            }
+        } else {
+            sel[grp] = 0xf;
+        }
+    }
+
+    memset(ss, 0, SD_SF_STATUS_SIZE);
+    ss[0] = 0;
+    ss[1] = 100;                                    // 100mA
+    for (grp = 0; grp < 6; grp++) {
+        ss[12 - grp * 2] = support[grp] >> 8;
+        ss[13 - grp * 2] = support[grp];
+    }
+    ss[14] = (sel[5] << 4) | sel[4];
+    ss[15] = (sel[3] << 4) | sel[2];
+    ss[16] = (sel[1] << 4) | sel[0];
+    ss[17] = SD_SWITCH_VER;
+}
+
+static int mmc_switch_cmd(emu_card_t *card, uint64_t now, uint32_t arg, emu_card_rsp_t *rsp)
+{
+    unsigned mode, idx, val;
+    uint8_t *ecsd = card->ext_csd;
+
+    if (card->state != ST_TRAN) {
+        return 0;
+    }
+    mode = (arg >> 24) & 0x3;
+    idx = (arg >> 16) & 0xff;
+    val = (arg >> 8) & 0xff;
+
+    rsp->rsp[0] = card_r1(card, now);
+    if (mode == MMC_SWITCH_MODE_CMD_SET) {
+        return 1;
+    }
+    if (idx >= ECSD_REV) {                          // properties segment is read only
+        card->status |= CDS_SWITCH_ERROR;
+        return 1;
+    }
+    switch (mode) {
+        case MMC_SWITCH_MODE_WRITE: ecsd[idx] = val; break;
+        case MMC_SWITCH_MODE_SET:   ecsd[idx] |= val; break;
+        case MMC_SWITCH_MODE_CLR:   ecsd[idx] &= ~val; break;
+    }
+    switch (idx) {
+        case ECSD_BUS_WIDTH:
+            card->width = (ecsd[idx] & 3) == ECSD_BUS_WIDTH_8 ? 8 : (ecsd[idx] & 3) == ECSD_BUS_WIDTH_4 ? 4 : 1;
+            break;
+        case ECSD_FLUSH_CACHE:
+        case ECSD_BKOPS_START:
+        case ECSD_SANITIZE_START:
+            ecsd[idx] = 0;                          // triggers, not settings
+            break;
+        case ECSD_CMDQ_MODE_EN:
+            if (!card->cfg.cmdq_depth) {
+                ecsd[idx] = 0;
+                card->status |= CDS_SWITCH_ERROR;
+            } else if (!(ecsd[idx] & ECSD_CMDQ_ENABLE)) {
+                memset(card->tasks, 0, sizeof(card->tasks));
+            }
+            break;
+    }
+    card_busy(card, now, card->cfg.switch_ns, ST_PRG, rsp);
+    return 1;
+}
+
+static int sd_acmd(emu_card_t *card, uint64_t now, unsigned op, uint32_t arg, emu_card_rsp_t *rsp)
+{
+    uint32_t ocr;
+
+    switch (op) {
+        case SD_AC_SEND_OP_COND:
+            if (card->state != ST_IDLE) {
+                return 0;
+            }
+            ocr = CARD_OCR;
+            if ((arg & CARD_OCR) && (arg & OCR_HCS)) {
+                if (card->polls > 0) {
+                    card->polls--;
+                } else {
+                    ocr |= OCR_PWRUP_CMP | OCR_HCS;
+                    if ((arg & OCR_S18R) && card->cfg.uhs && !card->s18) {
+                        ocr |= OCR_S18A;
+                    }
+                    card->state = ST_READY;
+                }
+            }
+            rsp->rsp[0] = ocr;
+            return 1;
+
+        case SD_AC_SET_BUS_WIDTH:
+            if (card->state != ST_TRAN) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            card->width = (arg & 3) == SD_BUS_WIDTH_4 ? 4 : 1;
+            return 1;
+
+        case SD_AC_SD_STATUS:
+            if (card->state != ST_TRAN) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            set_be_bits(card->ssr, 512, 510, 2, card->width == 4 ? 2 : 0);
+            memcpy(card->reg, card->ssr, sizeof(card->ssr));
+            card_reg_xfer(card, now, EMU_DATA_READ, sizeof(card->ssr), rsp);
+            return 1;
+
+        case 51:                                    // SEND_SCR
+            if (card->state != ST_TRAN) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            memcpy(card->reg, card->scr, sizeof(card->scr));
+            card_reg_xfer(card, now, EMU_DATA_READ, sizeof(card->scr), rsp);
+            return 1;
+
+        case SD_AC_SET_WR_BLK_ERASE_COUNT:
+        case SD_AC_SET_CLR_CARD_DETECT:
+            if (card->state != ST_TRAN) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            return 1;
+    }
+    return -1;                                      // not an app command, the plain one runs
+}
+
+static int card_cmd(emu_card_t *card, uint64_t now, unsigned op, uint32_t arg, emu_card_rsp_t *rsp)
+{
+    int sd = card->cfg.type == EMU_CARD_SD;
+    uint32_t r1;
+
+    switch (op) {
+        case MMC_GO_IDLE_STATE:
+            card_reset(card);
+            return 0;                               // no response
+
+        case MMC_SEND_OP_COND:                      // CMD1, eMMC only
+            if (sd || (card->state != ST_IDLE && card->state != ST_READY)) {
+                return 0;
+            }
+            rsp->rsp[0] = CARD_OCR_MMC | (card->hcs ? CARD_OCR_SECTOR : 0);
+            if (arg) {
+                if (card->polls > 0) {
+                    card->polls--;
+                } else {
+                    rsp->rsp[0] |= OCR_PWRUP_CMP;
+                    card->state = ST_READY;
+                }
+            }
+            return 1;
+
+        case MMC_ALL_SEND_CID:
+            if (card->state != ST_READY) {
+                return 0;
+            }
+            memcpy(rsp->rsp, card->cid, sizeof(card->cid));
+            card->state = ST_IDENT;
+            return 1;
+
+        case MMC_SET_RELATIVE_ADDR:
+            if (card->state != ST_IDENT && card->state != ST_STBY) {
+                return 0;
+            }
+            if (sd) {
+                card->rca = CARD_RCA;
+                r1 = card_r1(card, now);
+                rsp->rsp[0] = (card->rca << 16) | ((r1 >> 8) & 0xc000) | ((r1 >> 6) & 0x2000) | (r1 & 0x1fff);
+            } else {
+                card->rca = arg >> 16;
+                rsp->rsp[0] = card_r1(card, now);
+            }
+            card->state = ST_STBY;
+            return 1;
+
+        case MMC_SLEEP_AWAKE:
+            if (sd || (arg >> 16) != card->rca) {
+                return 0;
+            }
+            if ((arg & MMC_SA_SLEEP) ? card->state != ST_STBY : card->state != ST_SLP) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            card->state = (arg & MMC_SA_SLEEP) ? ST_SLP : ST_STBY;
+            return 1;
+
+        case MMC_SWITCH:
+            if (!sd) {
+                return mmc_switch_cmd(card, now, arg, rsp);
+            }
+            if (card->state != ST_TRAN) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            sd_switch_status(card, arg);
+            card_reg_xfer(card, now, EMU_DATA_READ, SD_SF_STATUS_SIZE, rsp);
+            return 1;
+
+        case MMC_SEL_DES_CARD:
+            if ((arg >> 16) != card->rca || !card->rca) {
+                if (card->state == ST_TRAN || card->state == ST_PRG) {
+                    card->state = ST_STBY;
+                }
+                return 0;                           // deselected cards don't answer
+            }
+            if (card->state != ST_STBY) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            card->state = ST_TRAN;
+            return 1;
+
+        case SD_SEND_IF_COND:                       // CMD8, SEND_EXT_CSD on eMMC
+            if (sd) {
+                if (card->state != ST_IDLE || ((arg >> 8) & 0xf) != SD_SIC_VHS_27_36V) {
+                    return 0;
+                }
+                rsp->rsp[0] = arg & 0xfff;
+                return 1;
+            }
+            if (card->state != ST_TRAN) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            memcpy(card->reg, card->ext_csd, sizeof(card->ext_csd));
+            card_reg_xfer(card, now, EMU_DATA_READ, sizeof(card->ext_csd), rsp);
+            return 1;
+
+        case MMC_SEND_CSD:
+        case MMC_SEND_CID:
+            if (card->state != ST_STBY || (arg >> 16) != card->rca) {
+                return 0;
+            }
+            memcpy(rsp->rsp, op == MMC_SEND_CSD ? card->csd : card->cid, sizeof(card->csd));
+            return 1;
+
+        case SD_VOLTAGE_SWITCH:
+            if (!sd || card->state != ST_READY || !card->cfg.uhs || card->s18) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            card->vswitch = 1;
+            return 1;
+
+        case MMC_STOP_TRANSMISSION:
+            if (card->state == ST_TRAN && cmdq_on(card)) {
+                return 0;                           // a task ends on its block count
+            }
+            r1 = card_r1(card, now);
+            if (card->state == ST_DATA) {
+                card->state = ST_TRAN;
+                card->dir = EMU_DATA_NONE;
+            } else if (card->state == ST_RCV) {
+                card->state = ST_TRAN;
+                card->dir = EMU_DATA_NONE;
+                card_busy(card, now, card_program_ns(card), ST_PRG, rsp);
+            } else if (card->state != ST_TRAN) {
+                return 0;
+            }
+            card->blkcnt = 0;
+            card->packed = 0;
+            rsp->rsp[0] = r1;
+            return 1;
+
+        case MMC_SEND_STATUS:
+            if ((arg >> 16) != card->rca || card->state < ST_STBY || card->state == ST_INA) {
+                return 0;
+            }
+            if ((arg & MMC_SEND_STATUS_SQS) && cmdq_on(card)) {
+                rsp->rsp[0] = cmdq_qsr(card, now);
+                return 1;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            return 1;
+
+        case MMC_GO_INACTIVE_STATE:
+            if ((arg >> 16) == card->rca) {
+                card->state = ST_INA;
+            }
+            return 0;
+
+        case MMC_SET_BLOCKLEN:
+            if (card->state != ST_TRAN) {
+                return 0;
+            }
+            if (arg != CARD_BLKSZ) {
+                card->status |= CDS_BLOCK_LEN_ERROR;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            return 1;
+
+        case MMC_READ_SINGLE_BLOCK:
+        case MMC_READ_MULTIPLE_BLOCK:
+        case MMC_WRITE_BLOCK:
+        case MMC_WRITE_MULTIPLE_BLOCK:
+            r1 = card_r1(card, now);
+            if (!card_rw(card, now, op, arg, rsp)) {
+                return 0;
+            }
+            rsp->rsp[0] = r1;
+            return 1;
+
+        case MMC_BUSTEST_R:
+            if (sd || card->state != ST_TRAN) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            for (r1 = 0; r1 < sizeof(card->bus_pattern); r1++) {
+                card->reg[r1] = ~card->bus_pattern[r1];
+            }
+            card_reg_xfer(card, now, EMU_DATA_READ, card->width, rsp);
+            return 1;
+
+        case SD_SEND_TUNING_BLOCK:                  // CMD19, BUSTEST_W on eMMC
+        case MMC_SEND_TUNING_BLOCK:
+            if (card->state != ST_TRAN || (op == MMC_SEND_TUNING_BLOCK && sd)) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            if (!sd && op == MMC_BUSTEST_W) {
+                card_reg_xfer(card, now, EMU_DATA_WRITE, card->width, rsp);
+                card->bustest = 1;
+                return 1;
+            }
+                // the host doesn't look at the pattern, only at the CRC
+            memset(card->reg, 0xa5, 128);
+            card_reg_xfer(card, now, EMU_DATA_READ, card->width == 8 ? 128 : 64, rsp);
+            card->stats.tunings++;
+            return 1;
+
+        case MMC_SET_BLOCK_COUNT:
+            if (card->state != ST_TRAN || cmdq_on(card) || ((arg & SBC_PACKED) && !card->cfg.packed_wr)) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            card->blkcnt = arg & 0xffff;
+            card->packed = !!(arg & SBC_PACKED);
+            return 1;
+
+        case SD_ERASE_WR_BLK_START:
+        case SD_ERASE_WR_BLK_END:
+        case MMC_TAG_ERASE_GROUP_START:
+        case MMC_TAG_ERASE_GROUP_END:
+            if (card->state != ST_TRAN || (sd != (op == SD_ERASE_WR_BLK_START || op == SD_ERASE_WR_BLK_END))) {
+                return 0;
+            }
+            rsp->rsp[0] = card_r1(card, now);
+            if (op == SD_ERASE_WR_BLK_START || op == MMC_TAG_ERASE_GROUP_START) {
+                card->erase_start = arg;
+            } else {
+                card->erase_end = arg;
+            }
+            return 1;
+
+        case MMC_ERASE:
+            return card_erase(card, now, rsp);
+
+        case MMC_QUEUED_TASK_PARAMS:
+        case MMC_QUEUED_TASK_ADDRESS:
+        case MMC_EXECUTE_READ_TASK:
+        case MMC_EXECUTE_WRITE_TASK:
+        case MMC_CMDQ_TASK_MGMT:
+            return sd ? 0 : cmdq_cmd(card, now, op, arg, rsp);
+
+        case MMC_APP_CMD:
+            if (!sd || card->state == ST_INA || (card->state >= ST_STBY && (arg >> 16) != card->rca)) {
+                return 0;
+            }
+            card->app = 1;
+            rsp->rsp[0] = card_r1(card, now);
+            return 1;
+    }
+    return 0;
+}
+
+int emu_card_cmd(emu_card_t *card, uint64_t now, unsigned op, uint32_t arg, emu_card_rsp_t *rsp)
+{
+    int app, ret;
+
+    memset(rsp, 0, sizeof(*rsp));
+    if (!card->powered || card->vswitch || card->state == ST_INA) {
+        return 0;
+    }
+    card->stats.cmds++;
+
+    app = card->app;
+    if (app && card->cfg.type == EMU_CARD_SD) {
+        if ((ret = sd_acmd(card, now, op, arg, rsp)) >= 0) {
+            card->app = 0;
+            return ret;
+        }
+    }
+    ret = card_cmd(card, now, op, arg, rsp);
+    if (op != MMC_APP_CMD) {
+        card->app = 0;
+    }
+    return ret;
+}
+
+int emu_card_read(emu_card_t *card, void *buf, uint32_t len)
+{
+    if (card->dir != EMU_DATA_READ) {
+        return -1;
+    }
+    if (card->regdata) {
+        if (card->reg_pos + len > sizeof(card->reg)) {
+            return -1;
+        }
+        memcpy(buf, card->reg + card->reg_pos, len);
+        card->reg_pos += len;
+        return 0;
+    }
+    if (card->addr + len > card->size) {
+        card->status |= CDS_OUT_OF_RANGE;
+        return -1;
+    }
+    memcpy(buf, card->media + card->addr, len);
+    card->addr += len;
+    card->blocks += len / CARD_BLKSZ;
+    card->stats.rd_blocks += len / CARD_BLKSZ;
+    return 0;
+}
+
+/* The header of a packed write, in card->reg: version, direction, the entries */
+static int packed_hdr(emu_card_t *card)
+{
+    const uint8_t *hdr = card->reg;
+    uint32_t ent, blks = 1;
+
+    card->pk_nent = hdr[2];
+    card->pk_ent = 0;
+    card->pk_left = 0;
+    if (hdr[0] != MMC_PACKED_VERSION || hdr[1] != MMC_PACKED_WRITE || card->pk_nent == 0 ||
+            card->pk_nent > card->cfg.packed_wr) {
+        return -1;
+    }
+    for (ent = 0; ent < card->pk_nent; ent++) {
+        card->pk[ent].blks = (hdr[8 * ent + 8] | hdr[8 * ent + 9] << 8);
+        card->pk[ent].addr = (uint32_t) (hdr[8 * ent + 12] | hdr[8 * ent + 13] << 8 |
+                hdr[8 * ent + 14] << 16 | (uint32_t) hdr[8 * ent + 15] << 24);
+        card->pk[ent].addr *= card->hcs ? CARD_BLKSZ : 1;
+        if (card->pk[ent].blks == 0 || card->pk[ent].addr + (uint64_t) card->pk[ent].blks * CARD_BLKSZ > card->size) {
+            return -1;
+        }
+        blks += card->pk[ent].blks;
+    }
+    if (blks != card->blkcnt) {
+        return -1;
+    }
+    card->stats.packed++;
+    return 0;
+}
+
+/* A packed write, the header block then the data of each entry in turn */
+static int packed_write(emu_card_t *card, const uint8_t *buf, uint32_t len)
+{
+    uint32_t n;
+
+    while (len) {
+        if (card->pk_bytes < CARD_BLKSZ) {
+            n = min(len, CARD_BLKSZ - card->pk_bytes);
+            memcpy(card->reg + card->pk_bytes, buf, n);
+            if (card->pk_bytes + n == CARD_BLKSZ && packed_hdr(card)) {
+                card->status |= CDS_ERROR;
+                return -1;
+            }
+        } else {
+            if (card->pk_left == 0) {
+                if (card->pk_ent == card->pk_nent) {
+                    return -1;
+                }
+                card->addr = card->pk[card->pk_ent].addr;
+                card->pk_left = card->pk[card->pk_ent++].blks * CARD_BLKSZ;
+            }
+            n = min(len, card->pk_left);
+            memcpy(card->media + card->addr, buf, n);
+            card->addr += n;
+            card->pk_left -= n;
+            card->stats.wr_blocks += n / CARD_BLKSZ;
+        }
+        card->pk_bytes += n;
+        buf += n;
+        len -= n;
+    }
+    card->blocks = card->pk_bytes / CARD_BLKSZ;
+    return 0;
+}
+
+int emu_card_write(emu_card_t *card, const void *buf, uint32_t len)
+{
+    if (card->dir != EMU_DATA_WRITE) {
+        return -1;
+    }
+    if (card->packed) {
+        return packed_write(card, buf, len);
+    }
+    if (card->regdata) {
+        if (card->reg_pos + len > sizeof(card->reg)) {
+            return -1;
+        }
+        memcpy(card->reg + card->reg_pos, buf, len);
+        card->reg_pos += len;
+        return 0;
+    }
+    if (card->addr + len > card->size) {
+        card->status |= CDS_OUT_OF_RANGE;
+        return -1;
+    }
+    memcpy(card->media + card->addr, buf, len);
+    card->addr += len;
+    card->blocks += len / CARD_BLKSZ;
+    card->stats.wr_blocks += len / CARD_BLKSZ;
+    return 0;
+}
+
+uint64_t emu_card_data_end(emu_card_t *card, uint64_t now)
+{
+    emu_card_rsp_t rsp;
+    int done;
+
+    if (card->dir == EMU_DATA_NONE) {
+        return 0;
+    }
+    done = card->regdata || !card->multi || (card->blkcnt && card->blocks >= card->blkcnt);
+    if (!done) {
+        return 0;                                   // until CMD12
+    }
+    if (card->bustest) {
+        memcpy(card->bus_pattern, card->reg, sizeof(card->bus_pattern));
+        card->bustest = 0;
+    }
+    card->blkcnt = 0;
+    card->packed = 0;
+    card->state = ST_TRAN;
+    if (card->dir == EMU_DATA_READ || card->regdata) {
+        card->dir = EMU_DATA_NONE;
+        return 0;
+    }
+    card->dir = EMU_DATA_NONE;
+    memset(&rsp, 0, sizeof(rsp));
+    card_busy(card, now, card_program_ns(card), ST_PRG, &rsp);
+    return rsp.busy_ns;
+}
+
+void emu_card_vio(emu_card_t *card, int v18)
+{
+    __atomic_store_n(&card->vio, v18, __ATOMIC_RELAXED);
+}
+
+unsigned emu_card_dat(emu_card_t *card, uint64_t now, int sig_1v8, int clk)
+{
+    if (!card->powered) {
+        return 0xf;
+    }
+    if (card->vswitch) {
+            // held low from the CMD11 response until the host
+            // runs the clock again at 1.8V
+        if (!sig_1v8 || !clk || __atomic_load_n(&card->vio, __ATOMIC_RELAXED) == 0) {
+            return 0;
+        }
+        card->vswitch = 0;
+        card->s18 = 1;
+    }
+    return now < card->busy_until ? 0xe : 0xf;
+}
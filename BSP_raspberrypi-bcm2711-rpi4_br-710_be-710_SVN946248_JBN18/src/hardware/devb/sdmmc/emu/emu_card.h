@@ -0,0 +1,120 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/* A memory backed SD card or eMMC device, as seen from the host controller */
+
+#ifndef EMU_CARD_H_
+#define EMU_CARD_H_
+
+#include <stdint.h>
+
+typedef enum {
+    EMU_CARD_SD,
+    EMU_CARD_EMMC
+} emu_card_type_t;
+
+typedef struct emu_card_cfg_t
+{
+    emu_card_type_t type;
+    uint32_t    sectors;        /* 512 byte sectors */
+    int         uhs;            /* SD: accepts 1.8V signalling and UHS-I bus speeds */
+    int         no_cmd23;       /* SD: SCR doesn't offer CMD23, multi-block transfers end with CMD12 */
+    uint32_t    read_ns;        /* access time before the first block of a read */
+    uint32_t    write_ns;       /* program busy after a write */
+    uint32_t    write_blk_ns;   /* and per block written */
+    uint32_t    erase_ns;       /* busy after an erase, trim or discard */
+    uint32_t    erase_blk_ns;   /* and per block erased */
+    uint32_t    switch_ns;      /* busy after an eMMC SWITCH */
+    uint32_t    err_every;      /* every n'th read or write fails with a data CRC error, 0 never */
+    uint32_t    stall_every;    /* every n'th write stays busy stall_ns longer, 0 never */
+    uint32_t    stall_ns;
+    uint32_t    cmdq_depth;     /* eMMC: command queue tasks, up to 32, 0 no queue */
+    uint32_t    packed_wr;      /* eMMC: writes in a packed write, 0 no packed commands */
+} emu_card_cfg_t;
+
+typedef struct emu_card_stats_t
+{
+    uint64_t    cmds;
+    uint64_t    reads;          /* read and write commands */
+    uint64_t    writes;
+    uint64_t    rd_blocks;
+    uint64_t    wr_blocks;
+    uint64_t    erases;
+    uint64_t    errors;         /* injected CRC errors */
+    uint64_t    stalls;
+    uint64_t    tunings;        /* tuning blocks sent */
+    uint64_t    tasks;          /* command queue tasks executed */
+    uint64_t    packed;         /* packed writes */
+} emu_card_stats_t;
+
+enum {
+    EMU_DATA_NONE,
+    EMU_DATA_READ,              /* card to host */
+    EMU_DATA_WRITE
+};
+
+/* What a command does on the bus, filled in by emu_card_cmd() */
+typedef struct emu_card_rsp_t
+{
+    uint32_t    rsp[4];         /* R2 as 128 bits, least significant word first */
+    int         data;           /* EMU_DATA_* */
+    uint32_t    blksz;
+    uint64_t    access_ns;      /* before the first data block */
+    uint64_t    busy_ns;        /* DAT0 busy after the response */
+    int         crc_err;        /* the data phase will fail */
+} emu_card_rsp_t;
+
+typedef struct emu_card emu_card_t;
+
+emu_card_t *emu_card_create(const emu_card_cfg_t *cfg);
+void emu_card_destroy(emu_card_t *card);
+
+/* Power from the host's SD bus power bit, off resets the card */
+void emu_card_power(emu_card_t *card, int on);
+
+/*
+ * I/O supply switched by the board, 1 for 1.8V. Until it's set the card
+ * follows the host's signalling bit, as if the controller drove the supply.
+ */
+void emu_card_vio(emu_card_t *card, int v18);
+
+/* A command at time now, returns 0 if the card didn't respond */
+int emu_card_cmd(emu_card_t *card, uint64_t now, unsigned op, uint32_t arg, emu_card_rsp_t *rsp);
+
+/* The data of the current read or write, returns -1 past the end of the device */
+int emu_card_read(emu_card_t *card, void *buf, uint32_t len);
+int emu_card_write(emu_card_t *card, const void *buf, uint32_t len);
+
+/*
+ * End of a data phase at time now. Returns how long DAT0 stays busy if the
+ * transfer is finished (one block, or the CMD23 count), otherwise the card
+ * keeps transferring until CMD12.
+ */
+uint64_t emu_card_data_end(emu_card_t *card, uint64_t now);
+
+/* DAT[3:0] levels, low around a voltage switch and DAT0 low while busy */
+unsigned emu_card_dat(emu_card_t *card, uint64_t now, int sig_1v8, int clk);
+
+/* The backing store, for the harness to check against */
+uint8_t *emu_card_media(emu_card_t *card);
+void emu_card_stats(emu_card_t *card, emu_card_stats_t *stats);
+
+#endif /* EMU_CARD_H_ */
@@ -0,0 +1,173 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * The VideoCore property mailbox. A write of a buffer address on the
+ * property channel is answered at once: the tags in the buffer are
+ * processed in place and the address is queued for the ARM to read back.
+ * Bus addresses are the driver's virtual ones here, as for DMA.
+ */
+
+#include <pthread.h>
+#include "emu_os.h"
+#include "emu_mbox.h"
+
+#define MBOX_SIZE           0x40
+#define MBOX0_READ          0x00
+#define MBOX0_STATUS        0x18
+#define MBOX1_WRITE         0x20
+#define MBOX1_STATUS        0x38
+#define MBOX_STATUS_FULL    0x80000000
+#define MBOX_STATUS_EMPTY   0x40000000
+#define MBOX_CHAN_PROP      8
+#define MBOX_QUEUE          8
+
+#define PROP_SUCCESS        0x80000000
+#define PROP_ERROR          0x80000001
+#define TAG_RESPONSE        0x80000000
+#define TAG_SET_GPIO_STATE  0x00038041
+
+struct emu_mbox
+{
+    emu_mbox_cfg_t      cfg;
+    emu_mbox_stats_t    stats;
+    emu_device_t        dev;
+    pthread_mutex_t     mutex;
+    uint32_t            queue[MBOX_QUEUE];  // answered messages for the ARM
+    unsigned            head;
+    unsigned            count;
+};
+
+static uint32_t mbox_tag(emu_mbox_t *mbox, uint32_t id, uint32_t *val, uint32_t len)
+{
+    switch (id) {
+        case TAG_SET_GPIO_STATE:
+            if (len < 2 * sizeof(uint32_t)) {
+                return 0;
+            }
+            mbox->stats.gpio_sets++;
+            val[0] = mbox->cfg.gpio ? mbox->cfg.gpio(mbox->cfg.ctx, val[0], val[1]) : 1;
+            return TAG_RESPONSE | (2 * sizeof(uint32_t));
+        default:
+            return 0;
+    }
+}
+
+static void mbox_property(emu_mbox_t *mbox, uint32_t *msg)
+{
+    uint32_t words = msg[0] / sizeof(uint32_t);
+    uint32_t i, len, rsp;
+
+    mbox->stats.msgs++;
+    for (i = 2; i + 3 <= words && msg[i] != 0; i += 3 + (len + 3) / 4) {
+        len = msg[i + 1];
+        if (i + 3 + (len + 3) / 4 > words) {
+            break;
+        }
+        if ((rsp = mbox_tag(mbox, msg[i], &msg[i + 3], len)) == 0) {
+            msg[1] = PROP_ERROR;
+            return;
+        }
+        msg[i + 2] = rsp;
+    }
+    msg[1] = PROP_SUCCESS;
+}
+
+static uint32_t mbox_read(void *ctx, unsigned off, unsigned width)
+{
+    emu_mbox_t *mbox = ctx;
+    uint32_t val = 0;
+
+    (void) width;
+    pthread_mutex_lock(&mbox->mutex);
+    switch (off) {
+        case MBOX0_READ:
+            if (mbox->count) {
+                val = mbox->queue[mbox->head];
+                mbox->head = (mbox->head + 1) % MBOX_QUEUE;
+                mbox->count--;
+            }
+            break;
+        case MBOX0_STATUS:
+            val = (mbox->count ? 0 : MBOX_STATUS_EMPTY) | (mbox->count == MBOX_QUEUE ? MBOX_STATUS_FULL : 0);
+            break;
+        case MBOX1_STATUS:
+            val = MBOX_STATUS_EMPTY;
+            break;
+        default:
+            break;
+    }
+    pthread_mutex_unlock(&mbox->mutex);
+    return val;
+}
+
+static void mbox_write(void *ctx, unsigned off, unsigned width, uint32_t val)
+{
+    emu_mbox_t *mbox = ctx;
+
+    (void) width;
+    if (off != MBOX1_WRITE) {
+        return;
+    }
+    if ((val & 0xf) != MBOX_CHAN_PROP || (val & ~0xf) == 0) {
+        emu_fatal("mailbox write %#x", val);
+    }
+    pthread_mutex_lock(&mbox->mutex);
+    mbox_property(mbox, (uint32_t *) (uintptr_t) (val & ~0xf));
+    if (mbox->count < MBOX_QUEUE) {
+        mbox->queue[(mbox->head + mbox->count++) % MBOX_QUEUE] = val;
+    }
+    pthread_mutex_unlock(&mbox->mutex);
+}
+
+emu_mbox_t *emu_mbox_create(const emu_mbox_cfg_t *cfg)
+{
+    emu_mbox_t *mbox;
+
+    if ((mbox = calloc(1, sizeof(*mbox))) == NULL) {
+        return NULL;
+    }
+    mbox->cfg = *cfg;
+    pthread_mutex_init(&mbox->mutex, NULL);
+
+    mbox->dev.name = "mbox";
+    mbox->dev.base = EMU_MBOX_BASE;
+    mbox->dev.size = MBOX_SIZE;
+    mbox->dev.read = mbox_read;
+    mbox->dev.write = mbox_write;
+    mbox->dev.ctx = mbox;
+    emu_device_add(&mbox->dev);
+    return mbox;
+}
+
+void emu_mbox_destroy(emu_mbox_t *mbox)
+{
+    emu_device_remove(&mbox->dev);
+    pthread_mutex_destroy(&mbox->mutex);
+    free(mbox);
+}
+
+void emu_mbox_stats(emu_mbox_t *mbox, emu_mbox_stats_t *stats)
+{
+    pthread_mutex_lock(&mbox->mutex);
+    *stats = mbox->stats;
+    pthread_mutex_unlock(&mbox->mutex);
+}
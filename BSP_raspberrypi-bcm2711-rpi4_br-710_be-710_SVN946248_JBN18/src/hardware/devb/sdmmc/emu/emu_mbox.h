@@ -0,0 +1,52 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/* The VideoCore property mailbox, as far as the bcm2711 bs uses it */
+
+#ifndef EMU_MBOX_H_
+#define EMU_MBOX_H_
+
+#include <stdint.h>
+
+#define EMU_MBOX_BASE       0xfe00b880
+
+typedef struct emu_mbox_cfg_t
+{
+        /* SET_GPIO_STATE on the firmware's expander, returns 0 if the pin exists */
+    int         (*gpio)(void *ctx, uint32_t gpio, uint32_t state);
+    void        *ctx;
+} emu_mbox_cfg_t;
+
+typedef struct emu_mbox_stats_t
+{
+    uint64_t    msgs;           /* property messages processed */
+    uint64_t    gpio_sets;
+} emu_mbox_stats_t;
+
+typedef struct emu_mbox emu_mbox_t;
+
+/* Registers the mailbox at EMU_MBOX_BASE */
+emu_mbox_t *emu_mbox_create(const emu_mbox_cfg_t *cfg);
+void emu_mbox_destroy(emu_mbox_t *mbox);
+
+void emu_mbox_stats(emu_mbox_t *mbox, emu_mbox_stats_t *stats);
+
+#endif /* EMU_MBOX_H_ */
@@ -0,0 +1,1086 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * The Neutrino kernel calls the driver makes, on the host.
+ *
+ * Channels only ever carry pulses, so a channel is a FIFO of pulses and a
+ * condition variable. Timers are served by one thread sleeping on the
+ * earliest expiry, interrupts are level triggered lines set by the device
+ * models: an attached event is sent while the line is high and unmasked,
+ * and delivery masks it until InterruptUnmask(), as with
+ * _NTO_INTR_FLAGS_TRK_MSK on the target.
+ *
+ * Everything here is under one lock. The device models call in with their
+ * own lock held (to change a line), never the other way round.
+ */
+
+#include <stdarg.h>
+#include <sys/prctl.h>
+#include "emu_os.h"
+
+#undef pthread_t
+#undef pthread_create
+#undef pthread_join
+#undef pthread_self
+#undef pthread_cancel
+#undef pthread_getschedparam
+#undef pthread_setname_np
+#undef mmap
+#undef munmap
+#undef timer_t
+
+#define EMU_CHANNELS        32
+#define EMU_CONNECTS        64
+#define EMU_TIMERS          32
+#define EMU_INTRS           8
+#define EMU_IRQ_LINES       1024
+#define EMU_THREADS         64
+#define EMU_DEVICES         4
+#define EMU_MAPS            16
+#define EMU_COID_BASE       0x40000000
+#define EMU_STACK_MIN       (256 * 1024)    // the driver's 16k stacks are too small with the sanitizers
+#define EMU_SPIN_NS         100000          // emu_sleep_until() spins the last stretch
+#define EMU_DRIVER_PRIO     21
+
+typedef struct emu_pulse_t
+{
+    struct emu_pulse_t  *next;
+    struct _pulse       pulse;
+} emu_pulse_t;
+
+typedef struct emu_chan_t
+{
+    int             chid;           // 0 when free
+    unsigned        flags;
+    int             conns;
+    emu_pulse_t     *head;
+    emu_pulse_t     *tail;
+    pthread_cond_t  cond;
+} emu_chan_t;
+
+typedef struct emu_timer_t
+{
+    int             used;
+    clockid_t       clock;
+    struct sigevent event;
+    uint64_t        expiry;         // CLOCK_MONOTONIC ns, 0 when disarmed
+    uint64_t        interval;
+} emu_timer_t;
+
+typedef struct emu_intr_t
+{
+    int             used;
+    int             irq;
+    int             masked;         // mask count, delivery adds one
+    struct sigevent event;
+} emu_intr_t;
+
+typedef struct emu_thread_t
+{
+    int             used;
+    pthread_t       host;
+    void            *(*func)(void *);
+    void            *arg;
+} emu_thread_t;
+
+typedef struct emu_map_t
+{
+    uintptr_t       va;
+    size_t          len;
+    const emu_device_t *dev;
+    unsigned        off;            // of va into the device
+} emu_map_t;
+
+struct qtime_entry emu_qtime = { .cycles_per_sec = 1000000000ULL };
+int emu_verbose;
+
+static pthread_mutex_t emu_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t emu_once = PTHREAD_ONCE_INIT;
+static pthread_cond_t timer_cond;
+static pthread_t timer_tid;
+
+static emu_chan_t chans[EMU_CHANNELS];
+static int conns[EMU_CONNECTS];     // chid per connection, 0 when free
+static emu_timer_t timers[EMU_TIMERS];
+static emu_intr_t intrs[EMU_INTRS];
+static uint8_t irq_level[EMU_IRQ_LINES];
+static emu_thread_t threads[EMU_THREADS];
+static const emu_device_t *devices[EMU_DEVICES];
+static emu_map_t maps[EMU_MAPS];
+static unsigned chan_gen;
+
+static __thread int emu_self;
+
+static pthread_mutex_t sleepon_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sleepon_cond = PTHREAD_COND_INITIALIZER;
+
+static void *emu_timer_thread(void *arg);
+
+void emu_fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "sdmmc-emu: ");
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+uint64_t emu_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Sleeps for the bulk of the wait and spins the rest, host sleeps
+ * overshoot by tens of microseconds and card latencies are not much more.
+ */
+void emu_sleep_until(uint64_t ns)
+{
+    struct timespec ts;
+    uint64_t now;
+
+    while ((now = emu_now_ns()) < ns) {
+        if (ns - now > EMU_SPIN_NS) {
+            nsec2timespec(&ts, ns - EMU_SPIN_NS);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+    }
+}
+
+static void emu_init(void)
+{
+    pthread_condattr_t attr;
+    unsigned i;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    for (i = 0; i < EMU_CHANNELS; i++) {
+        pthread_cond_init(&chans[i].cond, NULL);
+    }
+
+    // the default 50us slack is more than most of the latencies modelled
+    prctl(PR_SET_TIMERSLACK, 1UL);
+
+    if (pthread_create(&timer_tid, NULL, emu_timer_thread, NULL) != 0) {
+        emu_fatal("no timer thread");
+    }
+    pthread_detach(timer_tid);
+}
+
+static emu_chan_t *emu_chan(int chid)
+{
+    emu_chan_t *chan;
+
+    if (chid <= 0) {
+        return NULL;
+    }
+    chan = &chans[(chid - 1) % EMU_CHANNELS];
+    return chan->chid == chid ? chan : NULL;
+}
+
+/* Queues a pulse on the channel behind coid, with emu_lock held */
+static int emu_pulse(int coid, int code, union sigval value)
+{
+    emu_pulse_t *p;
+    emu_chan_t *chan;
+    unsigned idx = coid - EMU_COID_BASE;
+
+    if (idx >= EMU_CONNECTS || (chan = emu_chan(conns[idx])) == NULL) {
+        errno = ESRCH;
+        return -1;
+    }
+    if ((p = calloc(1, sizeof(*p))) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    p->pulse.code = code;
+    p->pulse.value = value;
+    p->pulse.scoid = coid;
+    if (chan->tail) {
+        chan->tail->next = p;
+    } else {
+        chan->head = p;
+    }
+    chan->tail = p;
+    pthread_cond_signal(&chan->cond);
+    return 0;
+}
+
+static void emu_event(const struct sigevent *event)
+{
+    if (event->sigev_notify == SIGEV_PULSE) {
+        emu_pulse(event->sigev_coid, event->sigev_code, event->sigev_value);
+    }
+}
+
+int ChannelCreate(unsigned flags)
+{
+    unsigned i;
+    int chid = -1;
+
+    pthread_once(&emu_once, emu_init);
+    pthread_mutex_lock(&emu_lock);
+    for (i = 0; i < EMU_CHANNELS; i++) {
+        if (chans[i].chid == 0) {
+            // a generation in the upper bits keeps stale ids from matching a reused slot
+            chid = ++chan_gen * EMU_CHANNELS + i + 1;
+            chans[i].chid = chid;
+            chans[i].flags = flags;
+            chans[i].conns = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&emu_lock);
+    if (chid == -1) {
+        errno = EAGAIN;
+    }
+    return chid;
+}
+
+int ChannelDestroy(int chid)
+{
+    emu_chan_t *chan;
+    emu_pulse_t *p;
+
+    pthread_mutex_lock(&emu_lock);
+    if ((chan = emu_chan(chid)) == NULL) {
+        pthread_mutex_unlock(&emu_lock);
+        errno = EINVAL;
+        return -1;
+    }
+    while ((p = chan->head) != NULL) {
+        chan->head = p->next;
+        free(p);
+    }
+    chan->tail = NULL;
+    chan->chid = 0;
+    pthread_cond_broadcast(&chan->cond);    // receivers see the channel gone
+    pthread_mutex_unlock(&emu_lock);
+    return 0;
+}
+
+int ConnectAttach(uint32_t nd, pid_t pid, int chid, unsigned index, int flags)
+{
+    emu_chan_t *chan;
+    unsigned i;
+    int coid = -1;
+
+    (void) nd;
+    (void) pid;
+    (void) index;
+    (void) flags;
+
+    pthread_mutex_lock(&emu_lock);
+    if ((chan = emu_chan(chid)) != NULL) {
+        for (i = 0; i < EMU_CONNECTS; i++) {
+            if (conns[i] == 0) {
+                conns[i] = chid;
+                chan->conns++;
+                coid = EMU_COID_BASE + i;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&emu_lock);
+    if (coid == -1) {
+        errno = chan ? EAGAIN : ESRCH;
+    }
+    return coid;
+}
+
+int ConnectDetach(int coid)
+{
+    static const union sigval zero;
+    unsigned idx = coid - EMU_COID_BASE;
+    emu_chan_t *chan;
+
+    pthread_mutex_lock(&emu_lock);
+    if (idx >= EMU_CONNECTS || conns[idx] == 0) {
+        pthread_mutex_unlock(&emu_lock);
+        errno = EINVAL;
+        return -1;
+    }
+    if ((chan = emu_chan(conns[idx])) != NULL && --chan->conns == 0 && (chan->flags & _NTO_CHF_DISCONNECT)) {
+        emu_pulse(coid, _PULSE_CODE_DISCONNECT, zero);
+    }
+    conns[idx] = 0;
+    pthread_mutex_unlock(&emu_lock);
+    return 0;
+}
+
+static int emu_send(int coid, int code, union sigval value)
+{
+    int status;
+
+    pthread_mutex_lock(&emu_lock);
+    status = emu_pulse(coid, code, value);
+    pthread_mutex_unlock(&emu_lock);
+    return status;
+}
+
+int MsgSendPulse(int coid, int priority, int code, int value)
+{
+    union sigval v;
+
+    (void) priority;
+    memset(&v, 0, sizeof(v));
+    v.sival_int = value;
+    return emu_send(coid, code, v);
+}
+
+int MsgSendPulsePtr(int coid, int priority, int code, void *value)
+{
+    union sigval v;
+
+    (void) priority;
+    v.sival_ptr = value;
+    return emu_send(coid, code, v);
+}
+
+int MsgSendPulse_r(int coid, int priority, int code, int value)
+{
+    return MsgSendPulse(coid, priority, code, value) == -1 ? -errno : 0;
+}
+
+int MsgSendPulsePtr_r(int coid, int priority, int code, void *value)
+{
+    return MsgSendPulsePtr(coid, priority, code, value) == -1 ? -errno : 0;
+}
+
+int MsgReceivePulse(int chid, void *pulse, size_t bytes, void *info)
+{
+    emu_chan_t *chan;
+    emu_pulse_t *p;
+
+    (void) info;
+    pthread_mutex_lock(&emu_lock);
+    for (;;) {
+        if ((chan = emu_chan(chid)) == NULL) {
+            pthread_mutex_unlock(&emu_lock);
+            errno = ESRCH;
+            return -1;
+        }
+        if ((p = chan->head) != NULL) {
+            break;
+        }
+        pthread_cond_wait(&chan->cond, &emu_lock);
+    }
+    if ((chan->head = p->next) == NULL) {
+        chan->tail = NULL;
+    }
+    pthread_mutex_unlock(&emu_lock);
+
+    memcpy(pulse, &p->pulse, bytes < sizeof(p->pulse) ? bytes : sizeof(p->pulse));
+    free(p);
+    return 0;
+}
+
+static void *emu_timer_thread(void *arg)
+{
+    struct timespec ts;
+    uint64_t now, next;
+    unsigned i;
+
+    (void) arg;
+    pthread_mutex_lock(&emu_lock);
+    for (;;) {
+        now = emu_now_ns();
+        next = UINT64_MAX;
+        for (i = 0; i < EMU_TIMERS; i++) {
+            emu_timer_t *t = &timers[i];
+
+            if (!t->used || t->expiry == 0) {
+                continue;
+            }
+            if (t->expiry <= now) {
+                emu_event(&t->event);
+                if (t->interval) {
+                    t->expiry += t->interval;
+                    if (t->expiry <= now) {
+                        t->expiry = now + t->interval;  // overran, don't fire a burst to catch up
+                    }
+                } else {
+                    t->expiry = 0;
+                    continue;
+                }
+            }
+            next = t->expiry < next ? t->expiry : next;
+        }
+        if (next == UINT64_MAX) {
+            pthread_cond_wait(&timer_cond, &emu_lock);
+        } else {
+            nsec2timespec(&ts, next);
+            pthread_cond_timedwait(&timer_cond, &emu_lock, &ts);
+        }
+    }
+    return NULL;
+}
+
+int emu_timer_create(clockid_t clock_id, struct sigevent *event, int *timerid)
+{
+    unsigned i;
+
+    pthread_once(&emu_once, emu_init);
+    pthread_mutex_lock(&emu_lock);
+    for (i = 0; i < EMU_TIMERS; i++) {
+        if (!timers[i].used) {
+            memset(&timers[i], 0, sizeof(timers[i]));
+            timers[i].used = 1;
+            timers[i].clock = clock_id;
+            timers[i].event = *event;
+            *timerid = i + 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&emu_lock);
+    if (i == EMU_TIMERS) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+static emu_timer_t *emu_timer(int timerid)
+{
+    if (timerid < 1 || timerid > EMU_TIMERS || !timers[timerid - 1].used) {
+        return NULL;
+    }
+    return &timers[timerid - 1];
+}
+
+int emu_timer_settime(int timerid, int flags, const struct itimerspec *value, struct itimerspec *ovalue)
+{
+    uint64_t now = emu_now_ns(), v;
+    struct timespec rt;
+    emu_timer_t *t;
+
+    pthread_mutex_lock(&emu_lock);
+    if ((t = emu_timer(timerid)) == NULL) {
+        pthread_mutex_unlock(&emu_lock);
+        errno = EINVAL;
+        return -1;
+    }
+    if (ovalue) {
+        memset(ovalue, 0, sizeof(*ovalue));
+        nsec2timespec(&ovalue->it_value, t->expiry > now ? t->expiry - now : 0);
+        nsec2timespec(&ovalue->it_interval, t->interval);
+    }
+    v = timespec2nsec(&value->it_value);
+    if (v == 0) {
+        t->expiry = 0;
+    } else if (flags & TIMER_ABSTIME) {
+        if (t->clock == CLOCK_REALTIME) {
+            clock_gettime(CLOCK_REALTIME, &rt);
+            v = v > timespec2nsec(&rt) ? now + v - timespec2nsec(&rt) : now;
+        }
+        t->expiry = v ? v : 1;
+    } else {
+        t->expiry = now + v;
+    }
+    t->interval = timespec2nsec(&value->it_interval);
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&emu_lock);
+    return 0;
+}
+
+int emu_timer_delete(int timerid)
+{
+    emu_timer_t *t;
+
+    pthread_mutex_lock(&emu_lock);
+    if ((t = emu_timer(timerid)) != NULL) {
+        t->used = 0;
+    }
+    pthread_mutex_unlock(&emu_lock);
+    if (t == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int InterruptAttachEvent(int intr, const struct sigevent *event, unsigned flags)
+{
+    unsigned i;
+
+    (void) flags;
+    if (intr < 0 || intr >= EMU_IRQ_LINES) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&emu_lock);
+    for (i = 0; i < EMU_INTRS; i++) {
+        if (!intrs[i].used) {
+            intrs[i].used = 1;
+            intrs[i].irq = intr;
+            intrs[i].masked = 0;
+            intrs[i].event = *event;
+            if (irq_level[intr]) {
+                intrs[i].masked++;
+                emu_event(event);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&emu_lock);
+    if (i == EMU_INTRS) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return i + 1;
+}
+
+static emu_intr_t *emu_intr(int id)
+{
+    if (id < 1 || id > EMU_INTRS || !intrs[id - 1].used) {
+        return NULL;
+    }
+    return &intrs[id - 1];
+}
+
+int InterruptDetach(int id)
+{
+    emu_intr_t *in;
+
+    pthread_mutex_lock(&emu_lock);
+    if ((in = emu_intr(id)) != NULL) {
+        in->used = 0;
+    }
+    pthread_mutex_unlock(&emu_lock);
+    return in ? 0 : -1;
+}
+
+int InterruptMask(int intr, int id)
+{
+    emu_intr_t *in;
+    int masked = -1;
+
+    (void) intr;
+    pthread_mutex_lock(&emu_lock);
+    if ((in = emu_intr(id)) != NULL) {
+        masked = ++in->masked;
+    }
+    pthread_mutex_unlock(&emu_lock);
+    return masked;
+}
+
+int InterruptUnmask(int intr, int id)
+{
+    emu_intr_t *in;
+    int masked = -1;
+
+    (void) intr;
+    pthread_mutex_lock(&emu_lock);
+    if ((in = emu_intr(id)) != NULL) {
+        if (in->masked > 0) {
+            in->masked--;
+        }
+        if (in->masked == 0 && irq_level[in->irq]) {
+            in->masked++;
+            emu_event(&in->event);
+        }
+        masked = in->masked;
+    }
+    pthread_mutex_unlock(&emu_lock);
+    return masked;
+}
+
+void emu_irq_set(int irq, int level)
+{
+    unsigned i;
+
+    if (irq < 0 || irq >= EMU_IRQ_LINES) {
+        return;
+    }
+    pthread_mutex_lock(&emu_lock);
+    if (irq_level[irq] != !!level) {
+        irq_level[irq] = !!level;
+        for (i = 0; level && i < EMU_INTRS; i++) {
+            if (intrs[i].used && intrs[i].irq == irq && intrs[i].masked == 0) {
+                intrs[i].masked++;
+                emu_event(&intrs[i].event);
+            }
+        }
+    }
+    pthread_mutex_unlock(&emu_lock);
+}
+
+unsigned emu_os_live(void)
+{
+    unsigned i, live = 0;
+
+    pthread_mutex_lock(&emu_lock);
+    for (i = 0; i < EMU_CHANNELS; i++) {
+        live += chans[i].chid != 0;
+    }
+    for (i = 0; i < EMU_CONNECTS; i++) {
+        live += conns[i] != 0;
+    }
+    for (i = 0; i < EMU_TIMERS; i++) {
+        live += timers[i].used;
+    }
+    for (i = 0; i < EMU_INTRS; i++) {
+        live += intrs[i].used;
+    }
+    for (i = 0; i < EMU_THREADS; i++) {
+        live += threads[i].used;
+    }
+    pthread_mutex_unlock(&emu_lock);
+    return live;
+}
+
+int ThreadCtl(int cmd, void *data)
+{
+    (void) cmd;
+    (void) data;
+    return 0;
+}
+
+uint64_t ClockCycles(void)
+{
+    return emu_now_ns();
+}
+
+uint64_t emu_time_ns(void)
+{
+    return emu_now_ns();
+}
+
+int nanospin_ns(unsigned long nsec)
+{
+    uint64_t end = emu_now_ns() + nsec;
+
+    while (emu_now_ns() < end) {
+        // spin
+    }
+    return 0;
+}
+
+void nsec2timespec(struct timespec *ts, uint64_t nsec)
+{
+    ts->tv_sec = nsec / 1000000000ULL;
+    ts->tv_nsec = nsec % 1000000000ULL;
+}
+
+uint64_t timespec2nsec(const struct timespec *ts)
+{
+    return (uint64_t) ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+void delay(unsigned int msec)
+{
+    struct timespec ts;
+
+    nsec2timespec(&ts, msec * 1000000ULL);
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+        // rest of it
+    }
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+int vslogf(int opcode, int severity, const char *fmt, va_list ap)
+{
+    (void) opcode;
+    if (!emu_verbose) {
+        return 0;
+    }
+    fprintf(stderr, "slog%d: ", severity);
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    return 0;
+}
+
+int slogf(int opcode, int severity, const char *fmt, ...)
+{
+    va_list ap;
+    int status;
+
+    va_start(ap, fmt);
+    status = vslogf(opcode, severity, fmt, ap);
+    va_end(ap);
+    return status;
+}
+
+/* pthread_sleepon_*() */
+
+int pthread_sleepon_lock(void)
+{
+    return pthread_mutex_lock(&sleepon_mutex);
+}
+
+int pthread_sleepon_unlock(void)
+{
+    return pthread_mutex_unlock(&sleepon_mutex);
+}
+
+int pthread_sleepon_wait(const volatile void *addr)
+{
+    (void) addr;
+    return pthread_cond_wait(&sleepon_cond, &sleepon_mutex);
+}
+
+int pthread_sleepon_signal(const volatile void *addr)
+{
+    (void) addr;
+    return pthread_cond_broadcast(&sleepon_cond);
+}
+
+int pthread_sleepon_broadcast(const volatile void *addr)
+{
+    (void) addr;
+    return pthread_cond_broadcast(&sleepon_cond);
+}
+
+/* Threads, numbered from 1 as on the target */
+
+static void *emu_thread_start(void *arg)
+{
+    emu_thread_t *t = arg;
+
+    emu_self = t - threads + 1;
+    return t->func(t->arg);
+}
+
+int emu_pthread_create(emu_pthread_t *tid, const pthread_attr_t *attr, void *(*func)(void *), void *arg)
+{
+    pthread_attr_t hattr;
+    size_t stack = 0;
+    emu_thread_t *t = NULL;
+    unsigned i;
+    int status;
+
+    pthread_mutex_lock(&emu_lock);
+    for (i = 0; i < EMU_THREADS; i++) {
+        if (!threads[i].used) {
+            t = &threads[i];
+            t->used = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&emu_lock);
+    if (t == NULL) {
+        return EAGAIN;
+    }
+
+    // the id is the caller's before the thread runs, the driver threads compare against it
+    t->func = func;
+    t->arg = arg;
+    if (tid) {
+        *tid = i + 1;
+    }
+
+    pthread_attr_init(&hattr);
+    if (attr) {
+        pthread_attr_getstacksize(attr, &stack);
+    }
+    pthread_attr_setstacksize(&hattr, stack > EMU_STACK_MIN ? stack : EMU_STACK_MIN);
+    status = pthread_create(&t->host, &hattr, emu_thread_start, t);
+    pthread_attr_destroy(&hattr);
+    if (status) {
+        t->used = 0;
+    }
+    return status;
+}
+
+int emu_pthread_join(emu_pthread_t tid, void **value)
+{
+    emu_thread_t *t;
+    int status;
+
+    if (tid < 1 || tid > EMU_THREADS || !threads[tid - 1].used) {
+        return ESRCH;
+    }
+    t = &threads[tid - 1];
+    if ((status = pthread_join(t->host, value)) == 0) {
+        pthread_mutex_lock(&emu_lock);
+        t->used = 0;
+        pthread_mutex_unlock(&emu_lock);
+    }
+    return status;
+}
+
+emu_pthread_t emu_pthread_self(void)
+{
+    return emu_self;
+}
+
+int emu_pthread_cancel(emu_pthread_t tid)
+{
+    if (tid < 1 || tid > EMU_THREADS || !threads[tid - 1].used) {
+        return ESRCH;
+    }
+    return pthread_cancel(threads[tid - 1].host);
+}
+
+int emu_pthread_getschedparam(emu_pthread_t tid, int *policy, struct sched_param *param)
+{
+    (void) tid;
+    *policy = SCHED_RR;
+    memset(param, 0, sizeof(*param));
+    param->sched_priority = EMU_DRIVER_PRIO;
+    return 0;
+}
+
+int emu_pthread_setname_np(emu_pthread_t tid, const char *name)
+{
+    char buf[16];
+
+    if (tid < 1 || tid > EMU_THREADS || !threads[tid - 1].used) {
+        return ESRCH;
+    }
+    strlcpy(buf, name, sizeof(buf));
+    return pthread_setname_np(threads[tid - 1].host, buf);
+}
+
+/*
+ * Memory. Physical addresses are host addresses, so MAP_PHYS of anything
+ * that isn't a device is the memory itself. The driver only maps it to
+ * read it back, a private copy keeps munmap() from unmapping the original.
+ */
+
+void *emu_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+    void *p;
+
+    if (flags & MAP_PHYS) {
+        if ((p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED) {
+            memcpy(p, (void *) (uintptr_t) off, len);
+        }
+        return p;
+    }
+    if (fd == NOFD) {
+        flags |= MAP_ANONYMOUS;
+    }
+    return mmap(addr, len, prot & ~PROT_NOCACHE, flags, fd, off);
+}
+
+int emu_munmap(void *addr, size_t len)
+{
+    return munmap(addr, len);
+}
+
+int mem_offset64(const void *addr, int fd, size_t len, off64_t *offset, size_t *contig_len)
+{
+    (void) fd;
+    *offset = (uintptr_t) addr;
+    if (contig_len) {
+        *contig_len = len;
+    }
+    return 0;
+}
+
+void emu_device_add(const emu_device_t *dev)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&emu_lock);
+    for (i = 0; i < EMU_DEVICES && devices[i]; i++) {
+        // first free slot
+    }
+    if (i == EMU_DEVICES) {
+        emu_fatal("too many devices");
+    }
+    devices[i] = dev;
+    pthread_mutex_unlock(&emu_lock);
+}
+
+void emu_device_remove(const emu_device_t *dev)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&emu_lock);
+    for (i = 0; i < EMU_DEVICES; i++) {
+        if (devices[i] == dev) {
+            devices[i] = NULL;
+        }
+    }
+    for (i = 0; i < EMU_MAPS; i++) {
+        if (maps[i].dev == dev) {
+            emu_fatal("%s removed while mapped", dev->name);
+        }
+    }
+    pthread_mutex_unlock(&emu_lock);
+}
+
+/*
+ * A device mapping is address space nothing can touch, any access that
+ * doesn't go through in*()/out*() faults.
+ */
+void *mmap_device_memory(void *addr, size_t len, int prot, int flags, uint64_t physical)
+{
+    const emu_device_t *dev = NULL;
+    unsigned i, m;
+    void *va;
+
+    (void) addr;
+    (void) prot;
+    (void) flags;
+    pthread_mutex_lock(&emu_lock);
+    for (i = 0; i < EMU_DEVICES; i++) {
+        if (devices[i] && physical >= devices[i]->base && physical + len <= devices[i]->base + devices[i]->size) {
+            dev = devices[i];
+            break;
+        }
+    }
+    for (m = 0; m < EMU_MAPS && maps[m].dev; m++) {
+        // first free slot
+    }
+    if (dev == NULL || m == EMU_MAPS) {
+        pthread_mutex_unlock(&emu_lock);
+        errno = dev ? ENOMEM : ENXIO;
+        return MAP_FAILED;
+    }
+    if ((va = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED) {
+        maps[m].va = (uintptr_t) va;
+        maps[m].len = len;
+        maps[m].dev = dev;
+        maps[m].off = physical - dev->base;
+    }
+    pthread_mutex_unlock(&emu_lock);
+    return va;
+}
+
+int munmap_device_memory(void *addr, size_t len)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&emu_lock);
+    for (i = 0; i < EMU_MAPS; i++) {
+        if (maps[i].dev && maps[i].va == (uintptr_t) addr) {
+            maps[i].dev = NULL;
+        }
+    }
+    pthread_mutex_unlock(&emu_lock);
+    return munmap(addr, len);
+}
+
+uintptr_t mmap_device_io(size_t len, uint64_t io)
+{
+    void *va = mmap_device_memory(NULL, len, 0, 0, io);
+
+    return va == MAP_FAILED ? (uintptr_t) MAP_FAILED : (uintptr_t) va;
+}
+
+int munmap_device_io(uintptr_t io, size_t len)
+{
+    return munmap_device_memory((void *) io, len);
+}
+
+/*
+ * Maps are only added and removed while the driver attaches and
+ * detaches, with no register traffic in flight, so lookups go unlocked.
+ */
+static const emu_map_t *emu_map(uintptr_t port, unsigned width)
+{
+    unsigned i;
+
+    for (i = 0; i < EMU_MAPS; i++) {
+        if (maps[i].dev && port >= maps[i].va && port + width <= maps[i].va + maps[i].len) {
+            return &maps[i];
+        }
+    }
+    emu_fatal("access to unmapped register %#lx", (unsigned long) port);
+}
+
+static uint32_t emu_in(uintptr_t port, unsigned width)
+{
+    const emu_map_t *m = emu_map(port, width);
+
+    return m->dev->read(m->dev->ctx, m->off + (port - m->va), width);
+}
+
+static void emu_out(uintptr_t port, unsigned width, uint32_t val)
+{
+    const emu_map_t *m = emu_map(port, width);
+
+    m->dev->write(m->dev->ctx, m->off + (port - m->va), width, val);
+}
+
+uint8_t in8(uintptr_t port)
+{
+    return emu_in(port, 1);
+}
+
+uint16_t in16(uintptr_t port)
+{
+    return emu_in(port, 2);
+}
+
+uint32_t in32(uintptr_t port)
+{
+    return emu_in(port, 4);
+}
+
+void out8(uintptr_t port, uint8_t val)
+{
+    emu_out(port, 1, val);
+}
+
+void out16(uintptr_t port, uint16_t val)
+{
+    emu_out(port, 2, val);
+}
+
+void out32(uintptr_t port, uint32_t val)
+{
+    emu_out(port, 4, val);
+}
+
+void *in32s(void *buff, unsigned len, uintptr_t port)
+{
+    uint32_t *p = buff;
+
+    while (len--) {
+        *p++ = emu_in(port, 4);
+    }
+    return p;
+}
+
+void *out32s(const void *buff, unsigned len, uintptr_t port)
+{
+    const uint32_t *p = buff;
+
+    while (len--) {
+        emu_out(port, 4, *p++);
+    }
+    return (void *) p;
+}
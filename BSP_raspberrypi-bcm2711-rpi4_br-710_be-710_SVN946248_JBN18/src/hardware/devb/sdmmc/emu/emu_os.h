@@ -0,0 +1,55 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/* Harness side of emu_os.c: device registers, interrupt lines and checks */
+
+#ifndef EMU_OS_H_
+#define EMU_OS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct emu_device_t
+{
+    const char  *name;
+    uint64_t    base;           /* physical address the driver maps */
+    size_t      size;
+    uint32_t    (*read)(void *ctx, unsigned off, unsigned width);
+    void        (*write)(void *ctx, unsigned off, unsigned width, uint32_t val);
+    void        *ctx;
+} emu_device_t;
+
+extern int emu_verbose;
+
+void emu_device_add(const emu_device_t *dev);
+void emu_device_remove(const emu_device_t *dev);
+
+/* Level of an interrupt line, the attached event fires while it's high and unmasked */
+void emu_irq_set(int irq, int level);
+
+/* Channels, connections, timers and threads still open, to catch leaks after a detach */
+unsigned emu_os_live(void);
+
+uint64_t emu_now_ns(void);
+void emu_sleep_until(uint64_t ns);
+void emu_fatal(const char *fmt, ...) __attribute__((format(printf, 1, 2), noreturn));
+
+#endif /* EMU_OS_H_ */
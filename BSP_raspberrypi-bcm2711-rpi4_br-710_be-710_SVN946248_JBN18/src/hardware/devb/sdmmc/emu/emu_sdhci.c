@@ -0,0 +1,757 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * An SDHCI v3 host controller in front of the card model.
+ *
+ * The controller works on its own timeline: when the driver writes the
+ * command register the whole command is played out against the card at
+ * once, bus time for the command, the card's access and busy times and the
+ * data blocks at the programmed clock and bus width, and what the driver
+ * would see is queued as events at the times it would happen (interrupt
+ * status bits and present state changes). Register reads apply whatever
+ * is due first, a worker thread applies the rest so interrupts arrive on
+ * time without the driver polling.
+ *
+ * ADMA2 descriptors are walked in host memory, the driver's physical
+ * addresses are its virtual ones here. PIO covers tuning and anything else
+ * issued without a scatter/gather list.
+ */
+
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <internal.h>
+#include <sdhci.h>
+#include "emu_os.h"
+#include "emu_sdhci.h"
+
+#undef pthread_t
+#undef pthread_create
+#undef pthread_join
+
+#define EV_MAX          8
+#define EV_CMD          0
+#define EV_DATA         1
+
+#define CMD_CLOCKS      (48 + 8)        // command and Ncr
+#define RSP_CLOCKS(_r)  ((_r) == 1 ? 136 : 48)
+#define CTO_CLOCKS      64
+#define BLK_CLOCKS      (16 + 2 + 2)    // CRC, start and end bits, Nac
+#define TUNE_BLOCKS     8               // tuning blocks before the sampling point is found
+#define SPIN_NS         100000
+#define ADMA_DESC_LIMIT 4096
+
+#define PSTATE_DATA     (SDHCI_PSTATE_DATI | SDHCI_PSTATE_DLA | SDHCI_PSTATE_RTA | \
+                         SDHCI_PSTATE_WTA | SDHCI_PSTATE_BRE | SDHCI_PSTATE_BWE)
+
+#define R(_hc, _off)    ((_hc)->regs[(_off) / 4])
+
+typedef struct emu_event_t
+{
+    uint64_t    t;
+    int         line;           // EV_CMD or EV_DATA, for the line resets
+    uint32_t    is;             // interrupt status set
+    uint32_t    clr;            // present state cleared
+    uint32_t    set;            // and set
+} emu_event_t;
+
+struct emu_sdhci
+{
+    emu_device_t        dev;
+    emu_card_t          *card;
+    emu_sdhci_cfg_t     cfg;
+    emu_sdhci_stats_t   stats;
+
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+    pthread_t           tid;
+    int                 stop;
+
+    uint32_t            regs[SDHCI_SIZE / 4 / 16];      // up to the capabilities, the rest reads 0
+    uint32_t            is;
+    uint32_t            pstate;
+    int                 irq;
+    emu_event_t         ev[EV_MAX];
+    int                 nev;
+
+        // PIO transfer in progress
+    uint8_t             *pio;
+    uint32_t            pio_len;
+    uint32_t            pio_pos;
+    uint32_t            pio_size;
+    uint32_t            pio_cmd;
+    uint32_t            pio_blks;
+    uint32_t            pio_blksz;
+    uint64_t            pio_end;
+    int                 tune_blocks;
+};
+
+static void sdhci_irq(emu_sdhci_t *hc)
+{
+    int level = (hc->is & R(hc, SDHCI_ISE)) != 0;
+
+    if (level != hc->irq) {
+        hc->irq = level;
+        hc->stats.irqs += level;
+        emu_irq_set(EMU_SDHCI_IRQ, level);
+    }
+}
+
+static void sdhci_event(emu_sdhci_t *hc, uint64_t t, int line, uint32_t is, uint32_t clr, uint32_t set)
+{
+    emu_event_t *ev;
+
+    if (hc->nev == EV_MAX) {
+        emu_fatal("sdhci: event queue full");
+    }
+    ev = &hc->ev[hc->nev++];
+    ev->t = t;
+    ev->line = line;
+    ev->is = is;
+    ev->clr = clr;
+    ev->set = set;
+    pthread_cond_signal(&hc->cond);
+}
+
+/* Applies the events due by now, in time order */
+static void sdhci_advance(emu_sdhci_t *hc, uint64_t now)
+{
+    emu_event_t ev;
+    uint32_t bits;
+    int i, first;
+
+    while (hc->nev) {
+        for (i = 1, first = 0; i < hc->nev; i++) {
+            if (hc->ev[i].t < hc->ev[first].t) {
+                first = i;
+            }
+        }
+        if (hc->ev[first].t > now) {
+            break;
+        }
+        ev = hc->ev[first];
+        hc->ev[first] = hc->ev[--hc->nev];
+
+            // status is only latched for the sources enabled in IE
+        bits = ev.is & R(hc, SDHCI_IE);
+        if (bits & SDHCI_INTR_ERR_MSK) {
+            bits |= SDHCI_INTR_ERRI;
+        }
+        hc->is |= bits;
+        hc->pstate = (hc->pstate & ~ev.clr) | ev.set;
+    }
+    sdhci_irq(hc);
+}
+
+static void sdhci_cancel(emu_sdhci_t *hc, int line)
+{
+    int i;
+
+    for (i = 0; i < hc->nev; ) {
+        if (hc->ev[i].line == line) {
+            hc->ev[i] = hc->ev[--hc->nev];
+        } else {
+            i++;
+        }
+    }
+}
+
+static uint32_t sdhci_cap(emu_sdhci_t *hc)
+{
+    return 1 | 0x80 |                               // 1MHz timeout clock
+           ((hc->cfg.base_mhz & 0xff) << 8) |
+           SDHCI_CAP_ADMA2 | SDHCI_CAP_HS | SDHCI_CAP_DMA |
+           SDHCI_CAP_S33 | SDHCI_CAP_S18 | SDHCI_CAP_64BIT_ADDR |
+           (hc->cfg.embedded ? SDHCI_CAP_CS_EMBEDDED : SDHCI_CAP_CS_RMB);
+}
+
+static uint32_t sdhci_clk(emu_sdhci_t *hc)
+{
+    uint32_t sysctl = R(hc, SDHCI_SYSCTL);
+    uint32_t div;
+
+    if (!(sysctl & SDHCI_SYSCTL_CEN)) {
+        return 0;
+    }
+    div = ((sysctl >> 8) & 0xff) | (((sysctl >> 6) & 0x3) << 8);
+    return div ? hc->cfg.base_mhz * 1000000 / (div * 2) : hc->cfg.base_mhz * 1000000;
+}
+
+static uint64_t sdhci_bus_ns(emu_sdhci_t *hc, uint64_t clocks)
+{
+    uint64_t clk;
+
+    if (hc->cfg.no_bus_time) {
+        return 0;
+    }
+    if ((clk = sdhci_clk(hc)) == 0) {
+        clk = SDIO_CLK_INIT;                        // driver bug, but keep going
+    }
+    return clocks * 1000000000ULL / clk;
+}
+
+static uint64_t sdhci_blk_ns(emu_sdhci_t *hc, uint32_t blksz)
+{
+    uint32_t hctl = R(hc, SDHCI_HCTL);
+    unsigned mode = (R(hc, SDHCI_AC12) >> 16) & SDHCI_HCTL2_MODE_MSK;
+    uint64_t clocks;
+    int width;
+
+    width = (hctl & SDHCI_HCTL_BW8) ? 8 : (hctl & SDHCI_HCTL_DTW4) ? 4 : 1;
+    clocks = (uint64_t) blksz * 8 / width;
+    if (mode == SDHCI_HCTL2_MODE_DDR50 || mode == SDHCI_HCTL2_MODE_HS400) {
+        clocks /= 2;
+    }
+    return sdhci_bus_ns(hc, clocks + BLK_CLOCKS);
+}
+
+/* Data and busy timeout, TMCLK x 2^(13 + DTOC) */
+static uint64_t sdhci_timeout_ns(emu_sdhci_t *hc)
+{
+    uint32_t dtoc = (R(hc, SDHCI_SYSCTL) >> 16) & 0xf;
+
+    return (1ULL << (13 + dtoc)) * 1000;            // 1MHz
+}
+
+/* End of the data blocks at t: auto CMD12, card busy, then transfer complete */
+static void sdhci_data_end(emu_sdhci_t *hc, uint64_t t, uint32_t cmd)
+{
+    emu_card_rsp_t rsp;
+    uint64_t busy;
+    int tuning;
+
+    busy = emu_card_data_end(hc->card, t);
+    tuning = (R(hc, SDHCI_AC12) >> 16) & SDHCI_HCTL2_EXEC_TUNING;
+    if ((cmd & SDHCI_CMD_ACMD12) && (cmd & SDHCI_CMD_MBS)) {
+        t += sdhci_bus_ns(hc, CMD_CLOCKS + RSP_CLOCKS(2));
+        if (!emu_card_cmd(hc->card, t, MMC_STOP_TRANSMISSION, 0, &rsp)) {
+            sdhci_event(hc, t, EV_DATA, SDHCI_INTR_ACE, 0, 0);
+            return;
+        }
+        R(hc, SDHCI_RESP3) = rsp.rsp[0];
+        busy = max(busy, rsp.busy_ns);
+    }
+    hc->stats.bus_ns += busy;
+    if (tuning) {                                   // only buffer read ready while tuning
+        sdhci_event(hc, t, EV_DATA, 0, PSTATE_DATA, 0);
+        return;
+    }
+    sdhci_event(hc, t + busy, EV_DATA, SDHCI_INTR_TC, PSTATE_DATA, 0);
+}
+
+/*
+ * Moves the data of a transfer through the ADMA2 descriptors, 0 or the error
+ * status. *int_bytes is how far into the data the last descriptor with the
+ * Int attribute ends, 0 if none had it.
+ */
+static uint32_t sdhci_adma(emu_sdhci_t *hc, int read, uint32_t bytes, uint32_t *int_bytes)
+{
+    uint32_t total = bytes;
+    uint8_t *desc;
+    uint64_t addr, daddr;
+    uint32_t len, n;
+    uint16_t attr;
+    int adma64, i;
+
+    adma64 = (R(hc, SDHCI_HCTL) & SDHCI_HCTL_DMA_MSK) == SDHCI_HCTL_ADMA64;
+    addr = R(hc, SDHCI_ADMA_ADDRL);
+    if (adma64) {
+        addr |= (uint64_t) R(hc, SDHCI_ADMA_ADDRH) << 32;
+    }
+
+    for (i = 0; i < ADMA_DESC_LIMIT && bytes; i++) {
+        desc = (uint8_t *) (uintptr_t) addr;
+        attr = *(uint16_t *) desc;
+        len = *(uint16_t *) (desc + 2);
+        daddr = *(uint32_t *) (desc + 4);
+        if (adma64) {
+            daddr |= (uint64_t) *(uint32_t *) (desc + 8) << 32;
+        }
+        hc->stats.adma_descs++;
+        if (!(attr & SDHCI_ADMA2_VALID)) {
+            break;
+        }
+        switch (attr & (3 << 4)) {
+            case SDHCI_ADMA2_LINK:
+                addr = daddr;
+                continue;
+
+            case SDHCI_ADMA2_TRAN:
+                n = min(len ? len : 65536, bytes);
+                if (read ? emu_card_read(hc->card, (void *) (uintptr_t) daddr, n) :
+                        emu_card_write(hc->card, (void *) (uintptr_t) daddr, n)) {
+                    return SDHCI_INTR_DTO;
+                }
+                bytes -= n;
+                if (attr & SDHCI_ADMA2_INT) {
+                    *int_bytes = total - bytes;
+                }
+                break;
+        }
+        if (attr & SDHCI_ADMA2_END) {
+            break;
+        }
+        addr += adma64 ? sizeof(sdhci_adma64_t) : sizeof(sdhci_adma32_t);
+    }
+    if (bytes) {
+        R(hc, SDHCI_ADMA_ES) = 1;                   // ST_FDS, descriptor fetch
+        return SDHCI_INTR_ADMAE;
+    }
+    return 0;
+}
+
+static void sdhci_command(emu_sdhci_t *hc)
+{
+    emu_card_rsp_t rsp;
+    uint32_t cmd, arg, blksz, blks, err, int_bytes = 0;
+    uint64_t t, t_rsp, t_data, to;
+    unsigned op, rtype;
+    int i, read;
+
+    cmd = R(hc, SDHCI_CMD);
+    arg = R(hc, SDHCI_ARG);
+    op = (cmd >> 24) & 0x3f;
+    rtype = (cmd >> 16) & 0x3;
+    t = emu_now_ns();
+    hc->stats.cmds++;
+
+    hc->pstate |= SDHCI_PSTATE_CMDI;
+    if ((cmd & SDHCI_CMD_DP) || rtype == 3) {
+        hc->pstate |= SDHCI_PSTATE_DATI | SDHCI_PSTATE_DLA;
+    }
+
+    if ((cmd & SDHCI_CMD_DP) && (cmd & SDHCI_CMD_ACMD23)) {
+        t += sdhci_bus_ns(hc, CMD_CLOCKS + RSP_CLOCKS(2));
+        if (!emu_card_cmd(hc->card, t, MMC_SET_BLOCK_COUNT, R(hc, SDHCI_SDMA_ARG2), &rsp)) {
+            sdhci_event(hc, t, EV_CMD, SDHCI_INTR_ACE, SDHCI_PSTATE_CMDI, 0);
+            return;
+        }
+    }
+
+    if (!emu_card_cmd(hc->card, t, op, arg, &rsp)) {
+        if (rtype == 0) {
+            t += sdhci_bus_ns(hc, CMD_CLOCKS);
+            sdhci_event(hc, t, EV_CMD, SDHCI_INTR_CC, SDHCI_PSTATE_CMDI, 0);
+        } else {
+            t += sdhci_bus_ns(hc, CMD_CLOCKS + CTO_CLOCKS);
+            sdhci_event(hc, t, EV_CMD, SDHCI_INTR_CTO, SDHCI_PSTATE_CMDI, 0);
+        }
+        return;
+    }
+
+        // R2 is stored without the CRC byte, shifted down 8 bits
+    if (rtype == 1) {
+        for (i = 0; i < 4; i++) {
+            R(hc, SDHCI_RESP0 + i * 4) = (rsp.rsp[i] >> 8) | (i < 3 ? rsp.rsp[i + 1] << 24 : 0);
+        }
+    } else if (rtype) {
+        R(hc, SDHCI_RESP0) = rsp.rsp[0];
+    }
+    t_rsp = t + sdhci_bus_ns(hc, CMD_CLOCKS + RSP_CLOCKS(rtype));
+    hc->stats.bus_ns += t_rsp - t;
+    sdhci_event(hc, t_rsp, EV_CMD, SDHCI_INTR_CC, SDHCI_PSTATE_CMDI, 0);
+
+    if (!(cmd & SDHCI_CMD_DP)) {
+        if (rtype == 3) {
+            to = sdhci_timeout_ns(hc);
+            if (rsp.busy_ns > to) {
+                sdhci_event(hc, t_rsp + to, EV_DATA, SDHCI_INTR_DTO, 0, 0);
+                sdhci_event(hc, t_rsp + rsp.busy_ns, EV_DATA, 0, PSTATE_DATA, 0);
+            } else {
+                sdhci_event(hc, t_rsp + rsp.busy_ns, EV_DATA, SDHCI_INTR_TC, PSTATE_DATA, 0);
+            }
+        }
+        return;
+    }
+
+    blksz = R(hc, SDHCI_BLK) & SDHCI_BLK_BLKSIZE_MASK;
+    blks = (cmd & SDHCI_CMD_MBS) && (cmd & SDHCI_CMD_BCE) ? R(hc, SDHCI_BLK) >> SDHCI_BLK_BLKCNT_SHIFT : 1;
+    read = !!(cmd & SDHCI_CMD_DDIR);
+    t_data = t_rsp + rsp.access_ns;
+
+    hc->pstate |= read ? SDHCI_PSTATE_RTA : SDHCI_PSTATE_WTA;
+    if (rsp.crc_err) {
+        sdhci_event(hc, t_data + sdhci_blk_ns(hc, blksz), EV_DATA, SDHCI_INTR_DCRC, 0, 0);
+        return;
+    }
+
+    if (cmd & SDHCI_CMD_DE) {
+        if ((R(hc, SDHCI_HCTL) & SDHCI_HCTL_DMA_MSK) == SDHCI_HCTL_SDMA) {
+            err = SDHCI_INTR_ADMAE;                 // no SDMA, CAP doesn't offer it
+        } else {
+            err = sdhci_adma(hc, read, blksz * blks, &int_bytes);
+        }
+        if (err) {
+            sdhci_event(hc, t_data, EV_DATA, err, 0, 0);
+            return;
+        }
+        if (int_bytes) {                            // DMA interrupt once that block is on the bus
+            sdhci_event(hc, t_data + (int_bytes + blksz - 1) / blksz * sdhci_blk_ns(hc, blksz), EV_DATA,
+                    SDHCI_INTR_DMA, 0, 0);
+        }
+        t_data += blks * sdhci_blk_ns(hc, blksz);
+        hc->stats.bus_ns += blks * sdhci_blk_ns(hc, blksz);
+        sdhci_data_end(hc, t_data, cmd);
+        return;
+    }
+
+    if (hc->pio_size < blksz * blks) {
+        if ((hc->pio = realloc(hc->pio, blksz * blks)) == NULL) {
+            emu_fatal("sdhci: no memory");
+        }
+        hc->pio_size = blksz * blks;
+    }
+    hc->pio_len = blksz * blks;
+    hc->pio_pos = 0;
+    hc->pio_cmd = cmd;
+    hc->pio_blks = blks;
+    hc->pio_blksz = blksz;
+    if (read) {
+        if (emu_card_read(hc->card, hc->pio, hc->pio_len)) {
+            sdhci_event(hc, t_data, EV_DATA, SDHCI_INTR_DTO, 0, 0);
+            return;
+        }
+        hc->pio_end = t_data + blks * sdhci_blk_ns(hc, blksz);
+        sdhci_event(hc, t_data + sdhci_blk_ns(hc, blksz), EV_DATA, SDHCI_INTR_BRR, 0, SDHCI_PSTATE_BRE);
+    } else {
+        sdhci_event(hc, t_rsp, EV_DATA, SDHCI_INTR_BWR, 0, SDHCI_PSTATE_BWE);
+    }
+}
+
+static uint32_t sdhci_pio_read(emu_sdhci_t *hc, uint64_t now)
+{
+    uint32_t val;
+    uint16_t hctl2;
+
+    if (!(hc->pstate & SDHCI_PSTATE_BRE)) {
+        return 0;
+    }
+    memcpy(&val, hc->pio + hc->pio_pos, sizeof(val));
+    hc->stats.pio_words++;
+    if ((hc->pio_pos += sizeof(val)) < hc->pio_len) {
+        return val;
+    }
+
+    hc->pstate &= ~SDHCI_PSTATE_BRE;
+    hctl2 = R(hc, SDHCI_AC12) >> 16;
+    if (hctl2 & SDHCI_HCTL2_EXEC_TUNING) {
+        if (++hc->tune_blocks >= TUNE_BLOCKS &&
+                !(hc->cfg.tune_fail && SDHCI_HCTL2_MODE(hctl2) == SDHCI_HCTL2_MODE_SDR104)) {
+            hctl2 = (hctl2 & ~SDHCI_HCTL2_EXEC_TUNING) | SDHCI_HCTL2_TUNED_CLK;
+            R(hc, SDHCI_AC12) = (R(hc, SDHCI_AC12) & 0xffff) | ((uint32_t) hctl2 << 16);
+        }
+    }
+    sdhci_data_end(hc, max(now, hc->pio_end), hc->pio_cmd);
+    return val;
+}
+
+static void sdhci_pio_write(emu_sdhci_t *hc, uint64_t now, uint32_t val)
+{
+    if (!(hc->pstate & SDHCI_PSTATE_BWE)) {
+        return;
+    }
+    memcpy(hc->pio + hc->pio_pos, &val, sizeof(val));
+    hc->stats.pio_words++;
+    if ((hc->pio_pos += sizeof(val)) < hc->pio_len) {
+        return;
+    }
+
+    hc->pstate &= ~SDHCI_PSTATE_BWE;
+    if (emu_card_write(hc->card, hc->pio, hc->pio_len)) {
+        sdhci_event(hc, now, EV_DATA, SDHCI_INTR_DTO, 0, 0);
+        return;
+    }
+    sdhci_data_end(hc, now + hc->pio_blks * sdhci_blk_ns(hc, hc->pio_blksz), hc->pio_cmd);
+}
+
+static void sdhci_reset(emu_sdhci_t *hc, uint32_t rst)
+{
+    if (rst & (SDHCI_SYSCTL_SRA | SDHCI_SYSCTL_SRC)) {
+        sdhci_cancel(hc, EV_CMD);
+        hc->pstate &= ~SDHCI_PSTATE_CMDI;
+        hc->is &= ~(SDHCI_INTR_CC | SDHCI_INTR_CTO | SDHCI_INTR_CCRC | SDHCI_INTR_CEB | SDHCI_INTR_CIE);
+    }
+    if (rst & (SDHCI_SYSCTL_SRA | SDHCI_SYSCTL_SRD)) {
+        sdhci_cancel(hc, EV_DATA);
+        hc->pstate &= ~PSTATE_DATA;
+        hc->pio_len = 0;
+        hc->is &= ~(SDHCI_INTR_TC | SDHCI_INTR_DMA | SDHCI_INTR_BRR | SDHCI_INTR_BWR |
+                    SDHCI_INTR_DTO | SDHCI_INTR_DCRC | SDHCI_INTR_DEB | SDHCI_INTR_ADMAE | SDHCI_INTR_ACE);
+    }
+    if (rst & SDHCI_SYSCTL_SRA) {
+        memset(hc->regs, 0, sizeof(hc->regs));
+        hc->is = 0;
+        emu_card_power(hc->card, 0);
+    }
+    if (!(hc->is & SDHCI_INTR_ERR_MSK)) {
+        hc->is &= ~SDHCI_INTR_ERRI;
+    }
+}
+
+static uint32_t sdhci_read32(emu_sdhci_t *hc, unsigned off, uint64_t now)
+{
+    uint32_t dat;
+
+    switch (off) {
+        case SDHCI_DATA:
+            return sdhci_pio_read(hc, now);
+
+        case SDHCI_PSTATE:
+            dat = emu_card_dat(hc->card, now, (R(hc, SDHCI_AC12) >> 16) & SDHCI_HCTL2_SIG_1_8V, sdhci_clk(hc) != 0);
+            return hc->pstate | SDHCI_CARD_STABLE | SDHCI_PSTATE_WP |
+                   SDHCI_PSTATE_CLSL_MSK | (dat << 20);
+
+        case SDHCI_IS:
+            return hc->is;
+
+        case SDHCI_CAP:
+            return sdhci_cap(hc);
+
+        case SDHCI_CAP2:
+            return hc->cfg.uhs ? (SDHCI_CAP_SDR50 | SDHCI_CAP_SDR104 | SDHCI_CAP_DDR50) : 0;
+
+        case SDHCI_MCCAP:
+            return (200 / SDHCI_MCCAP_MULT) << 16 | (200 / SDHCI_MCCAP_MULT);
+
+        case SDHCI_SLOT_IS:
+            return (SDHCI_SPEC_VER_3 << 16) | hc->irq;
+    }
+    return off / 4 < sizeof(hc->regs) / 4 ? hc->regs[off / 4] : 0;
+}
+
+static void sdhci_write32(emu_sdhci_t *hc, unsigned off, uint32_t val, uint32_t mask, uint64_t now)
+{
+    uint32_t old;
+
+    if (off / 4 >= sizeof(hc->regs) / 4) {
+        return;
+    }
+    old = hc->regs[off / 4];
+    switch (off) {
+        case SDHCI_DATA:
+            sdhci_pio_write(hc, now, val);
+            return;
+
+        case SDHCI_PSTATE:
+        case SDHCI_RESP0:
+        case SDHCI_RESP1:
+        case SDHCI_RESP2:
+        case SDHCI_RESP3:
+            return;
+
+        case SDHCI_IS:
+            hc->is &= ~(val & mask);
+            if (!(hc->is & SDHCI_INTR_ERR_MSK)) {
+                hc->is &= ~SDHCI_INTR_ERRI;
+            }
+            return;
+
+        case SDHCI_AC12:
+            mask &= 0xffff0000;                     // auto CMD12 status is read only
+            break;
+    }
+    hc->regs[off / 4] = (old & ~mask) | (val & mask);
+
+    switch (off) {
+        case SDHCI_CMD:
+            if (mask & 0xffff0000) {
+                sdhci_command(hc);
+            }
+            break;
+
+        case SDHCI_HCTL:
+            if ((old ^ hc->regs[off / 4]) & SDHCI_HCTL_SDBP) {
+                emu_card_power(hc->card, !!(hc->regs[off / 4] & SDHCI_HCTL_SDBP));
+            }
+            break;
+
+        case SDHCI_SYSCTL:
+            sdhci_reset(hc, val & mask & (SDHCI_SYSCTL_SRA | SDHCI_SYSCTL_SRC | SDHCI_SYSCTL_SRD));
+            R(hc, SDHCI_SYSCTL) &= ~(SDHCI_SYSCTL_SRA | SDHCI_SYSCTL_SRC | SDHCI_SYSCTL_SRD | SDHCI_SYSCTL_ICS);
+            if (R(hc, SDHCI_SYSCTL) & SDHCI_SYSCTL_ICE) {
+                R(hc, SDHCI_SYSCTL) |= SDHCI_SYSCTL_ICS;
+            }
+            break;
+
+        case SDHCI_IE:
+            hc->is &= hc->regs[off / 4];
+            if (!(hc->is & SDHCI_INTR_ERR_MSK)) {
+                hc->is &= ~SDHCI_INTR_ERRI;
+            }
+            break;
+
+        case SDHCI_AC12:
+            if (!(old & (SDHCI_HCTL2_EXEC_TUNING << 16)) && (val & mask & (SDHCI_HCTL2_EXEC_TUNING << 16))) {
+                hc->tune_blocks = 0;
+            }
+            break;
+    }
+}
+
+static uint32_t sdhci_read(void *ctx, unsigned off, unsigned width)
+{
+    emu_sdhci_t *hc = ctx;
+    uint64_t now = emu_now_ns();
+    uint32_t val;
+
+    pthread_mutex_lock(&hc->mutex);
+    sdhci_advance(hc, now);
+    val = sdhci_read32(hc, off & ~3, now) >> ((off & 3) * 8);
+    sdhci_advance(hc, now);
+    pthread_mutex_unlock(&hc->mutex);
+    return width == 4 ? val : val & ((1u << (width * 8)) - 1);
+}
+
+static void sdhci_write(void *ctx, unsigned off, unsigned width, uint32_t val)
+{
+    emu_sdhci_t *hc = ctx;
+    uint64_t now = emu_now_ns();
+    uint32_t mask;
+
+    mask = width == 4 ? ~0u : ((1u << (width * 8)) - 1) << ((off & 3) * 8);
+    pthread_mutex_lock(&hc->mutex);
+    sdhci_advance(hc, now);
+    sdhci_write32(hc, off & ~3, val << ((off & 3) * 8), mask, now);
+    sdhci_advance(hc, now);
+    pthread_mutex_unlock(&hc->mutex);
+}
+
+/*
+ * Applies events when they fall due. Sleeps until shortly before the next
+ * one and spins the rest, a late interrupt costs as much as a slow card.
+ */
+static void *sdhci_worker(void *arg)
+{
+    emu_sdhci_t *hc = arg;
+    struct timespec ts;
+    uint64_t now, next;
+    int i;
+
+    prctl(PR_SET_TIMERSLACK, 1UL);
+    pthread_mutex_lock(&hc->mutex);
+    while (!hc->stop) {
+        now = emu_now_ns();
+        sdhci_advance(hc, now);
+        if (hc->nev == 0) {
+            pthread_cond_wait(&hc->cond, &hc->mutex);
+            continue;
+        }
+        for (i = 1, next = hc->ev[0].t; i < hc->nev; i++) {
+            next = min(next, hc->ev[i].t);
+        }
+        if (next > now + SPIN_NS) {
+            nsec2timespec(&ts, next - SPIN_NS);
+            pthread_cond_timedwait(&hc->cond, &hc->mutex, &ts);
+        } else {
+            pthread_mutex_unlock(&hc->mutex);
+            emu_sleep_until(next);
+            pthread_mutex_lock(&hc->mutex);
+        }
+    }
+    pthread_mutex_unlock(&hc->mutex);
+    return NULL;
+}
+
+emu_sdhci_t *emu_sdhci_create(emu_card_t *card, const emu_sdhci_cfg_t *cfg)
+{
+    pthread_condattr_t attr;
+    emu_sdhci_t *hc;
+
+    if ((hc = calloc(1, sizeof(*hc))) == NULL) {
+        return NULL;
+    }
+    hc->card = card;
+    hc->cfg = *cfg;
+    if (hc->cfg.base_mhz == 0) {
+        hc->cfg.base_mhz = 100;
+    }
+    pthread_mutex_init(&hc->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&hc->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&hc->tid, NULL, sdhci_worker, hc) != 0) {
+        free(hc);
+        return NULL;
+    }
+
+    hc->dev.name = "sdhci";
+    hc->dev.base = EMU_SDHCI_BASE;
+    hc->dev.size = SDHCI_SIZE;
+    hc->dev.read = sdhci_read;
+    hc->dev.write = sdhci_write;
+    hc->dev.ctx = hc;
+    emu_device_add(&hc->dev);
+    return hc;
+}
+
+void emu_sdhci_destroy(emu_sdhci_t *hc)
+{
+    emu_device_remove(&hc->dev);
+    pthread_mutex_lock(&hc->mutex);
+    hc->stop = 1;
+    pthread_cond_signal(&hc->cond);
+    pthread_mutex_unlock(&hc->mutex);
+    pthread_join(hc->tid, NULL);
+    emu_irq_set(EMU_SDHCI_IRQ, 0);
+    free(hc->pio);
+    free(hc);
+}
+
+void emu_sdhci_stats(emu_sdhci_t *hc, emu_sdhci_stats_t *stats)
+{
+    pthread_mutex_lock(&hc->mutex);
+    *stats = hc->stats;
+    pthread_mutex_unlock(&hc->mutex);
+}
+
+/*
+ * SOC glue. The target's sdio_soc_scan() and sdio_soc_device() come from
+ * the HWI tables, the emulated board has the one controller above.
+ */
+int sdio_soc_scan(void)
+{
+    sdio_hc_t *hc;
+
+    if ((hc = sdio_hc_alloc()) == NULL) {
+        return ENOMEM;
+    }
+    return sdio_soc_device(hc);
+}
+
+int sdio_soc_device(sdio_hc_t *hc)
+{
+    sdio_hc_cfg_t *cfg = &hc->cfg;
+
+    if (cfg->name[0] == '\0') {
+        strlcpy(cfg->name, "bcm2711", sizeof(cfg->name));
+    }
+    if (cfg->base_addrs == 0) {
+        cfg->base_addr[0] = EMU_SDHCI_BASE;
+        cfg->base_addr_size[0] = SDHCI_SIZE;
+        cfg->base_addrs = 1;
+    }
+    if (cfg->irqs == 0) {
+        cfg->irq[0] = EMU_SDHCI_IRQ;
+        cfg->irqs = 1;
+    }
+    return EOK;
+}
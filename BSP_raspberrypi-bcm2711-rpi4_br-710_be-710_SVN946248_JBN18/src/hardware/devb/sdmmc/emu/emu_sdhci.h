@@ -0,0 +1,59 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/* An SDHCI v3 controller with ADMA2 in front of an emu_card_t */
+
+#ifndef EMU_SDHCI_H_
+#define EMU_SDHCI_H_
+
+#include <stdint.h>
+#include "emu_card.h"
+
+#define EMU_SDHCI_BASE      0xfe340000
+#define EMU_SDHCI_IRQ       158
+
+typedef struct emu_sdhci_cfg_t
+{
+    uint32_t    base_mhz;       /* SD base clock */
+    int         embedded;       /* slot type in CAP, eMMC */
+    int         uhs;            /* SDR50, SDR104 and DDR50 in CAP2 */
+    int         no_bus_time;    /* commands and data take no time on the bus */
+    int         tune_fail;      /* tuning never finds a sampling point in SDR104 */
+} emu_sdhci_cfg_t;
+
+typedef struct emu_sdhci_stats_t
+{
+    uint64_t    cmds;
+    uint64_t    adma_descs;
+    uint64_t    pio_words;
+    uint64_t    irqs;           /* rising edges of the interrupt line */
+    uint64_t    bus_ns;         /* time the command and data lines were busy */
+} emu_sdhci_stats_t;
+
+typedef struct emu_sdhci emu_sdhci_t;
+
+/* Registers the controller at EMU_SDHCI_BASE, interrupting on EMU_SDHCI_IRQ */
+emu_sdhci_t *emu_sdhci_create(emu_card_t *card, const emu_sdhci_cfg_t *cfg);
+void emu_sdhci_destroy(emu_sdhci_t *hc);
+
+void emu_sdhci_stats(emu_sdhci_t *hc, emu_sdhci_stats_t *stats);
+
+#endif /* EMU_SDHCI_H_ */
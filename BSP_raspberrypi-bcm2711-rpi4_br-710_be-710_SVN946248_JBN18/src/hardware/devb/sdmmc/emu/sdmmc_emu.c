@@ -0,0 +1,1234 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * Host harness for devb-sdmmc. The SIM and sdiodi run unchanged on Linux,
+ * over the SDHCI model in emu_sdhci.c and the card in emu_card.c, with the
+ * kernel calls from emu_os.c and libcam from emu_cam.c. Where io-blk would
+ * serve requests the harness drives the SIM with SCSI read and write ccbs,
+ * and data set management (TRIM) devctls, through its sim_action entry, as
+ * many outstanding as the queue depth. The bcm2711 bs switches the SD I/O
+ * supply through the firmware mailbox in emu_mbox.c.
+ *
+ *   sdmmc-emu check        run the built-in correctness scenarios
+ *   sdmmc-emu bench        throughput and IOPS over card types and workloads
+ *   sdmmc-emu [options]    one run, see usage()
+ *
+ * Every sector written carries its LBA and a generation number, reads are
+ * checked against what was last written and at the end the card's media is
+ * compared with the harness's view, so misdirected or lost writes show up
+ * even when they read back consistently. A trimmed sector may read back
+ * either what it held or zeros, until it is written again.
+ *
+ * The driver keeps state in statics, each run is a forked child.
+ */
+
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <ntocam.h>
+#include <sim.h>
+#include <ntoscsi.h>
+#include <hw/dcmd_sim_sdmmc.h>
+#include "emu_os.h"
+#include "emu_cam.h"
+#include "emu_card.h"
+#include "emu_sdhci.h"
+#include "emu_mbox.h"
+
+#define EMU_SECTOR      512
+#define EMU_QD_MAX      32
+#define EMU_IO_MAX      (512 * 1024)
+#define EMU_RETRIES     3
+#define EMU_BENCH_RUNS  3           // best of, per bench configuration
+#define EMU_WATCHDOG    120         // seconds per run
+#define EMU_READY_MS    5000        // for the card to be identified
+#define EMU_IDLE_MS     500         // past the driver's idle time, before the final verify
+#define EMU_VSEL_GPIO   132         // SD_VDDIO on the firmware's expander
+#define EMU_CMDQ_DEPTH  32          // eMMC command queue tasks
+#define EMU_PACKED_WR   63          // eMMC writes in a packed write
+
+enum { EMU_READ, EMU_WRITE, EMU_TRIM };
+enum { EMU_MERGE_OFF, EMU_MERGE_ON, EMU_MERGE_PACKED };
+
+typedef struct emu_cfg_t
+{
+    const char  *name;
+    int         emmc;
+    int         uhs;
+    int         no_cmd23;           // SD card without CMD23
+    uint32_t    sectors;            // card size
+    uint32_t    span;               // sectors the workload covers, from 0
+    unsigned    ios;
+    unsigned    size;               // bytes per io, 0 mixes sizes
+    unsigned    qd;
+    unsigned    writes;             // percent
+    unsigned    trims;              // percent
+    uint32_t    trim_blks;          // sectors per TRIM
+    int         deferred;           // sdmmc discard=on
+    int         cmdq;               // sdmmc cmdq=on
+    int         merge;              // EMU_MERGE_*, sdmmc merge=on or merge=packed
+    unsigned    readahead;          // KB, sdmmc readahead=
+    int         stats;              // sdmmc stats=on
+    int         phys;               // sdmmc phys=on
+    int         random;
+    int         verify;
+    int         fast;               // no bus time, no card latency
+    uint32_t    read_ns;
+    uint32_t    write_ns;
+    uint32_t    write_blk_ns;
+    uint32_t    erase_ns;
+    uint32_t    erase_blk_ns;
+    uint32_t    err_every;
+    uint32_t    stall_every;
+    uint32_t    stall_ns;
+    uint32_t    base_mhz;           // SD base clock
+    int         tune_fail;          // tuning fails in SDR104
+    int         reset;              // pause and run the driver, which resets the card, then more ios
+    uint32_t    timing;             // TIMING_xxx the card must end up at, 0 any
+    const char  *opts;              // more sdmmc options
+    const char  *hcopts;            // more sdio options
+} emu_cfg_t;
+
+typedef struct emu_res_t
+{
+    unsigned            fails;
+    uint64_t            ios;
+    uint64_t            bytes;
+    uint64_t            ns;
+    uint64_t            retries;
+    uint64_t            rw;         // read and write ccbs submitted, all passes
+    uint64_t            cmd_rw;     // of them before the command statistics were read
+    uint64_t            mismatches;
+    uint64_t            trims;
+    uint64_t            max_ns;     // longest read or write
+    SDMMC_DISCARD_STATS discard;
+    SDMMC_DEVICE_INFO   dev;
+    SDMMC_CMD_STATS     cmd;
+    SDMMC_BUSY_STATS    busy;
+    SDMMC_RA_STATS      ra;
+    uint32_t            tune_fails; // before the reset
+    emu_card_stats_t    card;
+    emu_sdhci_stats_t   hc;
+    emu_mbox_stats_t    mbox;
+} emu_res_t;
+
+typedef struct emu_io_t
+{
+    union {
+        CCB_SCSIIO  ccb;
+        CCB_DEVCTL  dccb;
+    };
+    uint8_t     sense[32];
+    struct {
+        DATA_SET_MGNT       hdr;
+        DATA_SET_MGNT_RANGE range;
+    } dsm;
+    uint8_t     *buf;
+    uint32_t    lba;
+    uint32_t    blks;
+    int         op;
+    uint64_t    start;
+    int         busy;
+    int         done;
+    unsigned    tries;
+} emu_io_t;
+
+extern int sdmmc_main(int argc, char *argv[]);
+
+static const emu_cfg_t emu_defaults = {
+    .name = "run",
+    .sectors = 128 * 1024,          // 64MB
+    .span = 16 * 1024,
+    .ios = 2000,
+    .size = 4096,
+    .qd = 4,
+    .trim_blks = 2048,
+    .base_mhz = 100,
+    .verify = 1,
+};
+
+static const emu_cfg_t *emu_cfg;
+static emu_res_t emu_res;
+static emu_card_t *emu_card;
+static emu_sdhci_t *emu_hc;
+static emu_mbox_t *emu_mbox;
+static uint8_t *emu_gen;            // generation last written, per sector
+static uint8_t *emu_trimmed;        // trimmed since last written, per sector
+static unsigned emu_errors_shown;
+static int emu_phys;                // the SIM takes physical lists, half the ios send them
+
+static pthread_mutex_t emu_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t emu_cond = PTHREAD_COND_INITIALIZER;
+
+static int emu_check(int cond, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static int emu_check(int cond, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (!cond) {
+        fprintf(stderr, "%s: ", emu_cfg->name);
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fprintf(stderr, "\n");
+    }
+    return !cond;
+}
+
+static uint32_t emu_word(uint32_t lba, uint8_t gen, unsigned i)
+{
+    uint32_t x = lba * 0x9e3779b1u ^ (uint32_t) gen << 24 ^ i * 0x01000193u;
+
+    return x ^ (x >> 15);
+}
+
+static void emu_fill(uint8_t *buf, uint32_t lba, uint32_t blks, uint8_t gen)
+{
+    uint32_t *w = (uint32_t *) buf;
+    unsigned b, i;
+
+    for (b = 0; b < blks; b++, lba++) {
+        w[0] = lba;
+        for (i = 1; i < EMU_SECTOR / 4; i++) {
+            w[i] = emu_word(lba, gen, i);
+        }
+        w += EMU_SECTOR / 4;
+    }
+}
+
+static int emu_zero(const uint8_t *buf)
+{
+    unsigned i;
+
+    for (i = 0; i < EMU_SECTOR; i++) {
+        if (buf[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Compares sectors with what was last written there, never written reads as zeros */
+static unsigned emu_verify(const char *what, const uint8_t *buf, uint32_t lba, uint32_t blks)
+{
+    static uint8_t expect[EMU_SECTOR];
+    unsigned b, bad = 0;
+
+    for (b = 0; b < blks; b++, lba++, buf += EMU_SECTOR) {
+        if (emu_gen[lba]) {
+            emu_fill(expect, lba, 1, emu_gen[lba]);
+        } else {
+            memset(expect, 0, sizeof(expect));
+        }
+        if (memcmp(buf, expect, EMU_SECTOR) != 0 && !(emu_trimmed[lba] && emu_zero(buf))) {
+            if (emu_errors_shown++ < 5) {
+                fprintf(stderr, "%s: %s sector %u (gen %u) holds lba %u\n", emu_cfg->name, what, lba,
+                        emu_gen[lba], *(const uint32_t *) buf);
+            }
+            bad++;
+        }
+    }
+    return bad;
+}
+
+/* Called by the SIM on its own thread */
+static void emu_done(CCB_SCSIIO *ccb)
+{
+    emu_io_t *io = (emu_io_t *) ccb;
+
+    pthread_mutex_lock(&emu_mutex);
+    io->done = 1;
+    pthread_cond_broadcast(&emu_cond);
+    pthread_mutex_unlock(&emu_mutex);
+}
+
+static void emu_submit(CAM_SIM_ENTRY *entry, SIM_HBA *hba, emu_io_t *io, uint8_t op, uint32_t lba,
+        uint32_t blks, void *buf, uint32_t len)
+{
+    CCB_SCSIIO *ccb = &io->ccb;
+    uint8_t *cdb;
+
+    memset(ccb, 0, sizeof(*ccb));
+    ccb->cam_ch.cam_ccb_len = sizeof(*ccb);
+    ccb->cam_ch.cam_func_code = XPT_SCSI_IO;
+    ccb->cam_ch.cam_flags = len ? (op == SC_WRITE10 ? CAM_DIR_OUT : CAM_DIR_IN) : CAM_DIR_NONE;
+    ccb->cam_cbfcnp = emu_done;
+    ccb->cam_data.cam_data_ptr = (uintptr_t) buf;
+    ccb->cam_dxfer_len = len;
+    ccb->cam_sense_ptr = io->sense;
+    ccb->cam_sense_len = sizeof(io->sense);
+    ccb->cam_timeout = 10;
+    ccb->cam_cdb_len = 10;
+    if (emu_phys && len && (lba >> 3) & 1) {
+            // as io-blk's buffer pool, the rest stand for client buffers
+        ccb->cam_ch.cam_flags |= CAM_DATA_PHYS;
+        ccb->cam_data.cam_data_ptr = xpt_vtop(buf, NULL);
+    }
+    cdb = ccb->cam_cdb_io.cam_cdb_bytes;
+    cdb[0] = op;
+    cdb[2] = lba >> 24;
+    cdb[3] = lba >> 16;
+    cdb[4] = lba >> 8;
+    cdb[5] = lba;
+    cdb[7] = blks >> 8;
+    cdb[8] = blks;
+    io->done = 0;
+    if (entry->sim_action(hba, (CCB *) ccb) != CAM_SUCCESS) {
+        emu_done(ccb);
+    }
+}
+
+static void emu_devctl(CAM_SIM_ENTRY *entry, SIM_HBA *hba, emu_io_t *io, uint32_t dcmd, void *data, size_t size)
+{
+    CCB_DEVCTL *ccb = &io->dccb;
+
+    memset(ccb, 0, sizeof(*ccb));
+    ccb->cam_ch.cam_ccb_len = sizeof(*ccb);
+    ccb->cam_ch.cam_func_code = XPT_DEVCTL;
+    ccb->cam_cbfcnp = emu_done;
+    ccb->cam_devctl_dcmd = dcmd;
+    ccb->cam_devctl_data = data;
+    ccb->cam_devctl_size = size;
+    io->done = 0;
+    if (entry->sim_action(hba, (CCB *) ccb) != CAM_SUCCESS) {
+        emu_done((CCB_SCSIIO *) ccb);
+    }
+}
+
+static void emu_trim(CAM_SIM_ENTRY *entry, SIM_HBA *hba, emu_io_t *io)
+{
+    memset(&io->dsm, 0, sizeof(io->dsm));
+    io->dsm.hdr.opt = DSM_OPT_TRIM;
+    io->dsm.hdr.nranges = 1;
+    io->dsm.range.lba = io->lba;
+    io->dsm.range.nlba = io->blks;
+    emu_devctl(entry, hba, io, DCMD_CAM_DATA_SET_MGNT, &io->dsm, sizeof(io->dsm));
+}
+
+static int emu_ok(const emu_io_t *io)
+{
+    if ((io->ccb.cam_ch.cam_status & CAM_STATUS_MASK) != CAM_REQ_CMP) {
+        return 0;
+    }
+    return io->ccb.cam_ch.cam_func_code != XPT_DEVCTL || io->dccb.cam_devctl_status == EOK;
+}
+
+static int emu_wait(emu_io_t *io)
+{
+    pthread_mutex_lock(&emu_mutex);
+    while (!io->done) {
+        pthread_cond_wait(&emu_cond, &emu_mutex);
+    }
+    pthread_mutex_unlock(&emu_mutex);
+    return emu_ok(io);
+}
+
+static int emu_sync(CAM_SIM_ENTRY *entry, SIM_HBA *hba, uint8_t op, uint32_t lba, uint32_t blks, void *buf,
+        uint32_t len)
+{
+    static emu_io_t io;
+
+    emu_submit(entry, hba, &io, op, lba, blks, buf, len);
+    return emu_wait(&io);
+}
+
+static int emu_overlaps(const emu_io_t *ios, unsigned qd, uint32_t lba, uint32_t blks)
+{
+    unsigned i;
+
+    for (i = 0; i < qd; i++) {
+        if (ios[i].busy && lba < ios[i].lba + ios[i].blks && ios[i].lba < lba + blks) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Picks the next io for a free slot, returns 0 once the workload is issued */
+static int emu_next(emu_io_t *io, const emu_io_t *ios, unsigned qd, unsigned *issued, uint32_t *cursor,
+        unsigned ios_total, unsigned size, unsigned writes, unsigned trims, int random)
+{
+    uint32_t blks, span = emu_cfg->span;
+
+    if (*issued == ios_total) {
+        return 0;
+    }
+    if ((unsigned) (rand() % 100) < trims) {
+        io->op = EMU_TRIM;
+        blks = min(emu_cfg->trim_blks, span);
+    } else {
+        io->op = (unsigned) (rand() % 100) < writes ? EMU_WRITE : EMU_READ;
+        blks = (size ? size : (EMU_SECTOR << (rand() % 9))) / EMU_SECTOR;
+        blks = min(blks, span);
+    }
+    do {
+        if (random && io->op == EMU_TRIM) {     // not erase group aligned
+            io->lba = (rand() % ((span - blks) / 8 + 1)) * 8;
+        } else if (random) {
+            io->lba = (rand() % (span / blks)) * blks;
+        } else {
+            if (*cursor + blks > span) {
+                *cursor = 0;
+            }
+            io->lba = *cursor;
+        }
+    } while (random && emu_overlaps(ios, qd, io->lba, blks));
+    if (!random) {
+        *cursor += blks;
+    }
+    io->blks = blks;
+    io->tries = 0;
+    (*issued)++;
+    return 1;
+}
+
+static void emu_start(CAM_SIM_ENTRY *entry, SIM_HBA *hba, emu_io_t *io)
+{
+    uint32_t lba;
+
+    if (io->op == EMU_WRITE && io->tries == 0) {
+        for (lba = io->lba; lba < io->lba + io->blks; lba++) {
+            emu_gen[lba] = emu_gen[lba] % 255 + 1;
+            emu_trimmed[lba] = 0;
+            if (emu_cfg->verify) {
+                emu_fill(io->buf + (lba - io->lba) * EMU_SECTOR, lba, 1, emu_gen[lba]);
+            }
+        }
+    }
+    io->busy = 1;
+    io->start = emu_now_ns();
+    if (io->op == EMU_TRIM) {
+        memset(emu_trimmed + io->lba, 1, io->blks);
+        emu_trim(entry, hba, io);
+    } else {
+        emu_res.rw++;
+        emu_submit(entry, hba, io, io->op == EMU_WRITE ? SC_WRITE10 : SC_READ10, io->lba, io->blks, io->buf,
+                io->blks * EMU_SECTOR);
+    }
+}
+
+/*
+ * A workload of n ios, qd of them outstanding. A write bumps the
+ * generation of its sectors at submission, random ios never overlap
+ * one in flight so the expected contents are known at completion.
+ */
+static void emu_workload(CAM_SIM_ENTRY *entry, SIM_HBA *hba, unsigned n, unsigned size, unsigned qd,
+        unsigned writes, unsigned trims, int random, int timed)
+{
+    static const char *names[] = { "read", "write", "trim" };
+    static emu_io_t ios[EMU_QD_MAX];
+    unsigned i, issued = 0, busy = 0;
+    uint32_t cursor = 0;
+    uint64_t start, ns;
+    int ok;
+
+    for (i = 0; i < qd; i++) {
+        ios[i].busy = 0;
+        if (ios[i].buf == NULL && posix_memalign((void **) &ios[i].buf, 4096, EMU_IO_MAX) != 0) {
+            emu_fatal("no memory");
+        }
+    }
+    start = emu_now_ns();
+    for (i = 0; i < qd; i++) {
+        if (emu_next(&ios[i], ios, qd, &issued, &cursor, n, size, writes, trims, random)) {
+            emu_start(entry, hba, &ios[i]);
+            busy++;
+        }
+    }
+
+    pthread_mutex_lock(&emu_mutex);
+    while (busy) {
+        for (i = 0; i < qd; i++) {
+            if (ios[i].busy && ios[i].done) {
+                break;
+            }
+        }
+        if (i == qd) {
+            pthread_cond_wait(&emu_cond, &emu_mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&emu_mutex);
+
+        ok = emu_ok(&ios[i]);
+        ios[i].busy = 0;
+        if (!ok && ++ios[i].tries < EMU_RETRIES) {
+            emu_res.retries++;
+            emu_start(entry, hba, &ios[i]);
+        } else {
+            if (!ok) {
+                emu_res.fails += emu_check(0, "%s of %u sectors at %u failed, status %#x",
+                        names[ios[i].op], ios[i].blks, ios[i].lba, ios[i].ccb.cam_ch.cam_status);
+            } else if (ios[i].op == EMU_READ && emu_cfg->verify) {
+                emu_res.mismatches += emu_verify("read", ios[i].buf, ios[i].lba, ios[i].blks);
+            }
+            if (timed && ios[i].op == EMU_TRIM) {
+                emu_res.trims++;
+            } else if (timed) {
+                emu_res.ios++;
+                emu_res.bytes += ios[i].blks * EMU_SECTOR;
+                ns = emu_now_ns() - ios[i].start;
+                emu_res.max_ns = max(emu_res.max_ns, ns);
+            }
+            busy--;
+            if (emu_next(&ios[i], ios, qd, &issued, &cursor, n, size, writes, trims, random)) {
+                emu_start(entry, hba, &ios[i]);
+                busy++;
+            }
+        }
+        pthread_mutex_lock(&emu_mutex);
+    }
+    pthread_mutex_unlock(&emu_mutex);
+    if (timed) {
+        emu_res.ns = emu_now_ns() - start;
+    }
+}
+
+/* Stands in for io-blk once the SIM is attached */
+static int emu_io(void *arg)
+{
+    static emu_io_t io;
+    const emu_cfg_t *cfg = arg;
+    SDMMC_DRVR_STATE ds;
+    CCB_PATHINQ pinq;
+    CAM_SIM_ENTRY *entry;
+    SIM_HBA *hba;
+    uint8_t cap[8];
+    uint64_t end;
+    unsigned span_ios;
+    int ready = 0;
+
+    if (!emu_cam_path(0, &entry, &hba)) {
+        emu_res.fails += emu_check(0, "no SIM registered");
+        return 1;
+    }
+
+    end = emu_now_ns() + EMU_READY_MS * 1000000ULL;
+    while (!(ready = emu_sync(entry, hba, SC_UNIT_RDY, 0, 0, NULL, 0)) && emu_now_ns() < end) {
+        delay(10);
+    }
+    if (emu_check(ready, "card not ready")) {
+        emu_res.fails++;
+        return 1;
+    }
+
+    memset(cap, 0, sizeof(cap));
+    if (emu_check(emu_sync(entry, hba, SC_RD_CAP, 0, 0, cap, sizeof(cap)), "read capacity failed")) {
+        emu_res.fails++;
+        return 1;
+    }
+    emu_res.fails += emu_check(UNALIGNED_RET32(cap) == ENDIAN_BE32(cfg->sectors - 1) &&
+            UNALIGNED_RET32(cap + 4) == ENDIAN_BE32(EMU_SECTOR),
+            "capacity %u x %u, expected %u x %u", ENDIAN_BE32(UNALIGNED_RET32(cap)) + 1,
+            ENDIAN_BE32(UNALIGNED_RET32(cap + 4)), cfg->sectors, EMU_SECTOR);
+
+        // io-blk sends physical lists if the SIM takes them, not with read-ahead
+    memset(&pinq, 0, sizeof(pinq));
+    pinq.cam_ch.cam_ccb_len = sizeof(pinq);
+    pinq.cam_ch.cam_func_code = XPT_PATH_INQ;
+    emu_res.fails += emu_check(entry->sim_action(hba, (CCB *) &pinq) == CAM_SUCCESS, "path inquiry failed");
+    emu_phys = (pinq.cam_vuhba_flags[CAM_VUHBA_FLAGS] & CAM_VUHBA_FLAG_PHYS) != 0;
+    if (cfg->phys) {
+        emu_res.fails += emu_check(emu_phys == !cfg->readahead, "physical lists %s",
+                emu_phys ? "taken" : "not taken");
+    }
+
+        // known contents to read back
+    span_ios = (cfg->span * EMU_SECTOR + 65535) / 65536;
+    if (cfg->verify && (cfg->writes < 100 || cfg->random)) {
+        emu_workload(entry, hba, span_ios, 65536, 4, 100, 0, 0, 0);
+    }
+
+    emu_workload(entry, hba, cfg->ios, cfg->size, cfg->qd, cfg->writes, cfg->trims, cfg->random, 1);
+
+    if (cfg->trims) {
+        delay(EMU_IDLE_MS);         // deferred discards go out once idle
+        emu_devctl(entry, hba, &io, DCMD_SDMMC_DISCARD_STATS, &emu_res.discard, sizeof(emu_res.discard));
+        emu_res.fails += emu_check(emu_wait(&io), "discard statistics failed");
+    }
+
+    if (cfg->reset) {
+        emu_devctl(entry, hba, &io, DCMD_SDMMC_CMD_STATS, &emu_res.cmd, sizeof(emu_res.cmd));
+        emu_res.fails += emu_check(emu_wait(&io), "command statistics failed");
+        emu_res.tune_fails = emu_res.cmd.tune_fails;
+
+        memset(&ds, 0, sizeof(ds));
+        ds.state = SDMMC_DRVR_PAUSE;
+        emu_devctl(entry, hba, &io, DCMD_SDMMC_DRVR_STATE, &ds, sizeof(ds));
+        emu_res.fails += emu_check(emu_wait(&io), "pause failed");
+        ds.state = SDMMC_DRVR_RUN;
+        emu_devctl(entry, hba, &io, DCMD_SDMMC_DRVR_STATE, &ds, sizeof(ds));
+        emu_res.fails += emu_check(emu_wait(&io), "run failed");
+
+        emu_workload(entry, hba, cfg->ios, cfg->size, cfg->qd, cfg->writes, cfg->trims, cfg->random, 0);
+    }
+
+    memset(&emu_res.cmd, 0, sizeof(emu_res.cmd));
+    emu_devctl(entry, hba, &io, DCMD_SDMMC_CMD_STATS, &emu_res.cmd, sizeof(emu_res.cmd));
+    emu_res.fails += emu_check(emu_wait(&io), "command statistics failed");
+    emu_res.cmd_rw = emu_res.rw;
+    emu_devctl(entry, hba, &io, DCMD_SDMMC_DEVICE_INFO, &emu_res.dev, sizeof(emu_res.dev));
+    emu_res.fails += emu_check(emu_wait(&io), "device information failed");
+    memset(&emu_res.busy, 0, sizeof(emu_res.busy));
+    emu_devctl(entry, hba, &io, DCMD_SDMMC_BUSY_STATS, &emu_res.busy, sizeof(emu_res.busy));
+    emu_res.fails += emu_check(emu_wait(&io), "busy statistics failed");
+    memset(&emu_res.ra, 0, sizeof(emu_res.ra));
+    emu_devctl(entry, hba, &io, DCMD_SDMMC_RA_STATS, &emu_res.ra, sizeof(emu_res.ra));
+    emu_res.fails += emu_check(emu_wait(&io), "read-ahead statistics failed");
+
+    if (cfg->verify) {
+        emu_workload(entry, hba, span_ios, 65536, 4, 0, 0, 0, 0);
+        emu_res.mismatches += emu_verify("media", emu_card_media(emu_card), 0, cfg->span);
+    }
+    return 0;
+}
+
+static void emu_watchdog(int sig)
+{
+    static const char msg[] = "watchdog: run did not finish, driver or harness stuck?\n";
+
+    (void) sig;
+    if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0) {
+        // exiting anyway
+    }
+    _exit(1);
+}
+
+/* The board's SD_VDDIO, the card sees 1.8V I/O only once it is switched */
+static int emu_gpio(void *ctx, uint32_t gpio, uint32_t state)
+{
+    (void) ctx;
+    if (gpio != EMU_VSEL_GPIO) {
+        return 1;
+    }
+    emu_card_vio(emu_card, state != 0);
+    return 0;
+}
+
+/* Every read and write ccb charged a queue wait, busy goes with the data commands */
+static int emu_stats(const SDMMC_CMD_STATS *cs)
+{
+    uint64_t queued = 0, wr_busy = 0, stop_busy = 0;
+    uint32_t i;
+    int fails = 0;
+
+    for (i = 0; i < cs->nops && i < SDMMC_STATS_OPS; i++) {
+        const SDMMC_OP_STATS *op = &cs->ops[i];
+
+        switch (op->opcode) {
+        case 24: case 25:
+            wr_busy += op->lat[SDMMC_PHASE_BUSY].count;
+            // fall through
+        case 17: case 18: case 46: case 47:
+            queued += op->lat[SDMMC_PHASE_QUEUE].count;
+            break;
+        case 12:
+            stop_busy += op->lat[SDMMC_PHASE_BUSY].count;
+            break;
+        }
+    }
+    fails += emu_check(queued == emu_res.cmd_rw, "%llu queue waits for %llu reads and writes",
+            (unsigned long long) queued, (unsigned long long) emu_res.cmd_rw);
+    fails += emu_check(wr_busy != 0 || emu_cfg->cmdq, "no busy charged to writes");
+    fails += emu_check(stop_busy == 0, "%llu busy waits charged to CMD12", (unsigned long long) stop_busy);
+    return fails;
+}
+
+/* The child's side of a run */
+static void emu_child(const emu_cfg_t *cfg, int fd)
+{
+    char opts[256], hc[128], ra[32];
+    char *argv[8];
+    emu_card_cfg_t ccfg;
+    emu_sdhci_cfg_t hcfg;
+    emu_mbox_cfg_t mcfg;
+    int argc = 0, status;
+
+    signal(SIGALRM, emu_watchdog);
+    alarm(EMU_WATCHDOG);
+    emu_cfg = cfg;
+
+    memset(&ccfg, 0, sizeof(ccfg));
+    ccfg.type = cfg->emmc ? EMU_CARD_EMMC : EMU_CARD_SD;
+    ccfg.sectors = cfg->sectors;
+    ccfg.uhs = cfg->uhs;
+    ccfg.no_cmd23 = cfg->no_cmd23;
+    ccfg.err_every = cfg->err_every;
+    ccfg.cmdq_depth = cfg->emmc ? EMU_CMDQ_DEPTH : 0;
+    ccfg.packed_wr = cfg->emmc ? EMU_PACKED_WR : 0;
+    if (!cfg->fast) {
+        ccfg.read_ns = cfg->read_ns;
+        ccfg.write_ns = cfg->write_ns;
+        ccfg.write_blk_ns = cfg->write_blk_ns;
+        ccfg.erase_ns = cfg->erase_ns;
+        ccfg.erase_blk_ns = cfg->erase_blk_ns;
+        ccfg.switch_ns = 50000;
+        ccfg.stall_every = cfg->stall_every;
+        ccfg.stall_ns = cfg->stall_ns;
+    }
+    memset(&hcfg, 0, sizeof(hcfg));
+    hcfg.base_mhz = cfg->base_mhz;
+    hcfg.embedded = cfg->emmc;
+    hcfg.uhs = cfg->uhs;
+    hcfg.no_bus_time = cfg->fast;
+    hcfg.tune_fail = cfg->tune_fail;
+    memset(&mcfg, 0, sizeof(mcfg));
+    mcfg.gpio = emu_gpio;
+
+    if ((emu_card = emu_card_create(&ccfg)) == NULL || (emu_hc = emu_sdhci_create(emu_card, &hcfg)) == NULL ||
+            (emu_mbox = emu_mbox_create(&mcfg)) == NULL || (emu_gen = calloc(cfg->sectors, 1)) == NULL || (emu_trimmed = calloc(cfg->sectors, 1)) == NULL) {
+        emu_fatal("no memory for the card");
+    }
+
+    snprintf(ra, sizeof(ra), ",readahead=%u", cfg->readahead);
+    snprintf(opts, sizeof(opts), "busno=0%s%s%s%s%s%s%s%s", cfg->deferred ? ",discard=on" : "",
+            cfg->cmdq ? ",cmdq=on" : "", cfg->merge == EMU_MERGE_PACKED ? ",merge=packed" :
+            cfg->merge == EMU_MERGE_ON ? ",merge=on" : "", cfg->readahead ? ra : "",
+            cfg->stats ? ",stats=on" : "", cfg->phys ? ",phys=on" : "", cfg->opts ? "," : "",
+            cfg->opts ? cfg->opts : "");
+    snprintf(hc, sizeof(hc), "hc=bcm2711,addr=%#x,irq=%d%s%s%s", EMU_SDHCI_BASE, EMU_SDHCI_IRQ,
+            cfg->emmc ? ",emmc" : "", cfg->hcopts ? "," : "", cfg->hcopts ? cfg->hcopts : "");
+    argv[argc++] = (char *) "devb-sdmmc";
+    argv[argc++] = (char *) "sdmmc";
+    argv[argc++] = opts;
+    argv[argc++] = (char *) "sdio";
+    argv[argc++] = hc;
+    argv[argc] = NULL;
+
+    emu_cam_set_main(emu_io, (void *) cfg);
+    status = sdmmc_main(argc, argv);
+    emu_res.fails += emu_check(status == 0, "driver exited with %d", status);
+    emu_res.fails += emu_check(emu_res.mismatches == 0, "%llu sectors did not hold what was written",
+            (unsigned long long) emu_res.mismatches);
+    emu_res.fails += emu_check(emu_os_live() == 0, "%u channels, timers or threads left after detach",
+            emu_os_live());
+    emu_res.fails += emu_check(emu_cam_allocated() == 0, "%llu bytes of DMA memory leaked",
+            (unsigned long long) emu_cam_allocated());
+
+    emu_card_stats(emu_card, &emu_res.card);
+    emu_sdhci_stats(emu_hc, &emu_res.hc);
+    emu_mbox_stats(emu_mbox, &emu_res.mbox);
+    if (cfg->err_every) {
+        emu_res.fails += emu_check(emu_res.card.errors != 0, "no CRC errors were injected");
+    }
+    if (cfg->trims) {
+        emu_res.fails += emu_check(emu_res.card.erases != 0, "no TRIM reached the card");
+        emu_res.fails += emu_check(!cfg->deferred == !(emu_res.discard.flags & SDMMC_DISCARD_DEFERRED),
+                "discards %sdeferred", cfg->deferred ? "not " : "");
+        emu_res.fails += emu_check(emu_res.discard.pending == 0, "%u discards still waiting after %u ms idle",
+                emu_res.discard.pending, EMU_IDLE_MS);
+    }
+    if (cfg->cmdq) {
+        emu_res.fails += emu_check(emu_res.card.tasks != 0, "no reads or writes were queued as tasks");
+        emu_res.fails += emu_check(emu_res.card.reads + emu_res.card.writes == emu_res.card.tasks,
+                "%llu reads and writes outside the queue",
+                (unsigned long long) (emu_res.card.reads + emu_res.card.writes - emu_res.card.tasks));
+    }
+    if (cfg->writes && !cfg->fast && !cfg->cmdq) {
+            // the host times busy from the end of the data, at least the card's program time
+        emu_res.fails += emu_check(emu_res.busy.waits != 0, "no busy waits after writes");
+        emu_res.fails += emu_check(emu_res.busy.total_us >= emu_res.busy.waits * (cfg->write_ns / 1000),
+                "%llu us busy over %llu waits, the card programs for %u us",
+                (unsigned long long) emu_res.busy.total_us, (unsigned long long) emu_res.busy.waits,
+                cfg->write_ns / 1000);
+    }
+    if (cfg->readahead) {
+            // writes in the stream shrink the window rather than waste the reads ahead
+        emu_res.fails += emu_check(emu_res.ra.nbufs != 0, "read-ahead not enabled");
+        emu_res.fails += emu_check(emu_res.ra.hits != 0, "no reads from the read-ahead buffers");
+        emu_res.fails += emu_check(emu_res.ra.fill_bytes <= emu_res.ra.hit_bytes ||
+                emu_res.ra.fill_bytes - emu_res.ra.hit_bytes <= emu_res.card.rd_blocks * EMU_SECTOR / 4,
+                "%llu KB read ahead, %llu KB used, of %llu KB read from the card",
+                (unsigned long long) emu_res.ra.fill_bytes / 1024, (unsigned long long) emu_res.ra.hit_bytes / 1024,
+                (unsigned long long) emu_res.card.rd_blocks * EMU_SECTOR / 1024);
+    }
+    if (cfg->stats) {
+        emu_res.fails += emu_stats(&emu_res.cmd);
+    }
+    if (cfg->merge) {
+        emu_res.fails += emu_check(emu_res.card.reads + emu_res.card.writes < emu_res.ios,
+                "%llu card reads and writes for %llu ios, nothing merged",
+                (unsigned long long) (emu_res.card.reads + emu_res.card.writes), (unsigned long long) emu_res.ios);
+    }
+    if (cfg->merge == EMU_MERGE_PACKED) {
+        emu_res.fails += emu_check(emu_res.card.packed != 0, "no packed writes");
+    }
+    if (cfg->timing) {
+        emu_res.fails += emu_check(emu_res.dev.timing == cfg->timing, "timing %u, expected %u",
+                emu_res.dev.timing, cfg->timing);
+    }
+    if (cfg->uhs && !cfg->emmc) {
+        emu_res.fails += emu_check(emu_res.mbox.gpio_sets != 0, "I/O supply never switched");
+    }
+    if (cfg->tune_fail) {
+        emu_res.fails += emu_check(emu_res.cmd.tune_fails != 0, "tuning did not fail");
+        emu_res.fails += emu_check(!cfg->reset || emu_res.cmd.tune_fails == emu_res.tune_fails,
+                "%u tuning failures after the reset, %u before", emu_res.cmd.tune_fails, emu_res.tune_fails);
+    } else {
+        emu_res.fails += emu_check(emu_res.cmd.tune_fails == 0, "%u of %u tunings failed",
+                emu_res.cmd.tune_fails, emu_res.cmd.tunes);
+    }
+    emu_mbox_destroy(emu_mbox);
+    emu_sdhci_destroy(emu_hc);
+    emu_card_destroy(emu_card);
+
+    if (write(fd, &emu_res, sizeof(emu_res)) != sizeof(emu_res)) {
+        _exit(1);
+    }
+    _exit(0);
+}
+
+/* Runs one configuration in a child, returns the number of failed checks */
+static int emu_run(const emu_cfg_t *cfg, emu_res_t *res)
+{
+    int fds[2], status;
+    pid_t pid;
+
+    if (cfg->qd == 0 || cfg->qd > EMU_QD_MAX || cfg->size % EMU_SECTOR || cfg->size > EMU_IO_MAX ||
+            cfg->span == 0 || cfg->span > cfg->sectors || cfg->size / EMU_SECTOR > cfg->span) {
+        emu_fatal("bad queue depth, size or span");
+    }
+    fflush(stdout);
+    if (pipe(fds) == -1 || (pid = fork()) == -1) {
+        emu_fatal("fork: %s", strerror(errno));
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        emu_child(cfg, fds[1]);
+    }
+    close(fds[1]);
+    memset(res, 0, sizeof(*res));
+    if (read(fds[0], res, sizeof(*res)) != sizeof(*res)) {
+        res->fails = 1;
+    }
+    close(fds[0]);
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s: child %s %d\n", cfg->name, WIFSIGNALED(status) ? "killed by signal" : "exited with",
+                WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+        res->fails++;
+    }
+    return res->fails;
+}
+
+static void emu_report(const emu_cfg_t *cfg, const emu_res_t *res)
+{
+    double s = res->ns / 1e9;
+
+    printf("%s: %llu ios, %.1f MB/s, %.0f IOPS, %.2f ms max, %llu retries\n", cfg->name,
+            (unsigned long long) res->ios, s > 0 ? res->bytes / s / 1e6 : 0, s > 0 ? res->ios / s : 0,
+            res->max_ns / 1e6, (unsigned long long) res->retries);
+    printf("  card: %llu cmds, %llu reads, %llu writes, %llu/%llu blocks, %llu CRC errors, %llu stalls, %llu tunings\n",
+            (unsigned long long) res->card.cmds, (unsigned long long) res->card.reads,
+            (unsigned long long) res->card.writes, (unsigned long long) res->card.rd_blocks,
+            (unsigned long long) res->card.wr_blocks, (unsigned long long) res->card.errors,
+            (unsigned long long) res->card.stalls, (unsigned long long) res->card.tunings);
+    if (res->card.tasks) {
+        printf("  cmdq: %llu tasks\n", (unsigned long long) res->card.tasks);
+    }
+    if (res->card.packed) {
+        printf("  packed: %llu writes\n", (unsigned long long) res->card.packed);
+    }
+    if (res->ra.nbufs) {
+        printf("  readahead: %llu hits, %llu misses, %llu/%llu KB used, %llu backoffs, %u KB window\n",
+                (unsigned long long) res->ra.hits, (unsigned long long) res->ra.misses,
+                (unsigned long long) res->ra.hit_bytes / 1024, (unsigned long long) res->ra.fill_bytes / 1024,
+                (unsigned long long) res->ra.backoffs, res->ra.cur_size / 1024);
+    }
+    if (res->busy.waits) {
+        printf("  busy: %llu waits, %.1f us mean, %.2f ms max%s\n", (unsigned long long) res->busy.waits,
+                (double) res->busy.total_us / res->busy.waits, res->busy.max_us / 1e3,
+                (res->busy.flags & SDMMC_BUSY_HW) ? ", host detects busy" : "");
+    }
+    printf("  host: %llu cmds, %llu interrupts, %llu ADMA descriptors, %.1f ms on the bus\n",
+            (unsigned long long) res->hc.cmds, (unsigned long long) res->hc.irqs,
+            (unsigned long long) res->hc.adma_descs, res->hc.bus_ns / 1e6);
+    printf("  bus: timing %u at %u Hz, %u tunings, %u failed, %llu I/O supply switches\n", res->dev.timing,
+            res->dev.dtr, res->cmd.tunes, res->cmd.tune_fails, (unsigned long long) res->mbox.gpio_sets);
+    if (res->trims) {
+        printf("  trims: %llu, %s, %llu erases of %llu blocks, %.2f ms max, %llu preempted, %llu clipped\n",
+                (unsigned long long) res->trims,
+                (res->discard.flags & SDMMC_DISCARD_DEFERRED) ? "deferred" : "immediate",
+                (unsigned long long) res->discard.erases, (unsigned long long) res->discard.erase_blks,
+                res->discard.max_us / 1e3, (unsigned long long) res->discard.preempted,
+                (unsigned long long) res->discard.clipped);
+    }
+}
+
+/* Card timings, roughly a class 10 SD card and a mid range eMMC */
+static void emu_card_timing(emu_cfg_t *cfg)
+{
+    cfg->erase_ns = 1000000;
+    cfg->erase_blk_ns = 200;
+
+    if (cfg->emmc) {
+        cfg->read_ns = 60000;
+        cfg->write_ns = 150000;
+        cfg->write_blk_ns = 2000;
+    } else {
+        cfg->read_ns = 250000;
+        cfg->write_ns = 400000;
+        cfg->write_blk_ns = 8000;
+    }
+}
+
+static int emu_checks(void)
+{
+    static const struct {
+        const char *name;
+        emu_cfg_t  cfg;
+    } tests[] = {
+        // sequential and random over the whole span, every size from 512 to 128K
+        { "sd-seq", { .size = 65536, .writes = 50, .ios = 600 } },
+        { "sd-rand", { .random = 1, .size = 4096, .qd = 8, .writes = 50, .ios = 3000 } },
+        { "sd-sizes", { .random = 1, .size = 0, .qd = 8, .writes = 50, .ios = 2000 } },
+        // data CRC errors, retried by the SIM or failed back and retried here
+        { "sd-crc", { .random = 1, .size = 16384, .qd = 4, .writes = 50, .ios = 1500, .err_every = 13 } },
+        // writes that stay busy for a long time now and then
+        { "sd-stall", { .random = 1, .size = 8192, .qd = 4, .writes = 70, .ios = 800, .stall_every = 50,
+                .stall_ns = 30000000 } },
+        // UHS-I through the I/O supply switch, and a card that can't be tuned at SDR104,
+        // which steps down and doesn't try again after the driver resets it
+        { "sd-uhs", { .uhs = 1, .random = 1, .size = 0, .qd = 8, .writes = 50, .ios = 2000,
+                .timing = TIMING_SDR104 } },
+        { "sd-uhs-fallback", { .uhs = 1, .tune_fail = 1, .reset = 1, .random = 1, .size = 16384, .qd = 4,
+                .writes = 50, .ios = 1000, .timing = TIMING_DDR50 } },
+        { "emmc-seq", { .emmc = 1, .size = 131072, .writes = 50, .ios = 600 } },
+        { "emmc-rand", { .emmc = 1, .random = 1, .size = 4096, .qd = 16, .writes = 50, .ios = 4000 } },
+        { "emmc-sizes", { .emmc = 1, .random = 1, .size = 0, .qd = 8, .writes = 50, .ios = 2000 } },
+        { "emmc-crc", { .emmc = 1, .random = 1, .size = 32768, .qd = 4, .writes = 50, .ios = 1500,
+                .err_every = 11 } },
+        // large eMMC, sector addressed
+        { "emmc-large", { .emmc = 1, .sectors = 8 * 1024 * 1024 + 4096, .random = 1, .size = 4096, .qd = 4,
+                .writes = 50, .ios = 1000 } },
+        // no bus time and no card latency, races between completion and the next command
+        { "emmc-fast", { .emmc = 1, .fast = 1, .random = 1, .size = 0, .qd = 16, .writes = 50, .ios = 5000 } },
+        // TRIMs among reads and writes, issued at once and deferred until idle
+        { "emmc-trim", { .emmc = 1, .random = 1, .size = 4096, .qd = 8, .writes = 50, .trims = 5, .ios = 2000 } },
+        { "emmc-discard", { .emmc = 1, .deferred = 1, .random = 1, .size = 4096, .qd = 8, .writes = 50, .trims = 5,
+                .ios = 2000 } },
+        // small adjacent TRIMs to merge, cut by the writes that follow
+        { "emmc-discard-seq", { .emmc = 1, .deferred = 1, .size = 65536, .writes = 50, .trims = 30,
+                .trim_blks = 96, .ios = 1000 } },
+        // reads and writes as command queue tasks, with CRC errors that discard the queue
+        { "emmc-cmdq", { .emmc = 1, .cmdq = 1, .random = 1, .size = 0, .qd = 16, .writes = 50, .ios = 3000 } },
+        { "emmc-cmdq-crc", { .emmc = 1, .cmdq = 1, .random = 1, .size = 16384, .qd = 8, .writes = 50, .ios = 1500,
+                .err_every = 17 } },
+        // queued ios merged, adjacent ones into one transfer and the rest into packed writes
+        { "emmc-merge", { .emmc = 1, .merge = EMU_MERGE_ON, .size = 4096, .qd = 16, .writes = 50, .ios = 3000 } },
+        { "emmc-packed", { .emmc = 1, .merge = EMU_MERGE_PACKED, .random = 1, .size = 0, .qd = 16, .writes = 70,
+                .ios = 3000 } },
+        // command statistics, with merged ccbs and writes stopped by CMD12
+        { "emmc-stats", { .emmc = 1, .stats = 1, .merge = EMU_MERGE_ON, .size = 4096, .qd = 16, .writes = 50,
+                .ios = 2000 } },
+        { "sd-stats", { .stats = 1, .no_cmd23 = 1, .random = 1, .size = 0, .qd = 4, .writes = 50, .ios = 1000,
+                .hcopts = "~ac12" } },
+        // sequential reads from the read-ahead buffers, with writes landing in the stream
+        { "emmc-readahead", { .emmc = 1, .readahead = 256, .size = 4096, .qd = 8, .writes = 10, .ios = 2000 } },
+        { "emmc-readahead-mixed", { .emmc = 1, .readahead = 256, .size = 4096, .qd = 8, .writes = 50,
+                .ios = 2000 } },
+        // physical lists from io-blk mixed with client buffers the SIM translates, none with read-ahead
+        { "sd-phys", { .phys = 1, .random = 1, .size = 0, .qd = 4, .writes = 50, .ios = 1500 } },
+        { "emmc-phys-merge", { .emmc = 1, .phys = 1, .merge = EMU_MERGE_PACKED, .random = 1, .size = 0, .qd = 16,
+                .writes = 50, .ios = 2000 } },
+        { "emmc-phys-readahead", { .emmc = 1, .phys = 1, .readahead = 256, .size = 4096, .qd = 8, .writes = 10,
+                .ios = 2000 } },
+    };
+    unsigned i, failed = 0;
+    emu_cfg_t cfg;
+    emu_res_t res;
+    int fails;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        cfg = emu_defaults;
+        cfg.name = tests[i].name;
+        cfg.emmc = tests[i].cfg.emmc;
+        cfg.size = tests[i].cfg.size;
+        cfg.random = tests[i].cfg.random;
+        cfg.writes = tests[i].cfg.writes;
+        cfg.fast = tests[i].cfg.fast;
+        cfg.err_every = tests[i].cfg.err_every;
+        cfg.stall_every = tests[i].cfg.stall_every;
+        cfg.stall_ns = tests[i].cfg.stall_ns;
+        cfg.trims = tests[i].cfg.trims;
+        cfg.deferred = tests[i].cfg.deferred;
+        cfg.cmdq = tests[i].cfg.cmdq;
+        cfg.merge = tests[i].cfg.merge;
+        cfg.readahead = tests[i].cfg.readahead;
+        cfg.stats = tests[i].cfg.stats;
+        cfg.phys = tests[i].cfg.phys;
+        cfg.no_cmd23 = tests[i].cfg.no_cmd23;
+        cfg.hcopts = tests[i].cfg.hcopts;
+        cfg.uhs = tests[i].cfg.uhs;
+        cfg.tune_fail = tests[i].cfg.tune_fail;
+        cfg.reset = tests[i].cfg.reset;
+        cfg.timing = tests[i].cfg.timing;
+#define EMU_SET(f)  if (tests[i].cfg.f) cfg.f = tests[i].cfg.f
+        EMU_SET(trim_blks);
+        EMU_SET(sectors);
+        EMU_SET(ios);
+        EMU_SET(qd);
+#undef EMU_SET
+        emu_card_timing(&cfg);
+
+        fails = emu_run(&cfg, &res);
+        if (emu_verbose) {
+            emu_report(&cfg, &res);
+        }
+        printf("%s %s\n", fails ? "FAIL" : "PASS", cfg.name);
+        failed += fails != 0;
+    }
+
+    printf("%u of %u checks failed\n", failed, i);
+    return failed ? 1 : 0;
+}
+
+/*
+ * Throughput and IOPS. The modelled rows include bus and card time, so
+ * they show what the driver gets out of the bus; the fast rows take both
+ * away and leave the driver's own cost per io.
+ */
+static int emu_bench(unsigned ios)
+{
+    static const struct {
+        const char  *name;
+        unsigned    size;
+        unsigned    qd;
+        unsigned    writes;
+        int         random;
+    } loads[] = {
+        { "seq-read", 131072, 4, 0, 0 },
+        { "seq-write", 131072, 4, 100, 0 },
+        { "rand-read", 4096, 1, 0, 1 },
+        { "rand-read", 4096, 8, 0, 1 },
+        { "rand-write", 4096, 8, 100, 1 },
+    };
+    static const struct {
+        const char  *name;
+        int         emmc;
+        int         fast;
+    } cards[] = {
+        { "sd", 0, 0 },
+        { "emmc", 1, 0 },
+        { "fast", 1, 1 },
+    };
+    static const struct {
+        const char  *name;
+        const char  *opts;
+        uint32_t    base_mhz;
+    } timings[] = {
+        { "hs", "timing=hs", 100 },
+        { "sdr50", "timing=hs:sdr12:sdr25:sdr50", 100 },
+        { "ddr50", "timing=hs:sdr12:sdr25:ddr", 100 },
+        { "sdr104", NULL, 100 },
+        { "sdr104", NULL, 200 },
+    };
+    unsigned c, l, rep;
+    double mbs, iops, best_mbs, best_iops, rw_mbs[2];
+    uint64_t best_max;
+    emu_cfg_t cfg;
+    emu_res_t res;
+    int fails = 0;
+
+    printf("%-5s %-10s %7s %3s %10s %10s %10s\n", "card", "load", "size", "qd", "MB/s", "IOPS", "irqs/io");
+    for (c = 0; c < sizeof(cards) / sizeof(cards[0]); c++) {
+        for (l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+            cfg = emu_defaults;
+            cfg.name = "bench";
+            cfg.emmc = cards[c].emmc;
+            cfg.fast = cards[c].fast;
+            cfg.size = loads[l].size;
+            cfg.qd = loads[l].qd;
+            cfg.writes = loads[l].writes;
+            cfg.random = loads[l].random;
+            cfg.ios = loads[l].size >= 65536 ? ios / 8 : ios;
+            cfg.verify = 0;
+            emu_card_timing(&cfg);
+
+            // best of a few runs, the host is not idle
+            best_mbs = best_iops = 0;
+            for (rep = 0; rep < EMU_BENCH_RUNS; rep++) {
+                fails += emu_run(&cfg, &res);
+                mbs = res.ns ? res.bytes * 1e3 / res.ns : 0;
+                iops = res.ns ? res.ios * 1e9 / res.ns : 0;
+                best_mbs = mbs > best_mbs ? mbs : best_mbs;
+                best_iops = iops > best_iops ? iops : best_iops;
+            }
+            printf("%-5s %-10s %7u %3u %10.1f %10.0f %10.2f\n", cards[c].name, loads[l].name, cfg.size, cfg.qd,
+                    best_mbs, best_iops, (double) res.hc.irqs / (res.ios ? res.ios : 1));
+        }
+    }
+
+    // random 4K reads and writes on eMMC with a TRIM among every twenty ios
+    printf("\n%-10s %10s %10s\n", "trims", "IOPS", "max ms");
+    for (c = 0; c < 2; c++) {
+        cfg = emu_defaults;
+        cfg.name = "bench";
+        cfg.emmc = 1;
+        cfg.deferred = c;
+        cfg.random = 1;
+        cfg.qd = 8;
+        cfg.writes = 50;
+        cfg.trims = 5;
+        cfg.ios = ios;
+        cfg.verify = 0;
+        emu_card_timing(&cfg);
+
+        best_iops = 0;
+        best_max = ~0ULL;
+        for (rep = 0; rep < EMU_BENCH_RUNS; rep++) {
+            fails += emu_run(&cfg, &res);
+            iops = res.ns ? res.ios * 1e9 / res.ns : 0;
+            best_iops = iops > best_iops ? iops : best_iops;
+            best_max = min(best_max, res.max_ns);
+        }
+        printf("%-10s %10.0f %10.2f\n", c ? "deferred" : "immediate", best_iops, best_max / 1e6);
+    }
+
+    // sequential 128K on a UHS-I SD card per bus timing. SDR104 runs at the
+    // base clock, the default 100MHz gives it no more than SDR50 or DDR50,
+    // the last row has the 200MHz it is specified for
+    printf("\n%-12s %7s %9s %10s %10s\n", "timing", "MHz", "bus MHz", "read MB/s", "write MB/s");
+    for (c = 0; c < sizeof(timings) / sizeof(timings[0]); c++) {
+        for (l = 0; l < 2; l++) {
+            cfg = emu_defaults;
+            cfg.name = "bench";
+            cfg.uhs = 1;
+            cfg.hcopts = timings[c].opts;
+            cfg.base_mhz = timings[c].base_mhz;
+            cfg.size = 131072;
+            cfg.qd = 4;
+            cfg.writes = l ? 100 : 0;
+            cfg.ios = ios / 8;
+            cfg.verify = 0;
+            emu_card_timing(&cfg);
+
+            best_mbs = 0;
+            for (rep = 0; rep < EMU_BENCH_RUNS; rep++) {
+                fails += emu_run(&cfg, &res);
+                mbs = res.ns ? res.bytes * 1e3 / res.ns : 0;
+                best_mbs = mbs > best_mbs ? mbs : best_mbs;
+            }
+            rw_mbs[l] = best_mbs;
+        }
+        printf("%-12s %7u %9.0f %10.1f %10.1f\n", timings[c].name, timings[c].base_mhz, res.dev.dtr / 1e6,
+                rw_mbs[0], rw_mbs[1]);
+    }
+
+    return fails ? 1 : 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: sdmmc-emu [options] [check | bench]\n"
+        "  -m          eMMC rather than an SD card\n"
+        "  -u          UHS-I SD card and host\n"
+        "  -S sectors  card size in 512 byte sectors (%u)\n"
+        "  -p sectors  span the workload covers (%u)\n"
+        "  -n ios      ios in the workload (%u)\n"
+        "  -s size     bytes per io, 0 mixes 512 to 128K (%u)\n"
+        "  -q depth    ios outstanding, up to %u (%u)\n"
+        "  -w percent  writes (0)\n"
+        "  -t percent  TRIMs (0)\n"
+        "  -T sectors  per TRIM (%u)\n"
+        "  -d          defer TRIMs until idle, sdmmc discard=on\n"
+        "  -Q          eMMC reads and writes as command queue tasks, sdmmc cmdq=on\n"
+        "  -M          merge queued ios, sdmmc merge=on\n"
+        "  -P          and pack eMMC writes, sdmmc merge=packed\n"
+        "  -R kb       read ahead kb, sdmmc readahead=\n"
+        "  -c          command statistics, sdmmc stats=on\n"
+        "  -a          physical lists for half the ios, sdmmc phys=on\n"
+        "  -r          random rather than sequential\n"
+        "  -e n        every nth card read or write fails with a CRC error\n"
+        "  -x n/ms     every nth write stays busy ms longer\n"
+        "  -f          fast: no bus time, no card latency\n"
+        "  -o opts     more sdmmc options\n"
+        "  -H opts     more sdio options, e.g. timing=hs\n"
+        "  -b mhz      SD base clock (%u)\n"
+        "  -N          do not verify data\n"
+        "  -v          verbose, driver slog messages to stderr\n",
+        emu_defaults.sectors, emu_defaults.span, emu_defaults.ios, emu_defaults.size, EMU_QD_MAX,
+        emu_defaults.qd, emu_defaults.trim_blks, emu_defaults.base_mhz);
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    emu_cfg_t cfg = emu_defaults;
+    emu_res_t res;
+    unsigned ms;
+    int opt, fails;
+
+    while ((opt = getopt(argc, argv, "muS:p:n:s:q:w:t:T:dQMPR:care:x:fo:H:b:Nvh")) != -1) {
+        switch (opt) {
+        case 'm': cfg.emmc = 1; break;
+        case 'u': cfg.uhs = 1; break;
+        case 'S': cfg.sectors = strtoul(optarg, NULL, 0); break;
+        case 'p': cfg.span = strtoul(optarg, NULL, 0); break;
+        case 'n': cfg.ios = strtoul(optarg, NULL, 0); break;
+        case 's': cfg.size = strtoul(optarg, NULL, 0); break;
+        case 'q': cfg.qd = strtoul(optarg, NULL, 0); break;
+        case 'w': cfg.writes = strtoul(optarg, NULL, 0); break;
+        case 't': cfg.trims = strtoul(optarg, NULL, 0); break;
+        case 'T': cfg.trim_blks = strtoul(optarg, NULL, 0); break;
+        case 'd': cfg.deferred = 1; break;
+        case 'Q': cfg.cmdq = 1; break;
+        case 'M': cfg.merge = EMU_MERGE_ON; break;
+        case 'P': cfg.merge = EMU_MERGE_PACKED; break;
+        case 'R': cfg.readahead = strtoul(optarg, NULL, 0); break;
+        case 'c': cfg.stats = 1; break;
+        case 'a': cfg.phys = 1; break;
+        case 'r': cfg.random = 1; break;
+        case 'e': cfg.err_every = strtoul(optarg, NULL, 0); break;
+        case 'x':
+            if (sscanf(optarg, "%u/%u", &cfg.stall_every, &ms) != 2) {
+                usage();
+            }
+            cfg.stall_ns = ms * 1000000;
+            break;
+        case 'f': cfg.fast = 1; break;
+        case 'o': cfg.opts = optarg; break;
+        case 'H': cfg.hcopts = optarg; break;
+        case 'b': cfg.base_mhz = strtoul(optarg, NULL, 0); break;
+        case 'N': cfg.verify = 0; break;
+        case 'v': emu_verbose = 1; break;
+        default: usage();
+        }
+    }
+
+    if (optind < argc && strcmp(argv[optind], "check") == 0) {
+        return emu_checks();
+    }
+    if (optind < argc && strcmp(argv[optind], "bench") == 0) {
+        return emu_bench(cfg.ios);
+    }
+    if (optind < argc || cfg.writes > 100 || cfg.trims > 100) {
+        usage();
+    }
+
+    emu_card_timing(&cfg);
+    fails = emu_run(&cfg, &res);
+    emu_report(&cfg, &res);
+    return fails ? 1 : 0;
+}
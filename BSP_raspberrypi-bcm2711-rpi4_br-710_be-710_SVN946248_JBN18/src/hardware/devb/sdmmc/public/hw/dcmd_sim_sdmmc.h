@@ -465,6 +465,98 @@ typedef struct _sdmmc_man_cmd {
 /*	_Uint8t			data[0];			variable length data */
 } SDMMC_MAN_CMD;
 
+typedef struct _sdmmc_busy_stats {
+#define SDMMC_STATS_ACTION_GET		0x00
+#define SDMMC_STATS_ACTION_RESET	0x01	/* get, then clear */
+	_Uint32t		action;
+#define SDMMC_BUSY_HW				0x01	/* host detects the end of DAT0 busy */
+	_Uint32t		flags;
+
+	_Uint64t		waits;				/* card busy waits after writes */
+	_Uint64t		total_us;			/* busy time, from the end of the data (host busy detection) and polls */
+	_Uint64t		max_us;				/* longest wait */
+#define SDMMC_BUSY_HIST_BINS		20
+	_Uint64t		hist[SDMMC_BUSY_HIST_BINS];	/* bin n counts waits of 2^n to 2^(n+1) us, bin 0 from 0 us, last bin unbounded */
+	_Uint32t		rsvd1[16];
+} SDMMC_BUSY_STATS;
+
+typedef struct _sdmmc_ra_stats {
+	_Uint32t		action;				/* SDMMC_STATS_ACTION_xxx */
+	_Uint32t		nbufs;				/* read-ahead buffers, 0 when disabled */
+	_Uint32t		buf_size;			/* bytes per buffer */
+	_Uint32t		cur_size;			/* bytes read ahead now, shrinks while writes hit the stream */
+
+	_Uint64t		hits;				/* reads copied from the buffers */
+	_Uint64t		misses;				/* reads that went to the device */
+	_Uint64t		fills;				/* read-ahead transfers */
+	_Uint64t		fill_bytes;			/* bytes read ahead */
+	_Uint64t		hit_bytes;			/* bytes copied from the buffers */
+	_Uint64t		invalidates;		/* buffers dropped by writes, erases or resets */
+	_Uint64t		backoffs;			/* writes or erases in or near the stream */
+	_Uint32t		rsvd1[14];
+} SDMMC_RA_STATS;
+
+typedef struct _sdmmc_discard_stats {
+	_Uint32t		action;				/* SDMMC_STATS_ACTION_xxx */
+#define SDMMC_DISCARD_DEFERRED		0x01	/* TRIM/DISCARD wait for the device to be idle */
+	_Uint32t		flags;
+	_Uint32t		pending;			/* ranges waiting */
+	_Uint32t		rsvd;
+
+	_Uint64t		pending_blks;		/* blocks they cover */
+	_Uint64t		ranges;				/* ranges deferred */
+	_Uint64t		merged;				/* ranges merged into a waiting one */
+	_Uint64t		clipped;			/* waiting ranges cut short by writes */
+	_Uint64t		erases;				/* commands issued for waiting ranges */
+	_Uint64t		erase_blks;			/* blocks they covered */
+	_Uint64t		erase_us;			/* time spent in them */
+	_Uint64t		max_us;				/* longest */
+	_Uint64t		preempted;			/* idle runs stopped by other work */
+	_Uint64t		flushed;			/* ranges issued at once for pause, sleep or detach */
+	_Uint64t		overflows;			/* ranges issued at once, no room to wait */
+	_Uint64t		errors;				/* ranges dropped after an error */
+	_Uint32t		rsvd1[16];
+} SDMMC_DISCARD_STATS;
+
+typedef struct _sdmmc_lat_hist {
+	_Uint32t		count;
+	_Uint32t		max_us;
+	_Uint64t		total_us;
+#define SDMMC_LAT_BINS				16
+	_Uint32t		hist[SDMMC_LAT_BINS];	/* bin n counts 2^n to 2^(n+1) us, bin 0 from 0 us, last bin unbounded */
+} SDMMC_LAT_HIST;
+
+typedef struct _sdmmc_op_stats {
+#define SDMMC_OP_ACMD				0x100	/* SD application command */
+	_Uint32t		opcode;				/* SD/MMC command index */
+	_Uint32t		errors;
+#define SDMMC_PHASE_QUEUE			0		/* ccb queued in the SIM, read/write commands only */
+#define SDMMC_PHASE_SETUP			1		/* host setup until the command is issued */
+#define SDMMC_PHASE_XFER			2		/* issued until the host completes it */
+#define SDMMC_PHASE_BUSY			3		/* card status polls waiting for it */
+#define SDMMC_PHASES				4
+	SDMMC_LAT_HIST	lat[SDMMC_PHASES];
+#define SDMMC_BYTE_BINS				12
+	_Uint32t		bytes[SDMMC_BYTE_BINS];	/* bin n counts transfers of 512 << n bytes or less, last bin unbounded */
+} SDMMC_OP_STATS;
+
+typedef struct _sdmmc_cmd_stats {
+#define SDMMC_STATS_ACTION_ENABLE	0x02
+#define SDMMC_STATS_ACTION_DISABLE	0x03
+	_Uint32t		action;				/* SDMMC_STATS_ACTION_xxx */
+#define SDMMC_CMD_STATS_ENABLED		0x01
+	_Uint32t		flags;
+	_Uint32t		nops;				/* opcodes seen */
+	_Uint32t		overflow;			/* commands of opcodes beyond SDMMC_STATS_OPS */
+	_Uint32t		resets;				/* device resets */
+	_Uint32t		retunes;			/* tuning repeated after CRC errors or timer */
+	_Uint32t		tunes;				/* tuning requests, at init and retune */
+	_Uint32t		tune_fails;			/* of them failed, a card failing too often gets a slower timing */
+#define SDMMC_STATS_OPS				16
+	SDMMC_OP_STATS	ops[SDMMC_STATS_OPS];
+	_Uint32t		rsvd1[16];
+} SDMMC_CMD_STATS;
+
 #define DCMD_SDMMC_DEVICE_INFO			__DIOF(_DCMD_CAM, _SIM_SDMMC + 0, struct _sdmmc_device_info)
 #define DCMD_SDMMC_DEVICE_HEALTH		__DIOF(_DCMD_CAM, _SIM_SDMMC + 1, union _sdmmc_device_health)
 #define DCMD_SDMMC_ERASE				__DIOTF(_DCMD_CAM, _SIM_SDMMC + 2, struct _sdmmc_erase)
@@ -480,6 +572,10 @@ typedef struct _sdmmc_man_cmd {
 #define DCMD_SDMMC_GEN_CMD				__DIOTF(_DCMD_CAM, _SIM_SDMMC + 12, struct _sdmmc_gen_cmd)
 #define DCMD_SDMMC_MAN_CMD				__DIOTF(_DCMD_CAM, _SIM_SDMMC + 13, struct _sdmmc_man_cmd)
 #define DCMD_SDMMC_DRVR_STATE			__DIOTF(_DCMD_CAM, _SIM_SDMMC + 14, struct _sdmmc_drvr_state)
+#define DCMD_SDMMC_BUSY_STATS			__DIOTF(_DCMD_CAM, _SIM_SDMMC + 15, struct _sdmmc_busy_stats)
+#define DCMD_SDMMC_RA_STATS				__DIOTF(_DCMD_CAM, _SIM_SDMMC + 16, struct _sdmmc_ra_stats)
+#define DCMD_SDMMC_CMD_STATS			__DIOTF(_DCMD_CAM, _SIM_SDMMC + 17, struct _sdmmc_cmd_stats)
+#define DCMD_SDMMC_DISCARD_STATS		__DIOTF(_DCMD_CAM, _SIM_SDMMC + 18, struct _sdmmc_discard_stats)
 
 #include <_packpop.h>
 
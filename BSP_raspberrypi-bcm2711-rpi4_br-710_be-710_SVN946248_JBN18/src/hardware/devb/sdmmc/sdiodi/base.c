@@ -33,6 +33,7 @@
 #include <sys/trace.h>
 #include <sys/slogcodes.h>
 #include <sys/mman.h>
+#include <sys/syspage.h>
 
 #include <internal.h>
 
@@ -132,12 +133,13 @@ static void report_invalid_suboption( const char* function, const char* suboptio
 // return position of MSB
 int fls( int val )
 {
-	int		idx;
+	unsigned	uval = val;
+	int			idx;
 
 	idx = 32;
-	while( val ) {
-		if( val & 0x80000000u ) return( idx );
-		val <<= 1;
+	while( uval ) {
+		if( uval & 0x80000000u ) return( idx );
+		uval <<= 1;
 		idx--;
 	}
 	return( 0 );
@@ -173,6 +175,7 @@ sdio_hc_t *sdio_hc_alloc( )
 		cfg->idle_time	= SDIO_PM_IDLE_TIME;
 		cfg->sleep_time	= SDIO_PM_SLEEP_TIME;
 		hc->hc_coid		= hc->hc_chid = hc->hc_tid = hc->tuning_timerid = -1;
+		hc->stats_cpu	= max( SYSPAGE_ENTRY( qtime )->cycles_per_sec / 1000000, 1 );
 		TAILQ_INSERT_TAIL( &sdio_ctrl.hlist, hc, hlink );
 	}
 
@@ -630,7 +633,13 @@ int _sdio_pwrmgnt( sdio_dev_t *dev, int pm )
 
 			if( ( hc->caps & HC_CAP_SLEEP ) ) {
 				if( ( dev->caps & DEV_CAP_SLEEP ) ) {
-					if( ( dev->flags & DEV_FLAG_WCE ) ) {
+					if( ( dev->flags & DEV_FLAG_CMDQ ) ) {		// queue is empty when idle
+						if( ( status = mmc_cmdq( dev, SDIO_CMDQ_DISABLE, SDIO_TIME_DEFAULT ) ) ) {
+							sdio_slogf( _SLOGC_SDIODI, _SLOG_ERROR, hc->cfg.verbosity, 0, "%s: cmdq disable fail %s", __FUNCTION__, strerror( status ) );
+						}
+					}
+
+					if( status == EOK && ( dev->flags & DEV_FLAG_WCE ) ) {
 						if( ( status = mmc_cache( dev, SDIO_CACHE_FLUSH, SDIO_TIME_DEFAULT * 5 ) ) ) {
 							sdio_slogf( _SLOGC_SDIODI, _SLOG_ERROR, hc->cfg.verbosity, 0, "%s: cache flush fail %s", __FUNCTION__, strerror( status ) );
 						}
@@ -692,9 +701,39 @@ int sdio_select_voltage( sdio_hc_t *hc, int ocr )
 	return( status );
 }
 
+static sdio_tune_rec_t *sdio_tune_rec( sdio_hc_t *hc )
+{
+	sdio_dev_t			*dev;
+	sdio_tune_rec_t		*rec;
+	sdio_tune_rec_t		*old;
+
+	dev	= &hc->device;
+	old	= &hc->tune_cache[0];
+
+	for( rec = &hc->tune_cache[0]; rec < &hc->tune_cache[SDIO_TUNE_CACHE]; rec++ ) {
+		if( !memcmp( rec->cid, dev->raw_cid, sizeof( rec->cid ) ) ) {
+			break;
+		}
+		if( rec->stamp < old->stamp ) {
+			old = rec;
+		}
+	}
+
+	if( rec == &hc->tune_cache[SDIO_TUNE_CACHE] ) {		// new card, replace the oldest
+		rec = old;
+		memset( rec, 0, sizeof( *rec ) );
+		memcpy( rec->cid, dev->raw_cid, sizeof( rec->cid ) );
+	}
+
+	rec->stamp = ++hc->tune_stamp;
+
+	return( rec );
+}
+
 int sdio_tune( sdio_hc_t *hc, int cmd )
 {
-	int	status;
+	sdio_tune_rec_t	*rec;
+	int				status;
 
 	status = EOK;
 
@@ -702,11 +741,61 @@ int sdio_tune( sdio_hc_t *hc, int cmd )
 
 	if( hc->entry.tune ) {
 		status = hc->entry.tune( hc, cmd );
+
+		hc->stats.tunes++;
+		rec = sdio_tune_rec( hc );
+		if( rec->timing != hc->timing || rec->clk != hc->clk ) {
+			rec->timing	= hc->timing;
+			rec->clk	= hc->clk;
+			rec->fails	= 0;
+		}
+
+		if( status == EOK ) {
+			rec->fails = 0;
+		}
+		else {
+			hc->stats.tune_fails++;
+				// only a card that never matched the pattern counts, not
+				// one that was removed or a command that timed out
+			if( status == EIO && ++rec->fails >= SDIO_TUNE_FAILS && !( rec->avoid & ( 1 << hc->timing ) ) ) {
+				rec->avoid |= 1 << hc->timing;
+				sdio_slogf( _SLOGC_SDIODI, _SLOG_ERROR, hc->cfg.verbosity, 0, "%s: card does not tune at timing %d, %d Hz", __FUNCTION__, hc->timing, hc->clk );
+			}
+		}
 	}
 
 	return( status );
 }
 
+	// The present card failed to tune at timing too often, use a slower one
+int sdio_tune_failed( sdio_hc_t *hc, int timing )
+{
+	sdio_tune_rec_t	*rec;
+
+	for( rec = &hc->tune_cache[0]; rec < &hc->tune_cache[SDIO_TUNE_CACHE]; rec++ ) {
+		if( !memcmp( rec->cid, hc->device.raw_cid, sizeof( rec->cid ) ) ) {
+			return( ( rec->avoid & ( 1 << timing ) ) != 0 );
+		}
+	}
+
+	return( 0 );
+}
+
+	// The card was removed, whatever it failed to tune at may have been the
+	// slot or the temperature, give it a fresh start when it comes back
+static void sdio_tune_forget( sdio_hc_t *hc )
+{
+	sdio_tune_rec_t	*rec;
+
+	for( rec = &hc->tune_cache[0]; rec < &hc->tune_cache[SDIO_TUNE_CACHE]; rec++ ) {
+		if( !memcmp( rec->cid, hc->device.raw_cid, sizeof( rec->cid ) ) ) {
+			rec->fails	= 0;
+			rec->avoid	= 0;
+			break;
+		}
+	}
+}
+
 int sdio_preset( sdio_hc_t *hc, int state )
 {
 	int	status;
@@ -814,7 +903,7 @@ int sdio_select_card( sdio_dev_t *dev, int rca )
 	return( status );
 }
 
-int _sdio_stop_transmission( sdio_dev_t *dev, int hpi )
+int _sdio_stop_transmission( sdio_dev_t *dev, int hpi, uint32_t *bsy_us )
 {
 	struct sdio_cmd		*cmd;
 	uint32_t			arg;
@@ -831,6 +920,10 @@ int _sdio_stop_transmission( sdio_dev_t *dev, int hpi )
 
 	}
 
+	if( bsy_us ) {
+		*bsy_us = cmd->bsy_us;
+	}
+
 	sdio_free_cmd( cmd );
 
 	return( status );
@@ -938,17 +1031,115 @@ static void sdio_rsp( sdio_dev_t *dev, uint32_t *rsp )
 		(rsp[0] & CDS_APP_CMD_S				) ? "APP " : "" );
 }
 
+static void sdio_stats_lat( sdio_lat_hist_t *lh, uint64_t us )
+{
+	lh->count++;
+	lh->total_us	+= us;
+	lh->max_us		= max( lh->max_us, us );
+	lh->hist[sdio_stats_bin( us, SDIO_STATS_LAT_BINS )]++;
+}
+
+// Charge the busy the host waited out, plus poll_us of card status polls,
+// to the last command that left the card busy
+static void sdio_stats_bsy( sdio_hc_t *hc, uint64_t poll_us )
+{
+	if( hc->stats_last && ( hc->stats_bsy || poll_us ) ) {
+		sdio_stats_lat( &hc->stats_last->lat[SDIO_STATS_BUSY], hc->stats_bsy + poll_us );
+	}
+	hc->stats_bsy = 0;
+}
+
+static sdio_op_stats_t *sdio_stats_op( sdio_hc_t *hc, struct sdio_cmd *cmd )
+{
+	sdio_stats_t	*st;
+	uint32_t		opcode;
+	int				idx;
+
+	st		= &hc->stats;
+	opcode	= cmd->opcode | ( ( cmd->flags & SCF_APP_CMD ) ? SDIO_STATS_ACMD : 0 );
+
+	for( idx = 0; idx < st->nops; idx++ ) {
+		if( st->ops[idx].opcode == opcode ) {
+			return( &st->ops[idx] );
+		}
+	}
+
+	if( st->nops >= SDIO_STATS_OPS ) {
+		st->overflow++;
+		return( NULL );
+	}
+
+	st->ops[st->nops].opcode = opcode;
+
+	return( &st->ops[st->nops++] );
+}
+
+// t0 when the command was handed to the host, t1 when the host took it (0 if it didn't)
+static void sdio_stats_cmd( sdio_hc_t *hc, struct sdio_cmd *cmd, uint64_t t0, uint64_t t1, int status )
+{
+	sdio_op_stats_t	*os;
+	uint64_t		t2;
+	uint64_t		bsy;
+	uint32_t		bytes;
+	int				bin;
+
+	t2	= ClockCycles( );
+	os	= sdio_stats_op( hc, cmd );
+	bsy	= t1 ? min( (uint64_t)cmd->bsy_us * hc->stats_cpu, t2 - t1 ) : 0;
+
+		// busy after a CMD12 is the data command's, card status polls
+		// are left to _sdio_wait_card_status, anything else starts anew
+	if( cmd->opcode == MMC_STOP_TRANSMISSION && hc->stats_last ) {
+		hc->stats_bsy += bsy / hc->stats_cpu;
+	}
+	else if( cmd->opcode != MMC_SEND_STATUS ) {
+		sdio_stats_bsy( hc, 0 );
+		hc->stats_last	= os;
+		hc->stats_bsy	= bsy / hc->stats_cpu;
+	}
+
+	if( os == NULL ) {
+		return;
+	}
+
+	if( status || cmd->status != CS_CMD_CMP ) {
+		os->errors++;
+	}
+
+	if( t1 ) {
+		sdio_stats_lat( &os->lat[SDIO_STATS_SETUP], ( t1 - t0 ) / hc->stats_cpu );
+		sdio_stats_lat( &os->lat[SDIO_STATS_XFER], ( t2 - t1 - bsy ) / hc->stats_cpu );
+	}
+
+	if( ( cmd->flags & SCF_DATA_MSK ) ) {
+		bytes = cmd->blks * cmd->blksz;
+		for( bin = 0; bin < SDIO_STATS_BYTE_BINS - 1 && bytes > ( 512U << bin ); bin++ ) {
+			;
+		}
+		os->bytes[bin]++;
+	}
+}
+
+// Poll the card status until it matches.  The card is usually ready at the
+// first or one of the next few polls, so the interval backs off from a
+// short spin to a 1ms sleep instead of sleeping a tick between every poll.
 int _sdio_wait_card_status( sdio_dev_t *dev, uint32_t *rsp, uint32_t mask, uint32_t val, uint32_t msec )
 {
-	sdio_hc_t	*hc;
-	int			status;
-	uint32_t	resp[4];
+	sdio_hc_t		*hc;
+	int				status;
+	uint32_t		resp[4];
+	uint64_t		budget;
+	uint64_t		t0;
+	uint32_t		poll;
 
 	hc		= dev->hc;
+	t0		= hc->stats.enabled ? ClockCycles( ) : 0;
 	status	= EOK;
 	rsp		= rsp ? rsp : resp;
+	budget	= (uint64_t)max( msec, 1 ) * 1000;		// us
+	poll	= SDIO_BSY_POLL_MIN;
 
-	for( msec = max( msec, 1 ); msec; msec-- ) {
+	while( budget ) {
 		if( ( status = _sdio_send_status( dev, rsp, SDIO_FALSE ) ) != EOK ) {
 			break;
 		}
@@ -965,15 +1156,27 @@ int _sdio_wait_card_status( sdio_dev_t *dev, uint32_t *rsp, uint32_t mask, uint3
 			status = EOK; break;
 		}
 
-		delay( 1 );
+		if( poll <= SDIO_BSY_POLL_SPIN ) {
+			nanospin_ns( poll * 1000L );
+			budget	-= min( budget, poll );
+			poll	<<= 1;
+		}
+		else {
+			delay( 1 );
+			budget	-= min( budget, 1000 );
+		}
 	}
 
-	if( !msec ) {
+	if( !budget ) {
 		sdio_slogf( _SLOGC_SDIODI, _SLOG_ERROR, hc->cfg.verbosity, 0, "%s:  mask %x, val %x, card status %x", __FUNCTION__, mask, val, rsp[0] );
 		sdio_rsp( dev, rsp );
 		status = ETIMEDOUT;
 	}
 
+	if( t0 && hc->stats.enabled ) {
+		sdio_stats_bsy( hc, ( ClockCycles( ) - t0 ) / hc->stats_cpu );
+	}
+
 	return( status );
 }
 
@@ -1112,9 +1315,10 @@ int _sdio_reset( sdio_dev_t *dev )
 
 	hc->flags		|= HC_FLAG_RST;
 	hc->flags		&= ~HC_FLAG_SKIP_PWRUP;
+	hc->stats.resets++;
 	dev->rca		= 0;
 	dev->pactive		= 0;
-	dev->flags		&= ~DEV_FLAG_WCE;
+	dev->flags		&= ~( DEV_FLAG_WCE | DEV_FLAG_CMDQ );
 
 	do {
 		sdio_power( hc, SDIO_PWR_OFF );
@@ -1156,6 +1360,8 @@ int _sdio_retune( sdio_hc_t *hc )
 		}
 	}
 
+	hc->stats.retunes++;
+
 	if( hc->device.dtype == DEV_TYPE_MMC ) {
 		status = mmc_retune( hc );
 	} else {
@@ -1194,9 +1400,13 @@ int sdio_wait_cmd( sdio_hc_t *hc, struct sdio_cmd *cmd, uint64_t tms )
 int sdio_issue_cmd( sdio_dev_t *dev, struct sdio_cmd *cmd, uint64_t tms )
 {
 	sdio_hc_t		*hc;
+	uint64_t		t0;
+	uint64_t		t1;
 	int				status;
 
 	hc				= dev->hc;
+	t0				= hc->stats.enabled ? ClockCycles( ) : 0;
+	t1				= 0;
 
 #ifdef SDIO_TRACE
 	sdio_trace_event( SDIO_TRACE_EVENT, "CMD %d, flgs 0x%x, arg 0x%x, blks %d, blksz %d, timeout %llums", cmd->opcode, cmd->flags, cmd->arg, cmd->blks, cmd->blksz, tms );
@@ -1211,6 +1421,12 @@ int sdio_issue_cmd( sdio_dev_t *dev, struct sdio_cmd *cmd, uint64_t tms )
 	pthread_mutex_unlock( &hc->mutex );
 
 	if( ( status = hc->entry.cmd( hc, cmd ) ) == EOK ) {
+		if( t0 ) {
+			t1 = ClockCycles( );
+		}
+		if( cmd->cbf && ( cmd->flags & SCF_DATA_MSK ) ) {	// data xfer in flight
+			cmd->cbf( cmd->hdl, cmd, ( (struct sdio_device *)cmd->hdl )->user );
+		}
 		status = sdio_wait_cmd( hc, cmd, tms );
 	}
 
@@ -1222,6 +1438,10 @@ int sdio_issue_cmd( sdio_dev_t *dev, struct sdio_cmd *cmd, uint64_t tms )
 		pthread_mutex_unlock( &hc->mutex );
 	}
 
+	if( t0 && hc->stats.enabled ) {
+		sdio_stats_cmd( hc, cmd, t0, t1, status );
+	}
+
 	return( status );
 }
 
@@ -1256,7 +1476,8 @@ int _sdio_send_cmd( sdio_dev_t *dev, struct sdio_cmd *cmd,
 	sdio_hc_t 	*hc;
 	int			status;
 
-	hc = dev->hc;
+	hc			= dev->hc;
+	cmd->cbf	= func;
 
 	if( ( status = _sdio_pwrmgnt( dev, PM_ACTIVE ) ) ) {
 		return( status );
@@ -1308,7 +1529,7 @@ int _sdio_send_cmd( sdio_dev_t *dev, struct sdio_cmd *cmd,
 		}
 
 		if( status == EOK ) {
-			if( ( cmd->flags & SCF_WAIT_DRDY ) && !( hc->caps & HC_CAP_BSY ) ) {
+			if( ( cmd->flags & SCF_WAIT_DRDY ) && ( !( hc->caps & HC_CAP_BSY ) || ( cmd->flags & SCF_BSY_POLL ) ) ) {
 				if( ( status = _sdio_wait_card_status( dev, NULL, CDS_READY_FOR_DATA | CDS_CUR_STATE_MSK, CDS_READY_FOR_DATA | CDS_CUR_STATE_TRAN, timeout ) ) != EOK ) {
 					break;
 				}
@@ -1510,6 +1731,7 @@ static int sdio_cd( sdio_hc_t *hc )
 		if( ( dev->flags & DEV_FLAG_PRESENT ) ) {
 			sdio_slogf( _SLOGC_SDIODI, _SLOG_ERROR, hc->cfg.verbosity, 0, "%s:  removal path %d, cd state 0x%x", __FUNCTION__, hc->path, cd );
 			atomic_clr( &dev->flags, DEV_FLAG_PRESENT );
+			sdio_tune_forget( hc );
 			pthread_mutex_lock( &sdio_ctrl.mutex );
 
 				// look up device based on path, generation
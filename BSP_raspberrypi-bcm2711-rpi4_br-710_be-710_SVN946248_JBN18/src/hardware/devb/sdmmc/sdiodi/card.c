@@ -23,6 +23,7 @@
 #include <atomic.h>
 #include <string.h>
 #include <malloc.h>
+#include <sys/syspage.h>
 
 #include <internal.h>
 
@@ -163,6 +164,14 @@ int	sdio_cmd_status( struct sdio_cmd *cmd, uint32_t *status, uint32_t *rsp )
 	return( EOK );
 }
 
+// How long (us) the host waited out DAT0 busy after the command, from the
+// end of the write data, or the R1b response, to transfer complete.  0 if
+// the host doesn't time busy (no busy detection, PIO or SDMA writes).
+_Uint32t sdio_cmd_busy( struct sdio_cmd *cmd )
+{
+	return( cmd->bsy_us );
+}
+
 int sdio_setup_cmd_ext( struct sdio_cmd *cmd, uint32_t flgs, uint32_t op, uint32_t arg, uint32_t earg )
 {
 	cmd->opcode		= op;
@@ -200,14 +209,34 @@ int sdio_send_cmd( struct sdio_device *device, struct sdio_cmd *cmd,
 		return( status );
 	}
 
-	status =_sdio_send_cmd( device->dev, cmd, func, timeout, retries );
+	cmd->hdl	= device;
+	status		=_sdio_send_cmd( device->dev, cmd, func, timeout, retries );
 
 	_sdio_synchronize( device, !0, -1 );
 
 	return( status );
 }
 
-int sdio_stop_transmission( struct sdio_device *device, int hpi )
+// Let the host build the data transfer of a command that will be sent
+// next, so it is ready the moment the current command completes.  Only
+// valid from the sdio_send_cmd() callback, which runs while the current
+// data transfer is in flight.  A NULL cmd drops a prepared transfer.
+int sdio_prep_cmd( struct sdio_device *device, struct sdio_cmd *cmd )
+{
+	sdio_hc_t		*hc;
+
+	hc = device->hc;
+
+	if( hc->entry.prep == NULL ) {
+		return( ENOTSUP );
+	}
+
+	return( hc->entry.prep( hc, cmd ) );
+}
+
+// As sdio_stop_transmission(), also returning the DAT0 busy the host waited
+// out after the CMD12, see sdio_cmd_busy()
+int sdio_stop_transmission_ext( struct sdio_device *device, int hpi, _Uint32t *bsy_us )
 {
 	int				status;
 
@@ -215,13 +244,18 @@ int sdio_stop_transmission( struct sdio_device *device, int hpi )
 		return( status );
 	}
 
-	status = _sdio_stop_transmission( device->dev, hpi );
+	status = _sdio_stop_transmission( device->dev, hpi, bsy_us );
 
 	_sdio_synchronize( device, !0, -1 );
 
 	return( status );
 }
 
+int sdio_stop_transmission( struct sdio_device *device, int hpi )
+{
+	return( sdio_stop_transmission_ext( device, hpi, NULL ) );
+}
+
 int sdio_set_partition( struct sdio_device *device, uint32_t partition )
 {
 	sdio_dev_t	*dev;
@@ -427,7 +461,7 @@ int sdio_hc_info( struct sdio_device *device, sdio_hc_info_t *info )
 
 	hc					= device->dev->hc;
 
-	info->caps			= hc->caps & 0xffffffff;
+	info->caps			= hc->caps & ( 0xffffffff | HC_CAP_BSY );
 	info->sg_max		= hc->cfg.sg_max;
 	info->dtr_max		= hc->clk_max;
 	info->dtr			= hc->clk;
@@ -440,6 +474,60 @@ int sdio_hc_info( struct sdio_device *device, sdio_hc_info_t *info )
 	return( EOK );
 }
 
+// Latency histogram bin, bin n counts 2^n to 2^(n+1) us, bin 0 from 0 us
+// and the last bin is unbounded
+int sdio_stats_bin( _Uint64t us, int bins )
+{
+	int		bin;
+
+	for( bin = 0; bin < bins - 1 && ( us >> ( bin + 1 ) ); bin++ ) {
+		;
+	}
+
+	return( bin );
+}
+
+int sdio_stats( struct sdio_device *device, sdio_stats_t *stats, int action )
+{
+	sdio_hc_t		*hc;
+
+	hc	= device->dev->hc;
+
+	if( stats ) {
+		*stats = hc->stats;
+	}
+
+	switch( action ) {
+		case SDIO_STATS_GET:
+			break;
+
+		case SDIO_STATS_CLEAR:
+			hc->stats_last		= NULL;
+			hc->stats_bsy		= 0;
+			hc->stats.nops		= 0;
+			hc->stats.overflow	= 0;
+			hc->stats.resets	= 0;
+			hc->stats.retunes	= 0;
+			hc->stats.tunes		= 0;
+			hc->stats.tune_fails	= 0;
+			memset( hc->stats.ops, 0, sizeof( hc->stats.ops ) );
+			break;
+
+		case SDIO_STATS_ENABLE:
+			hc->stats.enabled	= 1;
+			break;
+
+		case SDIO_STATS_DISABLE:
+			hc->stats.enabled	= 0;
+			break;
+
+		default:
+			return( EINVAL );
+	}
+
+	return( EOK );
+}
+
 int sdio_dev_info( struct sdio_device *device, sdio_dev_info_t *info )
 {
 	sdio_hc_t		*hc;
@@ -490,6 +578,12 @@ int sdio_dev_info( struct sdio_device *device, sdio_dev_info_t *info )
 		}
 		info->spec_vers			= dev->csd.spec_vers;
 		info->spec_rev			= ecsd->ext_csd_rev;
+		if( ( dev->caps & DEV_CAP_CMDQ ) ) {
+			info->cmdq_depth	= ( dev->raw_ecsd[ECSD_CMDQ_DEPTH] & ECSD_CMDQ_DEPTH_MSK ) + 1;
+		}
+		if( ( dev->caps & DEV_CAP_PACKED ) ) {
+			info->packed_wr		= dev->raw_ecsd[ECSD_MAX_PACKED_WRITES];
+		}
 	}
 	else {
 		info->spec_vers			= dev->scr.sd_spec;
@@ -534,6 +628,112 @@ int sdio_cache( struct sdio_device *device, int op, uint32_t timeout )
 	return( status );
 }
 
+int sdio_cmdq( struct sdio_device *device, int op, uint32_t timeout )
+{
+	sdio_dev_t	*dev;
+	int			status;
+
+	dev = device->dev;
+
+	if( ( status = _sdio_synchronize( device, !0, 1 ) ) != EOK ) {
+		return( status );
+	}
+
+	if( ( dev->dtype == DEV_TYPE_MMC ) ) {
+		status = mmc_cmdq( dev, op, timeout );
+	}
+	else {
+		status = EINVAL;
+	}
+
+	_sdio_synchronize( device, !0, -1 );
+
+	return( status );
+}
+
+int sdio_cmdq_queue( struct sdio_device *device, int tag, int flgs, uint64_t lba, int nlba )
+{
+	int			status;
+
+	if( ( status = _sdio_synchronize( device, !0, 1 ) ) != EOK ) {
+		return( status );
+	}
+
+	status = mmc_cmdq_queue( device->dev, tag, flgs, lba, nlba );
+
+	_sdio_synchronize( device, !0, -1 );
+
+	return( status );
+}
+
+int sdio_cmdq_status( struct sdio_device *device, uint32_t *qsr )
+{
+	int			status;
+
+	if( ( status = _sdio_synchronize( device, !0, 1 ) ) != EOK ) {
+		return( status );
+	}
+
+	status = mmc_cmdq_status( device->dev, qsr );
+
+	_sdio_synchronize( device, !0, -1 );
+
+	return( status );
+}
+
+int sdio_cmdq_execute( struct sdio_device *device, struct sdio_cmd *cmd, int tag, int flgs,
+		int blks, int blksz, void *sgl, int sgc, void *mhdl, uint32_t timeout )
+{
+	int			status;
+
+	if( ( status = _sdio_synchronize( device, !0, 1 ) ) != EOK ) {
+		return( status );
+	}
+
+	cmd->hdl	= device;
+	status		= mmc_cmdq_execute( device->dev, cmd, tag, flgs, blks, blksz, sgl, sgc, mhdl, timeout );
+
+	_sdio_synchronize( device, !0, -1 );
+
+	return( status );
+}
+
+int sdio_cmdq_discard( struct sdio_device *device, int tag )
+{
+	int			status;
+
+	if( ( status = _sdio_synchronize( device, !0, 1 ) ) != EOK ) {
+		return( status );
+	}
+
+	status = mmc_cmdq_discard( device->dev, tag );
+
+	_sdio_synchronize( device, !0, -1 );
+
+	return( status );
+}
+
+int sdio_packed_write( struct sdio_device *device, struct sdio_cmd *cmd, uint64_t addr, int flgs,
+		int blks, int blksz, void *sgl, int sgc, void *mhdl, uint32_t timeout )
+{
+	int			status;
+
+	if( device->dev->dtype != DEV_TYPE_MMC ) {
+		return( EINVAL );
+	}
+
+	if( ( status = _sdio_synchronize( device, !0, 1 ) ) != EOK ) {
+		return( status );
+	}
+
+	cmd->hdl	= device;
+	status		= mmc_packed_write( device->dev, cmd, addr, flgs, blks, blksz, sgl, sgc, mhdl, timeout );
+
+	_sdio_synchronize( device, !0, -1 );
+
+	return( status );
+}
+
 int sdio_erase( struct sdio_device *device, int partition, int flgs, uint64_t lba, int nlba )
 {
 	sdio_dev_t	*dev;
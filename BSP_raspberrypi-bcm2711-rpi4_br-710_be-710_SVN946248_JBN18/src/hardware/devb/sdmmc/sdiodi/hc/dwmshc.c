@@ -672,7 +672,7 @@ static int dw_xfer_setup( sdio_hc_t *hc, sdio_cmd_t *cmd, uint32_t *command, uin
 	}
 
 	if( cmd->blks > 1 ) {
-		if( ( hc->caps & HC_CAP_ACMD12 ) ) {
+		if( ( hc->caps & HC_CAP_ACMD12 ) && !( cmd->flags & SCF_NO_ACMD ) ) {
 			*imask		|= DW_INT_ACD;
 			*command	|= DW_CMD_SEND_STOP;
 		}
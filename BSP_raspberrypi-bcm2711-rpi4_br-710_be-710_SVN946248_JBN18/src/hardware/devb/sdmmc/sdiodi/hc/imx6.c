@@ -479,10 +479,10 @@ static int imx6_sdhcx_xfer_setup( sdio_hc_t *hc, sdio_cmd_t *cmd,
 
 	if( cmd->blks > 1 ) {
 		mix_ctrl |= IMX6_SDHCX_MIX_CTRL_MBS | IMX6_SDHCX_MIX_CTRL_BCE;
-		if( ( hc->caps & HC_CAP_ACMD23 ) && ( cmd->flags & SCF_SBC ) ) {
+		if( ( hc->caps & HC_CAP_ACMD23 ) && ( cmd->flags & SCF_SBC ) && !( cmd->flags & SCF_NO_ACMD ) ) {
 			mix_ctrl |= IMX6_SDHCX_MIX_CTRL_ACMD23;
 		}
-		else if( ( hc->caps & HC_CAP_ACMD12 ) ) {
+		else if( ( hc->caps & HC_CAP_ACMD12 ) && !( cmd->flags & SCF_NO_ACMD ) ) {
 			mix_ctrl |= IMX6_SDHCX_MIX_CTRL_ACMD12;
 		}
 	}
@@ -634,11 +634,11 @@ static int imx_sdhcx_xfer_setup(sdio_hc_t *hc, sdio_cmd_t *cmd, uint32_t *comman
 
     if (cmd->blks > 1) {
         mix_ctrl |= IMX_USDHC_MIX_CTRL_MSBSEL_MASK | IMX_USDHC_MIX_CTRL_BCEN_MASK;
-        if ((hc->caps & HC_CAP_ACMD23) && (cmd->flags & SCF_SBC)) {
+        if ((hc->caps & HC_CAP_ACMD23) && (cmd->flags & SCF_SBC) && !(cmd->flags & SCF_NO_ACMD)) {
             /* Auto CMD23 need to use sdma address register to store the argument */
             out32(base + IMX_USDHC_DS_ADDR, cmd->blks);
             mix_ctrl |= IMX_USDHC_MIX_CTRL_AC23EN_MASK;
-        } else if ((hc->caps & HC_CAP_ACMD12)) {
+        } else if ((hc->caps & HC_CAP_ACMD12) && !(cmd->flags & SCF_NO_ACMD)) {
             mix_ctrl |= IMX_USDHC_MIX_CTRL_AC12EN_MASK;
         }
     }
@@ -499,10 +499,10 @@ static int ls10xx_xfer_setup(sdio_hc_t *hc, sdio_cmd_t *cmd, uint32_t *command,
 
     if(cmd->blks > 1) {
         *command |= LS10XX_CMD_MSBSEL | LS10XX_CMD_BCEN;
-        if((hc->caps & HC_CAP_ACMD23) && (cmd->flags & SCF_SBC)) {
+        if((hc->caps & HC_CAP_ACMD23) && (cmd->flags & SCF_SBC) && !(cmd->flags & SCF_NO_ACMD)) {
             *command |= LS10XX_CMD_ACEN_ACMD23;
         }
-        else if((hc->caps & HC_CAP_ACMD12)) {
+        else if((hc->caps & HC_CAP_ACMD12) && !(cmd->flags & SCF_NO_ACMD)) {
             *command |= LS10XX_CMD_ACEN_ACMD12;
         }
     }
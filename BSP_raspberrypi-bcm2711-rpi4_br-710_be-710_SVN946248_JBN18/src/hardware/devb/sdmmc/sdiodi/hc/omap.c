@@ -1110,11 +1110,11 @@ static int omap_xfer_setup( sdio_hc_t *hc, sdio_cmd_t *cmd, uint32_t *command, u
 		//	If block count is more than one, add flags for multiple block transfer.
 		if( cmd->blks > 1 ) {
 			*command |= CMD_MBS | CMD_BCE;
-			if( ( hc->caps & HC_CAP_ACMD23 ) && ( cmd->flags & SCF_SBC ) ) {
+			if( ( hc->caps & HC_CAP_ACMD23 ) && ( cmd->flags & SCF_SBC ) && !( cmd->flags & SCF_NO_ACMD ) ) {
 				*command |= CMD_ACMD23;
 				out32( mmchs->mmc_base + MMCHS_SDMASA, cmd->blks );
 			}
-			else if( ( hc->caps & HC_CAP_ACMD12 ) ) {
+			else if( ( hc->caps & HC_CAP_ACMD12 ) && !( cmd->flags & SCF_NO_ACMD ) ) {
 				*command |= CMD_ACMD12;
 			}
 		}
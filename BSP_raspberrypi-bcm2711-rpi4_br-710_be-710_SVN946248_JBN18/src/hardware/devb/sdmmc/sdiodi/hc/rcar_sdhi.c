@@ -454,7 +454,7 @@ static int rcar_sdhi_cmd(sdio_hc_t *hc, sdio_cmd_t *cmd)
         if (cmd->flags & SCF_MULTIBLK) {
             rcar_sdh_write(sdhi, SDHI_STOP, SDHI_STOP_SEC);
             command |= SDHI_CMD_DAT_MULTI;
-            if (!(hc->caps & HC_CAP_ACMD12))
+            if (!(hc->caps & HC_CAP_ACMD12) || (cmd->flags & SCF_NO_ACMD))
                 command |= SDHI_CMD_NOAC12;
         }
 
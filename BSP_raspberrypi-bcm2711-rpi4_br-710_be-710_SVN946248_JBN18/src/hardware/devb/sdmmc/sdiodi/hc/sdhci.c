@@ -48,15 +48,17 @@ static int sdhci_abort( sdio_hc_t *hc, sdio_cmd_t *cmd );
 static int sdhci_event( sdio_hc_t *hc, sdio_event_t *ev );
 static int sdhci_tune( sdio_hc_t *hc, int op );
 static int sdhci_preset( sdio_hc_t *hc, int enable );
+static int sdhci_prep( sdio_hc_t *hc, sdio_cmd_t *cmd );
 
-static sdio_hc_entry_t sdhci_hc_entry =	{ 16,
+static sdio_hc_entry_t sdhci_hc_entry =	{ 17,
 										sdhci_dinit, NULL,
 										sdhci_cmd, sdhci_abort,
 										sdhci_event, sdhci_cd, sdhci_pwr,
 										sdhci_clk, sdhci_bus_mode,
 										sdhci_bus_width, sdhci_timing,
 										sdhci_signal_voltage, sdhci_drv_type,
-										NULL, sdhci_tune, sdhci_preset
+										NULL, sdhci_tune, sdhci_preset,
+										sdhci_prep
 										};
 #ifdef SDHCI_DEBUG
 static int sdhci_reg_dump( sdio_hc_t *hc, const char *func, int line )
@@ -160,6 +162,7 @@ static int sdhci_reset( sdio_hc_t *hc, uint32_t rst )
 
 	sdhc	= (sdhci_hc_t *)hc->cs_hdl;
 	base	= sdhc->base;
+	sdhc->aprep	= NULL;
 
 	sctl	= sdhci_in32( base + SDHCI_SYSCTL );
 
@@ -215,6 +218,20 @@ static int sdhci_pio_xfer( sdio_hc_t *hc, sdio_cmd_t *cmd )
 	return( EOK );
 }
 
+// DAT0 busy ended (TC) or timed out (DTO), time it from the end of the
+// write data or the R1b response for sdio_cmd_busy()
+static void sdhci_bsy_end( sdio_hc_t *hc, sdio_cmd_t *cmd )
+{
+	sdhci_hc_t		*sdhc;
+
+	sdhc	= (sdhci_hc_t *)hc->cs_hdl;
+
+	if( sdhc->bsy_t0 ) {
+		cmd->bsy_us		= ( ClockCycles( ) - sdhc->bsy_t0 ) / hc->stats_cpu;
+		sdhc->bsy_t0	= 0;
+	}
+}
+
 static int sdhci_intr_event( sdio_hc_t *hc )
 {
 	sdhci_hc_t		*sdhc;
@@ -262,7 +279,16 @@ static int sdhci_intr_event( sdio_hc_t *hc )
 		return( EOK );
 	}
 
-	if( ( sts & SDHCI_INTR_ERRI ) ) {			// Check of errors
+	if( ( sts & SDHCI_INTR_ERRI ) && ( sts & SDHCI_INTR_ERR_MSK ) == SDHCI_INTR_DTO && SDHCI_CMD_BSY( cmd ) ) {
+			// busy outlasted the host's busy timeout, response was
+			// good so complete and leave the rest to card status polling
+		sdhci_bsy_end( hc, cmd );
+		cmd->flags	|= SCF_BSY_POLL;
+		cmd->rsp[0]	= sdhci_in32( base + SDHCI_RESP0 );
+		cs			= CS_CMD_CMP;
+		sdhci_reset( hc, SDHCI_SYSCTL_SRD );
+	}
+	else if( ( sts & SDHCI_INTR_ERRI ) ) {			// Check of errors
 		if( sts & SDHCI_INTR_DTO )		cs = CS_DATA_TO_ERR;
 		if( sts & SDHCI_INTR_DCRC )		cs = CS_DATA_CRC_ERR;
 		if( sts & SDHCI_INTR_DEB )		cs = CS_DATA_END_ERR;
@@ -293,14 +319,24 @@ static int sdhci_intr_event( sdio_hc_t *hc )
 			else if( ( cmd->flags & SCF_RSP_PRESENT ) ) {
 				cmd->rsp[0] = sdhci_in32( base + SDHCI_RESP0 );
 			}
-			cs = CS_CMD_CMP;
+			if( !SDHCI_CMD_BSY( cmd ) ) {		// else complete at busy end (TC)
+				cs = CS_CMD_CMP;
+			}
+			else {
+				sdhc->bsy_t0 = ClockCycles( );
+			}
+		}
+
+		if( ( sts & SDHCI_INTR_DMA ) && ( sdhc->flags & SF_USE_ADMA ) ) {
+			sdhc->bsy_t0 = ClockCycles( );		// last write descriptor done
 		}
 
 		if( ( sts & SDHCI_INTR_TC ) ) {
+			sdhci_bsy_end( hc, cmd );
 			cs = CS_CMD_CMP;
 			cmd->rsp[0] = sdhci_in32( base + SDHCI_RESP0 );
 		}
-		else if( ( sts & SDHCI_INTR_DMA ) ) {	// restart on dma boundary
+		else if( ( sts & SDHCI_INTR_DMA ) && !( sdhc->flags & SF_USE_ADMA ) ) {	// restart on dma boundary
 			sdhci_out32( base + SDHCI_SDMA_ARG2, sdhci_in32( base + SDHCI_SDMA_ARG2 ) );
 		}
 
@@ -348,7 +384,7 @@ static int sdhci_event( sdio_hc_t *hc, sdio_event_t *ev )
 	return( status );
 }
 
-static int sdhci_adma_setup( sdio_hc_t *hc, sdio_cmd_t *cmd )
+static int sdhci_adma_build( sdio_hc_t *hc, sdio_cmd_t *cmd, int idx )
 {
 	sdhci_hc_t			*sdhc;
 	sdhci_adma64_t		*adma;
@@ -357,17 +393,15 @@ static int sdhci_adma_setup( sdio_hc_t *hc, sdio_cmd_t *cmd )
 	int					sgi;
 	int					acnt;
 	int					alen;
+	int					tbl;
 	int					sg_count;
 	paddr64_t			paddr;
+	paddr64_t			lpaddr;
 	int					desc_sz;
 	sdio_hc_cfg_t		*cfg = &hc->cfg;
 
 	sdhc	= (sdhci_hc_t *)hc->cs_hdl;
-	adma	= (sdhci_adma64_t *)sdhc->adma;
-
-#ifdef SDHCI_DEBUG
-	sdio_slogf( _SLOGC_SDIODI, _SLOG_ERROR, 1, 1, "%s: ", __FUNCTION__ );
-#endif
+	adma	= (sdhci_adma64_t *)( (uintptr_t)sdhc->adma + idx * sdhc->adma_sz );
 
 	sgc = cmd->sgc;
 	sgp = cmd->sgl;
@@ -378,10 +412,27 @@ static int sdhci_adma_setup( sdio_hc_t *hc, sdio_cmd_t *cmd )
 	}
 
 	desc_sz = ( sdhc->flags & SF_USE_ADMA64 ) ? sizeof( sdhci_adma64_t ) : sizeof( sdhci_adma32_t );
-	for( sgi = 0, acnt = 0; sgi < sgc; sgi++, sgp++ ) {
+	for( sgi = 0, acnt = 0, tbl = 0; sgi < sgc; sgi++, sgp++ ) {
 		paddr		= sgp->sg_address + cfg->bmstr_xlat;
 		sg_count	= sgp->sg_count;
 		while( sg_count ) {
+				// the last descriptor of a full table links to the next
+				// one, check before writing, the other cmd's tables follow
+			if( acnt == ADMA_DESC_MAX - 1 ) {
+				if( ++tbl >= ADMA_TBL_LINKS ) {
+					return( ENOTSUP );
+				}
+				lpaddr			= sdhc->admap + idx * sdhc->adma_sz + tbl * desc_sz * ADMA_DESC_MAX + cfg->bmstr_xlat;
+				adma->attr		= SDHCI_ADMA2_VALID | SDHCI_ADMA2_LINK;
+				adma->addr_lo	= lpaddr;
+				adma->len		= 0;
+				if( ( sdhc->flags & SF_USE_ADMA64 ) ) {
+					adma->addr_hi = lpaddr >> 32;
+				}
+				adma = (sdhci_adma64_t *)( (uintptr_t)sdhc->adma + idx * sdhc->adma_sz + tbl * desc_sz * ADMA_DESC_MAX );
+				acnt = 0;
+			}
+			acnt++;
 			alen		= min( sg_count, SDHCI_ADMA2_MAX_XFER );
 			adma->attr	= SDHCI_ADMA2_VALID | SDHCI_ADMA2_TRAN;
 			adma->addr_lo	= paddr;
@@ -392,18 +443,60 @@ static int sdhci_adma_setup( sdio_hc_t *hc, sdio_cmd_t *cmd )
 			sg_count	-= alen;
 			paddr		+= alen;
 			adma = (sdhci_adma64_t *)( (uintptr_t)adma + desc_sz );
-			if( ++acnt > ADMA_DESC_MAX ) {
-				return( ENOTSUP );
-			}
 		}
 	}
 
 	adma = (sdhci_adma64_t *)( (uintptr_t)adma - desc_sz );
 	adma->attr |= SDHCI_ADMA2_END;
+	if( !( cmd->flags & SCF_DIR_IN ) ) {
+		adma->attr |= SDHCI_ADMA2_INT;			// data end, busy runs from here to TC
+	}
+
+	return( EOK );
+}
+
+// The caller may set up the prepared cmd again for a different transfer
+// (a merged or readahead request issued ahead of the prepared one), only
+// use the prepared table if it still describes the cmd's data.
+static int sdhci_adma_prepared( sdhci_hc_t *sdhc, sdio_cmd_t *cmd )
+{
+	return( sdhc->aprep == cmd && sdhc->aprep_sgl == cmd->sgl &&
+			sdhc->aprep_sgc == cmd->sgc && sdhc->aprep_blks == cmd->blks &&
+			sdhc->aprep_flags == ( cmd->flags & ( SCF_DATA_PHYS | SCF_DIR_IN ) ) );
+}
+
+static int sdhci_adma_setup( sdio_hc_t *hc, sdio_cmd_t *cmd )
+{
+	sdhci_hc_t			*sdhc;
+	paddr64_t			admap;
+	int					idx;
+	int					status;
+
+	sdhc	= (sdhci_hc_t *)hc->cs_hdl;
+	idx		= sdhc->aidx ^ 1;
+	status	= EOK;
+
+#ifdef SDHCI_DEBUG
+	sdio_slogf( _SLOGC_SDIODI, _SLOG_ERROR, 1, 1, "%s: prepared %d", __FUNCTION__, sdhci_adma_prepared( sdhc, cmd ) );
+#endif
 
-	sdhci_out32( sdhc->base + SDHCI_ADMA_ADDRL, (uint32_t)(sdhc->admap + cfg->bmstr_xlat) );
+		// the table may already have been built by sdhci_prep
+		// while the previous command was transferring
+	if( !sdhci_adma_prepared( sdhc, cmd ) ) {
+		status = sdhci_adma_build( hc, cmd, idx );
+	}
+	sdhc->aprep = NULL;
+
+	if( status != EOK ) {
+		return( status );
+	}
+
+	sdhc->aidx	= idx;
+	admap		= sdhc->admap + idx * sdhc->adma_sz + hc->cfg.bmstr_xlat;
+
+	sdhci_out32( sdhc->base + SDHCI_ADMA_ADDRL, (uint32_t)admap );
 	if( ( sdhc->flags & SF_USE_ADMA64 ) ) {
-		sdhci_out32( sdhc->base + SDHCI_ADMA_ADDRH, (uint32_t)((sdhc->admap + cfg->bmstr_xlat) >> 32) );
+		sdhci_out32( sdhc->base + SDHCI_ADMA_ADDRH, (uint32_t)( admap >> 32 ) );
 	}
 
 	return( EOK );
@@ -456,6 +549,7 @@ static int sdhci_xfer_setup( sdio_hc_t *hc, sdio_cmd_t *cmd,
 			if( ( status = sdhci_adma_setup( hc, cmd ) ) == EOK ) {
 				hctl		|= ( sdhc->flags & SF_USE_ADMA64 ) ? SDHCI_HCTL_ADMA64 : SDHCI_HCTL_ADMA32;
 				*command	|= SDHCI_CMD_DE;
+				*imask		|= ( cmd->flags & SCF_DIR_IN ) ? 0 : SDHCI_INTR_DMA;
 			}
 		}
 		else {
@@ -476,11 +570,11 @@ static int sdhci_xfer_setup( sdio_hc_t *hc, sdio_cmd_t *cmd,
 
 	if( cmd->blks > 1 ) {
 		*command |= SDHCI_CMD_MBS | SDHCI_CMD_BCE;
-		if( ( hc->caps & HC_CAP_ACMD23 ) && ( cmd->flags & SCF_SBC ) ) {
+		if( ( hc->caps & HC_CAP_ACMD23 ) && ( cmd->flags & SCF_SBC ) && !( cmd->flags & SCF_NO_ACMD ) ) {
 			*command |= SDHCI_CMD_ACMD23;
 			sdhci_out32( base + SDHCI_SDMA_ARG2, cmd->blks );
 		}
-		else if( ( hc->caps & HC_CAP_ACMD12 ) ) {
+		else if( ( hc->caps & HC_CAP_ACMD12 ) && !( cmd->flags & SCF_NO_ACMD ) ) {
 			*command |= SDHCI_CMD_ACMD12;
 		}
 	}
@@ -516,6 +610,8 @@ static int sdhci_cmd( sdio_hc_t *hc, sdio_cmd_t *cmd )
 	command	= cmd->opcode << 24;
 
 	sdhci_out32( base + SDHCI_IS, SDHCI_INTR_CLR_MSK );	// Clear Status
+	sdhc->bsy_t0	= 0;
+	cmd->bsy_us		= 0;
 
 	if( cmd->opcode == MMC_STOP_TRANSMISSION ) {
 		command |= SDHCI_CMD_TYPE_CMD12;
@@ -529,6 +625,13 @@ static int sdhci_cmd( sdio_hc_t *hc, sdio_cmd_t *cmd )
 	}
 	else {
 		imask |= SDHCI_INTR_CC;						// Enable command complete intr
+		if( SDHCI_CMD_BSY( cmd ) ) {
+				// TC signals the end of DAT0 busy, DTO the busy timeout
+			imask |= SDHCI_INTR_TC | SDHCI_INTR_DTO;
+			if( cmd->opcode != MMC_STOP_TRANSMISSION ) {
+				pmask |= SDHCI_PSTATE_DATI;
+			}
+		}
 	}
 
 	if( ( cmd->flags & SCF_RSP_PRESENT ) ) {
@@ -567,6 +670,36 @@ static int sdhci_abort( sdio_hc_t *hc, sdio_cmd_t *cmd )
 	return( EOK );
 }
 
+// Build the ADMA table of the command that will be issued next into the
+// table the controller is not using, so sdhci_adma_setup only has to
+// point the controller at it.  A NULL cmd drops the prepared table.
+static int sdhci_prep( sdio_hc_t *hc, sdio_cmd_t *cmd )
+{
+	sdhci_hc_t		*sdhc;
+	int				status;
+
+	sdhc		= (sdhci_hc_t *)hc->cs_hdl;
+	sdhc->aprep	= NULL;
+
+	if( cmd == NULL ) {
+		return( EOK );
+	}
+
+	if( !cmd->sgc || !( hc->caps & HC_CAP_DMA ) || !( sdhc->flags & SF_USE_ADMA ) ) {
+		return( ENOTSUP );
+	}
+
+	if( ( status = sdhci_adma_build( hc, cmd, sdhc->aidx ^ 1 ) ) == EOK ) {
+		sdhc->aprep			= cmd;
+		sdhc->aprep_sgl		= cmd->sgl;
+		sdhc->aprep_sgc		= cmd->sgc;
+		sdhc->aprep_blks	= cmd->blks;
+		sdhc->aprep_flags	= cmd->flags & ( SCF_DATA_PHYS | SCF_DIR_IN );
+	}
+
+	return( status );
+}
+
 static int sdhci_pwr( sdio_hc_t *hc, int vdd )
 {
 	sdhci_hc_t		*sdhc;
@@ -1004,10 +1137,14 @@ static int sdhci_tune( sdio_hc_t *hc, int op )
 		}
 	}
 
+		// EIO means the card never matched the tuning pattern, a failed
+		// command (card removed, timeout) keeps its own status
 	if( status || ( hctl2 & SDHCI_HCTL2_EXEC_TUNING ) ) {
 		hctl2 &= ~( SDHCI_HCTL2_TUNED_CLK | SDHCI_HCTL2_EXEC_TUNING );
 		sdhci_out16( base + SDHCI_HCTL2, hctl2 );
-		status = EIO;
+		if( status == EOK ) {
+			status = EIO;
+		}
 	}
 
 	sdio_free_cmd( cmd );
@@ -1087,7 +1224,7 @@ int sdhci_dinit( sdio_hc_t *hc )
 	}
 
 	if( sdhc->adma ) {
-		sdio_free( sdhc->adma, sizeof( sdhci_adma32_t ) * ADMA_DESC_MAX );
+		sdio_free( sdhc->adma, sdhc->adma_sz * ADMA_TBL_MAX );
 	}
 
 	free( sdhc );
@@ -1293,7 +1430,8 @@ int sdhci_init( sdio_hc_t *hc )
 				hc->caps	|= HC_CAP_ACMD23;
 			}
 			hc->cfg.sg_max	= ADMA_DESC_MAX;
-			if( ( sdhc->adma = sdio_alloc( desc_sz * ADMA_DESC_MAX ) ) == NULL) {
+			sdhc->adma_sz	= desc_sz * ADMA_DESC_MAX * ADMA_TBL_LINKS;
+			if( ( sdhc->adma = sdio_alloc( sdhc->adma_sz * ADMA_TBL_MAX ) ) == NULL) {
 				sdio_slogf( _SLOGC_SDIODI, _SLOG_ERROR, 1, 1, "%s: ADMA mmap %s", __FUNCTION__, strerror( errno ) );
 				sdhci_dinit( hc );
 				return( errno );
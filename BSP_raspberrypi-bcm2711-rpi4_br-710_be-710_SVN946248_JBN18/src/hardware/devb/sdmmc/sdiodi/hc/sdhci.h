@@ -231,6 +231,7 @@ sdhci_out32s(const void *__buff, unsigned __len, _Uintptrt __addr) {
 									 SDHCI_INTR_ERRI /* | SDHCI_INTR_CINS | SDHCI_INTR_CREM */ )
 	#define SDHCI_INTR_ALL			0x33ff87ff
 	#define SDHCI_INTR_CLR_MSK		0x117f80f3
+	#define SDHCI_INTR_ERR_MSK		0xffff0000
 
 #define	SDHCI_AC12				0x3C
 
@@ -335,11 +336,14 @@ typedef struct _sdhci_adma64_t {
 
 #define SDHCI_ADMA2_VALID	(1 << 0)	// valid
 #define SDHCI_ADMA2_END		(1 << 1)	// end of descriptor, transfer complete interrupt will be generated
-#define SDHCI_ADMA2_INT		(1 << 2)	// generate DMA interrupt, will not be used
+#define SDHCI_ADMA2_INT		(1 << 2)	// generate DMA interrupt, marks the end of write data
 #define SDHCI_ADMA2_NOP		(0 << 4)	// no OP, go to the next desctiptor
 #define SDHCI_ADMA2_TRAN	(2 << 4)	// transfer data
 #define SDHCI_ADMA2_LINK	(3 << 4)	// link to another descriptor
 
+// command without data that holds DAT0 busy (R1b), completes with TC
+#define SDHCI_CMD_BSY(_c)	( ( (_c)->flags & SCF_RSP_BUSY ) && !( (_c)->flags & SCF_DATA_MSK ) )
+
 // extra 32 bit on top of the descriptor for V4 mode
 #define SDHCI_ADMA2_64_DESC_SZ(sdhc)	\
 		(( sdhc->flags & SF_V4_MODE ) ? sizeof( sdhci_adma64_t ) + sizeof( uint32_t ) : sizeof( sdhci_adma64_t ))
@@ -362,9 +366,19 @@ typedef	struct _sdhci_hc {
 	int				tuning_mode;
 
 #define ADMA_DESC_MAX		256
+#define ADMA_TBL_MAX		2		// tables, next cmd is prepared while the current one runs
+#define ADMA_TBL_LINKS		4		// linked tables per cmd, large or fragmented transfers
 	sdio_sge_t		sgl[ADMA_DESC_MAX];
 	sdhci_adma64_t	*adma;
 	paddr64_t		admap;
+	int				adma_sz;		// size of the linked tables of one cmd
+	int				aidx;			// table last given to the controller
+	sdio_cmd_t		*aprep;			// cmd prepared in the other table
+	sdio_sge_t		*aprep_sgl;		// transfer the prepared table was built for
+	uint32_t		aprep_sgc;
+	uint32_t		aprep_blks;
+	uint32_t		aprep_flags;
+	uint64_t		bsy_t0;			// ClockCycles at the end of write data or the R1b response
 } sdhci_hc_t;
 
 extern int sdhci_init( sdio_hc_t *hc );
@@ -647,11 +647,11 @@ static int sdhci_xfer_setup( sdio_hc_t *hc, sdio_cmd_t *cmd,
 
     if( cmd->blks > 1 ) {
         *command |= SDHCI_CMD_MBS | SDHCI_CMD_BCE;
-        if( ( hc->caps & HC_CAP_ACMD23 ) && ( cmd->flags & SCF_SBC ) ) {
+        if( ( hc->caps & HC_CAP_ACMD23 ) && ( cmd->flags & SCF_SBC ) && !( cmd->flags & SCF_NO_ACMD ) ) {
             *command |= SDHCI_CMD_ACMD23;
             sdhci_out32( base + SDHCI_SDMA_ARG2, cmd->blks );
         }
-        else if( ( hc->caps & HC_CAP_ACMD12 ) ) {
+        else if( ( hc->caps & HC_CAP_ACMD12 ) && !( cmd->flags & SCF_NO_ACMD ) ) {
             *command |= SDHCI_CMD_ACMD12;
         }
     }
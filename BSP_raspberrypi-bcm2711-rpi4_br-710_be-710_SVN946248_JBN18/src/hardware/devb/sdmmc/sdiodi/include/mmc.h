@@ -103,9 +103,10 @@
 
 #define	MMC_SEND_STATUS				13
 	#define MMC_SEND_STATUS_HPI			(1 << 0)
+	#define MMC_SEND_STATUS_SQS			(1 << 15)	// return Queue Status Register (CMDQ)
 
 // Card/Device Status Response Bits
-	#define	CDS_OUT_OF_RANGE			(1 << 31)
+	#define	CDS_OUT_OF_RANGE			(1U << 31)
 	#define	CDS_ADDRESS_ERROR			(1 << 30)
 	#define	CDS_BLOCK_LEN_ERROR			(1 << 29)
 	#define	CDS_ERASE_SEQ_ERROR			(1 << 28)
@@ -167,7 +168,8 @@
 #define	MMC_WRITE_DAT_UNTIL_STOP	20
 #define MMC_SEND_TUNING_BLOCK		21
 #define MMC_SET_BLOCK_COUNT         23
-	#define	SBC_RL_WRITE				(1 << 31)
+	#define	SBC_RL_WRITE				(1U << 31)
+	#define	SBC_PACKED					(1 << 30)	// packed command, first block is the header
 #define	MMC_WRITE_BLOCK				24
 #define	MMC_WRITE_MULTIPLE_BLOCK	25
 #define	MMC_PROGRAM_CID				26
@@ -203,6 +205,21 @@
 	#define MMC_LU_SET_PWD				0x01
 	#define MMC_LU_PWD_SIZE				16		// max password size
 
+#define	MMC_QUEUED_TASK_PARAMS		44
+	#define MMC_QTP_RL_WRITE			(1U << 31)	// reliable write
+	#define MMC_QTP_DIR_READ			(1 << 30)
+	#define MMC_QTP_FORCED_PRG			(1 << 24)
+	#define MMC_QTP_PRIORITY			(1 << 23)
+	#define MMC_QTP_TASK_ID( _t )		( ( (_t) & 0x1f ) << 16 )
+	#define MMC_QTP_BLKS_MAX			0xffff
+#define	MMC_QUEUED_TASK_ADDRESS		45
+#define	MMC_EXECUTE_READ_TASK		46
+#define	MMC_EXECUTE_WRITE_TASK		47
+#define	MMC_CMDQ_TASK_MGMT			48
+	#define MMC_CMDQ_TM_DISCARD_QUEUE	0x1
+	#define MMC_CMDQ_TM_DISCARD_TASK	0x2
+	#define MMC_CMDQ_TASKS_MAX			32
+
 #define	MMC_APP_CMD					55
 #define	MMC_GEN_CMD					56
 #define	MMC_READ_OCR				58
@@ -213,9 +230,18 @@
 #define	MMC_MAN_CMD3				62
 #define	MMC_MAN_CMD4				63
 
+// packed command header
+#define MMC_PACKED_VERSION			0x01
+#define MMC_PACKED_READ				0x01
+#define MMC_PACKED_WRITE			0x02
+#define MMC_PACKED_HDR(_rw, _n)		( MMC_PACKED_VERSION | ( (_rw) << 8 ) | ( ( (_n) & 0xff ) << 16 ) )
+
 // EXT_CSD fields
 #define MMC_EXT_CSD_SIZE			512
 
+#define ECSD_CMDQ_MODE_EN			15
+	#define ECSD_CMDQ_ENABLE			0x01
+
 #define	ECSD_FFU_STATUS				26
 	#define	ECSD_FFU_SUCCESS			0x00
 	#define	ECSD_FFU_GENERAL			0x10	// General error
@@ -414,6 +440,12 @@
 
 #define	ECSD_FIRMWARE_VERSION		254	// Firmware version, 8 bytes
 
+#define ECSD_CMDQ_DEPTH				307
+	#define ECSD_CMDQ_DEPTH_MSK			0x1f	// queue depth - 1
+
+#define ECSD_CMDQ_SUPPORT			308
+	#define ECSD_CMDQ_SUP				0x01
+
 #define	ECSD_FFU_ARG				487	// FFU argument, 4 bytes
 
 #define ECSD_FFU_FEATURE			492
@@ -423,6 +455,8 @@
 	#define	ECSD_FFU_SUPPORTED		(1 << 0)	// Device support FFU
 	#define	ECSD_VSM_SUPPORTED		(1 << 1)	// Device support Vendor Specific Mode
 
+#define ECSD_MAX_PACKED_WRITES		501
+
 #define ECSD_BKOPS_SUPPORTED		502  // Background operation support
 	#define ECSD_BKOPS_SUP				1
 
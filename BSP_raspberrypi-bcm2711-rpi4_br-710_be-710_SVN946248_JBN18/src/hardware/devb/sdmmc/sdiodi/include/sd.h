@@ -61,7 +61,7 @@
 #define	SD_STOP_TRANSMISSION		12
 #define	SD_SEND_STATUS				13
 // Card/Device Status Response Bits
-	#define	CDS_OUT_OF_RANGE			(1 << 31)
+	#define	CDS_OUT_OF_RANGE			(1U << 31)
 	#define	CDS_ADDRESS_ERROR			(1 << 30)
 	#define	CDS_BLOCK_LEN_ERROR			(1 << 29)
 	#define	CDS_ERASE_SEQ_ERROR			(1 << 28)
@@ -31,6 +31,8 @@
 #define	SDIO_TRUE					1
 #define SDIO_TIME_DEFAULT			1000
 #define SDIO_BKOPS_MAX_TIMEOUT		(4* 60 * 1000)
+#define SDIO_BSY_POLL_MIN			16		// us, first card status poll interval
+#define SDIO_BSY_POLL_SPIN			256		// us, longest interval spun rather than slept
 
 #define SDIO_DATA_PTR_V( _p )		( (void *)(uintptr_t)(_p) )
 #define SDIO_DATA_PTR_P( _p )		( (uintptr_t)(_p) )
@@ -44,6 +46,7 @@ typedef struct _sdio_csd				sdio_csd_t;
 typedef struct _sdio_ecsd				sdio_ecsd_t;
 typedef struct _sdio_hc_info			sdio_hc_info_t;
 typedef struct _sdio_dev_info			sdio_dev_info_t;
+typedef struct _sdio_stats				sdio_stats_t;
 typedef struct _sdio_funcs				sdio_funcs_t;
 typedef struct _sdio_connect_parm		sdio_connect_parm_t;
 typedef struct _sdio_device_ident		sdio_device_ident_t;
@@ -195,6 +198,8 @@ struct _sdio_sge {
 // driver internal
 #define	SCF_DATA_PHYS		(1 << 24)	// data physical address
 #define	SCF_MULTIBLK		(1 << 25)
+#define	SCF_BSY_POLL		(1 << 26)	// host gave up on busy detection, poll card status
+#define	SCF_NO_ACMD			(1 << 27)	// block count set by the caller, no auto cmd 12/23
 
 // command status
 #define CS_CMD_INPROG		0x00
@@ -277,6 +282,8 @@ struct _sdio_dev_info {
 #define DEV_CAP_HS400ES			(1 << 18)
 #define DEV_CAP_BKOPS_AUTO		(1 << 19)	// Auto Background Operations supported
 #define DEV_CAP_UC				(1 << 20)	// ultra capacity (2TB - 128TB)
+#define DEV_CAP_CMDQ			(1 << 21)	// Command Queue supported
+#define DEV_CAP_PACKED			(1 << 22)	// Packed write commands supported
 
 	_Uint64t			caps;
 
@@ -308,8 +315,10 @@ struct _sdio_dev_info {
 #define SPEED_CLASS_6	0x03
 #define SPEED_CLASS_10	0x04
 	_Uint32t			speed_class;
+	_Uint32t			cmdq_depth;		// Command Queue depth (tasks)
+	_Uint32t			packed_wr;		// max writes in a packed command
 
-	_Uint32t			rsvd[15];
+	_Uint32t			rsvd[13];
 };
 
 struct _sdio_hc_info {
@@ -334,6 +343,7 @@ struct _sdio_hc_info {
 #define	HC_CAP_DDR50				(1 << 14)	// Dual Data Rate supported
 #define HC_CAP_HS200				(1 << 15)
 #define HC_CAP_HS400				(1 << 16)
+#define HC_CAP_BSY					(1LL << 33)	// card detect busy supported
 #define HC_CAP_HS400ES				(1LL << 34)
 	_Uint64t		caps;
 	_Uint32t		version;
@@ -347,6 +357,45 @@ struct _sdio_hc_info {
 	_Uint32t		rsvd[10];
 };
 
+// Command statistics, collected while enabled.  Each command is timed from
+// sdio_send_cmd to the host taking it (setup), from there to its completion
+// (xfer), and the DAT0 busy after it (busy), waited out by the host and in
+// card status polls.  Busy after a CMD12 goes with the data command it stops.
+#define SDIO_STATS_OPS				16		// opcodes, in order of first use
+#define SDIO_STATS_LAT_BINS			16		// bin n counts 2^n to 2^(n+1) us
+#define SDIO_STATS_BYTE_BINS		12		// bin n counts 512 << n bytes or less
+#define SDIO_STATS_SETUP			0
+#define SDIO_STATS_XFER				1
+#define SDIO_STATS_BUSY				2
+#define SDIO_STATS_PHASES			3
+
+typedef struct _sdio_lat_hist {
+	_Uint32t		count;
+	_Uint32t		max_us;
+	_Uint64t		total_us;
+	_Uint32t		hist[SDIO_STATS_LAT_BINS];
+} sdio_lat_hist_t;
+
+typedef struct _sdio_op_stats {
+#define SDIO_STATS_ACMD				0x100	// application command
+	_Uint32t		opcode;
+	_Uint32t		errors;
+	sdio_lat_hist_t	lat[SDIO_STATS_PHASES];
+	_Uint32t		bytes[SDIO_STATS_BYTE_BINS];
+} sdio_op_stats_t;
+
+struct _sdio_stats {
+	_Uint32t		enabled;
+	_Uint32t		nops;
+	_Uint32t		overflow;					// commands of opcodes beyond SDIO_STATS_OPS
+	_Uint32t		resets;						// counted while disabled too
+	_Uint32t		retunes;
+	_Uint32t		tunes;						// tuning requests, at init and retune
+	_Uint32t		tune_fails;
+	_Uint32t		rsvd[1];
+	sdio_op_stats_t	ops[SDIO_STATS_OPS];
+};
+
 struct _sdio_funcs {
 	int			nfuncs;
 
@@ -382,6 +431,7 @@ extern int				sdio_hpi( struct sdio_device *device, uint32_t timeout);
 extern int				sdio_send_status( struct sdio_device *, _Uint32t *rsp, int hpi );
 extern int				sdio_wait_card_status( struct sdio_device *device, uint32_t *rsp, uint32_t mask, uint32_t val, uint32_t msec );
 extern int				sdio_stop_transmission( struct sdio_device *device, int hpi );
+extern int				sdio_stop_transmission_ext( struct sdio_device *device, int hpi, _Uint32t *bsy_us );
 extern int				sdio_set_block_count( struct sdio_device *device, int blkcnt, uint32_t flgs );
 extern int				sdio_set_block_length( struct sdio_device *device, int blklen );
 extern int				sdio_lock_unlock( struct sdio_device *device, int action, uint8_t *pwd, int pwd_len );
@@ -391,9 +441,11 @@ extern int				sdio_erase( struct sdio_device *, int partition, int flgs,
 extern struct sdio_cmd	*sdio_alloc_cmd( void );
 extern void				sdio_free_cmd( struct sdio_cmd * );
 extern int				sdio_cmd_status( struct sdio_cmd *cmd, _Uint32t *status, _Uint32t *rsp );
+extern _Uint32t			sdio_cmd_busy( struct sdio_cmd *cmd );
 extern int				sdio_send_cmd( struct sdio_device *dev, struct sdio_cmd *cmd,
 							void (*func)( struct sdio_device *, struct sdio_cmd *, void *),
 							_Uint32t timeout, int retries );
+extern int				sdio_prep_cmd( struct sdio_device *dev, struct sdio_cmd *cmd );
 extern int				sdio_setup_cmd( struct sdio_cmd *cmd, _Uint32t flgs,
 							_Uint32t op, _Uint32t arg );
 extern int				sdio_setup_cmd_ext( struct sdio_cmd *cmd, _Uint32t flgs,
@@ -418,10 +470,26 @@ extern int				sdio_mmc_gen_man( struct sdio_device *device, uint8_t op, void *bu
 extern int				sdio_hc_info( struct sdio_device *dev, sdio_hc_info_t *info );
 extern int				sdio_dev_info( struct sdio_device *device, sdio_dev_info_t *info );
 extern int				sdio_retune( struct sdio_device *device );
+#define SDIO_STATS_GET		0
+#define SDIO_STATS_CLEAR	1				// get, then clear
+#define SDIO_STATS_ENABLE	2
+#define SDIO_STATS_DISABLE	3
+extern int				sdio_stats( struct sdio_device *dev, sdio_stats_t *stats, int action );
+extern int				sdio_stats_bin( _Uint64t us, int bins );
 #define SDIO_CACHE_DISABLE	0
 #define SDIO_CACHE_ENABLE	1
 #define SDIO_CACHE_FLUSH	2
 extern int				sdio_cache( struct sdio_device *dev, int op, uint32_t timeout );
+#define SDIO_CMDQ_DISABLE	0
+#define SDIO_CMDQ_ENABLE	1
+extern int				sdio_cmdq( struct sdio_device *dev, int op, uint32_t timeout );
+extern int				sdio_cmdq_queue( struct sdio_device *dev, int tag, int flgs, uint64_t lba, int nlba );
+extern int				sdio_cmdq_status( struct sdio_device *dev, _Uint32t *qsr );
+extern int				sdio_cmdq_execute( struct sdio_device *dev, struct sdio_cmd *cmd, int tag, int flgs,
+							int blks, int blksz, void *sgl, int sgc, void *mhdl, _Uint32t timeout );
+extern int				sdio_cmdq_discard( struct sdio_device *dev, int tag );
+extern int				sdio_packed_write( struct sdio_device *dev, struct sdio_cmd *cmd, uint64_t addr, int flgs,
+							int blks, int blksz, void *sgl, int sgc, void *mhdl, _Uint32t timeout );
 extern int				sdio_set_partition( struct sdio_device *dev, _Uint32t partition );
 extern struct sdio_device *sdio_device_lookup( struct sdio_connection *connection,
 							sdio_device_instance_t *instance );
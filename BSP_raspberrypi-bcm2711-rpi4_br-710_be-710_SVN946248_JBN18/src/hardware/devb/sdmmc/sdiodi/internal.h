@@ -89,6 +89,7 @@ typedef struct _sdio_vendor			sdio_vendor_t;
 typedef struct _sdio_product		sdio_product_t;
 typedef struct _sdio_device_errata	sdio_device_errata_t;
 typedef struct _sdio_pci_dev		sdio_pci_dev_t;
+typedef struct _sdio_tune_rec		sdio_tune_rec_t;
 
 #define DTR_MAX_SDR104			208000000
 #define DTR_MAX_SDR50			100000000
@@ -149,6 +150,7 @@ struct sdio_cmd {
 	sdio_sge_t				*sgl;
 	void					*mhdl;
 	void					(*cbf)( struct sdio_device *, sdio_cmd_t *, void *);
+	_Uint32t				bsy_us;	// DAT0 busy waited out by the host, see sdio_cmd_busy()
 };
 
 struct _sdio_wspc {
@@ -219,6 +221,7 @@ struct _sdio_hc_entry {
 	int			(*driver_strength)(sdio_hc_t *, int timing, int type);
 	int			(*tune)(sdio_hc_t *, int op);
 	int			(*preset)(sdio_hc_t *, int);
+	int			(*prep)(sdio_hc_t *, sdio_cmd_t *);	// build a queued cmd's data xfer, NULL cancels
 };
 
 struct _sdio_dev {
@@ -243,6 +246,7 @@ struct _sdio_dev {
 #define DEV_FLAG_WRITE_PROTECT	0x4000		// write protected
 #define DEV_FLAG_WCE			0x8000		// Write Cache Enable
 #define DEV_FLAG_HS400ES		0x10000		// high speed 400 enhanced strobe
+#define DEV_FLAG_CMDQ			0x20000		// Command Queue enabled
 	_Uint32t				flags;
 
 	_Uint32t				rsettle;
@@ -349,6 +353,20 @@ struct _sdio_pci_dev {
 	uint32_t			pflags;
 };
 
+	// Outcome of tuning a card, kept per CID across resets and power
+	// management until the card is removed. The sampling point itself stays
+	// in the host, which loses it on reset, so what is kept is which timings
+	// a card tunes at. Only EIO from entry.tune, the pattern never matched,
+	// counts as a failure.
+struct _sdio_tune_rec {
+	_Uint32t			cid[SDIO_CID_SIZE];	// raw CID, all 0 when unused
+	_Uint32t			timing;				// TIMING_xxx last tuned at
+	_Uint32t			clk;				// and its clock
+	_Uint32t			fails;				// failed tunings in a row at timing
+	_Uint32t			avoid;				// ( 1 << TIMING_xxx ) the card could not be tuned at
+	_Uint32t			stamp;				// last use, the oldest is replaced
+};
+
 struct _sdio_hc {							// Host Controller
 	TAILQ_ENTRY(_sdio_hc)	hlink;
 	sdio_hc_cfg_t		cfg;
@@ -447,6 +465,11 @@ struct _sdio_hc {							// Host Controller
 	int					tuning_count;
 	int					tuning_timerid;
 
+#define SDIO_TUNE_CACHE		4				// cards remembered
+#define SDIO_TUNE_FAILS		2				// failed tunings in a row before a timing is avoided
+	sdio_tune_rec_t		tune_cache[SDIO_TUNE_CACHE];
+	_Uint32t			tune_stamp;
+
 	int					slot;
 
 	sdio_pci_dev_t		pci;
@@ -468,6 +491,11 @@ struct _sdio_hc {							// Host Controller
 
 	_Uint32t			bus_errs;			// bus errors
 
+	sdio_stats_t		stats;				// see sdio_stats()
+	sdio_op_stats_t		*stats_last;		// last command, busy waits are charged to it
+	_Uint64t			stats_bsy;			// us of busy the host waited out after it, not yet charged
+	_Uint64t			stats_cpu;			// ClockCycles per us, for stats and busy times
+
 	void				*cs_hdl;			// Chipset specfic handle
 	void				*bs_hdl;			// Board specfic handle
 };
@@ -547,6 +575,7 @@ extern int sdio_all_send_cid( sdio_hc_t *hc, uint32_t *cid );
 
 extern int sdio_clock( sdio_hc_t *hc, int clk );
 extern int sdio_tune( sdio_hc_t *hc, int cmd );
+extern int sdio_tune_failed( sdio_hc_t *hc, int timing );
 extern int sdio_preset( sdio_hc_t *hc, int state );
 extern int sdio_timing( sdio_hc_t *hc, int timing );
 extern int sdio_bus_mode( sdio_hc_t *hc, int bus_mode );
@@ -564,7 +593,7 @@ extern int _sdio_pwrmgnt( sdio_dev_t *dev, int pm );
 extern int _sdio_retune( sdio_hc_t *hc );
 extern int _sdio_set_block_count( sdio_dev_t *dev, int blkcnt, uint32_t flgs );
 extern int _sdio_set_block_length( sdio_dev_t *dev, int blklen );
-extern int _sdio_stop_transmission( sdio_dev_t *dev, int hpi );
+extern int _sdio_stop_transmission( sdio_dev_t *dev, int hpi, uint32_t *bsy_us );
 extern int _sdio_send_status( sdio_dev_t *dev, uint32_t *rsp, int hpi );
 extern int _sdio_send_cmd( sdio_dev_t *dev, struct sdio_cmd *cmd,
 		void (*func)( struct sdio_device *, sdio_cmd_t *, void *),
@@ -587,6 +616,12 @@ extern int mmc_sleep_awake( sdio_dev_t *dev, int flgs );
 extern int mmc_send_ext_csd( sdio_dev_t *dev, uint8_t *csd );
 extern int mmc_set_partition( sdio_dev_t *dev, uint32_t partition );
 extern int mmc_cache( sdio_dev_t *dev, int op, uint32_t timeout );
+extern int mmc_cmdq( sdio_dev_t *dev, int op, uint32_t timeout );
+extern int mmc_cmdq_queue( sdio_dev_t *dev, int tag, int flgs, uint64_t lba, int nlba );
+extern int mmc_cmdq_status( sdio_dev_t *dev, uint32_t *qsr );
+extern int mmc_cmdq_execute( sdio_dev_t *dev, sdio_cmd_t *cmd, int tag, int flgs, int blks, int blksz, void *sgl, int sgc, void *mhdl, uint32_t timeout );
+extern int mmc_cmdq_discard( sdio_dev_t *dev, int tag );
+extern int mmc_packed_write( sdio_dev_t *dev, sdio_cmd_t *cmd, uint64_t addr, int flgs, int blks, int blksz, void *sgl, int sgc, void *mhdl, uint32_t timeout );
 extern uint64_t mmc_erase_timeout( sdio_dev_t *dev, uint32_t etype, uint64_t nlba );
 extern int mmc_erase( sdio_dev_t *dev, int partition, int flgs, uint64_t lba, int nlba );
 extern int mmc_write_protect( sdio_dev_t *dev, int op, int ptype, int mode, uint32_t lba, uint32_t nlba );
@@ -283,6 +283,10 @@ static int mmc_parse_ext_csd( sdio_dev_t *dev, sdio_ecsd_t *ecsd, uint8_t *raw_e
 			dev->caps	|= DEV_CAP_CACHE;
 		}
 
+		if( raw_ecsd[ECSD_MAX_PACKED_WRITES] > 1 ) {
+			dev->caps	|= DEV_CAP_PACKED;
+		}
+
 		ecsd->driver_strength = raw_ecsd[ECSD_DRIVER_STRENGTH];
 		if( !( ecsd->driver_strength & ( 1 << hc->drv_type ) ) ) {
 			hc->drv_type = 0;	// fall back to default value
@@ -309,6 +313,13 @@ static int mmc_parse_ext_csd( sdio_dev_t *dev, sdio_ecsd_t *ecsd, uint8_t *raw_e
 		if( ( dev->caps & DEV_CAP_BKOPS ) ) {
 			dev->caps |= DEV_CAP_BKOPS_AUTO;
 		}
+			// Command Queue
+		if( ( raw_ecsd[ECSD_CMDQ_SUPPORT] & ECSD_CMDQ_SUP ) ) {
+			dev->caps |= DEV_CAP_CMDQ;
+			if( ( raw_ecsd[ECSD_CMDQ_MODE_EN] & ECSD_CMDQ_ENABLE ) ) {
+				dev->flags	|= DEV_FLAG_CMDQ;
+			}
+		}
 	}
 
 	ecsd->card_type = raw_ecsd[ECSD_CARD_TYPE] & ECSD_CARD_TYPE_MSK;
@@ -436,7 +447,6 @@ int mmc_rpmb_rw( sdio_dev_t *dev, void *pf, int nf, int flgs )
 	uint32_t		flags;
 	uint32_t		sbcflg = 0;
 	int				op;
-	uint64_t		acmd_caps;
 	int				status;
 
 	hc		= dev->hc;
@@ -464,20 +474,14 @@ int mmc_rpmb_rw( sdio_dev_t *dev, void *pf, int nf, int flgs )
 	}
 
 	if( ( status = _sdio_set_block_count( dev, nf, sbcflg ) ) == EOK ) {
-			// We have to temporarily disable ACMD12/ACMD23, otherwise HC will try
-			// to use ACMD12/ACMD23 feature, which messes up the command sequence
-		acmd_caps = hc->caps & ( HC_CAP_ACMD23 | HC_CAP_ACMD12 );
-		hc->caps &= ~( HC_CAP_ACMD23 | HC_CAP_ACMD12 );
-
+			// The HC mustn't use ACMD12/ACMD23, which
+			// messes up the command sequence
 		sge.sg_count   = RPMB_FRAME_SIZE * nf;
 		sge.sg_address = (paddr_t)buf;
 		sdio_setup_cmd( cmd, flags, op, 0 );
-		sdio_setup_cmd_io( cmd, flags, nf, RPMB_FRAME_SIZE, &sge, 1, NULL );
+		sdio_setup_cmd_io( cmd, flags | SCF_NO_ACMD, nf, RPMB_FRAME_SIZE, &sge, 1, NULL );
 		status = _sdio_send_cmd( dev, cmd, NULL, SDIO_TIME_DEFAULT * 5, 0 );
 
-			// Restore ACMD12/ACMD23 flag
-		hc->caps |= acmd_caps;
-
 		if( status == EOK && flgs == SCF_DIR_IN ) {
 			memcpy( pf, buf, nf * RPMB_FRAME_SIZE );
 		}
@@ -630,6 +634,167 @@ int mmc_cache( sdio_dev_t *dev, int op, uint32_t timeout )
 	return( status );
 }
 
+int mmc_cmdq( sdio_dev_t *dev, int op, uint32_t timeout )
+{
+	int	status;
+
+	if( !( dev->caps & DEV_CAP_CMDQ ) ) {
+		return( ENOTSUP );
+	}
+
+	status = EOK;
+
+	switch( op ) {
+		case SDIO_CMDQ_DISABLE:
+			if( ( dev->flags & DEV_FLAG_CMDQ ) ) {
+				if( ( status = mmc_switch( dev, MMC_SWITCH_CMDSET_DFLT, MMC_SWITCH_MODE_WRITE, ECSD_CMDQ_MODE_EN, 0, timeout ) ) == EOK ) {
+					dev->flags &= ~DEV_FLAG_CMDQ;
+				}
+			}
+			break;
+
+		case SDIO_CMDQ_ENABLE:
+				// a reset or power cycle turns the queue off, so callers
+				// re-enable before every new batch of tasks
+			if( !( dev->flags & DEV_FLAG_CMDQ ) ) {
+				if( ( status = mmc_switch( dev, MMC_SWITCH_CMDSET_DFLT, MMC_SWITCH_MODE_WRITE, ECSD_CMDQ_MODE_EN, ECSD_CMDQ_ENABLE, timeout ) ) == EOK ) {
+					dev->flags |= DEV_FLAG_CMDQ;
+				}
+			}
+			break;
+
+		default:
+			status = EINVAL; break;
+	}
+
+	return( status );
+}
+
+// Queue a task (CMD44/CMD45).  The device acknowledges the task
+// immediately and reports it in the QSR once it is ready to transfer.
+int mmc_cmdq_queue( sdio_dev_t *dev, int tag, int flgs, uint64_t lba, int nlba )
+{
+	sdio_cmd_t		*cmd;
+	uint32_t		arg;
+	int				status;
+
+	if( !( dev->flags & DEV_FLAG_CMDQ ) ) {
+		return( EINVAL );
+	}
+
+	if( nlba <= 0 || nlba > MMC_QTP_BLKS_MAX ) {
+		return( EINVAL );
+	}
+
+	if( ( cmd = sdio_alloc_cmd( ) ) == NULL ) {
+		return( ENOMEM );
+	}
+
+	arg = MMC_QTP_TASK_ID( tag ) | nlba;
+
+	if( ( flgs & SCF_DIR_IN ) ) {
+		arg |= MMC_QTP_DIR_READ;
+	}
+	else if( ( flgs & SCF_SBC_RLW ) ) {
+		arg |= MMC_QTP_RL_WRITE;
+	}
+
+	sdio_setup_cmd( cmd, SCF_CTYPE_AC | SCF_RSP_R1, MMC_QUEUED_TASK_PARAMS, arg );
+
+	if( ( status = _sdio_send_cmd( dev, cmd, NULL, SDIO_TIME_DEFAULT, 0 ) ) == EOK && !( cmd->rsp[0] & CDS_ERROR_MSK ) ) {
+		lba = ( dev->caps & DEV_CAP_HC ) ? lba : ( lba * SDIO_DFLT_BLKSZ );
+		sdio_setup_cmd( cmd, SCF_CTYPE_AC | SCF_RSP_R1, MMC_QUEUED_TASK_ADDRESS, lba );
+		status = _sdio_send_cmd( dev, cmd, NULL, SDIO_TIME_DEFAULT, 0 );
+	}
+
+	if( status == EOK && ( cmd->rsp[0] & CDS_ERROR_MSK ) ) {
+		status = EIO;		// task rejected (bad address/count or tag in use)
+	}
+
+	sdio_free_cmd( cmd );
+
+	return( status );
+}
+
+// Read the Queue Status Register, one bit per task ready for execution
+int mmc_cmdq_status( sdio_dev_t *dev, uint32_t *qsr )
+{
+	sdio_cmd_t		*cmd;
+	int				status;
+
+	if( ( cmd = sdio_alloc_cmd( ) ) == NULL ) {
+		return( ENOMEM );
+	}
+
+	sdio_setup_cmd( cmd, SCF_CTYPE_AC | SCF_RSP_R1, MMC_SEND_STATUS, ( dev->rca << 16 ) | MMC_SEND_STATUS_SQS );
+
+	if( ( status = _sdio_send_cmd( dev, cmd, NULL, SDIO_TIME_DEFAULT, SDIO_CMD_RETRIES ) ) == EOK ) {
+		*qsr = cmd->rsp[0];
+	}
+
+	sdio_free_cmd( cmd );
+
+	return( status );
+}
+
+// Execute a ready task (CMD46/CMD47).  The block count was given when the
+// task was queued, so the host must not add CMD23 or an auto CMD12.
+int mmc_cmdq_execute( sdio_dev_t *dev, sdio_cmd_t *cmd, int tag, int flgs, int blks, int blksz, void *sgl, int sgc, void *mhdl, uint32_t timeout )
+{
+	int				op;
+
+	op	= ( flgs & SCF_DIR_IN ) ? MMC_EXECUTE_READ_TASK : MMC_EXECUTE_WRITE_TASK;
+
+	sdio_setup_cmd( cmd, SCF_CTYPE_ADTC | SCF_RSP_R1, op, MMC_QTP_TASK_ID( tag ) );
+	sdio_setup_cmd_io( cmd, ( flgs & ( SCF_DATA_MSK | SCF_DATA_PHYS ) ) | SCF_NO_ACMD, blks, blksz, sgl, sgc, mhdl );
+
+	return( _sdio_send_cmd( dev, cmd, NULL, timeout, 0 ) );
+}
+
+// Task management (CMD48), tag < 0 discards the entire queue
+int mmc_cmdq_discard( sdio_dev_t *dev, int tag )
+{
+	sdio_cmd_t		*cmd;
+	uint32_t		arg;
+	int				status;
+
+	if( ( cmd = sdio_alloc_cmd( ) ) == NULL ) {
+		return( ENOMEM );
+	}
+
+	arg = ( tag < 0 ) ? MMC_CMDQ_TM_DISCARD_QUEUE : ( MMC_QTP_TASK_ID( tag ) | MMC_CMDQ_TM_DISCARD_TASK );
+
+	sdio_setup_cmd( cmd, SCF_CTYPE_AC | SCF_RSP_R1B, MMC_CMDQ_TASK_MGMT, arg );
+
+	status = _sdio_send_cmd( dev, cmd, NULL, SDIO_TIME_DEFAULT, SDIO_CMD_RETRIES );
+
+	sdio_free_cmd( cmd );
+
+	return( status );
+}
+
+// Packed write (CMD23 with the packed bit, then CMD25).  The first block
+// of the data is the packed command header, blks includes it and addr is
+// the address of the first write in the header.
+int mmc_packed_write( sdio_dev_t *dev, sdio_cmd_t *cmd, uint64_t addr, int flgs, int blks, int blksz, void *sgl, int sgc, void *mhdl, uint32_t timeout )
+{
+	int				status;
+
+	if( !( dev->caps & DEV_CAP_PACKED ) || blks > MMC_QTP_BLKS_MAX ) {
+		return( EINVAL );
+	}
+
+	if( ( status = _sdio_set_block_count( dev, blks, SBC_PACKED ) ) != EOK ) {
+		return( status );
+	}
+
+		// block count was set above, the host mustn't add CMD23 or CMD12
+	sdio_setup_cmd( cmd, SCF_CTYPE_ADTC | SCF_RSP_R1, MMC_WRITE_MULTIPLE_BLOCK, addr );
+	sdio_setup_cmd_io( cmd, ( flgs & SCF_DATA_PHYS ) | SCF_DIR_OUT | SCF_MULTIBLK | SCF_NO_ACMD, blks, blksz, sgl, sgc, mhdl );
+
+	return( _sdio_send_cmd( dev, cmd, NULL, timeout, 0 ) );
+}
+
 uint64_t mmc_erase_timeout( sdio_dev_t *dev, uint32_t etype, uint64_t nlba )
 {
 	uint8_t			*ecsd;
@@ -241,9 +241,9 @@ int sd_switch( sdio_dev_t *dev, int mode, int grp, uint8_t val, uint8_t *switch_
 		return( ENOMEM );
 	}
 
-	arg = mode << 31 | 0x00ffffff;
-	arg &= ~( 0xf << ( grp * 4 ) );
-	arg |= ( val << ( grp * 4 ) );
+	arg = (uint32_t)mode << 31 | 0x00ffffff;
+	arg &= ~( 0xfu << ( grp * 4 ) );
+	arg |= ( (uint32_t)val << ( grp * 4 ) );
 
 	sdio_setup_cmd( cmd, SCF_CTYPE_ADTC | SCF_RSP_R1, SD_SWITCH_FUNC, arg );
 	sge.sg_count = SD_SF_STATUS_SIZE; sge.sg_address = SDIO_DATA_PTR_P( sbuf );
@@ -818,13 +818,14 @@ static int sd_select_bus_mode( sdio_dev_t *dev, int bus_mode )
 
 	hc				= dev->hc;
 
-	if( (bus_mode & SD_BUS_MODE_SDR104) && (hc->caps & HC_CAP_SDR104) )
+		// skip the timings this card could not be tuned at before
+	if( (bus_mode & SD_BUS_MODE_SDR104) && (hc->caps & HC_CAP_SDR104) && !sdio_tune_failed( hc, TIMING_SDR104 ) )
 		bus_spd_mode = SD_BUS_MODE_SDR104;
-	else if( (bus_mode & SD_BUS_MODE_DDR50) && (hc->caps & HC_CAP_DDR50) )
+	else if( (bus_mode & SD_BUS_MODE_DDR50) && (hc->caps & HC_CAP_DDR50) && !sdio_tune_failed( hc, TIMING_DDR50 ) )
 		bus_spd_mode = SD_BUS_MODE_DDR50;
-	else if( (bus_mode & SD_BUS_MODE_SDR50) && (hc->caps & HC_CAP_SDR50) )
+	else if( (bus_mode & SD_BUS_MODE_SDR50) && (hc->caps & HC_CAP_SDR50) && !sdio_tune_failed( hc, TIMING_SDR50 ) )
 		bus_spd_mode = SD_BUS_MODE_SDR50;
-	else if( (bus_mode & SD_BUS_MODE_SDR25) && (hc->caps & HC_CAP_SDR25) )
+	else if( (bus_mode & SD_BUS_MODE_SDR25) && (hc->caps & HC_CAP_SDR25) && !sdio_tune_failed( hc, TIMING_SDR25 ) )
 		bus_spd_mode = SD_BUS_MODE_SDR25;
 	else
 		bus_spd_mode = SD_BUS_MODE_SDR12;
@@ -846,26 +847,38 @@ static int sd_init_uhs( sdio_dev_t *dev )
 		return( status );
 	}
 
-	bus_spd_mode = sd_select_bus_mode( dev, swcaps->bus_mode );
+	do {
+		bus_spd_mode = sd_select_bus_mode( dev, swcaps->bus_mode );
 
-	if( ( status = sd_set_drv_type( dev, bus_spd_mode, swcaps->drv_type ) ) != EOK ) {
-		return( status );
-	}
+		if( ( status = sd_set_drv_type( dev, bus_spd_mode, swcaps->drv_type ) ) != EOK ) {
+			return( status );
+		}
 
-	if( ( status = sd_set_current_limit( dev, bus_spd_mode, swcaps->curr_limit ) ) ) {
-		return( status );
-	}
+		if( ( status = sd_set_current_limit( dev, bus_spd_mode, swcaps->curr_limit ) ) ) {
+			return( status );
+		}
 
-	if( ( status = sd_set_bus_speed_mode( dev, bus_spd_mode ) ) != EOK ) {
-		return( status );
-	}
+		if( ( status = sd_set_bus_speed_mode( dev, bus_spd_mode ) ) != EOK ) {
+			return( status );
+		}
 
-	sdio_preset( hc, SDIO_TRUE );
-	if( ( status = sdio_tune( hc, SD_SEND_TUNING_BLOCK ) ) ) {
-			// tuning may have failed, but we should should be able to continue.
-			// ie hc will use defaults an we will re-tune if we get a CRC error
-		sdio_slogf( _SLOGC_SDIODI, _SLOG_ERROR, hc->cfg.verbosity, 0, "%s: tuning failure %s (%d)", __FUNCTION__, strerror( status ), status );
-	}
+		sdio_preset( hc, SDIO_TRUE );
+		while( ( status = sdio_tune( hc, SD_SEND_TUNING_BLOCK ) ) == EIO && !sdio_tune_failed( hc, hc->timing ) ) {
+				// try again, until the card has failed at this timing often enough to be avoided
+		}
+
+		if( status == ENXIO ) {
+			return( status );
+		}
+
+		if( status ) {
+				// a pattern failure steps down to a timing that doesn't need
+				// tuning or hasn't failed, anything else stays here. At the
+				// slowest we should be able to continue. ie hc will use
+				// defaults and we will re-tune if we get a CRC error
+			sdio_slogf( _SLOGC_SDIODI, _SLOG_ERROR, hc->cfg.verbosity, 0, "%s: tuning failure %s (%d)", __FUNCTION__, strerror( status ), status );
+		}
+	} while( status == EIO && bus_spd_mode != SD_BUS_MODE_SDR12 );
 
 	dev->flags |= DEV_FLAG_UHS;
 
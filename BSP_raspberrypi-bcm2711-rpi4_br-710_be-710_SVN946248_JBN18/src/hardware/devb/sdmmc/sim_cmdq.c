@@ -0,0 +1,478 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+// Module Description:  eMMC command queue
+//
+// Reads and writes are handed to the device as tagged tasks (CMD44/CMD45)
+// so it can schedule them internally, then executed (CMD46/CMD47) in the
+// order the device reports them ready in the QSR.  None of the hosts in
+// this tree have a CQHCI engine, so the queue is driven in software from
+// the SIM thread.
+
+#include <strings.h>
+
+#include <sim_sdmmc.h>
+
+#define CMDQ_QSR_TIMEOUT		SDMMC_TIMEOUT_S_TO_NS( SDMMC_TIME_DEFAULT )
+
+int sdmmc_cmdq_init( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_CMDQ		*cq;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	cq		= &ext->cmdq;
+
+	memset( cq, 0, sizeof( SDMMC_CMDQ ) );
+	cq->qsr_poll = SDIO_BSY_POLL_MIN;
+
+	if( !( ext->eflags & SDMMC_EFLAG_CMDQ ) ) {
+		return( EOK );
+	}
+
+#ifdef SDMMC_WRITE_VERIFY
+	cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  command queue not supported with write verify", __FUNCTION__ );
+	ext->eflags &= ~SDMMC_EFLAG_CMDQ;
+	return( ENOTSUP );
+#endif
+
+	if( !( ext->dev_inf.caps & DEV_CAP_CMDQ ) || ext->dev_inf.cmdq_depth == 0 ) {
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  device doesn't support command queue", __FUNCTION__ );
+		ext->eflags &= ~SDMMC_EFLAG_CMDQ;
+		return( ENOTSUP );
+	}
+
+	cq->depth = min( ext->dev_inf.cmdq_depth, SDMMC_CMDQ_DEPTH_MAX );
+
+	cam_slogf( _SLOGC_SIM_MMC, _SLOG_INFO, 1, 1, "%s:  command queue depth %d", __FUNCTION__, cq->depth );
+
+	return( EOK );
+}
+
+static int sdmmc_cmdq_tag( SDMMC_CMDQ *cq )
+{
+	int		tag;
+
+	if( ( tag = ffs( (int)~cq->tmap ) - 1 ) < 0 || tag >= cq->depth ) {
+		return( -1 );
+	}
+
+	return( tag );
+}
+
+// reads/writes with data can be queued as tasks
+static int sdmmc_cmdq_rw( CCB_SCSIIO *ccb )
+{
+	if( ccb->cam_ch.cam_func_code != XPT_SCSI_IO || !ccb->cam_dxfer_len ) {
+		return( CAM_FALSE );
+	}
+
+	switch( ccb->cam_cdb_io.cam_cdb_bytes[0] ) {
+		case SC_READ10:
+		case SC_WRITE10:
+			return( CAM_TRUE );
+
+		default:
+			return( CAM_FALSE );
+	}
+}
+
+// Commands that may be sent with queueing enabled once the queue is empty.
+// Everything else (legacy data transfers, RPMB, pass through commands) runs
+// with the device back in legacy mode.
+static int sdmmc_cmdq_legacy( CCB_SCSIIO *ccb )
+{
+	if( ccb->cam_ch.cam_func_code != XPT_SCSI_IO ) {
+		return( CAM_TRUE );
+	}
+
+	switch( ccb->cam_cdb_io.cam_cdb_bytes[0] ) {
+		case SC_UNIT_RDY:
+		case SC_INQUIRY:
+		case SC_SPINDLE:
+		case SC_RD_CAP:
+		case SC_SYNC:
+		case SC_MSELECT10:
+		case SC_MSENSE10:
+		case SC_ERASE12:
+		case SC_WR_SAME16:
+		case SC_SERVICE_ACTION_IN16:
+			return( CAM_FALSE );
+
+		default:
+			return( CAM_TRUE );
+	}
+}
+
+static SDMMC_PARTITION *sdmmc_cmdq_part( SIM_SDMMC_EXT *ext, CCB_SCSIIO *ccb )
+{
+	return( &ext->targets[ccb->cam_ch.cam_target_id].partitions[ccb->cam_ch.cam_target_lun] );
+}
+
+static void sdmmc_cmdq_done( SIM_HBA *hba, int tag, int status )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_CMDQ		*cq;
+	CCB_SCSIIO		*ccb;
+
+	ext				= (SIM_SDMMC_EXT *)hba->ext;
+	cq				= &ext->cmdq;
+	ccb				= cq->tasks[tag].ccb;
+
+	cq->tasks[tag].ccb	= NULL;
+	cq->tmap		&= ~( 1u << tag );
+	cq->rmap		&= ~( 1u << tag );
+
+	ccb->cam_ch.cam_status = status;
+	sdmmc_post_ccb( hba, ccb );
+}
+
+// Discard the device queue after a failed task, queue command or QSR read.
+// The failed task completes with an error, the other tasks go back to the
+// head of the simq to be queued again.  When no single task is to blame
+// (tag < 0) they all complete with the error and the CAM layer retries.
+// A tag that isn't queued (rejected by CMD44/CMD45) is left to the caller.
+static void sdmmc_cmdq_recover( SIM_HBA *hba, int tag, int status )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_CMDQ		*cq;
+	CCB_SCSIIO		*ccb;
+	uint32_t		rsp[4];
+	int				t;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	cq		= &ext->cmdq;
+
+	cq->recoveries++;
+
+	cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  tag %d, tmap 0x%x, status %d", __FUNCTION__, tag, cq->tmap, status );
+
+	if( status != ENXIO ) {
+		if( sdio_cmdq_discard( ext->device, -1 ) || sdio_send_status( ext->device, rsp, 0 ) ||
+				( rsp[0] & ( CDS_READY_FOR_DATA | CDS_CUR_STATE_MSK ) ) != ( CDS_READY_FOR_DATA | CDS_CUR_STATE_TRAN ) ) {
+			sdmmc_reset( hba );		// turns queueing off, re-enabled with the next task
+		}
+	}
+
+	for( t = cq->depth - 1; t >= 0; t-- ) {
+		if( !( cq->tmap & ( 1u << t ) ) ) {
+			continue;
+		}
+
+		ccb = cq->tasks[t].ccb;
+		if( t == tag || tag < 0 || status == ENXIO ) {
+			sdmmc_cmdq_done( hba, t, sdmmc_error( hba, ccb, status ) );
+		}
+		else {
+			cq->tasks[t].ccb	= NULL;
+			cq->tmap			&= ~( 1u << t );
+			simq_ccb_requeue( hba->simq, ccb );
+		}
+	}
+
+	cq->rmap			= 0;
+	cq->qsr_timestamp	= 0;
+	cq->qsr_poll		= SDIO_BSY_POLL_MIN;
+
+	sdio_dev_info( ext->device, &ext->dev_inf );	// device info may have been updated after reset
+}
+
+// Queue a read/write as a task.  On failure the ccb completes here.
+static void sdmmc_cmdq_queue( SIM_HBA *hba, CCB_SCSIIO *ccb )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_CMDQ		*cq;
+	SDMMC_PARTITION	*part;
+	SDMMC_TASK		*task;
+	uint64_t		lba;
+	uint32_t		nblks;
+	int				flgs;
+	int				tag;
+	int				status;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	cq		= &ext->cmdq;
+	part	= sdmmc_cmdq_part( ext, ccb );
+	flgs	= ( ccb->cam_cdb_io.cam_cdb_bytes[0] == SC_READ10 ) ? SCF_DIR_IN : SCF_DIR_OUT;
+
+	if( hba->verbosity > 3 ) {
+		xpt_display_ccb( ccb, hba->verbosity );
+	}
+
+	if( ( status = sdmmc_unit_ready( hba, ccb ) ) != CAM_REQ_CMP ) {
+	}
+	else if( ( ccb->cam_ch.cam_flags & CAM_DATA_PHYS ) && !( ext->hc_inf.caps & HC_CAP_DMA ) ) {
+		status = CAM_PROVIDE_FAIL;
+	}
+	else if( ( ext->dev_inf.flags & DEV_FLAG_CARD_LOCKED ) ) {
+		status = sdmmc_error( hba, ccb, EACCES );
+	}
+	else if( ( flgs & SCF_DIR_OUT ) && ( part->pflags & SDMMC_PFLAG_WP ) ) {
+		status = sdmmc_error( hba, ccb, EROFS );
+	}
+	else if( ( part->config & MMC_PART_MSK ) == MMC_PART_RPMB ) {		// no read/write to RPMB
+		status = CAM_PROVIDE_FAIL;
+	}
+	else if( cq->tmap == 0 ) {
+			// the device queue is empty, select the partition and (re)enable
+			// queueing which a reset or power transition will have turned off
+		sdmmc_bkops( hba, CAM_FALSE );	// Check for urgent background operations
+
+		if( ( status = sdio_set_partition( ext->device, part->config ) ) != EOK ||
+				( status = sdio_cmdq( ext->device, SDIO_CMDQ_ENABLE, SDIO_TIME_DEFAULT ) ) != EOK ) {
+			cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s: partition/cmdq failure %s", __FUNCTION__, strerror( status ) );
+			sdmmc_reset( hba );
+			status = sdmmc_error( hba, ccb, ETIMEDOUT );
+		}
+		else {
+			cq->config	= part->config;
+			status		= CAM_REQ_CMP;
+		}
+	}
+
+	if( status != CAM_REQ_CMP ) {
+		ccb->cam_ch.cam_status = status;
+		sdmmc_post_ccb( hba, ccb );
+		return;
+	}
+
+	if( ( flgs & SCF_DIR_OUT ) && ( ext->dev_inf.caps & DEV_CAP_CACHE ) && ( ext->eflags & SDMMC_EFLAG_CACHE ) ) {
+		ext->eflags |= SDMMC_EFLAG_VCACHE_DIRTY;		// see sdmmc_scsi_io()
+	}
+
+	tag		= sdmmc_cmdq_tag( cq );
+	task	= &cq->tasks[tag];
+
+	if( ( ccb->cam_ch.cam_flags & CAM_SCATTER_VALID ) ) {
+		task->sgc				= ccb->cam_sglist_cnt;
+		task->sgl				= (sdio_sge_t *)ccb->cam_data.cam_sg_ptr;
+	}
+	else {
+		task->sgc				= 1;
+		task->sgl				= &task->sge;
+		task->sge.sg_count		= ccb->cam_dxfer_len;
+		task->sge.sg_address	= ccb->cam_data.cam_data_ptr;
+	}
+
+	if( ( ccb->cam_ch.cam_flags & CAM_DATA_PHYS ) ) {
+		flgs |= SCF_DATA_PHYS;
+	}
+
+	sdmmc_ccb_lba( ccb->cam_cdb_io.cam_cdb_bytes, &lba, &nblks );
+
+	if( part->blk_shft ) {
+		lba <<= part->blk_shft;
+	}
+
+	task->ccb	= ccb;
+	task->part	= part;
+	task->flgs	= flgs;
+	task->lba	= lba + part->slba;
+	task->blks	= ccb->cam_dxfer_len / ext->dev_inf.sector_size;
+
+	if( ( status = sdio_cmdq_queue( ext->device, tag, flgs, task->lba, task->blks ) ) != EOK ) {
+		task->ccb	= NULL;
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  tag %d, lba %"PRIu64", blks %d, status %d",
+			__FUNCTION__, tag, task->lba, task->blks, status );
+		sdmmc_cmdq_recover( hba, tag, status );
+		ccb->cam_ch.cam_status = sdmmc_error( hba, ccb, ( status == EIO ) ? EIO : ETIMEDOUT );
+		sdmmc_post_ccb( hba, ccb );
+		return;
+	}
+
+		// the simq wait ends once the device holds the task
+	if( ( ext->eflags & SDMMC_EFLAG_STATS ) && SDMMC_CCB_PRIV( ccb )->queued ) {
+		sdmmc_stats_qwait( hba, ( flgs & SCF_DIR_IN ) ? MMC_EXECUTE_READ_TASK : MMC_EXECUTE_WRITE_TASK,
+			ClockCycles( ) - SDMMC_CCB_PRIV( ccb )->queued );
+	}
+
+	cq->tmap |= ( 1u << tag );
+	cq->queued++;
+	if( cq->max_queued < __builtin_popcount( cq->tmap ) ) {
+		cq->max_queued = __builtin_popcount( cq->tmap );
+	}
+}
+
+// Execute one ready task, reading the QSR first when no task is known to be ready
+static void sdmmc_cmdq_exec( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT		*ext;
+	SDMMC_CMDQ			*cq;
+	SDMMC_TASK			*task;
+	struct sdio_cmd		*cmd;
+	struct timespec		ts;
+	uint64_t			now;
+	uint32_t			qsr;
+	uint32_t			cstatus;
+	uint32_t			rsp[4];
+	int					tag;
+	int					status;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	cq		= &ext->cmdq;
+
+	if( cq->rmap == 0 ) {
+		cq->polls++;
+		if( ( status = sdio_cmdq_status( ext->device, &qsr ) ) != EOK ) {
+			sdmmc_cmdq_recover( hba, -1, ( status == ENXIO ) ? ENXIO : ETIMEDOUT );
+			return;
+		}
+
+		if( ( cq->rmap = qsr & cq->tmap ) == 0 ) {
+			cq->empty_polls++;
+			clock_gettime( CLOCK_MONOTONIC, &ts );
+			now = timespec2nsec( &ts );
+			if( cq->qsr_timestamp == 0 ) {
+				cq->qsr_timestamp = now;
+			}
+			else if( now - cq->qsr_timestamp > CMDQ_QSR_TIMEOUT ) {
+				sdmmc_cmdq_recover( hba, -1, ETIMEDOUT );
+				return;
+			}
+
+				// back off like _sdio_wait_card_status(), a short spin
+				// growing to a 1ms sleep, instead of polling back to back
+			if( cq->qsr_poll <= SDIO_BSY_POLL_SPIN ) {
+				nanospin_ns( cq->qsr_poll * 1000L );
+				cq->qsr_poll <<= 1;
+			}
+			else {
+				delay( 1 );
+			}
+			return;
+		}
+		cq->qsr_timestamp	= 0;
+		cq->qsr_poll		= SDIO_BSY_POLL_MIN;
+	}
+
+	tag		= ffs( cq->rmap ) - 1;
+	task	= &cq->tasks[tag];
+
+	if( ( cmd = sdio_alloc_cmd( ) ) == NULL ) {
+		sdmmc_cmdq_recover( hba, tag, ENOMEM );
+		return;
+	}
+
+	status = sdio_cmdq_execute( ext->device, cmd, tag, task->flgs, task->blks, ext->dev_inf.sector_size,
+				task->sgl, task->sgc, task->ccb->cam_req_map, task->ccb->cam_timeout * 1000 );
+	sdio_cmd_status( cmd, &cstatus, rsp );
+	sdio_free_cmd( cmd );
+
+	if( status ) {
+		status = ( status == ENXIO ) ? ENXIO : ETIMEDOUT;
+		if( cstatus == CS_DATA_CRC_ERR || cstatus == CS_DATA_END_ERR ) {
+			if( ext->instance.ident.dtype == DEV_TYPE_SD ) {
+				sdio_bus_error( ext->device );
+			}
+		}
+	}
+	else if( rsp[0] ) {
+		if( ( rsp[0] & CDS_URGENT_BKOPS ) ) {
+			ext->bkops_status = ECSD_BS_OPERATIONS_CRITICAL;
+		}
+		if( ( rsp[0] & ( CDS_ERROR | CDS_CARD_ECC_FAILED ) ) ) {
+			status = EIO;
+		}
+		if( ( rsp[0] & CDS_WP_VIOLATION ) ) {
+			status = EROFS;
+		}
+		if( ( rsp[0] & CDS_CARD_IS_LOCKED ) ) {
+			status = EACCES;
+		}
+	}
+
+	if( status ) {
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  tag %d, flgs 0x%x, lba %"PRIu64", blks %d, status %d, cstatus 0x%x, rsp[0] 0x%x",
+			__FUNCTION__, tag, task->flgs, task->lba, task->blks, status, cstatus, rsp[0] );
+		sdmmc_cmdq_recover( hba, tag, status );
+		return;
+	}
+
+	if( ( task->flgs & SCF_DIR_IN ) ) {
+		task->part->rc += task->blks;
+	}
+	else {
+		task->part->wc += task->blks;
+	}
+
+	sdmmc_cmdq_done( hba, tag, CAM_REQ_CMP );
+}
+
+// Called with a ccb just dequeued by sdmmc_start_ccb().  Keeps the device
+// queue filled from the simq and executes ready tasks until both are empty.
+// A ccb that can't be queued stops the filling; it is returned once the
+// queued tasks have completed, for the caller to run on its own.
+CCB_SCSIIO *sdmmc_cmdq_start( SIM_HBA *hba, CCB_SCSIIO *ccb )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_CMDQ		*cq;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	cq		= &ext->cmdq;
+
+	while( 1 ) {
+		if( ccb ) {
+			if( !sdmmc_cmdq_rw( ccb ) ||
+					( cq->tmap && sdmmc_cmdq_part( ext, ccb )->config != cq->config ) ) {
+				cq->barrier = ccb;		// wait for the device queue to drain
+			}
+			else {
+				sdmmc_cmdq_queue( hba, ccb );
+			}
+			ccb = NULL;
+		}
+
+		if( cq->barrier == NULL && sdmmc_cmdq_tag( cq ) >= 0 &&
+				( ccb = simq_ccb_dequeue( hba->simq ) ) != NULL ) {
+			continue;
+		}
+
+		if( cq->tmap ) {
+			sdmmc_cmdq_exec( hba );
+			continue;
+		}
+
+		if( ( ccb = cq->barrier ) != NULL ) {
+			cq->barrier = NULL;
+			if( sdmmc_cmdq_rw( ccb ) ) {		// partition switch
+				continue;
+			}
+		}
+		break;
+	}
+
+		// in case retune is needed
+	if( sdio_retune( ext->device ) != EOK ) {
+		sdmmc_reset( hba );
+	}
+
+	if( ccb && sdmmc_cmdq_legacy( ccb ) ) {
+		sdio_cmdq( ext->device, SDIO_CMDQ_DISABLE, SDIO_TIME_DEFAULT );
+	}
+
+	return( ccb );
+}
+
+
+#if defined(__QNXNTO__) && defined(__USESRCVERSION)
+#include <sys/srcversion.h>
+__SRCVERSION("$URL$ $Rev$")
+#endif
@@ -0,0 +1,303 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+// Module Description:  deferred discards
+//
+// File systems hand the SIM TRIM and DISCARD ranges as they free blocks.
+// Issued at once, each one holds the queue for an erase command whose
+// timeout runs to seconds, and the reads and writes behind it stall.  With
+// the discard option the ranges are completed at once and kept, merged with
+// the waiting ranges they touch.  Once the device has been idle for the PM
+// idle time they are issued from the driver thread, a chunk of whole erase
+// groups at a time (the unaligned head and tail of a range on their own),
+// and the run stops as soon as other work has been started in between.
+// Writes cut the waiting ranges they overlap, so an erase never reaches
+// blocks written after the discard.  Until it is issued, a discarded block
+// reads back its old contents.  DISCARD allows that, and so do the TRIMs of
+// WRITE SAME with UNMAP and of the data set management devctl, as read
+// capacity reports thin provisioning without TPRZ.  An eMMC TRIM otherwise
+// reads back as erased once it completes, so the TRIM of the erase devctl
+// is never deferred.
+
+#include <sim_sdmmc.h>
+
+int sdmmc_discard_init( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_DISCARD	*dc;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	dc		= &ext->discard;
+
+	memset( dc, 0, sizeof( SDMMC_DISCARD ) );
+
+	if( !( ext->eflags & SDMMC_EFLAG_DISCARD ) ) {
+		return( EOK );
+	}
+
+	if( ( ext->eflags & SDMMC_EFLAG_CMDQ ) ) {		// erases can't pass queued tasks
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  deferred discard not supported with command queue", __FUNCTION__ );
+		ext->eflags &= ~SDMMC_EFLAG_DISCARD;
+		return( ENOTSUP );
+	}
+
+	if( !( ext->dev_inf.caps & ( DEV_CAP_TRIM | DEV_CAP_DISCARD ) ) ) {
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_INFO, hba->verbosity, 1, "%s:  device doesn't support TRIM/DISCARD", __FUNCTION__ );
+		ext->eflags &= ~SDMMC_EFLAG_DISCARD;
+		return( ENOTSUP );
+	}
+
+		// ranges are issued from the idle check of the PM timer
+	if( !ext->pm_idle_time_ns ) {
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  deferred discard needs an idle time", __FUNCTION__ );
+		ext->eflags &= ~SDMMC_EFLAG_DISCARD;
+		return( EINVAL );
+	}
+
+	dc->egs				= max( ext->dev_inf.erase_size / 512, 1 );
+	dc->stats.flags		= SDMMC_DISCARD_DEFERRED;
+
+	return( EOK );
+}
+
+static void sdmmc_discard_remove( SDMMC_DISCARD *dc, int idx )
+{
+	dc->nranges--;
+	memmove( &dc->ranges[idx], &dc->ranges[idx + 1], ( dc->nranges - idx ) * sizeof( SDMMC_DISCARD_RANGE ) );
+}
+
+// Returns EOK when the range waits, the caller issues it otherwise
+int sdmmc_discard_queue( SIM_HBA *hba, SDMMC_PARTITION *part, int dtype, uint64_t lba, uint64_t nlba )
+{
+	SIM_SDMMC_EXT		*ext;
+	SDMMC_DISCARD		*dc;
+	SDMMC_DISCARD_RANGE	*dr;
+	uint64_t			elba;
+	int					idx;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	dc		= &ext->discard;
+	elba	= lba + nlba;
+
+	if( !( ext->eflags & SDMMC_EFLAG_DISCARD ) || ( dtype != MMC_ERASE_TRIM && dtype != MMC_ERASE_DISCARD ) ) {
+		return( ENOTSUP );
+	}
+
+		// absorb the waiting ranges this one overlaps or adjoins
+	for( idx = 0; idx < dc->nranges; ) {
+		dr = &dc->ranges[idx];
+		if( dr->config == part->config && dr->dtype == dtype && dr->lba <= elba && lba <= dr->lba + dr->nlba ) {
+			lba		= min( lba, dr->lba );
+			elba	= max( elba, dr->lba + dr->nlba );
+			sdmmc_discard_remove( dc, idx );
+			dc->stats.merged++;
+			continue;
+		}
+		idx++;
+	}
+
+		// nothing was absorbed, as a merge frees a slot
+	if( dc->nranges == SDMMC_DISCARD_RANGES ) {
+		dc->stats.overflows++;
+		return( ENOSPC );
+	}
+
+	dr			= &dc->ranges[dc->nranges++];
+	dr->config	= part->config;
+	dr->dtype	= dtype;
+	dr->lba		= lba;
+	dr->nlba	= elba - lba;
+	dc->stats.ranges++;
+
+	return( EOK );
+}
+
+void sdmmc_discard_clip( SIM_HBA *hba, SDMMC_PARTITION *part, uint64_t lba, uint64_t blks )
+{
+	SIM_SDMMC_EXT		*ext;
+	SDMMC_DISCARD		*dc;
+	SDMMC_DISCARD_RANGE	*dr;
+	uint64_t			elba;
+	uint64_t			dend;
+	int					idx;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	dc		= &ext->discard;
+	elba	= lba + blks;
+
+	for( idx = 0; idx < dc->nranges; idx++ ) {
+		dr		= &dc->ranges[idx];
+		dend	= dr->lba + dr->nlba;
+		if( dr->config != part->config || elba <= dr->lba || dend <= lba ) {
+			continue;
+		}
+
+		dc->stats.clipped++;
+		if( lba > dr->lba && elba < dend ) {		// split around the write
+			if( dc->nranges < SDMMC_DISCARD_RANGES ) {
+				dc->ranges[dc->nranges]			= *dr;
+				dc->ranges[dc->nranges].lba		= elba;
+				dc->ranges[dc->nranges].nlba	= dend - elba;
+				dc->nranges++;
+			}									// else the tail isn't discarded
+			dr->nlba = lba - dr->lba;
+		}
+		else if( lba > dr->lba ) {				// write covers the tail
+			dr->nlba = lba - dr->lba;
+		}
+		else if( elba < dend ) {				// write covers the head
+			dr->lba		= elba;
+			dr->nlba	= dend - elba;
+		}
+		else {
+			sdmmc_discard_remove( dc, idx-- );
+		}
+	}
+}
+
+// Issues the next chunk of the first waiting range
+static int sdmmc_discard_chunk( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT		*ext;
+	SDMMC_DISCARD		*dc;
+	SDMMC_DISCARD_RANGE	*dr;
+	SDMMC_PARTITION		part;
+	uint64_t			nlba;
+	uint64_t			start;
+	uint64_t			us;
+	struct timespec		ts;
+	int					status;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	dc		= &ext->discard;
+	dr		= &dc->ranges[0];
+
+	if( ( dr->lba % dc->egs ) ) {				// up to the first group boundary
+		nlba = min( dr->nlba, dc->egs - dr->lba % dc->egs );
+	}
+	else if( dr->nlba >= dc->egs ) {			// whole groups
+		nlba = min( dr->nlba, max( SDMMC_DISCARD_CHUNK_BLKS, dc->egs ) );
+		nlba -= nlba % dc->egs;
+	}
+	else {										// the start of the last group
+		nlba = dr->nlba;
+	}
+
+		// read-ahead may have buffered the blocks again since they were queued
+	part.config = dr->config;
+	sdmmc_ra_invalidate( hba, &part, dr->lba, nlba );
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	start = timespec2nsec( &ts );
+
+	status = sdio_erase( ext->device, dr->config, dr->dtype, dr->lba, nlba );
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	us = ( timespec2nsec( &ts ) - start ) / 1000;
+
+	dc->stats.erases++;
+	dc->stats.erase_blks	+= nlba;
+	dc->stats.erase_us		+= us;
+	dc->stats.max_us		= max( dc->stats.max_us, us );
+
+	if( status != EOK ) {						// a discard is only a hint, drop the range
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  lba %"PRIu64", blks %"PRIu64", status %d",
+			__FUNCTION__, dr->lba, nlba, status );
+		dc->stats.errors++;
+		sdmmc_discard_remove( dc, 0 );
+		return( status );
+	}
+
+	dr->lba		+= nlba;
+	dr->nlba	-= nlba;
+	if( !dr->nlba ) {
+		sdmmc_discard_remove( dc, 0 );
+	}
+
+	return( EOK );
+}
+
+// Called from the PM timer once the device is idle, then for each
+// SDMMC_DISCARD_PULSE it sends itself.  A ccb queued meanwhile is started
+// before the pulse is received and the run stops until the next idle time.
+int sdmmc_discard_run( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_DISCARD	*dc;
+	struct timespec	ts;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	dc		= &ext->discard;
+
+	if( !dc->nranges || ext->nexus || ext->drvr_state == SDMMC_DRVR_PAUSE || !( ext->eflags & SDMMC_EFLAG_PRESENT ) ) {
+		dc->running = CAM_FALSE;
+		return( EOK );
+	}
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	if( timespec2nsec( &ts ) < ext->pm_timestamp + ext->pm_idle_time_ns ||
+			( ext->bkops_status & BKOPS_STATUS_OPERATIONS_INPROG ) ) {
+		if( dc->running ) {
+			dc->stats.preempted++;
+		}
+		dc->running = CAM_FALSE;
+		return( EAGAIN );
+	}
+
+	sdmmc_discard_chunk( hba );
+
+	if( !dc->nranges ) {
+		dc->running = CAM_FALSE;
+		sdmmc_bkops( hba, CAM_TRUE );		// the erases may have left maintenance to do
+		return( EOK );
+	}
+
+	dc->running = CAM_TRUE;
+	MsgSendPulse( hba->coid, ext->priority, SDMMC_DISCARD_PULSE, 0 );
+
+	return( EOK );
+}
+
+// Before the device is paused, put to sleep or detached
+void sdmmc_discard_flush( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_DISCARD	*dc;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	dc		= &ext->discard;
+
+	if( !( ext->eflags & SDMMC_EFLAG_PRESENT ) ) {	// card is gone
+		dc->nranges = 0;
+		return;
+	}
+
+	dc->stats.flushed += dc->nranges;
+	while( dc->nranges ) {
+		sdmmc_discard_chunk( hba );
+	}
+}
+
+
+#if defined(__QNXNTO__) && defined(__USESRCVERSION)
+#include <sys/srcversion.h>
+__SRCVERSION("$URL$ $Rev$")
+#endif
@@ -0,0 +1,458 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+// Module Description:  read/write request merging
+//
+// io-blk hands the SIM one ccb per request, so a stream of small writes
+// costs a command, a busy wait and a status poll per ccb.  Ccbs queued
+// behind the nexus for the same partition and direction are gathered and
+// issued as one transfer, a multi-block read/write while their LBAs are
+// contiguous, or an eMMC packed write when they aren't.  If the transfer
+// fails the ccbs are redone one at a time so each gets its own status.
+
+#include <sim_sdmmc.h>
+
+int sdmmc_merge_init( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_MERGE		*mg;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	mg		= &ext->merge;
+
+	memset( mg, 0, sizeof( SDMMC_MERGE ) );
+
+	if( !( ext->eflags & SDMMC_EFLAG_MERGE ) ) {
+		return( EOK );
+	}
+
+#ifdef SDMMC_WRITE_VERIFY
+	cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  merging not supported with write verify", __FUNCTION__ );
+	ext->eflags &= ~( SDMMC_EFLAG_MERGE | SDMMC_EFLAG_PACKED );
+	return( ENOTSUP );
+#endif
+
+	if( ( ext->eflags & SDMMC_EFLAG_CMDQ ) ) {		// device schedules the queued tasks
+		ext->eflags &= ~( SDMMC_EFLAG_MERGE | SDMMC_EFLAG_PACKED );
+		return( EOK );
+	}
+
+		// the merged scatter list is built from physical addresses
+	if( !( ext->hc_inf.caps & HC_CAP_DMA ) || ext->hc_inf.sg_max < 2 ) {
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  host doesn't support scatter/gather DMA", __FUNCTION__ );
+		ext->eflags &= ~( SDMMC_EFLAG_MERGE | SDMMC_EFLAG_PACKED );
+		return( ENOTSUP );
+	}
+
+	if( ( ext->eflags & SDMMC_EFLAG_PACKED ) ) {
+		if( !( ext->dev_inf.caps & DEV_CAP_PACKED ) || ext->dev_inf.sector_size > SDMMC_MERGE_HDR_SIZE ) {
+			cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  device doesn't support packed commands", __FUNCTION__ );
+			ext->eflags &= ~SDMMC_EFLAG_PACKED;
+		}
+		else if( ( mg->hdr = xpt_alloc( XPT_ALLOC_CONTIG | XPT_ALLOC_NOCACHE, SDMMC_MERGE_HDR_SIZE, NULL ) ) == MAP_FAILED ) {
+			cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  xpt_alloc packed header failure", __FUNCTION__ );
+			mg->hdr = NULL;
+			ext->eflags &= ~SDMMC_EFLAG_PACKED;
+		}
+		else {
+			mg->hdr_paddr = xpt_vtop( mg->hdr, NULL );
+		}
+	}
+
+	cam_slogf( _SLOGC_SIM_MMC, _SLOG_INFO, 1, 1, "%s:  merging %d ccbs%s", __FUNCTION__,
+			SDMMC_MERGE_CCB_MAX, ( ext->eflags & SDMMC_EFLAG_PACKED ) ? ", packed writes" : "" );
+
+	return( EOK );
+}
+
+int sdmmc_merge_dinit( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_MERGE		*mg;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	mg		= &ext->merge;
+
+	if( mg->hdr ) {
+		xpt_free( mg->hdr, SDMMC_MERGE_HDR_SIZE );
+		mg->hdr = NULL;
+	}
+
+	return( EOK );
+}
+
+// can nccb share the transfer of ccb
+static int sdmmc_merge_ccb( CCB_SCSIIO *ccb, CCB_SCSIIO *nccb )
+{
+	if( nccb->cam_ch.cam_func_code != XPT_SCSI_IO || !nccb->cam_dxfer_len ) {
+		return( CAM_FALSE );
+	}
+
+	if( nccb->cam_cdb_io.cam_cdb_bytes[0] != ccb->cam_cdb_io.cam_cdb_bytes[0] ) {
+		return( CAM_FALSE );
+	}
+
+	if( nccb->cam_ch.cam_target_id != ccb->cam_ch.cam_target_id ||
+			nccb->cam_ch.cam_target_lun != ccb->cam_ch.cam_target_lun ) {
+		return( CAM_FALSE );
+	}
+
+	return( CAM_TRUE );
+}
+
+// Gather the ccbs queued behind ccb that can share its transfer.  A ccb
+// that can't is put back at the head of the simq.  Returns the number of
+// ccbs in the transfer, ccb included.
+int sdmmc_merge_gather( SIM_HBA *hba, CCB_SCSIIO *ccb, int flgs, uint64_t lba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_MERGE		*mg;
+	SDMMC_PARTITION	*part;
+	CCB_SCSIIO		*nccb;
+	uint64_t		nlba;
+	uint64_t		elba;
+	uint32_t		nblks;
+	uint32_t		blks;
+	uint32_t		blks_max;
+	uint32_t		blksz;
+	uint32_t		sgc;
+	uint32_t		sg_max;
+	int				packed;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	mg		= &ext->merge;
+	part	= &ext->targets[ccb->cam_ch.cam_target_id].partitions[ccb->cam_ch.cam_target_lun];
+	blksz	= ext->dev_inf.sector_size;
+
+	mg->nccb		= 1;
+	mg->nent		= 1;
+	mg->ccbs[0]		= ccb;
+	mg->lbas[0]		= lba;
+	mg->blks		= ccb->cam_dxfer_len / blksz;
+	mg->sgc			= ( ccb->cam_ch.cam_flags & CAM_SCATTER_VALID ) ? ccb->cam_sglist_cnt : 1;
+	elba			= lba + mg->blks;
+
+		// the packed header takes a block and a scatter list entry
+	packed		= ( flgs & SCF_DIR_OUT ) && ( ext->eflags & SDMMC_EFLAG_PACKED ) && elba <= SC_RW_MAX_LBA32;
+	sg_max		= min( ext->hc_inf.sg_max, SDMMC_MERGE_SGE_MAX ) - ( packed ? 1 : 0 );
+	blks_max	= SDMMC_MERGE_XFER_MAX / blksz - ( packed ? 1 : 0 );
+
+	while( mg->nccb < SDMMC_MERGE_CCB_MAX && ( nccb = simq_ccb_dequeue( hba->simq ) ) != NULL ) {
+		if( !sdmmc_merge_ccb( ccb, nccb ) ) {
+			simq_ccb_requeue( hba->simq, nccb );
+			break;
+		}
+
+		sdmmc_ccb_lba( nccb->cam_cdb_io.cam_cdb_bytes, &nlba, &nblks );
+
+		if( part->blk_shft ) {
+			nlba <<= part->blk_shft;
+		}
+
+		nlba	+= part->slba;
+		blks	= nccb->cam_dxfer_len / blksz;
+		sgc		= ( nccb->cam_ch.cam_flags & CAM_SCATTER_VALID ) ? nccb->cam_sglist_cnt : 1;
+
+		if( mg->blks + blks > blks_max || mg->sgc + sgc > sg_max ) {
+			simq_ccb_requeue( hba->simq, nccb );
+			break;
+		}
+
+		if( nlba != elba ) {
+			if( !packed || mg->nent >= ext->dev_inf.packed_wr || nlba + blks > SC_RW_MAX_LBA32 ) {
+				simq_ccb_requeue( hba->simq, nccb );
+				break;
+			}
+			mg->nent++;
+		}
+
+		mg->ccbs[mg->nccb]		= nccb;
+		mg->lbas[mg->nccb++]	= nlba;
+		mg->blks				+= blks;
+		mg->sgc					+= sgc;
+		elba					= nlba + blks;
+	}
+
+	if( mg->nccb > 1 ) {
+		sdmmc_pipe_flush( hba );		// data xfer was prepared for ccb alone
+	}
+
+	return( mg->nccb );
+}
+
+// physical scatter list of the gathered ccbs, behind the packed header
+static int sdmmc_merge_sgl( SIM_HBA *hba, int packed )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_MERGE		*mg;
+	CCB_SCSIIO		*ccb;
+	sdio_sge_t		*sgp;
+	sdio_sge_t		sge;
+	int				sgc;
+	int				nsg;
+	int				idx;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	mg		= &ext->merge;
+	sgc		= 0;
+
+	if( packed ) {
+		mg->sgl[sgc].sg_count	= ext->dev_inf.sector_size;
+		mg->sgl[sgc].sg_address	= mg->hdr_paddr;
+		sgc++;
+	}
+
+	for( idx = 0; idx < mg->nccb; idx++ ) {
+		ccb = mg->ccbs[idx];
+
+		if( ( ccb->cam_ch.cam_flags & CAM_SCATTER_VALID ) ) {
+			nsg				= ccb->cam_sglist_cnt;
+			sgp				= (sdio_sge_t *)ccb->cam_data.cam_sg_ptr;
+		}
+		else {
+			nsg				= 1;
+			sgp				= &sge;
+			sgp->sg_count	= ccb->cam_dxfer_len;
+			sgp->sg_address	= ccb->cam_data.cam_data_ptr;
+		}
+
+		if( ( ccb->cam_ch.cam_flags & CAM_DATA_PHYS ) ) {
+			memcpy( &mg->sgl[sgc], sgp, nsg * sizeof( sdio_sge_t ) );
+		}
+		else {
+			xpt_vtop_sg( (SG_ELEM *)sgp, (SG_ELEM *)&mg->sgl[sgc], nsg, ccb->cam_req_map );
+		}
+
+		sgc += nsg;
+	}
+
+	return( sgc );
+}
+
+// Fill in the packed command header, one entry (CMD23 and CMD25 argument)
+// per run of contiguous ccbs.
+static void sdmmc_merge_hdr( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_MERGE		*mg;
+	uint32_t		blksz;
+	uint32_t		blks;
+	uint64_t		addr;
+	int				ent;
+	int				idx;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	mg		= &ext->merge;
+	blksz	= ext->dev_inf.sector_size;
+	ent		= 0;
+
+	memset( mg->hdr, 0, blksz );
+
+	for( idx = 0; idx < mg->nccb; idx++ ) {
+		blks = mg->ccbs[idx]->cam_dxfer_len / blksz;
+		if( idx && mg->lbas[idx] == mg->lbas[idx - 1] + mg->ccbs[idx - 1]->cam_dxfer_len / blksz ) {
+			mg->hdr[ent * 2] += blks;
+			continue;
+		}
+
+		ent++;
+		addr					= ( ext->dev_inf.caps & DEV_CAP_HC ) ? mg->lbas[idx] : ( mg->lbas[idx] * blksz );
+		mg->hdr[ent * 2]		= blks;
+		mg->hdr[ent * 2 + 1]	= addr;
+	}
+
+	mg->hdr[0] = MMC_PACKED_HDR( MMC_PACKED_WRITE, ent );
+
+	for( ; ent >= 0; ent-- ) {
+		mg->hdr[ent * 2]		= ENDIAN_LE32( mg->hdr[ent * 2] );
+		mg->hdr[ent * 2 + 1]	= ENDIAN_LE32( mg->hdr[ent * 2 + 1] );
+	}
+}
+
+static int sdmmc_merge_packed( SIM_HBA *hba, SDMMC_PARTITION *part, int sgc, uint32_t timeout )
+{
+	SIM_SDMMC_EXT		*ext;
+	SDMMC_MERGE			*mg;
+	struct sdio_cmd		*cmd;
+	struct sdio_device	*dev;
+	uint64_t			addr;
+	uint32_t			blksz;
+	uint32_t			cstatus;
+	uint32_t			bsy_us;
+	uint32_t			rsp[4];
+	int					status;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	mg		= &ext->merge;
+	dev		= ext->device;
+	blksz	= ext->dev_inf.sector_size;
+	timeout	*= 1000;
+	addr	= ( ext->dev_inf.caps & DEV_CAP_HC ) ? mg->lbas[0] : ( mg->lbas[0] * blksz );
+
+	if( ( cmd = sdio_alloc_cmd( ) ) == NULL ) {
+		return( ENOMEM );
+	}
+
+	status = sdio_packed_write( dev, cmd, addr, SCF_DATA_PHYS, mg->blks + 1, blksz, mg->sgl, sgc, NULL, timeout );
+	sdio_cmd_status( cmd, &cstatus, rsp );
+	bsy_us = sdio_cmd_busy( cmd );
+	sdio_free_cmd( cmd );
+
+	if( status == ENXIO ) {				// card has been removed
+		return( status );
+	}
+
+	if( status == EOK && ( rsp[0] & CDS_ERROR_MSK ) ) {
+		status = EIO;
+	}
+
+	if( status == EOK ) {
+		status = sdmmc_wait_busy( hba, rsp, timeout, bsy_us );
+	}
+
+	if( status ) {
+		if( sdio_send_status( dev, rsp, 0 ) || ( rsp[0] & ( CDS_READY_FOR_DATA | CDS_CUR_STATE_MSK ) ) != ( CDS_READY_FOR_DATA | CDS_CUR_STATE_TRAN ) ) {
+			if( sdio_stop_transmission( dev, 0 ) ) {
+				sdmmc_reset( hba );
+			}
+		}
+
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  entries %d, blks %d, status %d, cstatus 0x%x, rsp[0] 0x%x",
+			__FUNCTION__, mg->nent, mg->blks, status, cstatus, rsp[0] );
+		return( status );
+	}
+
+	part->wc += mg->blks;
+
+	return( EOK );
+}
+
+// Issue the gathered ccbs as one transfer and complete the ccbs behind the
+// nexus.  Returns the cam status of the nexus.
+int sdmmc_merge_rw( SIM_HBA *hba, SDMMC_PARTITION *part, int flgs )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_MERGE		*mg;
+	CCB_SCSIIO		*ccb;
+	sdio_sge_t		*sgp;
+	sdio_sge_t		sge;
+	uint64_t		now;
+	int				sgc;
+	int				status;
+	int				cstatus;
+	int				idx;
+	int				op;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	mg		= &ext->merge;
+	ccb		= mg->ccbs[0];
+	flgs	&= SCF_DATA_MSK;
+	sgc		= sdmmc_merge_sgl( hba, mg->nent > 1 );
+
+		// each ccb gathered waited in the simq until now, the nexus is
+		// charged by sdmmc_rw unless the transfer is a packed write
+	if( ( ext->eflags & SDMMC_EFLAG_STATS ) ) {
+		op	= ( flgs & SCF_DIR_IN ) ? MMC_READ_MULTIPLE_BLOCK : MMC_WRITE_MULTIPLE_BLOCK;
+		now	= ClockCycles( );
+		for( idx = 1; idx < mg->nccb; idx++ ) {
+			if( SDMMC_CCB_PRIV( mg->ccbs[idx] )->queued ) {
+				sdmmc_stats_qwait( hba, op, now - SDMMC_CCB_PRIV( mg->ccbs[idx] )->queued );
+			}
+		}
+		if( mg->nent > 1 && ext->stats_qwait ) {
+			sdmmc_stats_qwait( hba, op, ext->stats_qwait );
+			ext->stats_qwait = 0;
+		}
+	}
+
+	if( ( flgs & SCF_DIR_OUT ) ) {			// the nexus was dropped by sdmmc_read_write
+		for( idx = 1; idx < mg->nccb; idx++ ) {
+			sdmmc_ra_invalidate( hba, part, mg->lbas[idx], mg->ccbs[idx]->cam_dxfer_len / ext->dev_inf.sector_size );
+			sdmmc_discard_clip( hba, part, mg->lbas[idx], mg->ccbs[idx]->cam_dxfer_len / ext->dev_inf.sector_size );
+		}
+	}
+
+	if( mg->nent > 1 ) {
+		sdmmc_merge_hdr( hba );
+		if( ( status = sdmmc_merge_packed( hba, part, sgc, ccb->cam_timeout ) ) == EOK ) {
+			mg->packed++;
+		}
+	}
+	else {
+		status = sdmmc_rw( hba, part, flgs | SCF_DATA_PHYS, mg->lbas[0], mg->blks * ext->dev_inf.sector_size,
+					mg->sgl, sgc, NULL, ccb->cam_timeout );
+	}
+
+	if( status == EOK ) {
+		mg->xfers++;
+		mg->merged += mg->nccb;
+		for( idx = 1; idx < mg->nccb; idx++ ) {
+			mg->ccbs[idx]->cam_ch.cam_status = CAM_REQ_CMP;
+			sdmmc_post_ccb( hba, mg->ccbs[idx] );
+		}
+		return( CAM_REQ_CMP );
+	}
+
+		// redo the ccbs one at a time so each gets its own status
+	mg->fallbacks++;
+	cstatus = CAM_REQ_CMP_ERR;
+
+	for( idx = 0; idx < mg->nccb; idx++ ) {
+		ccb = mg->ccbs[idx];
+
+		sdmmc_pipe_flush( hba );
+
+		if( ( ccb->cam_ch.cam_flags & CAM_SCATTER_VALID ) ) {
+			sgc				= ccb->cam_sglist_cnt;
+			sgp				= (sdio_sge_t *)ccb->cam_data.cam_sg_ptr;
+		}
+		else {
+			sgc				= 1;
+			sgp				= &sge;
+			sgp->sg_count	= ccb->cam_dxfer_len;
+			sgp->sg_address	= ccb->cam_data.cam_data_ptr;
+		}
+
+		if( ( status = sdmmc_rw( hba, part, flgs | ( ( ccb->cam_ch.cam_flags & CAM_DATA_PHYS ) ? SCF_DATA_PHYS : 0 ),
+					mg->lbas[idx], ccb->cam_dxfer_len, sgp, sgc, ccb->cam_req_map, ccb->cam_timeout ) ) != EOK ) {
+			status = sdmmc_error( hba, ccb, status );
+		}
+		else {
+			status = CAM_REQ_CMP;
+		}
+
+		if( idx == 0 ) {
+			cstatus = status;
+		}
+		else {
+			ccb->cam_ch.cam_status = status;
+			sdmmc_post_ccb( hba, ccb );
+		}
+	}
+
+	return( cstatus );
+}
+
+
+#if defined(__QNXNTO__) && defined(__USESRCVERSION)
+#include <sys/srcversion.h>
+__SRCVERSION("$URL$ $Rev$")
+#endif
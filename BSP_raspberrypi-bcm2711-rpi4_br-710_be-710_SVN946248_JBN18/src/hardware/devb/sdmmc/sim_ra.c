@@ -0,0 +1,359 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+// Module Description:  read-ahead
+//
+// Sequential readers (program loads, cp, media playback) hand the SIM a
+// stream of small reads, each paying for a command of its own.  Once
+// SDMMC_RA_SEQ_MIN reads have followed each other, a read that misses the
+// buffers is widened to the end of its aligned window and read into the
+// least recently used buffer.  The reads that follow are copied out of the
+// buffers without going to the device.  Writes and erases drop the buffers
+// they overlap, a reset or resume drops them all.
+//
+// A write or erase within a window of the stream would drop what was read
+// ahead before it is used.  It restarts the sequential count and halves the
+// window, down to SDMMC_RA_WIN_MIN.  Each buffer the stream reads to its
+// end doubles the window again, up to the buffer size.
+
+#include <sim_sdmmc.h>
+
+int sdmmc_ra_init( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_RA		*ra;
+	SDMMC_RA_BUF	*rb;
+	uint32_t		size;
+	uint32_t		win;
+	int				idx;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	ra		= &ext->ra;
+	size	= ra->size;
+
+	memset( ra, 0, sizeof( SDMMC_RA ) );
+	ra->size = size;
+
+	if( !size ) {
+		return( EOK );
+	}
+
+	if( ( ext->eflags & SDMMC_EFLAG_CMDQ ) ) {		// reads are queued tasks
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  read-ahead not supported with command queue", __FUNCTION__ );
+		return( ENOTSUP );
+	}
+
+		// buffers are filled by DMA and read back through the cache
+	if( !( ext->hc_inf.caps & HC_CAP_DMA ) ) {
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  host doesn't support DMA", __FUNCTION__ );
+		return( ENOTSUP );
+	}
+
+	win = min( size / ext->dev_inf.sector_size, SDMMC_RA_WIN_MAX );
+	if( win < SDMMC_RA_WIN_MIN ) {
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  read-ahead size %d too small", __FUNCTION__, size );
+		return( EINVAL );
+	}
+
+	ra->win		= win;
+	ra->cur		= win;
+	ra->size	= win * ext->dev_inf.sector_size;
+
+	for( idx = 0; idx < SDMMC_RA_BUFS; idx++ ) {
+		rb = &ra->bufs[idx];
+		if( ( rb->vaddr = xpt_alloc( XPT_ALLOC_CONTIG, ra->size, &rb->paddr ) ) == MAP_FAILED ) {
+			cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  xpt_alloc read-ahead buffer failure", __FUNCTION__ );
+			rb->vaddr = NULL;
+			sdmmc_ra_dinit( hba );
+			return( ENOMEM );
+		}
+		ra->nbufs++;
+	}
+
+	ra->stats.nbufs		= ra->nbufs;
+	ra->stats.buf_size	= ra->size;
+	ra->stats.cur_size	= ra->size;
+
+	cam_slogf( _SLOGC_SIM_MMC, _SLOG_INFO, 1, 1, "%s:  read-ahead %d x %dKB", __FUNCTION__, ra->nbufs, ra->size / 1024 );
+
+	return( EOK );
+}
+
+int sdmmc_ra_dinit( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_RA		*ra;
+	SDMMC_RA_BUF	*rb;
+	int				idx;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	ra		= &ext->ra;
+
+	for( idx = 0; idx < SDMMC_RA_BUFS; idx++ ) {
+		rb = &ra->bufs[idx];
+		if( rb->vaddr ) {
+			xpt_free( rb->vaddr, ra->size );
+			rb->vaddr = NULL;
+		}
+		rb->blks = 0;
+	}
+
+	ra->nbufs			= 0;
+	ra->stats.nbufs		= 0;
+
+	return( EOK );
+}
+
+static SDMMC_RA_BUF *sdmmc_ra_lookup( SDMMC_RA *ra, uint32_t config, uint64_t lba )
+{
+	SDMMC_RA_BUF	*rb;
+	int				idx;
+
+	for( idx = 0; idx < ra->nbufs; idx++ ) {
+		rb = &ra->bufs[idx];
+		if( rb->blks && rb->config == config && lba >= rb->lba && lba < rb->lba + rb->blks ) {
+			return( rb );
+		}
+	}
+
+	return( NULL );
+}
+
+// first block of lba to elba that isn't buffered, elba if they all are
+static uint64_t sdmmc_ra_hole( SDMMC_RA *ra, uint32_t config, uint64_t lba, uint64_t elba )
+{
+	SDMMC_RA_BUF	*rb;
+
+	while( lba < elba && ( rb = sdmmc_ra_lookup( ra, config, lba ) ) != NULL ) {
+		lba = rb->lba + rb->blks;
+	}
+
+	return( min( lba, elba ) );
+}
+
+// Read from lba to the end of its window, and at least to relba (the end of
+// the read), into the least recently used buffer
+static int sdmmc_ra_fill( SIM_HBA *hba, SDMMC_PARTITION *part, uint64_t lba, uint64_t relba, uint32_t timeout )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_RA		*ra;
+	SDMMC_RA_BUF	*rb;
+	sdio_sge_t		sge;
+	uint64_t		elba;
+	uint32_t		blks;
+	int				status;
+	int				idx;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	ra		= &ext->ra;
+	elba	= min( max( lba - lba % ra->cur + ra->cur, relba ), lba + ra->win );
+	elba	= min( elba, part->slba + part->nlba );
+	blks	= elba - lba;
+	rb		= &ra->bufs[0];
+
+	for( idx = 1; idx < ra->nbufs && rb->blks; idx++ ) {
+		if( !ra->bufs[idx].blks || ra->bufs[idx].stamp < rb->stamp ) {
+			rb = &ra->bufs[idx];
+		}
+	}
+
+	rb->blks		= 0;
+	sge.sg_count	= blks * ext->dev_inf.sector_size;
+	sge.sg_address	= rb->paddr;
+
+	if( ( status = sdmmc_rw( hba, part, SCF_DIR_IN | SCF_DATA_PHYS, lba, sge.sg_count, &sge, 1, NULL, timeout ) ) != EOK ) {
+		return( status );
+	}
+
+	xpt_cache_inval( rb->vaddr, rb->paddr, sge.sg_count );
+
+	rb->config		= part->config;
+	rb->lba			= lba;
+	rb->blks		= blks;
+	rb->stamp		= ++ra->stamp;
+
+	ra->stats.fills++;
+	ra->stats.fill_bytes += ( elba - max( lba, min( relba, elba ) ) ) * ext->dev_inf.sector_size;
+
+	return( EOK );
+}
+
+// copy the blocks of ccb out of the buffers, they must all be buffered
+static void sdmmc_ra_copy( SIM_HBA *hba, CCB_SCSIIO *ccb, uint32_t config, uint64_t lba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_RA		*ra;
+	SDMMC_RA_BUF	*rb;
+	sdio_sge_t		*sgp;
+	sdio_sge_t		sge;
+	char			*src;
+	uint32_t		blksz;
+	uint32_t		len;
+	uint32_t		cnt;
+	uint32_t		off;
+	uint32_t		soff;
+	uint32_t		n;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	ra		= &ext->ra;
+	blksz	= ext->dev_inf.sector_size;
+	len		= ccb->cam_dxfer_len;
+	soff	= 0;
+
+	if( ( ccb->cam_ch.cam_flags & CAM_SCATTER_VALID ) ) {
+		sgp				= (sdio_sge_t *)ccb->cam_data.cam_sg_ptr;
+	}
+	else {
+		sgp				= &sge;
+		sgp->sg_count	= ccb->cam_dxfer_len;
+		sgp->sg_address	= ccb->cam_data.cam_data_ptr;
+	}
+
+	while( len ) {
+		rb			= sdmmc_ra_lookup( ra, config, lba );
+		off			= ( lba - rb->lba ) * blksz;
+		cnt			= min( len, rb->blks * blksz - off );
+		src			= rb->vaddr + off;
+		rb->stamp	= ++ra->stamp;
+		lba			+= cnt / blksz;
+		len			-= cnt;
+
+		while( cnt ) {
+			n = min( cnt, sgp->sg_count - soff );
+			memcpy( (char *)(uintptr_t)sgp->sg_address + soff, src, n );
+			src		+= n;
+			cnt		-= n;
+			soff	+= n;
+			if( soff == sgp->sg_count ) {
+				sgp++;
+				soff = 0;
+			}
+		}
+	}
+}
+
+// Satisfy a read from the buffers, reading ahead when it continues a
+// sequential stream.  Returns EOK when the ccb data has been supplied,
+// otherwise the read is left to the caller.
+int sdmmc_ra_read( SIM_HBA *hba, SDMMC_PARTITION *part, CCB_SCSIIO *ccb, uint64_t lba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_RA		*ra;
+	SDMMC_RA_BUF	*rb;
+	uint64_t		elba;
+	uint64_t		hole;
+	uint32_t		blks;
+	int				status;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	ra		= &ext->ra;
+
+		// no mapping to copy out through, so with read-ahead io-blk isn't
+		// asked for physical lists (phys=on, see sdmmc_path_inq())
+	if( ( ccb->cam_ch.cam_flags & CAM_DATA_PHYS ) ) {
+		return( ENOTSUP );
+	}
+
+	blks	= ccb->cam_dxfer_len / ext->dev_inf.sector_size;
+	elba	= lba + blks;
+
+	if( part->config == ra->config && lba == ra->next_lba ) {
+		if( ra->seq < SDMMC_RA_SEQ_MIN ) {
+			ra->seq++;
+		}
+	}
+	else {
+		ra->seq = 0;
+	}
+
+	ra->config		= part->config;
+	ra->next_lba	= elba;
+
+	if( ( hole = sdmmc_ra_hole( ra, part->config, lba, elba ) ) < elba ) {
+		ra->stats.misses++;
+
+		if( ra->seq < SDMMC_RA_SEQ_MIN || blks >= ra->win || elba > part->slba + part->nlba ) {
+			return( ENOENT );
+		}
+
+		sdmmc_pipe_flush( hba );		// data xfer was prepared for ccb
+
+		do {
+			if( ( status = sdmmc_ra_fill( hba, part, hole, elba, ccb->cam_timeout ) ) != EOK ) {
+				return( status );
+			}
+		} while( ( hole = sdmmc_ra_hole( ra, part->config, hole, elba ) ) < elba );
+	}
+	else {
+		sdmmc_pipe_flush( hba );
+		ra->stats.hits++;
+		ra->stats.hit_bytes += ccb->cam_dxfer_len;
+	}
+
+	sdmmc_ra_copy( hba, ccb, part->config, lba );
+
+		// the stream used a whole buffer, widen the window again
+	rb = sdmmc_ra_lookup( ra, part->config, elba - 1 );
+	if( elba == rb->lba + rb->blks && ra->cur < ra->win ) {
+		ra->cur				= min( ra->cur * 2, ra->win );
+		ra->stats.cur_size	= ra->cur * ext->dev_inf.sector_size;
+	}
+
+	return( EOK );
+}
+
+// Drop the buffers holding any of blks blocks at lba, all of them if part is NULL
+void sdmmc_ra_invalidate( SIM_HBA *hba, SDMMC_PARTITION *part, uint64_t lba, uint64_t blks )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_RA		*ra;
+	SDMMC_RA_BUF	*rb;
+	int				idx;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	ra		= &ext->ra;
+
+	if( part && part->config == ra->config && ra->nbufs &&
+			lba < ra->next_lba + ra->cur && lba + blks + ra->cur > ra->next_lba ) {
+		ra->seq				= 0;
+		ra->cur				= max( ra->cur / 2, SDMMC_RA_WIN_MIN );
+		ra->stats.cur_size	= ra->cur * ext->dev_inf.sector_size;
+		ra->stats.backoffs++;
+	}
+
+	for( idx = 0; idx < ra->nbufs; idx++ ) {
+		rb = &ra->bufs[idx];
+		if( !rb->blks ) {
+			continue;
+		}
+
+		if( part == NULL || ( rb->config == part->config && lba < rb->lba + rb->blks && rb->lba < lba + blks ) ) {
+			rb->blks = 0;
+			ra->stats.invalidates++;
+		}
+	}
+}
+
+
+#if defined(__QNXNTO__) && defined(__USESRCVERSION)
+#include <sys/srcversion.h>
+__SRCVERSION("$URL$ $Rev$")
+#endif
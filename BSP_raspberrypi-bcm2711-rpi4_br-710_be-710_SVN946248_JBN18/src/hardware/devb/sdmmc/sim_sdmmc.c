@@ -111,7 +111,9 @@ static SIM_HBA *sdmmc_alloc_hba( )
 
 	ext = (SIM_SDMMC_EXT *)hba->ext;
 
-	hba->pathid			= hba->coid = hba->chid = hba->tid = hba->iid = -1;
+	hba->pathid			= -1;
+	hba->coid			= hba->chid = hba->iid = -1;
+	hba->tid			= -1;
 	hba->verbosity		= sdmmc_ctrl.verbosity;
 	ext->ntargs			= 0;
 	ext->priority		= SDMMC_SCHED_PRIORITY;
@@ -263,6 +265,8 @@ static int sdmmc_dev_cfg( SIM_HBA *hba )
 
 //	cam_slogf( _SLOGC_SIM_MMC, _SLOG_INFO, 1, 1, "%s", __FUNCTION__ );
 
+	sdmmc_ra_invalidate( hba, NULL, 0, 0 );		// reset or resume, don't trust the buffers
+
 	if( ( ext->dev_inf.caps & DEV_CAP_CACHE ) && ( ext->eflags & SDMMC_EFLAG_CACHE ) ) {
 		if( sdio_cache( ext->device, ( ext->eflags & SDMMC_EFLAG_CACHE ) ? SDIO_CACHE_ENABLE : SDIO_CACHE_DISABLE, SDIO_TIME_DEFAULT ) ) {
 			cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  Error %s volatile cache", __FUNCTION__, ( ext->eflags & SDMMC_EFLAG_CACHE ) ? "Enabling" : "Disabling" );
@@ -306,6 +310,15 @@ static int sdmmc_dev_dcfg( SIM_HBA *hba )
 
 //	cam_slogf( _SLOGC_SIM_MMC, _SLOG_INFO, 1, 1, "%s", __FUNCTION__ );
 
+	sdmmc_discard_flush( hba );
+
+		// leave the device in legacy mode for the next owner
+	if( ( ext->eflags & SDMMC_EFLAG_CMDQ ) ) {
+		if( ( status = sdio_cmdq( ext->device, SDIO_CMDQ_DISABLE, SDIO_TIME_DEFAULT ) ) != EOK ) {
+			cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  Error Disabling command queue", __FUNCTION__ );
+		}
+	}
+
 		// flush volatile cache
 	if( ( ext->dev_inf.caps & DEV_CAP_CACHE ) && ( ext->eflags & SDMMC_EFLAG_CACHE ) ) {
 		if( ( status = sdio_cache( ext->device, SDIO_CACHE_FLUSH, SDIO_TIME_DEFAULT * 5 ) ) != EOK ) {
@@ -359,6 +372,7 @@ static int sdmmc_detach( SIM_HBA *hba )
 	}
 
 	if( hba->simq ) {
+		sdmmc_pipe_flush( hba );
 		simq_dinit( hba->simq );
 	}
 
@@ -367,6 +381,12 @@ static int sdmmc_detach( SIM_HBA *hba )
 		sdio_detach( ext->device );
 	}
 
+	sdmmc_merge_dinit( hba );
+
+	sdmmc_ra_dinit( hba );
+
+	sdmmc_vtop_dinit( hba );
+
 #ifdef SDMMC_WRITE_VERIFY
 	if( ext->ver_vaddr ) {
 		xpt_free( ext->ver_vaddr, SDMMC_VER_BSIZE );
@@ -441,6 +461,20 @@ static int sdmmc_attach( SIM_HBA *hba, struct sdio_connection *connection, sdio_
 
 		sdmmc_dev_cfg( hba );
 
+		sdmmc_cmdq_init( hba );
+
+		sdmmc_merge_init( hba );
+
+		sdmmc_ra_init( hba );
+
+		sdmmc_vtop_init( hba );
+
+		sdmmc_discard_init( hba );
+
+		if( ( ext->eflags & SDMMC_EFLAG_STATS ) ) {
+			sdmmc_stats_enable( hba, CAM_TRUE );
+		}
+
 		status = sdmmc_reg( hba );
 	}
 
@@ -503,7 +537,7 @@ static void sdmmc_sdio_event( struct sdio_connection *connection, sdio_device_in
 	}
 }
 
-static int sdmmc_post_ccb( SIM_HBA *hba, CCB_SCSIIO *ccb )
+int sdmmc_post_ccb( SIM_HBA *hba, CCB_SCSIIO *ccb )
 {
 	SIM_SDMMC_EXT	*ext;
 	struct timespec	ts;
@@ -555,7 +589,7 @@ static int sdmmc_sense( CCB_SCSIIO *ccb, int sense, int asc, int ascq )
 	return( ccb->cam_ch.cam_status );
 }
 
-static int sdmmc_error( SIM_HBA *hba, CCB_SCSIIO *ccb, int status )
+int sdmmc_error( SIM_HBA *hba, CCB_SCSIIO *ccb, int status )
 {
 	SIM_SDMMC_EXT	*ext;
 
@@ -946,9 +980,14 @@ static int sdmmc_write_same( SIM_HBA *hba, CCB_SCSIIO *ccb )
 		return( status );
 	}
 
+	sdmmc_ra_invalidate( hba, part, lba, nlba );
+
 	if( !( ext->dev_inf.caps & DEV_CAP_TRIM ) || !( cdb->write_same16.opt & WS_OPT_UNMAP ) ) {
 		status = sdmmc_error( hba, ccb, EINVAL );
 	}
+	else if( sdmmc_discard_queue( hba, part, MMC_ERASE_TRIM, lba, nlba ) == EOK ) {
+		status = EOK;
+	}
 	else if( ( status = sdio_erase( ext->device, part->config, MMC_ERASE_TRIM, lba, nlba ) ) ) {
 		status = sdmmc_error( hba, ccb, status );
 	}
@@ -986,8 +1025,11 @@ static int sdmmc_erase12( SIM_HBA *hba, CCB_SCSIIO *ccb )
 				( lba % egs ) || ( nlba % egs ) ) {
 			status = sdmmc_error( hba, ccb, EINVAL );
 		}
-		else if( ( status = sdio_erase( ext->device, part->config, MMC_ERASE_SECURE, lba, nlba ) ) ) {
-			status = sdmmc_error( hba, ccb, status );
+		else {
+			sdmmc_ra_invalidate( hba, part, lba, nlba );
+			if( ( status = sdio_erase( ext->device, part->config, MMC_ERASE_SECURE, lba, nlba ) ) ) {
+				status = sdmmc_error( hba, ccb, status );
+			}
 		}
 	}
 
@@ -1187,6 +1229,10 @@ static int sdmmc_pm( SIM_HBA *hba, int op )
 }
 #endif
 
+	if( op != PM_ACTIVE && ext->discard.nranges ) {
+		sdmmc_discard_flush( hba );
+	}
+
 	switch( op ) {
 		case PM_IDLE:
 			sdio_pwrmgnt( ext->device, PM_IDLE );
@@ -1292,6 +1338,10 @@ int sdmmc_reset( SIM_HBA *hba )
 
 	ext		= (SIM_SDMMC_EXT *)hba->ext;
 
+		// the reset drops the host's prepared transfer, put the
+		// pipelined ccb back on the simq to be issued after it
+	sdmmc_pipe_flush( hba );
+
 	sdio_reset( ext->device );
 
 	if( ( ext->dev_inf.caps & DEV_CAP_CACHE ) && ( ext->eflags & SDMMC_EFLAG_CACHE ) ) {
@@ -1554,6 +1604,184 @@ static int sdmmc_write_protect( SIM_HBA *hba, int op, int partition, int mode, u
 }
 
 
+// Drop the pipelined ccb and its prepared data transfer.  The ccb goes
+// back to the head of the simq, where a freeze caused by a failed nexus
+// holds it like any other queued request.
+void sdmmc_pipe_flush( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT		*ext;
+
+	ext = (SIM_SDMMC_EXT *)hba->ext;
+
+	if( ext->pcmd ) {
+		sdio_prep_cmd( ext->device, NULL );
+		sdio_free_cmd( ext->pcmd );
+		ext->pcmd = NULL;
+	}
+	ext->psgl = NULL;
+
+	if( ext->pnexus ) {
+		simq_ccb_requeue( hba->simq, ext->pnexus );
+		ext->pnexus = NULL;
+	}
+}
+
+// sdio_send_cmd callback, called once a read/write data transfer is in
+// flight.  Dequeue the next ccb and, if it is a read/write, have the host
+// translate its buffers and build its DMA table now, so the command can be
+// issued the moment the current transfer completes.
+static void sdmmc_pipe( struct sdio_device *device, struct sdio_cmd *cmd, void *hdl )
+{
+	SIM_HBA				*hba;
+	SIM_SDMMC_EXT		*ext;
+	CCB_SCSIIO			*ccb;
+	sdio_sge_t			*sgp;
+	int					sgc;
+	int					flgs;
+
+	hba		= (SIM_HBA *)hdl;
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+
+	if( ( ext->eflags & SDMMC_EFLAG_CMDQ ) ) {		// reads/writes are queued tasks
+		return;
+	}
+
+	if( ext->pnexus == NULL ) {
+		if( ext->pcmd || ( ext->pnexus = simq_ccb_dequeue( hba->simq ) ) == NULL ) {
+			return;
+		}
+	}
+
+	ccb = ext->pnexus;
+	if( ccb->cam_ch.cam_func_code != XPT_SCSI_IO || !ccb->cam_dxfer_len ) {
+		return;
+	}
+
+	switch( ccb->cam_cdb_io.cam_cdb_bytes[0] ) {
+		case SC_READ10:
+			flgs = SCF_DIR_IN; break;
+		case SC_WRITE10:
+			flgs = SCF_DIR_OUT; break;
+		default:
+			return;
+	}
+
+	if( ( ccb->cam_ch.cam_flags & CAM_SCATTER_VALID ) ) {
+		sgc				= ccb->cam_sglist_cnt;
+		sgp				= (sdio_sge_t *)ccb->cam_data.cam_sg_ptr;
+	}
+	else {
+		sgc				= 1;
+		sgp				= &ext->psge;
+		sgp->sg_count	= ccb->cam_dxfer_len;
+		sgp->sg_address	= ccb->cam_data.cam_data_ptr;
+	}
+
+	if( ( ccb->cam_ch.cam_flags & CAM_DATA_PHYS ) ) {
+		flgs |= SCF_DATA_PHYS;
+	}
+	else if( sdmmc_vtop( hba, &sgp, sgc, ccb->cam_req_map, CAM_TRUE ) == EOK ) {
+		flgs |= SCF_DATA_PHYS;
+	}
+
+	if( ext->pcmd == NULL && ( ext->pcmd = sdio_alloc_cmd( ) ) == NULL ) {
+		return;
+	}
+
+		// sdmmc_read_write issues the nexus with this list, so the host
+		// sees the transfer it prepared and keeps the table it built
+	ext->psgl = ( flgs & SCF_DATA_PHYS ) ? sgp : NULL;
+
+	sdio_setup_cmd_io( ext->pcmd, flgs, ccb->cam_dxfer_len / ext->dev_inf.sector_size,
+				ext->dev_inf.sector_size, sgp, sgc, ccb->cam_req_map );
+
+	if( sdio_prep_cmd( device, ext->pcmd ) != EOK ) {
+		sdio_free_cmd( ext->pcmd );
+		ext->pcmd = NULL;
+		ext->psgl = NULL;
+	}
+}
+
+// Wait for the card to finish programming after a write, timeout in ms.
+// Hosts with busy detection complete the write at the end of DAT0 busy, so
+// the card is normally ready at the first status poll.  bsy_us is the busy
+// the host already waited out (sdio_cmd_busy), the histogram counts it
+// together with the polls.
+int sdmmc_wait_busy( SIM_HBA *hba, uint32_t *rsp, uint32_t timeout, uint32_t bsy_us )
+{
+	SIM_SDMMC_EXT		*ext;
+	SDMMC_BUSY_STATS	*bs;
+	struct timespec		ts;
+	uint64_t			start;
+	uint64_t			us;
+	int					status;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	bs		= &ext->busy;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	start	= timespec2nsec( &ts );
+
+	status	= sdio_wait_card_status( ext->device, rsp, CDS_READY_FOR_DATA | CDS_CUR_STATE_MSK, CDS_READY_FOR_DATA | CDS_CUR_STATE_TRAN, timeout );
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	us		= ( timespec2nsec( &ts ) - start ) / 1000 + bsy_us;
+
+	bs->waits++;
+	bs->total_us	+= us;
+	bs->max_us		= max( bs->max_us, us );
+	bs->hist[sdio_stats_bin( us, SDMMC_BUSY_HIST_BINS )]++;
+
+	return( status );
+}
+
+void sdmmc_stats_enable( SIM_HBA *hba, int enable )
+{
+	SIM_SDMMC_EXT		*ext;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+
+	if( enable ) {
+		ext->stats_cpu = max( SYSPAGE_ENTRY( qtime )->cycles_per_sec / 1000000, 1 );
+		sdio_stats( ext->device, NULL, SDIO_STATS_ENABLE );
+		atomic_set( &ext->eflags, SDMMC_EFLAG_STATS );
+	}
+	else {
+		atomic_clr( &ext->eflags, SDMMC_EFLAG_STATS );
+		sdio_stats( ext->device, NULL, SDIO_STATS_DISABLE );
+	}
+}
+
+// Charge the cycles a ccb was queued to the read/write command carrying it
+void sdmmc_stats_qwait( SIM_HBA *hba, int op, uint64_t cycles )
+{
+	SIM_SDMMC_EXT		*ext;
+	SDMMC_QWAIT			*qw;
+	SDMMC_LAT_HIST		*lh;
+	uint64_t			us;
+	int					idx;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	us		= cycles / ext->stats_cpu;
+
+	for( idx = 0, qw = ext->qwait; idx < SDMMC_QWAIT_OPS; idx++, qw++ ) {
+		if( qw->opcode == op || qw->lat.count == 0 ) {
+			break;
+		}
+	}
+
+	if( idx == SDMMC_QWAIT_OPS ) {
+		return;
+	}
+
+	lh				= &qw->lat;
+	qw->opcode		= op;
+	lh->count++;
+	lh->total_us	+= us;
+	lh->max_us		= max( lh->max_us, us );
+	lh->hist[sdio_stats_bin( us, SDMMC_LAT_BINS )]++;
+}
+
 int sdmmc_rw( SIM_HBA *hba, SDMMC_PARTITION *part, int flgs, uint64_t addr, int dlen, sdio_sge_t *sgl, int sgc, void *mhdl, uint32_t timeout )
 {
 	SIM_SDMMC_EXT		*ext;
@@ -1567,6 +1795,8 @@ int sdmmc_rw( SIM_HBA *hba, SDMMC_PARTITION *part, int flgs, uint64_t addr, int
 	int					status;
 	int					bus_err;
 	uint32_t			cstatus;
+	uint32_t			bsy_us;
+	uint32_t			stop_us;
 	uint32_t			rsp[4];
 
 	ext		= (SIM_SDMMC_EXT *)hba->ext;
@@ -1598,16 +1828,26 @@ int sdmmc_rw( SIM_HBA *hba, SDMMC_PARTITION *part, int flgs, uint64_t addr, int
 		flgs |= SCF_SUA;
 	}
 
-	if( ( cmd = sdio_alloc_cmd( ) ) == NULL ) {
+	if( ext->pcmd && ext->pnexus == NULL ) {		// data xfer already prepared for the nexus
+		cmd			= ext->pcmd;
+		ext->pcmd	= NULL;
+	}
+	else if( ( cmd = sdio_alloc_cmd( ) ) == NULL ) {
 		return( ENOMEM );
 	}
 
 	sdio_setup_cmd_ext( cmd, SCF_CTYPE_ADTC | SCF_RSP_R1, op, addr, addr >> 32 );
 	sdio_setup_cmd_io( cmd, flgs, blks, blksz, sgl, sgc, mhdl );
-	status = sdio_send_cmd( dev, cmd, NULL, timeout, 0 );
+	status = sdio_send_cmd( dev, cmd, sdmmc_pipe, timeout, 0 );
 	sdio_cmd_status( cmd, &cstatus, rsp );
+	bsy_us = sdio_cmd_busy( cmd );
 	sdio_free_cmd( cmd );
 
+	if( ext->stats_qwait ) {
+		sdmmc_stats_qwait( hba, op, ext->stats_qwait );
+		ext->stats_qwait = 0;
+	}
+
 	if( status ) {
 		if( status == ENXIO ) {				// card has been removed
 			return( status );
@@ -1622,14 +1862,17 @@ int sdmmc_rw( SIM_HBA *hba, SDMMC_PARTITION *part, int flgs, uint64_t addr, int
 	else {
 		if( ( flgs & SCF_MULTIBLK ) ) {
 			if( ( !( flgs & SCF_SBC ) && ( dlen > blksz ) && !( ext->hc_inf.caps & HC_CAP_ACMD12 ) ) ) {
-				if( sdio_stop_transmission( dev, 0 ) ) {
+					// a write's busy follows the CMD12 that ends it
+				stop_us = 0;
+				if( sdio_stop_transmission_ext( dev, 0, &stop_us ) ) {
 					status = ETIMEDOUT;
 				}
+				bsy_us += stop_us;
 			}
 		}
 
 		if( status == EOK && ( flgs & SCF_DIR_OUT ) ) {
-			if( ( status = sdio_wait_card_status( dev, rsp, CDS_READY_FOR_DATA | CDS_CUR_STATE_MSK, CDS_READY_FOR_DATA | CDS_CUR_STATE_TRAN, timeout ) ) ) {
+			if( ( status = sdmmc_wait_busy( hba, rsp, timeout, bsy_us ) ) ) {
 				sdio_stop_transmission( dev, 0 );
 			}
 		}
@@ -1803,7 +2046,7 @@ int sdmmc_write_verify( SIM_HBA *hba, CCB_SCSIIO *ccb )
 }
 #endif
 
-static void sdmmc_ccb_lba( uint8_t *cdb, uint64_t *lba, uint32_t *nlba )
+void sdmmc_ccb_lba( uint8_t *cdb, uint64_t *lba, uint32_t *nlba )
 {
 	switch( cdb[0] ) {
 		case SC_READ10:
@@ -1895,6 +2138,33 @@ int sdmmc_read_write( SIM_HBA *hba, CCB_SCSIIO *ccb, int flgs )
 
 	lba		+= part->slba;
 
+	if( ( flgs & SCF_DIR_OUT ) && ext->discard.nranges ) {
+		sdmmc_discard_clip( hba, part, lba, ccb->cam_dxfer_len / ext->dev_inf.sector_size );
+	}
+
+	if( ext->ra.nbufs ) {
+		if( ( flgs & SCF_DIR_IN ) ) {
+			if( sdmmc_ra_read( hba, part, ccb, lba ) == EOK ) {
+				return( CAM_REQ_CMP );
+			}
+		}
+		else {
+			sdmmc_ra_invalidate( hba, part, lba, ccb->cam_dxfer_len / ext->dev_inf.sector_size );
+		}
+	}
+
+	if( ( ext->eflags & SDMMC_EFLAG_MERGE ) && sdmmc_merge_gather( hba, ccb, flgs, lba ) > 1 ) {
+		return( sdmmc_merge_rw( hba, part, flgs ) );
+	}
+
+	if( ext->pcmd && ext->pnexus == NULL && ext->psgl ) {		// translated by sdmmc_pipe
+		sgp		= ext->psgl;
+		flgs	|= SCF_DATA_PHYS;
+	}
+	else if( !( flgs & SCF_DATA_PHYS ) && sdmmc_vtop( hba, &sgp, sgc, ccb->cam_req_map, CAM_FALSE ) == EOK ) {
+		flgs |= SCF_DATA_PHYS;
+	}
+
 #ifdef SDMMC_SIM_RETRY
 	retry = SDMMC_RW_RETRIES;
 	do {
@@ -2055,6 +2325,13 @@ int sdmmc_erase_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb )
 		status = EINVAL;			// verify request is within partition
 	}
 	else {
+		sdmmc_ra_invalidate( hba, part, slba, nlba );
+
+			// a waiting discard must not reach blocks erased now
+		if( erase->action != SDMMC_ERASE_ACTION_DISCARD ) {
+			sdmmc_discard_clip( hba, part, slba, nlba );
+		}
+
 		switch( erase->action ) {
 			case SDMMC_ERASE_ACTION_NORMAL:
 					// verify for erase group alignment
@@ -2075,7 +2352,7 @@ int sdmmc_erase_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb )
 				}
 				break;
 
-			case SDMMC_ERASE_ACTION_TRIM:
+			case SDMMC_ERASE_ACTION_TRIM:		// reads erased after, not deferred
 				if( ( ext->dev_inf.caps & DEV_CAP_TRIM ) ) {
 					if( ( status = sdio_erase( ext->device, part->config, MMC_ERASE_TRIM, slba, nlba ) ) == EOK ) {
 						part->tc += nlba;
@@ -2099,7 +2376,9 @@ int sdmmc_erase_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb )
 
 			case SDMMC_ERASE_ACTION_DISCARD:
 				if( ( ext->dev_inf.caps & DEV_CAP_TRIM ) ) {
-					if( ( status = sdio_erase( ext->device, part->config, MMC_ERASE_DISCARD, slba, nlba ) ) == EOK ) {
+					if( sdmmc_discard_queue( hba, part, MMC_ERASE_DISCARD, slba, nlba ) == EOK ||
+							( status = sdio_erase( ext->device, part->config, MMC_ERASE_DISCARD, slba, nlba ) ) == EOK ) {
+						status = EOK;
 						part->dc += nlba;
 					}
 				}
@@ -2149,6 +2428,10 @@ static int sdmmc_lock_unlock_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb )
 		return( CAM_REQ_CMP );
 	}
 
+	if( lock->action == SDMMC_LU_ACTION_ERASE ) {
+		sdmmc_ra_invalidate( hba, NULL, 0, 0 );
+	}
+
 	if( ( status = sdio_lock_unlock( ext->device, lock->action, lock->pwd, lock->pwd_len ) ) == EOK ) {
 		sdio_dev_info( ext->device, &ext->dev_inf );	// update device info
 	}
@@ -2344,7 +2627,10 @@ static int sdmmc_dsm( SIM_HBA *hba, SDMMC_PARTITION *part, DATA_SET_MGNT *dsm, i
 			break;
 		}
 
-		if( ( status = sdio_erase( ext->device, part->config, dtype, lba, nlba ) ) ) {
+		sdmmc_ra_invalidate( hba, part, lba, nlba );
+
+		if( sdmmc_discard_queue( hba, part, dtype, lba, nlba ) != EOK &&
+				( status = sdio_erase( ext->device, part->config, dtype, lba, nlba ) ) ) {
 			break;
 		}
 
@@ -2465,6 +2751,226 @@ static int sdmmc_part_info_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb )
 	return( CAM_REQ_CMP );
 }
 
+static int sdmmc_busy_stats_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb )
+{
+	SIM_SDMMC_EXT			*ext;
+	SDMMC_BUSY_STATS		*bs;
+	uint32_t				action;
+	int						status;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	bs		= (SDMMC_BUSY_STATS *)ccb->cam_devctl_data;
+	status	= EOK;
+
+	if( ccb->cam_devctl_size < ( sizeof( SDMMC_BUSY_STATS ) ) ) {
+		status = EINVAL;
+	}
+	else {
+		action		= bs->action;
+		*bs			= ext->busy;
+		bs->action	= action;
+		bs->flags	= ( ext->hc_inf.caps & HC_CAP_BSY ) ? SDMMC_BUSY_HW : 0;
+
+		switch( action ) {
+			case SDMMC_STATS_ACTION_GET:
+				break;
+
+			case SDMMC_STATS_ACTION_RESET:
+				memset( &ext->busy, 0, sizeof( ext->busy ) );
+				break;
+
+			default:
+				status = EINVAL;
+				break;
+		}
+	}
+
+	ccb->cam_devctl_status = status;
+
+	return( CAM_REQ_CMP );
+}
+
+static int sdmmc_ra_stats_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb )
+{
+	SIM_SDMMC_EXT			*ext;
+	SDMMC_RA_STATS			*rs;
+	uint32_t				action;
+	int						status;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	rs		= (SDMMC_RA_STATS *)ccb->cam_devctl_data;
+	status	= EOK;
+
+	if( ccb->cam_devctl_size < ( sizeof( SDMMC_RA_STATS ) ) ) {
+		status = EINVAL;
+	}
+	else {
+		action		= rs->action;
+		*rs			= ext->ra.stats;
+		rs->action	= action;
+
+		switch( action ) {
+			case SDMMC_STATS_ACTION_GET:
+				break;
+
+			case SDMMC_STATS_ACTION_RESET:
+				memset( &ext->ra.stats.hits, 0, sizeof( SDMMC_RA_STATS ) - offsetof( SDMMC_RA_STATS, hits ) );	// keep the configuration
+				break;
+
+			default:
+				status = EINVAL;
+				break;
+		}
+	}
+
+	ccb->cam_devctl_status = status;
+
+	return( CAM_REQ_CMP );
+}
+
+static int sdmmc_discard_stats_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb )
+{
+	SIM_SDMMC_EXT			*ext;
+	SDMMC_DISCARD_STATS		*ds;
+	uint32_t				action;
+	int						status;
+	int						idx;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	ds		= (SDMMC_DISCARD_STATS *)ccb->cam_devctl_data;
+	status	= EOK;
+
+	if( ccb->cam_devctl_size < ( sizeof( SDMMC_DISCARD_STATS ) ) ) {
+		status = EINVAL;
+	}
+	else {
+		action			= ds->action;
+		*ds				= ext->discard.stats;
+		ds->action		= action;
+		ds->pending		= ext->discard.nranges;
+		for( idx = 0; idx < ext->discard.nranges; idx++ ) {
+			ds->pending_blks += ext->discard.ranges[idx].nlba;
+		}
+
+		switch( action ) {
+			case SDMMC_STATS_ACTION_GET:
+				break;
+
+			case SDMMC_STATS_ACTION_RESET:
+				memset( &ext->discard.stats.ranges, 0, sizeof( SDMMC_DISCARD_STATS ) - offsetof( SDMMC_DISCARD_STATS, ranges ) );	// keep the configuration
+				break;
+
+			default:
+				status = EINVAL;
+				break;
+		}
+	}
+
+	ccb->cam_devctl_status = status;
+
+	return( CAM_REQ_CMP );
+}
+
+static int sdmmc_cmd_stats_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb )
+{
+	SIM_SDMMC_EXT			*ext;
+	SDMMC_CMD_STATS			*cs;
+	SDMMC_OP_STATS			*os;
+	SDMMC_QWAIT				*qw;
+	sdio_stats_t			*st;
+	sdio_op_stats_t			*sos;
+	uint32_t				action;
+	int						status;
+	int						idx;
+	int						ph;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	cs		= (SDMMC_CMD_STATS *)ccb->cam_devctl_data;
+	status	= EOK;
+
+	if( ccb->cam_devctl_size < ( sizeof( SDMMC_CMD_STATS ) ) ) {
+		ccb->cam_devctl_status = EINVAL;
+		return( CAM_REQ_CMP );
+	}
+
+	if( ( st = malloc( sizeof( sdio_stats_t ) ) ) == NULL ) {
+		ccb->cam_devctl_status = ENOMEM;
+		return( CAM_REQ_CMP );
+	}
+
+	action = cs->action;
+	memset( cs, 0, sizeof( SDMMC_CMD_STATS ) );
+	cs->action = action;
+
+	switch( action ) {
+		case SDMMC_STATS_ACTION_GET:
+		case SDMMC_STATS_ACTION_RESET:
+			break;
+
+		case SDMMC_STATS_ACTION_ENABLE:
+			sdmmc_stats_enable( hba, CAM_TRUE );
+			break;
+
+		case SDMMC_STATS_ACTION_DISABLE:
+			sdmmc_stats_enable( hba, CAM_FALSE );
+			break;
+
+		default:
+			status = EINVAL;
+			break;
+	}
+
+	if( status == EOK ) {
+		sdio_stats( ext->device, st, ( action == SDMMC_STATS_ACTION_RESET ) ? SDIO_STATS_CLEAR : SDIO_STATS_GET );
+
+		cs->flags		= ( ext->eflags & SDMMC_EFLAG_STATS ) ? SDMMC_CMD_STATS_ENABLED : 0;
+		cs->nops		= min( st->nops, SDMMC_STATS_OPS );
+		cs->overflow	= st->overflow;
+		cs->resets		= st->resets;
+		cs->retunes		= st->retunes;
+		cs->tunes		= st->tunes;
+		cs->tune_fails	= st->tune_fails;
+
+		for( idx = 0; idx < cs->nops; idx++ ) {
+			os				= &cs->ops[idx];
+			sos				= &st->ops[idx];
+			os->opcode		= sos->opcode;
+			os->errors		= sos->errors;
+			for( ph = 0; ph < SDIO_STATS_PHASES; ph++ ) {
+				os->lat[SDMMC_PHASE_SETUP + ph].count		= sos->lat[ph].count;
+				os->lat[SDMMC_PHASE_SETUP + ph].max_us		= sos->lat[ph].max_us;
+				os->lat[SDMMC_PHASE_SETUP + ph].total_us	= sos->lat[ph].total_us;
+				memcpy( os->lat[SDMMC_PHASE_SETUP + ph].hist, sos->lat[ph].hist, min( sizeof( os->lat[0].hist ), sizeof( sos->lat[0].hist ) ) );
+			}
+			memcpy( os->bytes, sos->bytes, min( sizeof( os->bytes ), sizeof( sos->bytes ) ) );
+		}
+
+			// queue waits go with the read/write commands
+		for( qw = ext->qwait; qw < &ext->qwait[SDMMC_QWAIT_OPS] && qw->lat.count; qw++ ) {
+			for( idx = 0; idx < cs->nops && cs->ops[idx].opcode != qw->opcode; idx++ ) {
+				;
+			}
+			if( idx == cs->nops ) {
+				if( cs->nops == SDMMC_STATS_OPS ) {
+					continue;
+				}
+				cs->ops[cs->nops++].opcode = qw->opcode;
+			}
+			cs->ops[idx].lat[SDMMC_PHASE_QUEUE] = qw->lat;
+		}
+
+		if( action == SDMMC_STATS_ACTION_RESET ) {
+			memset( ext->qwait, 0, sizeof( ext->qwait ) );
+		}
+	}
+
+	free( st );
+
+	ccb->cam_devctl_status = status;
+
+	return( CAM_REQ_CMP );
+}
+
 static int sdmmc_pwr_mgnt_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb )
 {
 	SIM_SDMMC_EXT			*ext;
@@ -2828,6 +3334,22 @@ static int sdmmc_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb )
 			status = sdmmc_drvr_state_devctl( hba, ccb );
 			break;
 
+		case DCMD_SDMMC_BUSY_STATS:
+			status = sdmmc_busy_stats_devctl( hba, ccb );
+			break;
+
+		case DCMD_SDMMC_RA_STATS:
+			status = sdmmc_ra_stats_devctl( hba, ccb );
+			break;
+
+		case DCMD_SDMMC_DISCARD_STATS:
+			status = sdmmc_discard_stats_devctl( hba, ccb );
+			break;
+
+		case DCMD_SDMMC_CMD_STATS:
+			status = sdmmc_cmd_stats_devctl( hba, ccb );
+			break;
+
 		default:
 #ifdef SIM_BS_DEVCTL
 			status = sim_bs_devctl( hba, ccb );
@@ -2969,7 +3491,14 @@ static void sdmmc_start_ccb( SIM_HBA *hba )
 	ext = (SIM_SDMMC_EXT *)hba->ext;
 
 	do {
-		if( ( ext->nexus = ccb = simq_ccb_dequeue( hba->simq ) ) == NULL ) {
+		if( ( ccb = ext->pnexus ) != NULL ) {		// dequeued during the previous transfer
+			ext->pnexus = NULL;
+		}
+		else {
+			ccb = simq_ccb_dequeue( hba->simq );
+		}
+
+		if( ( ext->nexus = ccb ) == NULL ) {
 #ifdef SDMMC_AGGRESSIVE_PM
 				// In aggressive pm mode we direct call the sdio layer,
 				// so we don't have the overhead of enabling/disabling
@@ -2981,6 +3510,19 @@ static void sdmmc_start_ccb( SIM_HBA *hba )
 
 		sdmmc_pm( hba, PM_ACTIVE );
 
+		if( ( ext->eflags & SDMMC_EFLAG_CMDQ ) ) {
+				// queue reads/writes until the simq and the device queue
+				// are empty, or a ccb that must run on its own turns up
+			if( ( ext->nexus = ccb = sdmmc_cmdq_start( hba, ccb ) ) == NULL ) {
+				continue;
+			}
+		}
+
+		ext->stats_qwait = 0;
+		if( ( ext->eflags & SDMMC_EFLAG_STATS ) && ccb->cam_ch.cam_func_code == XPT_SCSI_IO && SDMMC_CCB_PRIV( ccb )->queued ) {
+			ext->stats_qwait = ClockCycles( ) - SDMMC_CCB_PRIV( ccb )->queued;
+		}
+
 		switch( ccb->cam_ch.cam_func_code ) {
 			case XPT_SCSI_IO:
 				status = sdmmc_scsi_io( hba, (CCB_SCSIIO *)ccb );
@@ -3000,6 +3542,11 @@ static void sdmmc_start_ccb( SIM_HBA *hba )
 		if( status != CAM_REQ_INPROG ) {
 			ccb->cam_ch.cam_status = status;
 			sdmmc_post_ccb( hba, ccb );
+				// release an unused prepared xfer, and don't let the
+				// next ccb bypass the simq if this one failed
+			if( ext->pnexus == NULL || status != CAM_REQ_CMP ) {
+				sdmmc_pipe_flush( hba );
+			}
 			// in case retune is needed
 			if( sdio_retune( ext->device ) != EOK ) {
 				sdmmc_reset( hba );
@@ -3030,7 +3577,14 @@ static int sdmmc_timer( SIM_HBA *hba )
 
 	if( pm_state == PM_ACTIVE ) {
 		if( timestamp >= ( ext->pm_timestamp + ext->pm_idle_time_ns ) ) {
-			sdmmc_pm( hba, PM_IDLE );
+			if( ext->discard.nranges ) {		// idle until the waiting discards are done
+				if( !ext->discard.running ) {
+					sdmmc_discard_run( hba );
+				}
+			}
+			else {
+				sdmmc_pm( hba, PM_IDLE );
+			}
 		}
 	}
 	else if( pm_state == PM_IDLE && ( ext->hc_inf.caps & HC_CAP_SLEEP ) ) {
@@ -3050,10 +3604,19 @@ void *sdmmc_driver_thread( void *hdl )
 	struct sigevent	event;
 	int				rid;
 	int				stat;
+	int				qdepth;
 
 	hba		= (SIM_HBA *)hdl;
 	ext		= (SIM_SDMMC_EXT *)hba->ext;
 	stat	= CAM_FALSE;
+	qdepth	= 1;
+
+	if( ( ext->eflags & SDMMC_EFLAG_CMDQ ) ) {
+		qdepth = ext->cmdq.depth;
+	}
+	else if( ( ext->eflags & SDMMC_EFLAG_MERGE ) ) {
+		qdepth = SDMMC_MERGE_CCB_MAX;
+	}
 
 	ext->drvr_state = SDMMC_DRVR_RUN;
 
@@ -3073,9 +3636,10 @@ void *sdmmc_driver_thread( void *hdl )
 		stat = CAM_TRUE;
 	}
 
-		// initialize SIM queue routines
+		// initialize SIM queue routines, one ccb beyond the
+		// queue depth is outstanding while the next is dequeued
 	if( !stat && ( hba->simq = simq_init( hba->coid, hba, MAX_NARROW_TARGET,
-			MAX_LUN, 2, 1, 2, ( ext->eflags & SDMMC_EFLAG_BKOPS ) ? 1 : 0 ) ) == NULL ) {
+			MAX_LUN, qdepth + 1, qdepth, qdepth + 1, ( ext->eflags & SDMMC_EFLAG_BKOPS ) ? 1 : 0 ) ) == NULL ) {
 		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  simq_init failure", __FUNCTION__ );
 		stat = CAM_TRUE;
 	}
@@ -3107,6 +3671,10 @@ void *sdmmc_driver_thread( void *hdl )
 				sdmmc_timer( hba );
 				break;
 
+			case SDMMC_DISCARD_PULSE:
+				sdmmc_discard_run( hba );
+				break;
+
 			case _PULSE_CODE_DISCONNECT:
 				return( NULL );
 
@@ -3156,6 +3724,7 @@ int sdmmc_sim_detach( )
 __attribute__((used))
 static int sdmmc_reset_bus( SIM_HBA *hba, CCB_RESETBUS *ccb )
 {
+	sdmmc_pipe_flush( hba );			// aborted with the rest of the simq
 	simq_scsi_reset( hba->simq );
 	xpt_async( AC_BUS_RESET, hba->pathid, -1, -1, NULL, 0 );
 	return( CAM_REQ_CMP );
@@ -3169,6 +3738,7 @@ static int sdmmc_reset_bus( SIM_HBA *hba, CCB_RESETBUS *ccb )
 __attribute__((used))
 static int sdmmc_reset_dev( SIM_HBA *hba, CCB_RESETDEV *ccb )
 {
+	sdmmc_pipe_flush( hba );
 	simq_reset_dev( hba->simq, ccb );
 	xpt_async( AC_SENT_BDR, hba->pathid, -1, -1, NULL, 0 );
 	return( CAM_REQ_CMP );
@@ -3221,6 +3791,9 @@ static int sdmmc_path_inq( SIM_HBA *hba, CCB_PATHINQ *ccb )
 	}
 	else {
 		ccb->cam_vuhba_flags[CAM_VUHBA_FLAGS]	= CAM_VUHBA_FLAG_PTR | CAM_VUHBA_FLAG_DMA;
+		if( ext->vtop.sgl && !ext->ra.nbufs ) {		// read/write buffers straight to the host
+			ccb->cam_vuhba_flags[CAM_VUHBA_FLAGS]	|= CAM_VUHBA_FLAG_PHYS;
+		}
 		if( ( ext->hc_inf.caps & HC_CAP_DMA_MSK ) != HC_CAP_DMA64 ) {
 			ccb->cam_vuhba_flags[CAM_VUHBA_EFLAGS]	|= CAM_VUHBA_EFLAG_DMA_32;
 		}
@@ -3331,6 +3904,10 @@ int sdmmc_sim_action( SIM_HBA *hba, CCB *ccbp )
 			break;
 
 		case XPT_SCSI_IO:
+			SDMMC_CCB_PRIV( (CCB_SCSIIO *)ccb )->queued = ( ext->eflags & SDMMC_EFLAG_STATS ) ? ClockCycles( ) : 0;
+			status = CAM_REQ_INPROG;
+			break;
+
 		case XPT_RESET_BUS:
 		case XPT_RESET_DEV:
 		case XPT_ABORT:
@@ -3479,6 +4056,12 @@ int sdmmc_sim_args( char *options )
 							"partitions",
 							"bs",
 							"pwroff_notify",
+							"cmdq",
+							"merge",
+							"readahead",
+							"stats",
+							"phys",
+							"discard",
 							NULL
 						};
 
@@ -3579,6 +4162,51 @@ int sdmmc_sim_args( char *options )
 
 				break;
 
+			case 8:							// cmdq
+				SDMMC_ARG_VAL( opts[opt], value );
+				if( !strcmp( value, "on" ) ) {
+					ext->eflags |= SDMMC_EFLAG_CMDQ;
+				}
+				break;
+
+			case 9:							// merge
+				SDMMC_ARG_VAL( opts[opt], value );
+				if( !strcmp( value, "on" ) ) {
+					ext->eflags |= SDMMC_EFLAG_MERGE;
+				}
+				else if( !strcmp( value, "packed" ) ) {
+					ext->eflags |= SDMMC_EFLAG_MERGE | SDMMC_EFLAG_PACKED;
+				}
+				break;
+
+			case 10:						// readahead
+				SDMMC_ARG_VAL( opts[opt], value );
+				if( ( val = cam_parse_number( value ) ) != CAM_INVALID_NUM && val > 0 ) {
+					ext->ra.size = val * 1024;
+				}
+				break;
+
+			case 11:						// stats
+				SDMMC_ARG_VAL( opts[opt], value );
+				if( !strcmp( value, "on" ) ) {
+					ext->eflags |= SDMMC_EFLAG_STATS;
+				}
+				break;
+
+			case 12:						// phys
+				SDMMC_ARG_VAL( opts[opt], value );
+				if( !strcmp( value, "on" ) ) {
+					ext->eflags |= SDMMC_EFLAG_PHYS;
+				}
+				break;
+
+			case 13:						// discard
+				SDMMC_ARG_VAL( opts[opt], value );
+				if( !strcmp( value, "on" ) ) {
+					ext->eflags |= SDMMC_EFLAG_DISCARD;
+				}
+				break;
+
 
 			default:
 				break;
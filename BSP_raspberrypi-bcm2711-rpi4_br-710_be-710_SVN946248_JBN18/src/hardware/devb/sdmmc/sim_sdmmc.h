@@ -136,6 +136,148 @@ typedef struct _sdmmc_target {
 	SDMMC_PARTITION		partitions[SDMMC_PARTITION_MAX];
 } SDMMC_TARGET;
 
+// Software command queue (eMMC 5.1 CMD44-CMD48).  Tasks are queued with
+// CMD44/CMD45, the QSR (CMD13 SQS) tells which are ready and CMD46/CMD47
+// moves the data.
+#define SDMMC_CMDQ_DEPTH_MAX			32
+
+typedef struct _sdmmc_task {
+	CCB_SCSIIO			*ccb;
+	SDMMC_PARTITION		*part;
+	_Uint64t			lba;			// device lba
+	_Uint32t			blks;
+	_Uint32t			flgs;
+	_Uint32t			sgc;
+	sdio_sge_t			*sgl;
+	sdio_sge_t			sge;			// ccb without a scatter list
+} SDMMC_TASK;
+
+typedef struct _sdmmc_cmdq {
+	_Uint32t			depth;			// tasks the device accepts
+	_Uint32t			tmap;			// tags queued on the device
+	_Uint32t			rmap;			// tags ready for execution (QSR)
+	_Uint32t			config;			// partition of the queued tasks
+	CCB_SCSIIO			*barrier;		// ccb that waits for an empty queue
+	_Uint64t			qsr_timestamp;	// first empty QSR poll
+	_Uint32t			qsr_poll;		// us, wait after the next empty QSR poll
+	SDMMC_TASK			tasks[SDMMC_CMDQ_DEPTH_MAX];
+
+	_Uint64t			queued;			// tasks queued
+	_Uint64t			polls;			// QSR reads
+	_Uint64t			empty_polls;	// QSR reads without a ready task
+	_Uint64t			recoveries;		// queue discards
+	_Uint32t			max_queued;		// high water mark
+} SDMMC_CMDQ;
+
+// Request merging.  Read/write ccbs queued behind the nexus are gathered
+// into one multi-block transfer while their LBAs are contiguous, or into
+// one packed write when they aren't.  Each ccb is completed on its own.
+#define SDMMC_MERGE_CCB_MAX				32
+#define SDMMC_MERGE_SGE_MAX				SDMMC_MAX_SG
+#define SDMMC_MERGE_XFER_MAX			( 1024 * 1024 )	// bytes per merged transfer
+#define SDMMC_MERGE_HDR_SIZE			4096		// packed header, one block
+
+typedef struct _sdmmc_merge {
+	_Uint32t			nccb;
+	_Uint32t			nent;			// runs of contiguous ccbs
+	_Uint32t			sgc;
+	_Uint32t			blks;
+	CCB_SCSIIO			*ccbs[SDMMC_MERGE_CCB_MAX];
+	_Uint64t			lbas[SDMMC_MERGE_CCB_MAX];	// device lba of each ccb
+	sdio_sge_t			sgl[SDMMC_MERGE_SGE_MAX];	// physical, header first when packed
+	_Uint32t			*hdr;			// packed command header
+	paddr64_t			hdr_paddr;
+
+	_Uint64t			xfers;			// merged transfers
+	_Uint64t			merged;			// ccbs completed by a merged transfer
+	_Uint64t			packed;			// packed writes
+	_Uint64t			fallbacks;		// merged transfers redone per ccb
+} SDMMC_MERGE;
+
+// Read-ahead.  A read that continues a sequential stream is widened to the
+// end of its aligned window and read into a driver buffer, later reads are
+// copied out of the buffers.  Writes and erases drop the buffers they hit,
+// and halve the window when they land in or near the stream.
+#define SDMMC_RA_BUFS					4
+#define SDMMC_RA_WIN_MIN				8			// 4KB of 512 byte blocks
+#define SDMMC_RA_WIN_MAX				2048		// 1MB of 512 byte blocks
+#define SDMMC_RA_SEQ_MIN				2			// sequential reads before reading ahead
+
+typedef struct _sdmmc_ra_buf {
+	_Uint32t			config;			// partition of the blocks
+	_Uint32t			blks;			// valid blocks, 0 when empty
+	_Uint64t			lba;			// device lba of the first block
+	_Uint64t			stamp;			// last use, lru replacement
+	char				*vaddr;
+	paddr64_t			paddr;
+} SDMMC_RA_BUF;
+
+typedef struct _sdmmc_ra {
+	_Uint32t			size;			// bytes per buffer (option)
+	_Uint32t			nbufs;			// 0 when disabled
+	_Uint32t			win;			// blocks per buffer
+	_Uint32t			cur;			// blocks read ahead now, SDMMC_RA_WIN_MIN to win
+	_Uint32t			config;			// partition of the stream
+	_Uint32t			seq;			// sequential reads in the stream
+	_Uint64t			next_lba;		// lba following the last read
+	_Uint64t			stamp;
+	SDMMC_RA_BUF		bufs[SDMMC_RA_BUFS];
+
+	SDMMC_RA_STATS		stats;
+} SDMMC_RA;
+
+// Deferred discards.  TRIM and DISCARD ranges complete at once and wait,
+// merged, until the device has been idle for the PM idle time.  They then go
+// out a chunk at a time from the driver thread until other work turns up.
+// Writes clip the waiting ranges they overlap.
+#define SDMMC_DISCARD_RANGES			64
+#define SDMMC_DISCARD_CHUNK_BLKS		32768		// 16MB of 512 byte blocks per command
+#define SDMMC_DISCARD_PULSE				0x41		// issue the next chunk
+
+typedef struct _sdmmc_discard_range {
+	_Uint32t			config;			// partition of the blocks
+	_Uint32t			dtype;			// MMC_ERASE_TRIM/DISCARD
+	_Uint64t			lba;			// device lba of the first block
+	_Uint64t			nlba;
+} SDMMC_DISCARD_RANGE;
+
+typedef struct _sdmmc_discard {
+	_Uint32t			nranges;		// waiting, in arrival order
+	_Uint32t			egs;			// erase group blocks
+	_Uint32t			running;		// chunk pulse outstanding
+	_Uint32t			rsvd;
+	SDMMC_DISCARD_RANGE	ranges[SDMMC_DISCARD_RANGES];
+
+	SDMMC_DISCARD_STATS	stats;
+} SDMMC_DISCARD;
+
+// Physical lists of the phys option, for ccbs that arrive virtual
+#define SDMMC_VTOP_SGLS					3			// nexus and two pipelined prepares
+
+typedef struct _sdmmc_vtop {
+	sdio_sge_t			*sgl;			// SDMMC_VTOP_SGLS lists of sg_max, NULL when disabled
+	int					sg_max;
+	int					psgl;			// list of the last pipelined prepare
+} SDMMC_VTOP;
+
+// SIM private data of a ccb, behind the simq's
+typedef struct _sdmmc_ccb_priv {
+	SIMQ_DATA			simq;
+	_Uint64t			queued;			// ClockCycles when queued, 0 unless timing
+} SDMMC_CCB_PRIV;
+
+#define SDMMC_CCB_PRIV( _ccb )			( (SDMMC_CCB_PRIV *)(_ccb)->cam_sim_priv )
+
+// Queue wait of the ccbs carried by each read/write command, CMD17/18/24/25
+// and the CMD46/47 of command queue tasks.  The host and card phases of the
+// commands come from sdio_stats().
+#define SDMMC_QWAIT_OPS					6
+
+typedef struct _sdmmc_qwait {
+	_Uint32t			opcode;
+	SDMMC_LAT_HIST		lat;
+} SDMMC_QWAIT;
+
 typedef struct _sim_sdmmc_ext {
 	SIM_HBA					*hba;
 
@@ -151,6 +293,12 @@ typedef struct _sim_sdmmc_ext {
 #define SDMMC_EFLAG_PWROFF_NOTIFY		(1 << 9)
 #define SDMMC_EFLAG_BKOPS_AUTO			(1 << 10)	// Device BKOPS
 #define SDMMC_EFLAG_VCACHE_DIRTY		(1 << 11)
+#define SDMMC_EFLAG_CMDQ				(1 << 12)	// command queue
+#define SDMMC_EFLAG_MERGE				(1 << 13)	// merge adjacent reads/writes
+#define SDMMC_EFLAG_PACKED				(1 << 14)	// packed writes for non adjacent writes
+#define SDMMC_EFLAG_STATS				(1 << 15)	// command statistics
+#define SDMMC_EFLAG_PHYS				(1 << 16)	// physical data addresses from io-blk
+#define SDMMC_EFLAG_DISCARD				(1 << 17)	// defer TRIM/DISCARD until idle
 #define SDMMC_EFLAG_BS					(1 << 24)
 	_Uint32t				eflags;
 	_Uint8t					priority;
@@ -158,6 +306,10 @@ typedef struct _sim_sdmmc_ext {
 	_Uint8t					rsvd[2];
 
 	CCB_SCSIIO				*nexus;
+	CCB_SCSIIO				*pnexus;			// next ccb, dequeued while nexus transfers
+	struct sdio_cmd			*pcmd;				// data xfer prepared for pnexus (nexus once promoted)
+	sdio_sge_t				*psgl;				// physical sg list pcmd was prepared with
+	sdio_sge_t				psge;				// sg entry of a pnexus without a sg list
 
 	struct sdio_device		*device;
 	sdio_device_instance_t	instance;
@@ -188,6 +340,18 @@ typedef struct _sim_sdmmc_ext {
 	_Uint32t				bkops_status;
 #define SDMMC_TIME_BKOPS			( SDIO_TIME_DEFAULT	* 5 )
 
+	SDMMC_CMDQ				cmdq;
+	SDMMC_MERGE				merge;
+	SDMMC_RA				ra;
+	SDMMC_VTOP				vtop;
+	SDMMC_DISCARD			discard;
+
+	SDMMC_BUSY_STATS		busy;				// card busy after writes
+
+	_Uint64t				stats_cpu;			// ClockCycles per us
+	_Uint64t				stats_qwait;		// cycles the nexus was queued, 0 once charged
+	SDMMC_QWAIT				qwait[SDMMC_QWAIT_OPS];
+
 	SDMMC_ASSD_PROPERTIES	assd_properties;
 	int						assd_active_sec_sys;
 
@@ -213,17 +377,52 @@ extern void *sdmmc_driver_thread( void *data );
 extern int sdmmc_bkops( SIM_HBA *hba, int tick );
 extern int sdmmc_bkops_cfg( SIM_HBA *hba, int value );
 extern int sdmmc_pwroff_notify( SIM_HBA *hba, uint8_t cfg );
+extern int sdmmc_post_ccb( SIM_HBA *hba, CCB_SCSIIO *ccb );
+extern int sdmmc_error( SIM_HBA *hba, CCB_SCSIIO *ccb, int status );
+extern void sdmmc_ccb_lba( uint8_t *cdb, uint64_t *lba, uint32_t *nlba );
 extern int sdmmc_unit_ready( SIM_HBA *hba, CCB_SCSIIO *ccb );
 extern int sdmmc_wp_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb );
 extern int sdmmc_erase_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb );
 extern int sdmmc_card_register_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb );
+extern int sdmmc_wait_busy( SIM_HBA *hba, uint32_t *rsp, uint32_t timeout, uint32_t bsy_us );
+extern void sdmmc_stats_qwait( SIM_HBA *hba, int op, uint64_t cycles );
+extern void sdmmc_stats_enable( SIM_HBA *hba, int enable );
 extern int sdmmc_rw( SIM_HBA *hba, SDMMC_PARTITION *part, int flgs, uint64_t addr, int dlen, sdio_sge_t *sgl, int sgc, void *mhdl, uint32_t timeout );
 extern int sdmmc_read_write( SIM_HBA *hba, CCB_SCSIIO *ccb, int flgs );
+extern void sdmmc_pipe_flush( SIM_HBA *hba );
 extern int sdmmc_reset( SIM_HBA *hba );
 extern int sim_bs_partition_config( SIM_HBA *hba );
 extern int sim_bs_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb );
 extern int sim_bs_pass_through( SIM_HBA *hba, CCB_SCSIIO *ccb );
 
+// sim_cmdq.c
+extern int sdmmc_cmdq_init( SIM_HBA *hba );
+extern CCB_SCSIIO *sdmmc_cmdq_start( SIM_HBA *hba, CCB_SCSIIO *ccb );
+
+// sim_merge.c
+extern int sdmmc_merge_init( SIM_HBA *hba );
+extern int sdmmc_merge_dinit( SIM_HBA *hba );
+extern int sdmmc_merge_gather( SIM_HBA *hba, CCB_SCSIIO *ccb, int flgs, uint64_t lba );
+extern int sdmmc_merge_rw( SIM_HBA *hba, SDMMC_PARTITION *part, int flgs );
+
+// sim_ra.c
+extern int sdmmc_ra_init( SIM_HBA *hba );
+extern int sdmmc_ra_dinit( SIM_HBA *hba );
+extern int sdmmc_ra_read( SIM_HBA *hba, SDMMC_PARTITION *part, CCB_SCSIIO *ccb, uint64_t lba );
+extern void sdmmc_ra_invalidate( SIM_HBA *hba, SDMMC_PARTITION *part, uint64_t lba, uint64_t blks );
+
+// sim_vtop.c
+extern int sdmmc_vtop_init( SIM_HBA *hba );
+extern int sdmmc_vtop_dinit( SIM_HBA *hba );
+extern int sdmmc_vtop( SIM_HBA *hba, sdio_sge_t **sgp, int sgc, void *mhdl, int pipe );
+
+// sim_discard.c
+extern int sdmmc_discard_init( SIM_HBA *hba );
+extern int sdmmc_discard_queue( SIM_HBA *hba, SDMMC_PARTITION *part, int dtype, uint64_t lba, uint64_t nlba );
+extern void sdmmc_discard_clip( SIM_HBA *hba, SDMMC_PARTITION *part, uint64_t lba, uint64_t blks );
+extern int sdmmc_discard_run( SIM_HBA *hba );
+extern void sdmmc_discard_flush( SIM_HBA *hba );
+
 // sim_assd.c
 extern int sdmmc_assd_init( SIM_HBA *hba );
 extern int sdmmc_assd_apdu_devctl( SIM_HBA *hba, CCB_DEVCTL *ccb );
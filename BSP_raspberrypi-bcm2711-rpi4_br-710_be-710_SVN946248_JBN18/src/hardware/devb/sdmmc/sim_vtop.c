@@ -0,0 +1,123 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+// Module Description:  physical data addresses
+//
+// With the phys option the SIM tells io-blk it takes physical scatter/gather
+// lists, so read/write ccbs from io-blk's buffer pool arrive with
+// CAM_DATA_PHYS set and go to the host as is.  Ccbs that still carry virtual
+// addresses, client buffers of raw or devctl I/O, are translated here when
+// the command is prepared, into a list of the SIM's own.  Their translation
+// isn't kept: the SIM doesn't see a client unmap its buffer, and a mapping
+// reused for another page would send the DMA to the wrong memory.  As with
+// xpt_vtop_sg(), each element is taken to be physically contiguous.
+//
+// Read-ahead copies hits out through the ccb's virtual addresses, with it
+// enabled io-blk isn't asked for physical lists (see sdmmc_path_inq()).
+
+#include <sim_sdmmc.h>
+
+int sdmmc_vtop_init( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_VTOP		*vt;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	vt		= &ext->vtop;
+
+	sdmmc_vtop_dinit( hba );
+
+	if( !( ext->eflags & SDMMC_EFLAG_PHYS ) ) {
+		return( EOK );
+	}
+
+	if( !( ext->hc_inf.caps & HC_CAP_DMA ) ) {
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  host doesn't support DMA", __FUNCTION__ );
+		return( ENOTSUP );
+	}
+
+	if( ext->ra.nbufs ) {
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_INFO, 1, 1, "%s:  read-ahead enabled, io-blk buffers stay virtual", __FUNCTION__ );
+	}
+
+	vt->sg_max	= ext->hc_inf.sg_max;
+
+	if( ( vt->sgl = malloc( SDMMC_VTOP_SGLS * vt->sg_max * sizeof( sdio_sge_t ) ) ) == NULL ) {
+		cam_slogf( _SLOGC_SIM_MMC, _SLOG_ERROR, 1, 1, "%s:  translation list alloc failure", __FUNCTION__ );
+		return( ENOMEM );
+	}
+
+	return( EOK );
+}
+
+int sdmmc_vtop_dinit( SIM_HBA *hba )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_VTOP		*vt;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	vt		= &ext->vtop;
+
+	free( vt->sgl );
+	vt->sgl		= NULL;
+	vt->psgl	= 0;
+
+	return( EOK );
+}
+
+// Replace the virtual list of a read/write with its translation.  The
+// nexus has a list of its own, pipelined prepares alternate between two
+// so the table of the command in flight is left alone.  Returns EOK when
+// *sgp now holds physical addresses.
+int sdmmc_vtop( SIM_HBA *hba, sdio_sge_t **sgp, int sgc, void *mhdl, int pipe )
+{
+	SIM_SDMMC_EXT	*ext;
+	SDMMC_VTOP		*vt;
+	sdio_sge_t		*psg;
+	int				status;
+
+	ext		= (SIM_SDMMC_EXT *)hba->ext;
+	vt		= &ext->vtop;
+
+	if( vt->sgl == NULL || sgc > vt->sg_max ) {
+		return( ENOTSUP );
+	}
+
+	if( pipe ) {
+		vt->psgl = ( vt->psgl == 1 ) ? 2 : 1;
+		psg = &vt->sgl[vt->psgl * vt->sg_max];
+	}
+	else {
+		psg = vt->sgl;
+	}
+
+	if( ( status = xpt_vtop_sg( (SG_ELEM *)*sgp, (SG_ELEM *)psg, sgc, mhdl ) ) == EOK ) {
+		*sgp = psg;
+	}
+
+	return( status );
+}
+
+
+#if defined(__QNXNTO__) && defined(__USESRCVERSION)
+#include <sys/srcversion.h>
+__SRCVERSION("$URL$ $Rev$")
+#endif
@@ -7,6 +7,8 @@ include ../../../prodroot_pkt.mk
 
 LIBS = netdrvrS drvrS cacheS m
 
+EXTRA_INCVPATH += $(PROJECT_ROOT)/public
+
 NAME = devnp-$(PROJECT)
 
 USEFILE=$(PROJECT_ROOT)/$(NAME).use
@@ -28,6 +28,8 @@
 #include <netinet/ip.h>
 
 
+#include <stdlib.h>
+#include <atomic.h>
 #include <sys/io-pkt.h>
 #include <sys/syspage.h>
 #include <device_qnx.h>
@@ -39,6 +41,7 @@
 
 #include <drvr/hwinfo.h>
 
+#include <sys/mman.h>
 #include <sys/neutrino.h>
 #include <sys/netmgr.h>
 #include <sys/trace.h>
@@ -50,7 +53,6 @@
 #include "genet.h"
 
 static void genet_cleanup(Genet *, int);
-static int enable_interrupt(void *);
 
 uint32_t genet_reg_read(Genet *genet, uint32_t reg)
 {
@@ -62,6 +64,90 @@ void genet_reg_write(Genet *genet, uint32_t reg, uint32_t val)
     out32(genet->genet_base + reg, val);
 }
 
+/*
+ * RX raises its interrupt once rx_coal.frames buffers are done or once the
+ * ring timeout expires after the first done buffer, whichever comes first.
+ */
+static void genet_set_rx_coalesce(Genet *genet)
+{
+    uint32_t ticks, reg;
+
+    ticks = (genet->rx_coal.usecs * 1000 + GENET_DMA_TIMEOUT_NS - 1) / GENET_DMA_TIMEOUT_NS;
+    if (ticks > GENET_DMA_TIMEOUT_MASK) {
+        ticks = GENET_DMA_TIMEOUT_MASK;
+    }
+
+    genet_reg_write(genet, GENET_RDMA_MBUF_DONE_INTR_THRESH,
+            genet->rx_coal.frames & GENET_DMA_INTR_THRESH_MASK);
+
+    reg = genet_reg_read(genet, GENET_RDMA_RING_TIMEOUT(GENET_DEFAULT_RING));
+    reg &= ~GENET_DMA_TIMEOUT_MASK;
+    genet_reg_write(genet, GENET_RDMA_RING_TIMEOUT(GENET_DEFAULT_RING), reg | ticks);
+
+    genet->coal_stats.rx_usecs = genet->rx_coal.usecs;
+    genet->coal_stats.rx_frames = genet->rx_coal.frames;
+}
+
+/*
+ * TX has no ring timeout, only the frame threshold. Below it completions
+ * are flushed by genet_tx_flush() every tx_coal.usecs instead.
+ */
+static void genet_set_tx_coalesce(Genet *genet)
+{
+    genet_reg_write(genet, GENET_TDMA_MBUF_DONE_INTR_THRESH,
+            genet->tx_coal.frames & GENET_DMA_INTR_THRESH_MASK);
+
+    genet->coal_stats.tx_usecs = genet->tx_coal.usecs;
+    genet->coal_stats.tx_frames = genet->tx_coal.frames;
+}
+
+static uint64_t genet_now_us(Genet *genet)
+{
+    return ClockCycles() / genet->cycles_per_us;
+}
+
+/* Called from rx_process_interrupt() once the ring is drained */
+void genet_rx_coal_update(Genet *genet)
+{
+    genet_dim_sample_t sample;
+
+    if (!genet->rx_adaptive) {
+        return;
+    }
+
+    sample.time_us = genet_now_us(genet);
+    sample.events  = genet->rxq[0].stats.interrupts;
+    sample.pkts    = genet->rxq[0].stats.packets;
+    sample.bytes   = genet->rxq[0].stats.bytes;
+
+    if (genet_dim_update(&genet->rx_dim, &sample)) {
+        genet->rx_coal = genet_dim_profiles[genet->rx_dim.profile];
+        genet->coal_stats.rx_changes = genet->rx_dim.changes;
+        genet_set_rx_coalesce(genet);
+    }
+}
+
+/* Called from tx_process_interrupt() once completions are reaped */
+void genet_tx_coal_update(Genet *genet)
+{
+    genet_dim_sample_t sample;
+
+    if (!genet->tx_adaptive) {
+        return;
+    }
+
+    sample.time_us = genet_now_us(genet);
+    sample.events  = genet->txq[0].stats.interrupts;
+    sample.pkts    = genet->txq[0].stats.packets;
+    sample.bytes   = genet->txq[0].stats.bytes;
+
+    if (genet_dim_update(&genet->tx_dim, &sample)) {
+        genet->tx_coal = genet_dim_profiles[genet->tx_dim.profile];
+        genet->coal_stats.tx_changes = genet->tx_dim.changes;
+        genet_set_tx_coalesce(genet);
+    }
+}
+
 struct _iopkt_drvr_entry IOPKT_DRVR_ENTRY_SYM(genet) = IOPKT_DRVR_ENTRY_SYM_INIT(genet_entry);
 
 #ifdef VARIANT_a
@@ -150,11 +236,6 @@ int genet_entry(void *dll_hdl,  struct _iopkt_self *iopkt, char *options)
     return EOK;
 }
 
-static int enable_interrupt(void *arg)
-{
-        return 1;
-}
-
 static int genet_get_board_mac_addr(uchar_t *mac)
 {
     unsigned hwi_off = hwi_find_device("genet", 0);
@@ -174,64 +255,66 @@ static int genet_get_board_mac_addr(uchar_t *mac)
     return EOK;
 }
 
-static void init_tx_ring(Genet *genet)
+static void init_tx_ring(Genet *genet, genet_txq_t *txq)
 {
-    genet_reg_write(genet, GENET_TDMA_START_ADDRESS, 0);
-    genet_reg_write(genet, GENET_TDMA_START_ADDRESSH, 0);
-    genet_reg_write(genet, GENET_TDMA_FLOW_PERIOD, 0);
-
-    genet_reg_write(genet, GENET_TDMA_END_ADDRESS,
-            ((GENET_RING_SIZE_MAX * GENET_DMA_DESC_WORDS) - 1) );
-    genet_reg_write(genet, GENET_TDMA_END_ADDRESSH, 0);
-
-    genet_reg_write(genet, GENET_TDMA_RING_BUF_SIZE,
-            (GENET_RING_SIZE_MAX << GENET_TDMA_RING_BUF_SIZE_DESC_SHIFT) | GENET_BUFFER_SIZE);
-
-    genet_reg_write(genet, GENET_TDMA_MBUF_DONE_INTR_THRESH, 2); // Interrupt for number of buffer??
-    genet_reg_write(genet, GENET_TDMA_WRITE_POINTER, 0);
-    genet_reg_write(genet, GENET_TDMA_READ_POINTER, 0);
-    genet_reg_write(genet, GENET_TDMA_CONSUMER_INDEX, 0);
-    genet_reg_write(genet, GENET_TDMA_PRODUCER_INDEX, 0);
-
-    /* enable the current ring */
-    genet_reg_write(genet, GENET_TDMA_RING_CFG, 1 << GENET_DEFAULT_RING );
-    /* enable the ring for the DMA
-       17b : 16th ring
-    */
-    genet_reg_write(genet, GENET_TDMA_CONTROL, 2 << GENET_DEFAULT_RING);
+    const unsigned ring = txq->ring;
+    const unsigned base = txq->d - genet->tx_d;
+
+    genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_START_ADDRESS, ring), base * GENET_DMA_DESC_WORDS);
+    genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_START_ADDRESSH, ring), 0);
+    genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_FLOW_PERIOD, ring), 0);
+
+    genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_END_ADDRESS, ring),
+            ((base + txq->size) * GENET_DMA_DESC_WORDS) - 1);
+    genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_END_ADDRESSH, ring), 0);
+
+    genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_RING_BUF_SIZE, ring),
+            (txq->size << GENET_TDMA_RING_BUF_SIZE_DESC_SHIFT) | GENET_BUFFER_SIZE);
+
+    if (ring == GENET_DEFAULT_RING) {
+        genet_set_tx_coalesce(genet);
+    } else {
+        /* priority rings are for latency, complete every frame */
+        genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_MBUF_DONE_INTR_THRESH, ring), 1);
+    }
+    genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_WRITE_POINTER, ring), base * GENET_DMA_DESC_WORDS);
+    genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_READ_POINTER, ring), base * GENET_DMA_DESC_WORDS);
+    genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_CONSUMER_INDEX, ring), 0);
+    genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_PRODUCER_INDEX, ring), 0);
 }
 
-static void init_rx_ring(Genet *genet)
+static void init_rx_ring(Genet *genet, genet_rxq_t *rxq)
 {
+    const unsigned ring = rxq->ring;
+    const unsigned base = rxq->d - genet->rx_d;
 
-    genet_reg_write(genet, GENET_RDMA_START_ADDRESS, 0);
-    genet_reg_write(genet, GENET_RDMA_START_ADDRESSH, 0);
+    genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_START_ADDRESS, ring), base * GENET_DMA_DESC_WORDS);
+    genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_START_ADDRESSH, ring), 0);
 
-    genet_reg_write(genet, GENET_RDMA_END_ADDRESS,
-            (GENET_RING_SIZE_MAX * GENET_DMA_DESC_WORDS)-1);
-    genet_reg_write(genet, GENET_RDMA_END_ADDRESSH, 0);
+    genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_END_ADDRESS, ring),
+            ((base + rxq->size) * GENET_DMA_DESC_WORDS) - 1);
+    genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_END_ADDRESSH, ring), 0);
 
-    genet_reg_write(genet, GENET_RDMA_RING_BUF_SIZE,
-            (GENET_RING_SIZE_MAX << GENET_TDMA_RING_BUF_SIZE_DESC_SHIFT) | GENET_BUFFER_SIZE);
+    genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_RING_BUF_SIZE, ring),
+            (rxq->size << GENET_RDMA_RING_BUF_SIZE_DESC_SHIFT) | GENET_BUFFER_SIZE);
 
-    genet_reg_write(genet, GENET_RDMA_MBUF_DONE_INTR_THRESH, 1); // Interrupt for number of buffer??
+    if (ring == GENET_DEFAULT_RING) {
+        genet_set_rx_coalesce(genet);
+    } else {
+        genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_MBUF_DONE_INTR_THRESH, ring), 1);
+    }
     //genet_reg_write(genet, GENET_RDMA_XON_XOFF_THRESH, (5 << GENET_RDMA_XON_XOFF_THR_SHIFT) | 10 << ?);
-    genet_reg_write(genet, GENET_RDMA_WRITE_POINTER, 0);
-    genet_reg_write(genet, GENET_RDMA_READ_POINTER, 0);
-    genet_reg_write(genet, GENET_RDMA_PRODUCER_INDEX, 0);
-    genet_reg_write(genet, GENET_RDMA_CONSUMER_INDEX, 0);
-
-    /* enable the current ring */
-    genet_reg_write(genet, GENET_RDMA_RING_CFG, 1 << GENET_DEFAULT_RING );
-    /* enable the ring for the DMA
-       17b : 16th ring
-    */
-    genet_reg_write(genet, GENET_RDMA_CONTROL, 2 << GENET_DEFAULT_RING);
+    genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_WRITE_POINTER, ring), base * GENET_DMA_DESC_WORDS);
+    genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_READ_POINTER, ring), base * GENET_DMA_DESC_WORDS);
+    genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_PRODUCER_INDEX, ring), 0);
+    genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_CONSUMER_INDEX, ring), 0);
 }
 
 static void genet_dma_init(Genet *genet)
 {
-    int i;
+    uint32_t tx_rings = 0, rx_rings = 0, prio[3] = { 0, 0, 0 };
+    uint32_t int1_enable = 0;
+    unsigned i;
 
     for(i=0; i < GENET_RING_SIZE_MAX; i++)
     {
@@ -239,17 +322,55 @@ static void genet_dma_init(Genet *genet)
         genet->rx_d[i].desc = genet->genet_base + GENET_RDMA_REG_OFF + i * GENET_DMA_DESC_SIZE;
     }
 
-    init_tx_ring(genet);
+    genet_queues_init(genet);
 
-    init_rx_ring(genet);
+    for (i = 0; i < genet->num_txq; i++) {
+        const unsigned ring = genet->txq[i].ring;
+
+        init_tx_ring(genet, &genet->txq[i]);
+        tx_rings |= 1 << ring;
+
+        /* ring 0 first, the default ring last */
+        prio[ring / 6] |= ((ring == GENET_DEFAULT_RING ? genet->num_txq : ring)
+                & GENET_DMA_PRIO_MASK) << GENET_DMA_PRIO_SHIFT(ring);
+        if (ring != GENET_DEFAULT_RING) {
+            int1_enable |= GENET_INTRL2_1_TX_RING(ring);
+        }
+    }
+
+    for (i = 0; i < genet->num_rxq; i++) {
+        const unsigned ring = genet->rxq[i].ring;
+
+        init_rx_ring(genet, &genet->rxq[i]);
+        rx_rings |= 1 << ring;
+        if (ring != GENET_DEFAULT_RING) {
+            int1_enable |= GENET_INTRL2_1_RX_RING(ring);
+        }
+    }
+
+    if (genet->num_txq > 1) {
+        genet_reg_write(genet, GENET_TDMA_ARB_CTRL, GENET_DMA_ARBITER_SP);
+        for (i = 0; i < 3; i++) {
+            genet_reg_write(genet, GENET_TDMA_PRIORITY(i * 6), prio[i]);
+        }
+    }
+
+    /* enable the current rings */
+    genet_reg_write(genet, GENET_TDMA_RING_CFG, tx_rings);
+    genet_reg_write(genet, GENET_RDMA_RING_CFG, rx_rings);
+
+    /* received frames go to the priority rings by their priority */
+    genet_rx_filters_init(genet);
+
+    /* priority ring done interrupts go to genet_isr1() */
+    genet_reg_write(genet, GENET_INTRL2_1_CPU_MASK_CLEAR, int1_enable);
 
     /* Enable the TX and RX DMA for already configured rings
      * no packets will be sent or received until the UMAC is started.
+     * Bit n + 1 enables ring n.
      */
-    genet_reg_write(genet, GENET_TDMA_CONTROL,
-            genet_reg_read(genet, GENET_TDMA_CONTROL) | GENET_TDMA_CONTROL_DMA_ENABLE);
-    genet_reg_write(genet, GENET_RDMA_CONTROL,
-            genet_reg_read(genet, GENET_RDMA_CONTROL) | GENET_RDMA_CONTROL_DMA_ENABLE);
+    genet_reg_write(genet, GENET_TDMA_CONTROL, (tx_rings << 1) | GENET_TDMA_CONTROL_DMA_ENABLE);
+    genet_reg_write(genet, GENET_RDMA_CONTROL, (rx_rings << 1) | GENET_RDMA_CONTROL_DMA_ENABLE);
 }
 
 static void genet_umac_reset(Genet *genet)
@@ -285,34 +406,43 @@ static void genet_umac_reset(Genet *genet)
 
 static void genet_hw_stop(Genet *genet)
 {
+    unsigned ring;
+
     /* clear the DMA control for both RX and Tx */
     genet_reg_write(genet, GENET_RDMA_CONTROL, 0);
     genet_reg_write(genet, GENET_TDMA_CONTROL, 0);
 
-    /* clear rx ring */
-    genet_reg_write(genet, GENET_RDMA_START_ADDRESS, 0);
-    genet_reg_write(genet, GENET_RDMA_START_ADDRESSH, 0);
-    genet_reg_write(genet, GENET_RDMA_END_ADDRESS,0);
-    genet_reg_write(genet, GENET_RDMA_END_ADDRESSH,0);
-    genet_reg_write(genet, GENET_RDMA_RING_BUF_SIZE,0);
-    genet_reg_write(genet, GENET_RDMA_MBUF_DONE_INTR_THRESH, 0);
-    genet_reg_write(genet, GENET_RDMA_WRITE_POINTER, 0);
-    genet_reg_write(genet, GENET_RDMA_READ_POINTER, 0);
-    genet_reg_write(genet, GENET_RDMA_PRODUCER_INDEX, 0);
-    genet_reg_write(genet, GENET_RDMA_CONSUMER_INDEX, 0);
-
-    /* clear tx ring */
-    genet_reg_write(genet, GENET_TDMA_START_ADDRESS, 0);
-    genet_reg_write(genet, GENET_TDMA_START_ADDRESSH, 0);
-    genet_reg_write(genet, GENET_TDMA_FLOW_PERIOD, 0);
-    genet_reg_write(genet, GENET_TDMA_END_ADDRESS,0);
-    genet_reg_write(genet, GENET_TDMA_END_ADDRESSH,0);
-    genet_reg_write(genet, GENET_TDMA_RING_BUF_SIZE,0);
-    genet_reg_write(genet, GENET_TDMA_MBUF_DONE_INTR_THRESH, 0);
-    genet_reg_write(genet, GENET_TDMA_WRITE_POINTER, 0);
-    genet_reg_write(genet, GENET_TDMA_READ_POINTER, 0);
-    genet_reg_write(genet, GENET_TDMA_CONSUMER_INDEX, 0);
-    genet_reg_write(genet, GENET_TDMA_PRODUCER_INDEX, 0);
+    /* clear the priority rings we may use and the default ring */
+    for (ring = 0; ring <= GENET_DEFAULT_RING; ring++) {
+        if (ring >= GENET_MAX_QUEUES - 1 && ring != GENET_DEFAULT_RING) {
+            continue;
+        }
+
+        /* clear rx ring */
+        genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_START_ADDRESS, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_START_ADDRESSH, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_END_ADDRESS, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_END_ADDRESSH, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_RING_BUF_SIZE, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_MBUF_DONE_INTR_THRESH, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_WRITE_POINTER, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_READ_POINTER, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_PRODUCER_INDEX, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_CONSUMER_INDEX, ring), 0);
+
+        /* clear tx ring */
+        genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_START_ADDRESS, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_START_ADDRESSH, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_FLOW_PERIOD, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_END_ADDRESS, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_END_ADDRESSH, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_RING_BUF_SIZE, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_MBUF_DONE_INTR_THRESH, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_WRITE_POINTER, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_READ_POINTER, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_CONSUMER_INDEX, ring), 0);
+        genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_PRODUCER_INDEX, ring), 0);
+    }
 }
 
 static int genet_umac_init(Genet *genet)
@@ -333,23 +463,28 @@ static int genet_umac_init(Genet *genet)
     genet_reg_write(genet, GENET_TDMA_SCB_BURST_SIZE, 8);
 
     /* Enable the interrupts */
-    int0_enable = GENET_INTRL2_RX_DONE
-              | GENET_INTRL2_TX_DONE
-              | GENET_INTRL2_0_LINK_UP
-              | GENET_INTRL2_0_LINK_DOWN;
+    int0_enable = GENET_INTRL2_0_WORK;
 
+    genet->irq0_pending = 0;
     genet_reg_write(genet, GENET_INTRL2_0_CPU_CLEAR, ~0);
     genet_reg_write(genet, GENET_INTRL2_0_CPU_MASK_CLEAR, int0_enable);
     genet_reg_write(genet, GENET_INTRL2_1_CPU_CLEAR, ~0);
     genet_reg_write(genet, GENET_INTRL2_1_CPU_MASK_CLEAR, 0);
 
-    /* Clear checksum offload and alignment */
+    /*
+     * Status blocks for checksum offload: RX frames land after a 64 byte
+     * status block and 2 bytes of padding, which also aligns the IP
+     * header, and every TX frame starts with one.
+     */
     ret = genet_reg_read(genet, GENET_RBUF_CNTRL);
-    genet_reg_write(genet, GENET_RBUF_CNTRL, ret & ~(GENET_RBUF_CNTRL_STATUS_64B_EN | GENET_RBUF_CNTRL_ALIGN_2B) );
+    genet_reg_write(genet, GENET_RBUF_CNTRL, ret | GENET_RBUF_CNTRL_STATUS_64B_EN | GENET_RBUF_CNTRL_ALIGN_2B);
+    ret = genet_reg_read(genet, GENET_TBUF_CNTRL);
+    genet_reg_write(genet, GENET_TBUF_CNTRL, ret | GENET_TBUF_CNTRL_STATUS_64B_EN);
 
-    /* Enable RX checksum */
+    /* Enable RX checksum, summed from the end of the L2 header */
     ret = genet_reg_read(genet, GENET_RBUF_CHK_CNTRL);
-    genet_reg_write(genet, GENET_RBUF_CHK_CNTRL, ret & (GENET_RBUF_CHK_CNTRL_RXCHK_EN) );
+    genet_reg_write(genet, GENET_RBUF_CHK_CNTRL, ret | GENET_RBUF_CHK_CNTRL_RXCHK_EN
+                            | GENET_RBUF_CHK_CNTRL_L3_PARSE_DIS);
 
     genet_reg_write(genet, GENET_UMAC_FRM_LEN, 0x600);
 
@@ -380,6 +515,7 @@ static void genet_rx_reap(Genet *genet, int count)
     {
         if( genet->rx_d[i].mb != NULL ){
             m_freem(genet->rx_d[i].mb);
+            genet->rx_d[i].mb = NULL;
         }
         /* Clear the DMA control, DMA physical MSB and LSB address*/
         out32(genet->rx_d[i].desc + GENET_DMA_DESC_CNTRL, 0);
@@ -390,24 +526,26 @@ static void genet_rx_reap(Genet *genet, int count)
 
 static int genet_setup_rx_descriptors(Genet *genet)
 {
-    int i;
+    unsigned q, i;
     struct mbuf *m;
 
-    for(i = 0; i < GENET_RING_SIZE_MAX; i++){
-        m = m_getcl(M_NOWAIT, MT_DATA, M_PKTHDR);
+    for (q = 0; q < genet->num_rxq; q++) {
+        genet_rxq_t *rxq = &genet->rxq[q];
+
+        for(i = 0; i < rxq->size; i++){
+            m = m_getcl(M_NOWAIT, MT_DATA, M_PKTHDR);
             if (m == NULL) {
-            /*
-             * No memory in system for mbuf
-             * exiting the driver because Rx won't work
-             * without mbuf allocated.
-             */
-            GENET_ERROR("No room for new mbuf..");
-            if(i) {
-                genet_rx_reap(genet, i-1);
+                /*
+                 * No memory in system for mbuf
+                 * exiting the driver because Rx won't work
+                 * without mbuf allocated.
+                 */
+                GENET_ERROR("No room for new mbuf..");
+                genet_rx_reap(genet, GENET_RING_SIZE_MAX);
+                return -1;
             }
-                    return -1;
-                }
-        genet_add_pkt_to_rx_desc(genet, m, &genet->rx_d[i]);
+            genet_add_pkt_to_rx_desc(genet, m, &rxq->d[i]);
+        }
     }
     return 0;
 }
@@ -421,6 +559,7 @@ int genet_attach(struct device *parent, struct device *self, void *aux)
     struct _iopkt_self *iopkt;
     unsigned char board_mac[6];
     uint32_t err;
+    unsigned i;
 
     attach_args = aux;
     iopkt = attach_args->iopkt;
@@ -436,42 +575,64 @@ int genet_attach(struct device *parent, struct device *self, void *aux)
     /* will be disabled when MDIO interrupt fixed */
     genet->probe_phy = 1;
 
+    if ((err = genet_config(genet, attach_args->options)) != EOK) {
+        return err;
+    }
+    callout_init(&genet->tx_callout);
+
+    genet->cycles_per_us = SYSPAGE_ENTRY(qtime)->cycles_per_sec / 1000000;
+    if (genet->cycles_per_us == 0) {
+        genet->cycles_per_us = 1;
+    }
+
     /* Seting interface name */
     strcpy(ifp->if_xname, genet->sc_dev.dv_xname);
     strcpy((char *) genet->cfg.uptype, "en");
     strcpy((char *) genet->cfg.device_description, "genet");
 
-    /* Rx done interrupt */
-    genet->intr_rx.func   = rx_process_interrupt;
-    genet->intr_rx.enable = enable_interrupt;
-    genet->intr_rx.arg    = genet;
-    if ((err = interrupt_entry_init(&genet->intr_rx, 0, NULL,
-                    IRUPT_PRIO_DEFAULT)) != EOK) {
-        return err;
-    }
-    /* Tx done interrupt */
-    genet->intr_tx.func = tx_process_interrupt;
-    genet->intr_tx.enable = enable_interrupt;
-    genet->intr_tx.arg = genet;
-    if ((err = interrupt_entry_init (&genet->intr_tx, 0, NULL,
+    /*
+     * Queue 0 and link share one INTRL2_0 entry so a single wakeup reaps
+     * TX and receives. Priority rings get one entry per queue so io-pkt
+     * can run them on different work threads.
+     */
+    genet->intr.func   = genet_process_interrupt;
+    genet->intr.enable = genet_intr_enable;
+    genet->intr.arg    = genet;
+    if ((err = interrupt_entry_init(&genet->intr, 0, NULL,
                     IRUPT_PRIO_DEFAULT)) != EOK) {
         return err;
     }
-    /* MDIO interrupt */
-    genet->intr_link.func   = link_process_interrupt;
-    genet->intr_link.enable = enable_interrupt;
-    genet->intr_link.arg    = genet;
-    if ((err = interrupt_entry_init (&genet->intr_link, 0, NULL,
-                    IRUPT_PRIO_DEFAULT)) != EOK) {
-        return err;
+
+    for (i = 1; i < GENET_MAX_QUEUES; i++) {
+        genet->rxq[i].intr.func   = rx_process_interrupt;
+        genet->rxq[i].intr.enable = genet_rxq_enable;
+        genet->rxq[i].intr.arg    = &genet->rxq[i];
+        if (i < genet->num_rxq && (err = interrupt_entry_init(&genet->rxq[i].intr, 0, NULL,
+                        IRUPT_PRIO_DEFAULT)) != EOK) {
+            return err;
+        }
+
+        genet->txq[i].intr.func   = tx_process_interrupt;
+        genet->txq[i].intr.enable = genet_txq_enable;
+        genet->txq[i].intr.arg    = &genet->txq[i];
+        if (i < genet->num_txq && (err = interrupt_entry_init(&genet->txq[i].intr, 0, NULL,
+                        IRUPT_PRIO_DEFAULT)) != EOK) {
+            return err;
+        }
     }
 
     /*HW support checksum and enabled using GENET_RBUF_CHK_CNTRL_RXCHK_EN*/
     ifp->if_capabilities_rx = IFCAP_CSUM_IPv4 | IFCAP_CSUM_TCPv4 | IFCAP_CSUM_UDPv4;
     ifp->if_capabilities_rx |= IFCAP_CSUM_TCPv6 | IFCAP_CSUM_UDPv6;
 
-    /* as of now no details to this from Pi4 and BCM */
-    // ifp->if_capabilities_tx = IFCAP_CSUM_IPv4 | IFCAP_CSUM_TCPv4 | IFCAP_CSUM_UDPv4;
+    /*
+     * TX TCP/UDP checksums through the status block. The IPv4 header
+     * checksum is not offloaded. There is no hardware TSO, genet_start()
+     * segments TSOv4 sends itself.
+     */
+    ifp->if_capabilities_tx = IFCAP_CSUM_TCPv4 | IFCAP_CSUM_UDPv4;
+    ifp->if_capabilities_tx |= IFCAP_CSUM_TCPv6 | IFCAP_CSUM_UDPv6;
+    ifp->if_capabilities_tx |= IFCAP_TSOv4;
     // genet->sc_ec.ec_capabilities |= ETHERCAP_JUMBO_MTU;
 
     ifp->if_flags = IFF_BROADCAST | IFF_SIMPLEX | IFF_MULTICAST;
@@ -484,7 +645,6 @@ int genet_attach(struct device *parent, struct device *self, void *aux)
     IFQ_SET_READY(&ifp->if_snd);
 
     /*GENET_CALL*/
-    genet->free_idx = 0;
     genet->cachectl.fd = NOFD;
 
     if (cache_init(0, &genet->cachectl, NULL) == -1) {
@@ -505,6 +665,20 @@ int genet_attach(struct device *parent, struct device *self, void *aux)
         return EIO;
     }
 
+    genet->tx_hdr = mmap(NULL, GENET_RING_SIZE_MAX * GENET_TX_HDR_SIZE, PROT_READ | PROT_WRITE | PROT_NOCACHE,
+            MAP_SHARED | MAP_ANON | MAP_PHYS, NOFD, 0);
+    if (genet->tx_hdr == MAP_FAILED) {
+        GENET_ERROR("TX header buffer allocation failed..");
+        genet->tx_hdr = NULL;
+        genet_cleanup(genet, 1);
+        return ENOMEM;
+    }
+    if (mem_offset64(genet->tx_hdr, NOFD, 1, &genet->tx_hdr_phys, NULL) == -1) {
+        GENET_ERROR("TX header buffer mem_offset64 failed..");
+        genet_cleanup(genet, 1);
+        return ENOMEM;
+    }
+
     if((genet->sc_sdhook = shutdownhook_establish(genet_shutdown, genet)) == NULL ){
         GENET_ERROR("shutdownhook_establish failed.");
         genet_cleanup(genet, 3);
@@ -565,6 +739,13 @@ int genet_attach(struct device *parent, struct device *self, void *aux)
         return ENOMEM;
     }
 
+    /* Fill the RX buffer pools, RX still works if these come up short */
+    for (i = 0; i < genet->num_rxq; i++) {
+        if (genet_rx_pool_refill(&genet->rxq[i], WTP) < GENET_RX_POOL_SIZE) {
+            GENET_WARNING("RX queue %u buffer pool only has %u buffers", i, genet->rxq[i].pool_cnt);
+        }
+    }
+
     /* Fetch the board MAC address from syspage */
     err = genet_get_board_mac_addr(board_mac);
     if (err != EOK) {
@@ -679,9 +860,8 @@ int genet_init(struct ifnet *ifp)
         genet->iid_isr0 = ret;
     }
 
-/*ISR_1(190) is for priority queues but we are not using those queues */
-#ifdef GENET_ISR_1
-    if(genet->iid_isr1 == -1) {
+/*ISR_1(190) is for priority queues */
+    if((genet->num_rxq > 1 || genet->num_txq > 1) && genet->iid_isr1 == -1) {
         GENET_DEBUG(" Attaching interrupt(%d).", GENET_ENET_IRQ1);
         if ((ret = InterruptAttach_r(GENET_ENET_IRQ1, genet_isr1,
                    genet, sizeof(*genet), _NTO_INTR_FLAGS_TRK_MSK )) < 0) {
@@ -692,7 +872,6 @@ int genet_init(struct ifnet *ifp)
 
         genet->iid_isr1 = ret;
     }
-#endif
 
     genet_set_multicast(genet);
 
@@ -720,6 +899,8 @@ void genet_stop(struct ifnet *ifp, int disable)
 
     /* shut down mii probing */
     callout_stop(&genet->mii_callout);
+    callout_stop(&genet->tx_callout);
+    genet->tx_flush_armed = 0;
 
     /* Stop monitoring phy */
     MDI_DisableMonitor(genet->mdi);
@@ -733,6 +914,7 @@ void genet_stop(struct ifnet *ifp, int disable)
     /* Mark the interface as down */
     ifp->if_flags &= ~IFF_RUNNING;
     ifp->if_flags_tx &= ~(IFF_OACTIVE | IFF_RUNNING);
+    genet_tx_purge(genet);
 
     /* Tx is clean, unlock ready for next time */
     NW_SIGUNLOCK_P(&ifp->if_snd_ex, genet->iopkt, wtp);
@@ -740,12 +922,60 @@ void genet_stop(struct ifnet *ifp, int disable)
     MDI_PowerdownPhy(genet->mdi, genet->cfg.phy_addr);
 }
 
+/* Fold the per queue counters into the nic_stats_t nicinfo reads */
+static void genet_update_stats(Genet *genet)
+{
+    nic_stats_t *stats = &genet->stats;
+    unsigned q;
+
+    stats->octets_rxed_ok = stats->rxed_ok = 0;
+    stats->rxed_broadcast = stats->rxed_multicast = 0;
+    stats->rx_failed_allocs = 0;
+    for (q = 0; q < genet->num_rxq; q++) {
+        const genet_rxq_t *rxq = &genet->rxq[q];
+
+        stats->octets_rxed_ok += rxq->stats.bytes;
+        stats->rxed_ok += rxq->stats.packets;
+        stats->rxed_broadcast += rxq->stats.broadcast;
+        stats->rxed_multicast += rxq->stats.multicast;
+        stats->rx_failed_allocs += rxq->pool_stats.alloc_failed;
+    }
+
+    stats->octets_txed_ok = stats->txed_ok = 0;
+    stats->txed_broadcast = stats->txed_multicast = 0;
+    for (q = 0; q < genet->num_txq; q++) {
+        const genet_txq_t *txq = &genet->txq[q];
+
+        stats->octets_txed_ok += txq->stats.bytes;
+        stats->txed_ok += txq->stats.packets;
+        stats->txed_broadcast += txq->stats.broadcast;
+        stats->txed_multicast += txq->stats.multicast;
+    }
+}
+
+/* Return a SIOCGDRVSPEC result, which follows the struct ifdrv */
+static int genet_drvspec_out(struct ifdrv *ifd, const void *buf, size_t len)
+{
+    if (ifd->ifd_len != len) {
+        return EINVAL;
+    }
+
+    if (ISSTACK) {
+        return copyout(buf, (((uint8_t *)ifd) + sizeof(*ifd)), len);
+    }
+
+    memcpy((((uint8_t *)ifd) + sizeof(*ifd)), buf, len);
+    return EOK;
+}
+
 int genet_ioctl(struct ifnet *ifp, unsigned long cmd, caddr_t data)
 {
     Genet *genet;
     struct drvcom_config *dcfgp;
     struct drvcom_stats *dstp;
     struct ifdrv_com *ifdc;
+    struct ifdrv *ifd;
+    unsigned q;
     int error;
 
     genet = ifp->if_softc;
@@ -775,6 +1005,7 @@ int genet_ioctl(struct ifnet *ifp, unsigned long cmd, caddr_t data)
                         break;
                     }
 
+                    genet_update_stats(genet);
                     memcpy(&dstp->dcom_stats, &genet->stats, sizeof(genet->stats));
                     break;
 
@@ -784,6 +1015,109 @@ int genet_ioctl(struct ifnet *ifp, unsigned long cmd, caddr_t data)
 
             break;
 
+        case SIOCGDRVSPEC:
+            ifd = (struct ifdrv *) data;
+
+            switch (ifd->ifd_cmd) {
+                case GENET_GET_COAL_STATS:
+                {
+                    genet_coal_stats_t cs = genet->coal_stats;
+
+                    cs.rx_interrupts = genet->rxq[0].stats.interrupts;
+                    cs.rx_packets = genet->rxq[0].stats.packets;
+                    cs.rx_bytes = genet->rxq[0].stats.bytes;
+                    cs.rx_polls = genet->rxq[0].stats.polls;
+                    cs.rx_budget_exhausted = genet->rxq[0].stats.budget_exhausted;
+                    cs.tx_interrupts = genet->txq[0].stats.interrupts;
+                    cs.tx_packets = genet->txq[0].stats.packets;
+                    cs.tx_bytes = genet->txq[0].stats.bytes;
+                    error = genet_drvspec_out(ifd, &cs, sizeof(cs));
+                    break;
+                }
+
+                case GENET_GET_RX_POOL_STATS:
+                {
+                    genet_rx_pool_stats_t ps[GENET_MAX_QUEUES];
+
+                    memset(ps, 0, sizeof(ps));
+                    for (q = 0; q < genet->num_rxq; q++) {
+                        ps[q] = genet->rxq[q].pool_stats;
+                    }
+                    error = genet_drvspec_out(ifd, ps, sizeof(ps));
+                    break;
+                }
+
+                case GENET_GET_QUEUE_STATS:
+                {
+                    genet_queue_stats_t qs;
+
+                    memset(&qs, 0, sizeof(qs));
+                    qs.rx_queues = genet->num_rxq;
+                    qs.tx_queues = genet->num_txq;
+                    for (q = 0; q < genet->num_rxq; q++) {
+                        qs.rx[q] = genet->rxq[q].stats;
+                    }
+                    for (q = 0; q < genet->num_txq; q++) {
+                        qs.tx[q] = genet->txq[q].stats;
+                    }
+                    error = genet_drvspec_out(ifd, &qs, sizeof(qs));
+                    break;
+                }
+
+                case GENET_GET_INTR_STATS:
+                    error = genet_drvspec_out(ifd, &genet->intr_stats,
+                            sizeof(genet->intr_stats));
+                    break;
+
+                case GENET_GET_PERF_STATS:
+                {
+                    genet_perf_stats_t ps;
+
+                    memset(&ps, 0, sizeof(ps));
+                    ps.timestamp = ClockCycles();
+                    ps.cycles_per_sec = SYSPAGE_ENTRY(qtime)->cycles_per_sec;
+                    ps.enabled = genet->perf;
+                    ps.rx_queues = genet->num_rxq;
+                    ps.tx_queues = genet->num_txq;
+                    ps.isr0 = genet->isr0_perf;
+                    ps.isr1 = genet->isr1_perf;
+                    for (q = 0; q < genet->num_rxq; q++) {
+                        ps.rx[q] = genet->rxq[q].perf;
+                    }
+                    for (q = 0; q < genet->num_txq; q++) {
+                        ps.tx[q] = genet->txq[q].perf;
+                    }
+                    error = genet_drvspec_out(ifd, &ps, sizeof(ps));
+                    break;
+                }
+
+                default:
+                    error = ENOTTY;
+            }
+
+            break;
+
+        case SIOCSDRVSPEC:
+            ifd = (struct ifdrv *) data;
+
+            switch (ifd->ifd_cmd) {
+                case GENET_CLR_PERF_STATS:
+                    memset(&genet->isr0_perf, 0, sizeof(genet->isr0_perf));
+                    memset(&genet->isr1_perf, 0, sizeof(genet->isr1_perf));
+                    for (q = 0; q < genet->num_rxq; q++) {
+                        memset(&genet->rxq[q].perf, 0, sizeof(genet->rxq[q].perf));
+                    }
+                    for (q = 0; q < genet->num_txq; q++) {
+                        memset(&genet->txq[q].perf, 0, sizeof(genet->txq[q].perf));
+                    }
+                    break;
+
+                default:
+                    error = ENOTTY;
+            }
+
+            break;
+
         case SIOCSIFMEDIA:
         case SIOCGIFMEDIA:
         {
@@ -823,6 +1157,7 @@ int genet_ioctl(struct ifnet *ifp, unsigned long cmd, caddr_t data)
 static void genet_cleanup(Genet *genet, int level)
 {
     struct ifnet *ifp;
+    unsigned q;
     ifp = &genet->sc_ec.ec_if;
 
     switch (level) {
@@ -835,17 +1170,19 @@ static void genet_cleanup(Genet *genet, int level)
                 genet->iid_isr0 = -1;
         }
 
-#ifdef GENET_ISR_1
             if(genet->iid_isr1 != -1) {
                 InterruptDetach(genet->iid_isr1);
                 genet->iid_isr1 = -1;
             }
-#endif
 
         case 5:
-            interrupt_entry_remove(&genet->intr_rx, NULL);
-            interrupt_entry_remove(&genet->intr_tx, NULL);
-            interrupt_entry_remove(&genet->intr_link, NULL);
+            for (q = 1; q < genet->num_rxq; q++) {
+                interrupt_entry_remove(&genet->rxq[q].intr, NULL);
+            }
+            for (q = 1; q < genet->num_txq; q++) {
+                interrupt_entry_remove(&genet->txq[q].intr, NULL);
+            }
+            interrupt_entry_remove(&genet->intr, NULL);
 
         case 4:
             bsd_mii_finimedia(genet);
@@ -856,12 +1193,19 @@ static void genet_cleanup(Genet *genet, int level)
 
         case 2:
             genet_rx_reap(genet, GENET_RING_SIZE_MAX);
+            for (q = 0; q < genet->num_rxq; q++) {
+                genet_rx_pool_fini(&genet->rxq[q]);
+            }
 
         case 1:
             if(genet->genet_base) {
                 munmap_device_memory((void *)genet->genet_base, GENET_REG_SIZE);
                 genet->genet_base = (uintptr_t)NULL;
             }
+            if (genet->tx_hdr != NULL) {
+                munmap(genet->tx_hdr, GENET_RING_SIZE_MAX * GENET_TX_HDR_SIZE);
+                genet->tx_hdr = NULL;
+            }
 
             break;
 
@@ -884,6 +1228,7 @@ int genet_detach(struct device *dev, int flags)
 
     cache_fini(&genet->cachectl);
     callout_stop(&genet->mii_callout);
+    callout_stop(&genet->tx_callout);
 
     genet_stop(ifp, 1);
     genet_hw_stop(genet);
@@ -902,57 +1247,6 @@ void genet_shutdown(void *arg)
     genet_stop(&genet->sc_ec.ec_if, 1);
 }
 
-#ifdef GENET_ISR_1
-const struct sigevent *
-genet_isr1(void *arg, int iid)
-{
-    Genet *genet;
-    uint32_t status;
-    genet = arg;
-
-    status = (genet_intrl2_1_read(genet, BCM_GENET_0_INTRL2_CPU_STAT)
-            & ~(genet_intrl2_1_read(genet, BCM_GENET_0_INTRL2_CPU_MASK_STATUS)) );
-
-    /* clear interrupts */
-    genet_intrl2_1_write(genet, BCM_GENET_0_INTRL2_CPU_CLEAR, status);
-
-    return 0;
-}
-#endif
-
-const struct sigevent *
-genet_isr0(void *arg, int iid)
-{
-    Genet *genet;
-
-    genet = arg;
-
-    genet->irq0_status = ( genet_reg_read(genet, GENET_INTRL2_0_CPU_STAT)
-            & ~ (genet_reg_read(genet, GENET_INTRL2_0_CPU_MASK_STATUS)) );
-
-    if (genet->irq0_status & GENET_INTRL2_RX_DONE) {
-        genet_reg_write(genet, GENET_INTRL2_0_CPU_CLEAR, genet->irq0_status & GENET_INTRL2_RX_DONE);
-        return interrupt_queue(genet->iopkt, &genet->intr_rx);
-    }
-
-    if (genet->irq0_status & GENET_INTRL2_TX_DONE) {
-        genet_reg_write(genet, GENET_INTRL2_0_CPU_CLEAR, genet->irq0_status & GENET_INTRL2_TX_DONE);
-        return interrupt_queue(genet->iopkt, &genet->intr_tx);
-    }
-
-    if (genet->irq0_status & (GENET_INTRL2_0_LINK_UP | GENET_INTRL2_0_LINK_DOWN)){
-        genet_reg_write(genet, GENET_INTRL2_0_CPU_CLEAR,
-                genet->irq0_status & (GENET_INTRL2_0_LINK_UP | GENET_INTRL2_0_LINK_DOWN));
-        genet->link_status = genet->irq0_status;
-        return interrupt_queue(genet->iopkt, &genet->intr_link);
-    }
-    /* Clear the interrupt for unknown recipient*/
-    genet_reg_write(genet, GENET_INTRL2_0_CPU_CLEAR, genet->irq0_status);
-    TraceEvent(_NTO_TRACE_INSERTSUSEREVENT, 3, genet->irq0_status, genet->irq0_status);
-
-    return 0;
-}
-
 
 #if defined(__QNXNTO__) && defined(__USESRCVERSION)
 #include <sys/srcversion.h>
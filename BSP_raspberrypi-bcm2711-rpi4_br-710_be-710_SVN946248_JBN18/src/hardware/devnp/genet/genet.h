@@ -38,8 +38,13 @@
 #include <dev/mii/miivar.h>
 #include <sys/syslog.h>
 #include <sys/slogcodes.h>
+#include <sys/neutrino.h>
+#include <sys/trace.h>
+
+#include <hw/genet_stats.h>
 
 #include "genet_reg.h"
+#include "genet_dim.h"
 
 #define GENET_ERROR(fmt, ...)   \
     do { slogf(_SLOGC_NETWORK, _SLOG_ERROR,"genet:%s():%d: "fmt, \
@@ -63,12 +68,117 @@
 
 #define GENET_DEFAULT_PRIO      21
 
+/* Default coalescing when adaptive moderation is turned off */
+#define GENET_DEFAULT_RX_USECS  0
+#define GENET_DEFAULT_RX_FRAMES 1
+#define GENET_DEFAULT_TX_FRAMES 2
+#define GENET_DEFAULT_TX_USECS  8   // genet_tx_flush() period, TX has no ring timeout
+
+/* Frames handled per RX poll before yielding the work thread */
+#define GENET_DEFAULT_RX_BUDGET 64
+
+/*
+ * Queues. Queue 0 is the default ring 16, queues 1..4 are the priority
+ * rings 0..3, ring 0 having the highest priority. With more than one
+ * queue the descriptors are split as in Linux: 32 for each priority ring
+ * at the bottom and 128 for the default ring on top. Window sizes are
+ * powers of two so the 16-bit ring indices wrap cleanly.
+ */
+#define GENET_PRIO_RING_SIZE    32
+#define GENET_MQ_DEFAULT_SIZE   (GENET_RING_SIZE_MAX - (GENET_MAX_QUEUES - 1) * GENET_PRIO_RING_SIZE)
+
+/* INTRL2_0 causes handed to genet_process_interrupt() */
+#define GENET_INTRL2_0_LINK     (GENET_INTRL2_0_LINK_UP | GENET_INTRL2_0_LINK_DOWN)
+#define GENET_INTRL2_0_WORK     (GENET_INTRL2_RX_DONE | GENET_INTRL2_TX_DONE | GENET_INTRL2_0_LINK)
+
+/*
+ * User trace events with the trace option, (argument, cycles) per stage
+ * and queue: the ISR status, frames polled, descriptors sent or reaped.
+ */
+#define GENET_TRACE_ISR0        0x100
+#define GENET_TRACE_ISR1        0x101
+#define GENET_TRACE_RX(q)       (0x110 + (q))
+#define GENET_TRACE_TX(q)       (0x120 + (q))
+#define GENET_TRACE_REAP(q)     (0x130 + (q))
+
 typedef struct Desc_t
 {
     uintptr_t desc;       // 0:CONTROL/STATUS, 1: PHYSICAL_ADDRESS_LO, 2: PHYSICAL_ADDRESS_HI
     struct mbuf *mb;
+    uint32_t addr_hi;     // last PHYSICAL_ADDRESS_HI written
 }Desc;
 
+/* Pre-allocated, pre-invalidated RX buffers */
+#define GENET_RX_POOL_SIZE      64
+#define GENET_RX_POOL_LOW       16  // refill below this many buffers
+
+typedef struct genet_rxbuf_t
+{
+    struct mbuf *m;
+    off64_t     phys;
+}genet_rxbuf_t;
+
+struct Genet_t;
+
+typedef struct genet_rxq_t
+{
+    struct Genet_t      *genet;
+    struct _iopkt_inter intr;       // RX done work for this queue
+    unsigned            index;
+    unsigned            ring;       // hardware ring
+    Desc                *d;         // descriptor window
+    unsigned            size;       // descriptors in the window
+    uint32_t            intr_mask;  // INTRL2 mask register
+    uint32_t            intr_bit;
+    unsigned            drops;      // last hardware discard count
+    int                 polling;    // RX done masked, work thread polling
+
+    /* Buffer pool, owned by this queue's work handler */
+    genet_rxbuf_t       pool[GENET_RX_POOL_SIZE];
+    unsigned            pool_cnt;
+    genet_rx_pool_stats_t pool_stats;
+
+    genet_q_stats_t     stats;
+    genet_rxq_perf_t    perf;
+}genet_rxq_t;
+
+typedef struct genet_txq_t
+{
+    struct Genet_t      *genet;
+    struct _iopkt_inter intr;       // TX done work for this queue
+    unsigned            index;
+    unsigned            ring;
+    Desc                *d;
+    unsigned            size;
+    uint32_t            intr_mask;
+    uint32_t            intr_bit;
+    volatile uint16_t   free_idx;   // last freed tx slot, see genet_tx_reap()
+    uint16_t            prod_idx;   // next tx slot, only genet_tx() moves it
+    volatile int        full;       // genet_start() found no room, genet_tx_reap() restarts it
+    struct mbuf         *held;      // frames waiting for room, by m_nextpkt, under if_snd_ex
+    struct mbuf         *held_last;
+    unsigned            held_cnt;
+    genet_q_stats_t     stats;
+    genet_txq_perf_t    perf;
+}genet_txq_t;
+
+/*
+ * Per descriptor TX header buffer: the status block, then up to
+ * GENET_TX_COPYBREAK bytes of small leading mbufs, with room left for
+ * padding a runt frame.
+ */
+#define GENET_TX_COPYBREAK  128
+#define GENET_TX_HDR_SIZE   256
+
+/*
+ * Frames genet_start() holds for a full ring so frames for the other
+ * rings can pass them in if_snd. Past this the ring blocks if_snd.
+ */
+#define GENET_TX_HELD_MAX   16
+
+/* Largest Ethernet + IPv4 + TCP header a TSO send may carry */
+#define GENET_TSO_HDR_MAX   (ETHER_HDR_LEN + ETHER_VLAN_ENCAP_LEN + 60 + 60)
+
 typedef struct Genet_t
 {
     /* Do not change the order of first three element */
@@ -80,31 +190,67 @@ typedef struct Genet_t
     nic_stats_t         stats;
     struct cache_ctrl   cachectl;
     struct callout      mii_callout;
+    struct callout      tx_callout;     /* genet_tx_flush() */
+    volatile int        tx_flush_armed;
     struct mii_data     bsd_mii;
 
     struct _iopkt_self  *iopkt;
-    struct _iopkt_inter intr_rx;
-    struct _iopkt_inter intr_tx;
-    struct _iopkt_inter intr_link;
+    struct _iopkt_inter intr;   /* INTRL2_0 work, queue 0 and link */
     mdi_t               *mdi;
 
     /* RX, TX descriptors (256)*/
     Desc                tx_d[GENET_RING_SIZE_MAX];
     Desc                rx_d[GENET_RING_SIZE_MAX];
 
+    /* Queues, each owning a window of the descriptors */
+    unsigned            num_rxq;
+    unsigned            num_txq;
+    genet_rxq_t         rxq[GENET_MAX_QUEUES];
+    genet_txq_t         txq[GENET_MAX_QUEUES];
+
+    /*
+     * One GENET_TX_HDR_SIZE header buffer per TX descriptor, holding the
+     * status block and any small leading mbufs copied behind it. Uncached,
+     * so never flushed.
+     */
+    uint8_t             *tx_hdr;
+    off64_t             tx_hdr_phys;
+
+    /* Segments of a TSO send not yet on a ring, linked by m_nextpkt */
+    struct mbuf         *tx_gso;
+
     /* Register base address */
     uintptr_t           genet_base;
     uintptr_t           mdio_base;
 
-    volatile uint16_t   free_idx; // last freed tx slot
-    unsigned            drops;
-    uint32_t            irq0_status;
+    volatile unsigned   irq0_pending;   /* causes masked by genet_isr0() */
     uint32_t            link_status;
     int                 iid_isr0;
     int                 iid_isr1;
+    genet_intr_stats_t  intr_stats;
     int                 probe_phy;
     int                 force_link;
     void                *sc_sdhook;
+
+    /* Interrupt coalescing, default ring only */
+    int                 rx_adaptive;
+    int                 tx_adaptive;
+    genet_coal_t        rx_coal;
+    genet_coal_t        tx_coal;
+    genet_dim_t         rx_dim;
+    genet_dim_t         tx_dim;
+    genet_coal_stats_t  coal_stats;
+    uint64_t            cycles_per_us;
+
+    /* RX polling */
+    unsigned            rx_budget;
+    unsigned            rx_pool_low;
+
+    /* Stage counters and tracepoints */
+    int                 perf;
+    int                 trace;
+    genet_stage_t       isr0_perf;
+    genet_stage_t       isr1_perf;
 }Genet;
 
 /* Function proto types */
@@ -116,16 +262,27 @@ void genet_stop(struct ifnet *, int);
 void genet_start(struct ifnet *);
 void genet_shutdown(void *);
 int genet_ioctl(struct ifnet *, unsigned long, caddr_t);
+int genet_config(Genet *, const char *);
+void genet_queues_init(Genet *);
 void genet_add_pkt_to_rx_desc(Genet *genet, struct mbuf *m, Desc *const rxdesc);
+unsigned genet_rx_pool_refill(genet_rxq_t *, struct nw_work_thread *);
+void genet_rx_pool_fini(genet_rxq_t *);
+void genet_rx_filters_init(Genet *);
 uint32_t genet_reg_read(Genet *, uint32_t );
 void genet_reg_write(Genet *, uint32_t , uint32_t );
+void genet_rx_coal_update(Genet *);
+void genet_tx_coal_update(Genet *);
+void genet_tx_purge(Genet *);
 
+int genet_intr_enable(void *);
+int genet_rxq_enable(void *);
+int genet_txq_enable(void *);
 const struct sigevent * genet_isr0(void *, int);
-#ifdef GENET_ISR_1
 const struct sigevent * genet_isr1(void *, int);
-#endif
 int rx_process_interrupt(void *, struct nw_work_thread *);
 int tx_process_interrupt(void *, struct nw_work_thread *);
+void genet_tx_reap(genet_txq_t *, struct nw_work_thread *);
+int genet_process_interrupt(void *, struct nw_work_thread *);
 int link_process_interrupt(void *, struct nw_work_thread *);
 
 int genet_ext_phy_init(struct ifnet *, Genet *);
@@ -134,6 +291,73 @@ void bsd_mii_initmedia(Genet *);
 void bsd_mii_finimedia(Genet *);
 void genet_mdi_finiphy(Genet *);
 
+/* Stage timing with perf=1, a ClockCycles() read each end; a flag test when off */
+static inline uint64_t genet_perf_start(const Genet *genet)
+{
+    return genet->perf ? ClockCycles() : 0;
+}
+
+static inline void genet_perf_end(const Genet *genet, genet_stage_t *st, uint64_t start,
+        int event, unsigned arg)
+{
+    uint32_t cycles;
+
+    if (!genet->perf) {
+        return;
+    }
+
+    cycles = ClockCycles() - start;
+    st->calls++;
+    st->cycles += cycles;
+    if (cycles > st->max_cycles) {
+        st->max_cycles = cycles;
+    }
+    if (genet->trace) {
+        TraceEvent(_NTO_TRACE_INSERTSUSEREVENT, event, arg, cycles);
+    }
+}
+
+static inline unsigned genet_perf_bucket(unsigned n)
+{
+    return n == 0 ? 0 : n >= 1U << (GENET_PERF_HIST - 2) ? GENET_PERF_HIST - 1 : 32 - __builtin_clz(n);
+}
+
+/* Order CPU writes to DMA visible memory before a doorbell register write */
+#if defined(__aarch64__)
+#define genet_wmb()     __asm__ __volatile__("dmb oshst" ::: "memory")
+#else
+#define genet_wmb()     __sync_synchronize()
+#endif
+
+/*
+ * Queue for a frame priority 0-7 with nprio priority queues: 0 and 1
+ * stay on the default queue, 2-7 are spread over the priority queues,
+ * the highest on queue 1 (ring 0).
+ */
+static inline unsigned genet_prio_queue(unsigned prio, unsigned nprio)
+{
+    return nprio == 0 || prio < 2 ? 0 : 1 + ((7 - prio) * nprio) / 6;
+}
+
+/* 16-bit ones complement sum over big endian words, for checksum offload */
+static inline uint32_t genet_csum_add(uint32_t sum, const uint8_t *p, unsigned len)
+{
+    for (; len > 1; p += 2, len -= 2) {
+        sum += (p[0] << 8) | p[1];
+    }
+    if (len) {
+        sum += p[0] << 8;
+    }
+    return sum;
+}
+
+static inline uint16_t genet_csum_fold(uint32_t sum)
+{
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
+
 #endif /* GENET_H_ */
 
 
@@ -0,0 +1,311 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+
+#include <stddef.h>
+#include "genet_dim.h"
+
+/*
+ * Profiles from lowest latency to strongest moderation. The frame counts
+ * stay well below GENET_RING_SIZE_MAX so the ring never fills while the
+ * hardware waits for the threshold.
+ */
+const genet_coal_t genet_dim_profiles[GENET_DIM_NPROFILES] = {
+    {   0,  1 },
+    {   8,  4 },
+    {  32, 16 },
+    {  64, 32 },
+    { 128, 64 },
+};
+
+enum {
+    GENET_DIM_STATS_WORSE,
+    GENET_DIM_STATS_SAME,
+    GENET_DIM_STATS_BETTER,
+};
+
+enum {
+    GENET_DIM_STEPPED,
+    GENET_DIM_TOO_TIRED,
+    GENET_DIM_ON_EDGE,
+};
+
+/* A change is significant if it is more than 10% of the reference */
+static int significant(uint32_t val, uint32_t ref)
+{
+    uint64_t diff = val > ref ? val - ref : ref - val;
+
+    return ref && (100 * diff / ref) > 10;
+}
+
+static int stats_compare(const genet_dim_stats_t *curr, const genet_dim_stats_t *prev)
+{
+    if (!prev->bpms) {
+        return curr->bpms ? GENET_DIM_STATS_BETTER : GENET_DIM_STATS_SAME;
+    }
+
+    if (significant(curr->bpms, prev->bpms)) {
+        return curr->bpms > prev->bpms ? GENET_DIM_STATS_BETTER : GENET_DIM_STATS_WORSE;
+    }
+
+    if (!prev->ppms) {
+        return curr->ppms ? GENET_DIM_STATS_BETTER : GENET_DIM_STATS_SAME;
+    }
+
+    if (significant(curr->ppms, prev->ppms)) {
+        return curr->ppms > prev->ppms ? GENET_DIM_STATS_BETTER : GENET_DIM_STATS_WORSE;
+    }
+
+    if (!prev->epms) {
+        return GENET_DIM_STATS_SAME;
+    }
+
+    /* Same throughput with fewer interrupts is better */
+    if (significant(curr->epms, prev->epms)) {
+        return curr->epms < prev->epms ? GENET_DIM_STATS_BETTER : GENET_DIM_STATS_WORSE;
+    }
+
+    return GENET_DIM_STATS_SAME;
+}
+
+static int dim_step(genet_dim_t *dim)
+{
+    if (dim->tired == GENET_DIM_NPROFILES * 2) {
+        return GENET_DIM_TOO_TIRED;
+    }
+
+    switch (dim->state) {
+        case GENET_DIM_PARKING_ON_TOP:
+        case GENET_DIM_PARKING_TIRED:
+            break;
+        case GENET_DIM_GOING_RIGHT:
+            if (dim->profile == GENET_DIM_NPROFILES - 1) {
+                return GENET_DIM_ON_EDGE;
+            }
+            dim->profile++;
+            dim->steps_right++;
+            break;
+        case GENET_DIM_GOING_LEFT:
+            if (dim->profile == 0) {
+                return GENET_DIM_ON_EDGE;
+            }
+            dim->profile--;
+            dim->steps_left++;
+            break;
+    }
+
+    dim->tired++;
+    return GENET_DIM_STEPPED;
+}
+
+static void dim_park_on_top(genet_dim_t *dim)
+{
+    dim->steps_right = 0;
+    dim->steps_left = 0;
+    dim->tired = 0;
+    dim->state = GENET_DIM_PARKING_ON_TOP;
+}
+
+static void dim_park_tired(genet_dim_t *dim)
+{
+    dim->steps_right = 0;
+    dim->steps_left = 0;
+    dim->state = GENET_DIM_PARKING_TIRED;
+}
+
+static void dim_exit_parking(genet_dim_t *dim)
+{
+    dim->state = dim->profile ? GENET_DIM_GOING_LEFT : GENET_DIM_GOING_RIGHT;
+    dim_step(dim);
+}
+
+/* We are on top once we have just turned back after overshooting */
+static int dim_on_top(const genet_dim_t *dim)
+{
+    switch (dim->state) {
+        case GENET_DIM_GOING_RIGHT:
+            return (dim->steps_left > 1) && (dim->steps_right == 1);
+        case GENET_DIM_GOING_LEFT:
+            return (dim->steps_right > 1) && (dim->steps_left == 1);
+        default:
+            return 0;
+    }
+}
+
+static void dim_turn(genet_dim_t *dim)
+{
+    switch (dim->state) {
+        case GENET_DIM_GOING_RIGHT:
+            dim->state = GENET_DIM_GOING_LEFT;
+            dim->steps_left = 0;
+            break;
+        case GENET_DIM_GOING_LEFT:
+            dim->state = GENET_DIM_GOING_RIGHT;
+            dim->steps_right = 0;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * A packet rate that has more than halved is a change of load, not the
+ * result of the last step: step back towards lower latency and search
+ * from there, also out of the parked states which ignore the rates.
+ */
+static int dim_decay(genet_dim_t *dim, const genet_dim_stats_t *curr)
+{
+    if (dim->profile == 0 || curr->ppms >= dim->prev.ppms / 2) {
+        return 0;
+    }
+
+    dim->profile--;
+    dim->state = GENET_DIM_GOING_LEFT;
+    dim->steps_left = 1;
+    dim->steps_right = 0;
+    dim->tired = 0;
+    dim->prev = *curr;
+    return 1;
+}
+
+static int dim_decision(genet_dim_t *dim, const genet_dim_stats_t *curr)
+{
+    genet_dim_state_t prev_state = dim->state;
+    unsigned prev_profile = dim->profile;
+
+    if (dim_decay(dim, curr)) {
+        return 1;
+    }
+
+    switch (dim->state) {
+        case GENET_DIM_PARKING_ON_TOP:
+            if (stats_compare(curr, &dim->prev) != GENET_DIM_STATS_SAME) {
+                dim_exit_parking(dim);
+            }
+            break;
+
+        case GENET_DIM_PARKING_TIRED:
+            dim->tired--;
+            if (!dim->tired) {
+                dim_exit_parking(dim);
+            }
+            break;
+
+        case GENET_DIM_GOING_RIGHT:
+        case GENET_DIM_GOING_LEFT:
+            if (stats_compare(curr, &dim->prev) != GENET_DIM_STATS_BETTER) {
+                dim_turn(dim);
+            }
+
+            if (dim_on_top(dim)) {
+                dim_park_on_top(dim);
+                break;
+            }
+
+            switch (dim_step(dim)) {
+                case GENET_DIM_ON_EDGE:
+                    dim_park_on_top(dim);
+                    break;
+                case GENET_DIM_TOO_TIRED:
+                    dim_park_tired(dim);
+                    break;
+            }
+            break;
+    }
+
+    if (prev_state != GENET_DIM_PARKING_ON_TOP || dim->state != GENET_DIM_PARKING_ON_TOP) {
+        dim->prev = *curr;
+    }
+
+    return dim->profile != prev_profile;
+}
+
+void genet_dim_init(genet_dim_t *dim, unsigned profile)
+{
+    dim->state = GENET_DIM_PARKING_ON_TOP;
+    dim->profile = profile < GENET_DIM_NPROFILES ? profile : 0;
+    dim->steps_right = 0;
+    dim->steps_left = 0;
+    dim->tired = 0;
+    dim->have_start = 0;
+    dim->prev.ppms = dim->prev.bpms = dim->prev.epms = 0;
+    dim->changes = 0;
+}
+
+/*
+ * Feed the current running counters. Returns 1 if dim->profile changed and
+ * the new genet_dim_profiles[dim->profile] must be written to the ring.
+ * Counters are free running and may wrap.
+ */
+int genet_dim_update(genet_dim_t *dim, const genet_dim_sample_t *now)
+{
+    genet_dim_stats_t curr;
+    uint32_t events;
+    uint64_t delta_us;
+
+    if (!dim->have_start) {
+        dim->start = *now;
+        dim->have_start = 1;
+        return 0;
+    }
+
+    events = now->events - dim->start.events;
+    delta_us = now->time_us - dim->start.time_us;
+
+    /*
+     * Too few interrupts for a window in GENET_DIM_IDLE_US: the link has
+     * gone quiet, start over from the lowest latency profile so the first
+     * frames after it are not held back by a moderation tuned for a load
+     * that is gone.
+     */
+    if (events < GENET_DIM_NEVENTS && delta_us >= GENET_DIM_IDLE_US) {
+        const unsigned prev_profile = dim->profile;
+        const uint32_t changes = dim->changes;
+
+        genet_dim_init(dim, 0);
+        dim->start = *now;
+        dim->have_start = 1;
+        dim->changes = changes + (prev_profile != 0);
+        return prev_profile != 0;
+    }
+
+    if (events < GENET_DIM_NEVENTS || delta_us == 0) {
+        return 0;
+    }
+
+    curr.ppms = (uint32_t)(((uint64_t)(uint32_t)(now->pkts - dim->start.pkts) * 1000) / delta_us);
+    curr.bpms = (uint32_t)(((now->bytes - dim->start.bytes) * 1000) / delta_us);
+    curr.epms = (uint32_t)(((uint64_t)events * 1000) / delta_us);
+
+    dim->start = *now;
+
+    if (dim_decision(dim, &curr)) {
+        dim->changes++;
+        return 1;
+    }
+    return 0;
+}
+
+
+#if defined(__QNXNTO__) && defined(__USESRCVERSION)
+#include <sys/srcversion.h>
+__SRCVERSION("$URL$ $Rev$")
+#endif
@@ -0,0 +1,101 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+
+#ifndef GENET_DIM_H_
+#define GENET_DIM_H_
+
+/*
+ * Dynamic interrupt moderation for the GENET rings.
+ *
+ * This file has no io-pkt or hardware dependencies so the tuning logic can
+ * be built and exercised on the host. The driver feeds it running counters
+ * from its interrupt handlers; every GENET_DIM_NEVENTS interrupts it
+ * compares the traffic seen in the last window with the previous one and
+ * steps through genet_dim_profiles[] towards the profile that moves the
+ * most data with the fewest interrupts, in the style of Linux net_dim.
+ * When the load drops it steps back towards the lowest latency profile
+ * without waiting for the search to come around.
+ */
+
+#include <stdint.h>
+
+#define GENET_DIM_NEVENTS           64  /* interrupts per decision window */
+#define GENET_DIM_NPROFILES         5
+#define GENET_DIM_IDLE_US           100000  /* a window this long means the load is gone */
+
+/* Coalescing parameters for one ring */
+typedef struct genet_coal_t
+{
+    uint32_t    usecs;      /* ring timeout, 0 disables the timer */
+    uint32_t    frames;     /* MBUF_DONE_INTR_THRESH, at least 1 */
+} genet_coal_t;
+
+extern const genet_coal_t genet_dim_profiles[GENET_DIM_NPROFILES];
+
+/* Snapshot of the running counters */
+typedef struct genet_dim_sample_t
+{
+    uint64_t    time_us;
+    uint32_t    events;     /* interrupts */
+    uint32_t    pkts;
+    uint64_t    bytes;
+} genet_dim_sample_t;
+
+/* Rates over one window, per millisecond */
+typedef struct genet_dim_stats_t
+{
+    uint32_t    ppms;
+    uint32_t    bpms;
+    uint32_t    epms;
+} genet_dim_stats_t;
+
+typedef enum
+{
+    GENET_DIM_PARKING_ON_TOP,
+    GENET_DIM_PARKING_TIRED,
+    GENET_DIM_GOING_RIGHT,  /* towards more moderation */
+    GENET_DIM_GOING_LEFT,   /* towards lower latency */
+} genet_dim_state_t;
+
+typedef struct genet_dim_t
+{
+    genet_dim_state_t   state;
+    unsigned            profile;
+    unsigned            steps_right;
+    unsigned            steps_left;
+    unsigned            tired;
+    int                 have_start;
+    genet_dim_sample_t  start;
+    genet_dim_stats_t   prev;
+    uint32_t            changes;    /* number of profile switches */
+} genet_dim_t;
+
+void genet_dim_init(genet_dim_t *dim, unsigned profile);
+int genet_dim_update(genet_dim_t *dim, const genet_dim_sample_t *now);
+
+#endif /* GENET_DIM_H_ */
+
+
+#if defined(__QNXNTO__) && defined(__USESRCVERSION)
+#include <sys/srcversion.h>
+__SRCVERSION("$URL$ $Rev$")
+#endif
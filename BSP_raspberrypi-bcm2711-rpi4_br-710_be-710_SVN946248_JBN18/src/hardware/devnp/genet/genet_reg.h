@@ -25,7 +25,7 @@
 
 /*BCM GENET base address*/
 #define GENET_BASE_ADDR             0xFD580000
-#define GENET_REG_SIZE              0x6000
+#define GENET_REG_SIZE              0x10000
 
 #define GENET_ENET_IRQ0             189
 #define GENET_ENET_IRQ1             190
@@ -74,11 +74,22 @@
 #define GENET_RBUF_CHK_CNTRL            0x314
 #define GENET_RBUF_CHK_CNTRL_RXCHK_EN   (1 << 0)
 #define GENET_RBUF_CHK_CNTRL_SKIP_FCS   (1 << 4)
+#define GENET_RBUF_CHK_CNTRL_L3_PARSE_DIS (1 << 5)
 
 /* genet TBUF reg and bits */
 #define GENET_TBUF_CNTRL                0x600
 #define GENET_TBUF_CNTRL_STATUS_64B_EN  (1 << 0)
 
+/* 64 byte status block ahead of each frame when STATUS_64B_EN is set */
+#define GENET_SB_SIZE                   64
+#define GENET_SB_RX_CSUM                0x08    // ones complement sum past the L2 header
+#define GENET_SB_RX_CSUM_MASK           0xFFFF
+#define GENET_SB_TX_CSUM_INFO           0x30
+#define GENET_SB_TX_CSUM_START_SHIFT    16
+#define GENET_SB_TX_CSUM_PROTO_UDP      (1 << 15)
+#define GENET_SB_TX_CSUM_LV             (1U << 31)
+#define GENET_SB_RX_ALIGN               2       // GENET_RBUF_CNTRL_ALIGN_2B
+
 /* genet UMAC and command */
 #define GENET_UMAC_CMD                  0x808
 #define GENET_UMAC_CMD_TX_ENA           (1 << 0)
@@ -172,6 +183,52 @@
 #define GENET_TDMA_SCB_BURST_SIZE       (GENET_TDMA_RING_OFFSET + 0x4c)
 #define GENET_RDMA_SCB_BURST_SIZE       (GENET_RDMA_RING_OFFSET + 0x4c)
 
+/*
+ * The ring registers above address the default ring 16, each ring has
+ * its own GENET_RING_CNTRL_SIZE block below it, e.g.
+ *   GENET_RING_REG(GENET_TDMA_PRODUCER_INDEX, 0)
+ */
+#define GENET_RING_REG(reg, ring)       ((reg) - ((GENET_DEFAULT_RING - (ring)) * GENET_RING_CNTRL_SIZE))
+
+/* genet TDMA arbiter, strict priority, lower value is served first */
+#define GENET_TDMA_ARB_CTRL             (GENET_TDMA_RING_CFG + 0x2c)
+#define GENET_DMA_ARBITER_SP            0x02
+#define GENET_TDMA_PRIORITY(ring)       (GENET_TDMA_RING_CFG + 0x30 + (((ring) / 6) * 4))
+#define GENET_DMA_PRIO_SHIFT(ring)      (((ring) % 6) * 5)
+#define GENET_DMA_PRIO_MASK             0x1F
+
+/* INTRL2_1: priority ring done bits */
+#define GENET_INTRL2_1_TX_RING(ring)    (1 << (ring))
+#define GENET_INTRL2_1_RX_RING(ring)    (1 << ((ring) + 16))
+
+/* genet RDMA per ring timeout, only RX rings have one */
+#define GENET_RDMA_RING_TIMEOUT(ring)   (GENET_RDMA_RING_CFG + 0x2c + ((ring) * 4))
+#define GENET_DMA_TIMEOUT_MASK          0xFFFF
+#define GENET_DMA_TIMEOUT_NS            8192    // one timeout tick
+
+#define GENET_DMA_INTR_THRESH_MASK      0x1FF
+
+/* genet RDMA filter to ring map, 4 bits per HFB filter: 0 default ring, n ring n - 1 */
+#define GENET_RDMA_INDEX2RING(f)        (GENET_RDMA_RING_CFG + 0x70 + ((f) / 8) * 4)
+#define GENET_RDMA_INDEX2RING_SHIFT(f)  (((f) % 8) * 4)
+#define GENET_RDMA_INDEX2RING_MASK      0xFU
+
+/*
+ * genet hardware filter block. Each filter word matches two frame bytes
+ * in its low half, bit 16 + n enabling the compare of data nibble n.
+ */
+#define GENET_HFB_OFF                   0x8000
+#define GENET_HFB_FILTERS               48
+#define GENET_HFB_FILTER_WORDS          128
+#define GENET_HFB_WORD(f, w)            (GENET_HFB_OFF + ((f) * GENET_HFB_FILTER_WORDS + (w)) * 4)
+#define GENET_HFB_NIBBLES(m)            ((m) << 16)
+#define GENET_HFB_CTRL                  0xFC00
+#define GENET_HFB_CTRL_EN               (1 << 0)
+#define GENET_HFB_FLT_ENABLE(f)         (0xFC04 + ((f) < 32) * 4)   // bit f % 32
+#define GENET_HFB_FLT_LEN(f)            (0xFC1C + ((GENET_HFB_FILTERS - 1 - (f)) / 4) * 4)
+#define GENET_HFB_FLT_LEN_SHIFT(f)      (((f) % 4) * 8)
+#define GENET_HFB_FLT_LEN_MASK          0xFFU
+
 /* genet DMA DESC flags */
 #define GENET_DMA_DESC_CNTRL            0x00
 #define GENET_DMA_DESC_ADDR_LSB         0x04
@@ -179,6 +236,7 @@
 
 
 /* genet TDMA DESC flags */
+#define GENET_DMA_TX_DO_CSUM            (1 << 4)
 #define GENET_DMA_DO_CRC                (1 << 5)
 #define GENET_DMA_APPEND_CRC            (1 << 6)
 #define GENET_DMA_FIRST_PKT             (1 << 13)
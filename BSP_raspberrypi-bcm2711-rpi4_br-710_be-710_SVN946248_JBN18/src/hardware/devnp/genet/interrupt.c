@@ -0,0 +1,204 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+#include <io-pkt/iopkt_driver.h>
+#include <atomic.h>
+#include <sys/io-pkt.h>
+
+#include "genet.h"
+
+/*
+ * Called by io-pkt once genet_process_interrupt() is done with every
+ * cause genet_isr0() masked. Anything that latched meanwhile fires again.
+ */
+int genet_intr_enable(void *arg)
+{
+    Genet *genet = arg;
+
+    genet_reg_write(genet, GENET_INTRL2_0_CPU_MASK_CLEAR, GENET_INTRL2_0_WORK);
+    return 1;
+}
+
+/*
+ * Called by io-pkt once rx_process_interrupt() has drained a priority ring.
+ * Frames that arrived while polling have latched the done bit again, so
+ * unmasking is enough to get another interrupt for them.
+ */
+int genet_rxq_enable(void *arg)
+{
+    genet_rxq_t *rxq = arg;
+
+    genet_reg_write(rxq->genet, rxq->intr_mask, rxq->intr_bit);
+    return 1;
+}
+
+int genet_txq_enable(void *arg)
+{
+    genet_txq_t *txq = arg;
+
+    genet_reg_write(txq->genet, txq->intr_mask, txq->intr_bit);
+    return 1;
+}
+
+/*
+ * Priority ring done interrupts. Each pending ring is masked and its
+ * queue's work queued; the queue unmasks itself once it is done.
+ */
+const struct sigevent *
+genet_isr1(void *arg, int iid)
+{
+    Genet *genet;
+    const struct sigevent *evp = NULL, *ev;
+    uint32_t status;
+    uint64_t start;
+    unsigned q;
+    genet = arg;
+    start = genet_perf_start(genet);
+
+    status = (genet_reg_read(genet, GENET_INTRL2_1_CPU_STAT)
+            & ~(genet_reg_read(genet, GENET_INTRL2_1_CPU_MASK_STATUS)) );
+    if (status == 0) {
+        genet_perf_end(genet, &genet->isr1_perf, start, GENET_TRACE_ISR1, status);
+        return NULL;
+    }
+
+    genet_reg_write(genet, GENET_INTRL2_1_CPU_MASK_SET, status);
+    /* clear interrupts */
+    genet_reg_write(genet, GENET_INTRL2_1_CPU_CLEAR, status);
+
+    for (q = 1; q < genet->num_rxq; q++) {
+        if (status & genet->rxq[q].intr_bit) {
+            if ((ev = interrupt_queue(genet->iopkt, &genet->rxq[q].intr)) != NULL) {
+                evp = ev;
+            }
+        }
+    }
+    for (q = 1; q < genet->num_txq; q++) {
+        if (status & genet->txq[q].intr_bit) {
+            if ((ev = interrupt_queue(genet->iopkt, &genet->txq[q].intr)) != NULL) {
+                evp = ev;
+            }
+        }
+    }
+
+    genet_perf_end(genet, &genet->isr1_perf, start, GENET_TRACE_ISR1, status);
+    return evp;
+}
+
+/*
+ * Default ring and link interrupts. Every pending cause is masked and
+ * cleared in one pass and handed to genet_process_interrupt() as a single
+ * event; genet_intr_enable() unmasks them once the work is done.
+ */
+const struct sigevent *
+genet_isr0(void *arg, int iid)
+{
+    Genet *genet;
+    genet_intr_stats_t *st;
+    uint32_t status, work;
+    uint64_t start;
+
+    genet = arg;
+    st = &genet->intr_stats;
+    start = genet_perf_start(genet);
+
+    status = ( genet_reg_read(genet, GENET_INTRL2_0_CPU_STAT)
+            & ~ (genet_reg_read(genet, GENET_INTRL2_0_CPU_MASK_STATUS)) );
+
+    st->interrupts++;
+    if (status == 0) {
+        st->spurious++;
+        genet_perf_end(genet, &genet->isr0_perf, start, GENET_TRACE_ISR0, status);
+        return NULL;
+    }
+
+    work = status & GENET_INTRL2_0_WORK;
+    if (work) {
+        genet_reg_write(genet, GENET_INTRL2_0_CPU_MASK_SET, work);
+    }
+    genet_reg_write(genet, GENET_INTRL2_0_CPU_CLEAR, status);
+
+    if (status & GENET_INTRL2_RX_DONE) {
+        st->rx++;
+    }
+    if (status & GENET_INTRL2_TX_DONE) {
+        st->tx++;
+    }
+    if (status & GENET_INTRL2_0_LINK) {
+        st->link++;
+        genet->link_status = status;
+    }
+    if (status & ~GENET_INTRL2_0_WORK) {
+        /* Unknown recipient, cleared above */
+        st->unknown++;
+        TraceEvent(_NTO_TRACE_INSERTSUSEREVENT, 3, status, status);
+    }
+    if (status & (status - 1)) {
+        st->multi++;
+    }
+
+    genet_perf_end(genet, &genet->isr0_perf, start, GENET_TRACE_ISR0, status);
+    if (work == 0) {
+        return NULL;
+    }
+
+    atomic_set(&genet->irq0_pending, work);
+    return interrupt_queue(genet->iopkt, &genet->intr);
+}
+
+/*
+ * Work for genet_isr0(): link, TX reaping and RX of the default ring in
+ * one io-pkt wakeup. While RX is polling the handler is called again
+ * with nothing new pending, so TX is reaped on those passes as well.
+ */
+int genet_process_interrupt(void *arg, struct nw_work_thread *wtp)
+{
+    Genet *genet = arg;
+    genet_rxq_t *rxq = &genet->rxq[0];
+    unsigned pending;
+
+    pending = atomic_clr_value(&genet->irq0_pending, ~0U);
+    genet->intr_stats.wakeups++;
+
+    if (pending & GENET_INTRL2_0_LINK) {
+        link_process_interrupt(genet, wtp);
+    }
+
+    if (pending & GENET_INTRL2_TX_DONE) {
+        tx_process_interrupt(&genet->txq[0], wtp);
+    } else if (rxq->polling) {
+        genet_tx_reap(&genet->txq[0], wtp);
+    }
+
+    if ((pending & GENET_INTRL2_RX_DONE) || rxq->polling) {
+        if (rx_process_interrupt(rxq, wtp) == 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+#if defined(__QNXNTO__) && defined(__USESRCVERSION)
+#include <sys/srcversion.h>
+__SRCVERSION("$URL$ $Rev$")
+#endif
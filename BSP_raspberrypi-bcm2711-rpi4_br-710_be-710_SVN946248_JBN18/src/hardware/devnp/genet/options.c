@@ -0,0 +1,299 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * Driver options and the configuration derived from them, kept apart from
+ * the io-pkt glue in genet.c so the host simulator runs the same code.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "genet.h"
+
+static char *genet_opts[] = {
+#define GENET_OPT_VERBOSE       0
+    "verbose",
+#define GENET_OPT_ADAPTIVE      1
+    "adaptive",
+#define GENET_OPT_RX_ADAPTIVE   2
+    "rx_adaptive",
+#define GENET_OPT_TX_ADAPTIVE   3
+    "tx_adaptive",
+#define GENET_OPT_RX_USECS      4
+    "rx_usecs",
+#define GENET_OPT_RX_FRAMES     5
+    "rx_frames",
+#define GENET_OPT_TX_FRAMES     6
+    "tx_frames",
+#define GENET_OPT_RX_BUDGET     7
+    "rx_budget",
+#define GENET_OPT_RX_POOL_LOW   8
+    "rx_pool_low",
+#define GENET_OPT_QUEUES        9
+    "queues",
+#define GENET_OPT_RX_QUEUES     10
+    "rx_queues",
+#define GENET_OPT_TX_QUEUES     11
+    "tx_queues",
+#define GENET_OPT_PERF          12
+    "perf",
+#define GENET_OPT_TRACE         13
+    "trace",
+#define GENET_OPT_TX_USECS      14
+    "tx_usecs",
+    NULL
+};
+
+static unsigned genet_opt_value(const char *opt, const char *value, unsigned dflt)
+{
+    if (value == NULL) {
+        GENET_WARNING("Option %s needs a value", opt);
+        return dflt;
+    }
+    return strtoul(value, NULL, 0);
+}
+
+/*
+ * Parse the driver options, e.g.
+ *   io-pkt-v6-hc -d genet adaptive=0,rx_usecs=32,rx_frames=16
+ */
+static int genet_parse_options(Genet *genet, const char *options)
+{
+    char *copy, *str, *value;
+    int opt;
+
+    if (options == NULL || *options == '\0') {
+        return EOK;
+    }
+
+    /* getsubopt() modifies the string */
+    copy = (strdup)(options);
+    if (copy == NULL) {
+        return ENOMEM;
+    }
+
+    str = copy;
+    while (*str != '\0') {
+        opt = getsubopt(&str, genet_opts, &value);
+        switch (opt) {
+            case GENET_OPT_VERBOSE:
+                genet->cfg.verbose = value ? strtoul(value, NULL, 0) : 1;
+                break;
+            case GENET_OPT_ADAPTIVE:
+                genet->rx_adaptive = genet->tx_adaptive =
+                        genet_opt_value(genet_opts[opt], value, 1) != 0;
+                break;
+            case GENET_OPT_RX_ADAPTIVE:
+                genet->rx_adaptive = genet_opt_value(genet_opts[opt], value, 1) != 0;
+                break;
+            case GENET_OPT_TX_ADAPTIVE:
+                genet->tx_adaptive = genet_opt_value(genet_opts[opt], value, 1) != 0;
+                break;
+            case GENET_OPT_RX_USECS:
+                genet->rx_coal.usecs = genet_opt_value(genet_opts[opt], value, GENET_DEFAULT_RX_USECS);
+                break;
+            case GENET_OPT_RX_FRAMES:
+                genet->rx_coal.frames = genet_opt_value(genet_opts[opt], value, GENET_DEFAULT_RX_FRAMES);
+                break;
+            case GENET_OPT_TX_FRAMES:
+                genet->tx_coal.frames = genet_opt_value(genet_opts[opt], value, GENET_DEFAULT_TX_FRAMES);
+                break;
+            case GENET_OPT_TX_USECS:
+                genet->tx_coal.usecs = genet_opt_value(genet_opts[opt], value, GENET_DEFAULT_TX_USECS);
+                break;
+            case GENET_OPT_RX_BUDGET:
+                genet->rx_budget = genet_opt_value(genet_opts[opt], value, GENET_DEFAULT_RX_BUDGET);
+                break;
+            case GENET_OPT_RX_POOL_LOW:
+                genet->rx_pool_low = genet_opt_value(genet_opts[opt], value, GENET_RX_POOL_LOW);
+                break;
+            case GENET_OPT_QUEUES:
+                genet->num_rxq = genet->num_txq = genet_opt_value(genet_opts[opt], value, 1);
+                break;
+            case GENET_OPT_RX_QUEUES:
+                genet->num_rxq = genet_opt_value(genet_opts[opt], value, 1);
+                break;
+            case GENET_OPT_TX_QUEUES:
+                genet->num_txq = genet_opt_value(genet_opts[opt], value, 1);
+                break;
+            case GENET_OPT_PERF:
+                genet->perf = genet_opt_value(genet_opts[opt], value, 1) != 0;
+                break;
+            case GENET_OPT_TRACE:
+                genet->trace = genet_opt_value(genet_opts[opt], value, 1) != 0;
+                break;
+            default:
+                /* generic io-pkt options are handled by the stack */
+                break;
+        }
+    }
+
+    (free)(copy);
+
+    /* Keep the thresholds within the ring and never strand RX or TX frames */
+    if (genet->rx_coal.frames == 0) {
+        genet->rx_coal.frames = 1;
+    } else if (genet->rx_coal.frames > GENET_RING_SIZE_MAX / 2) {
+        genet->rx_coal.frames = GENET_RING_SIZE_MAX / 2;
+    }
+    if (genet->tx_coal.frames == 0) {
+        genet->tx_coal.frames = 1;
+    } else if (genet->tx_coal.frames > GENET_RING_SIZE_MAX / 2) {
+        genet->tx_coal.frames = GENET_RING_SIZE_MAX / 2;
+    }
+    if (genet->rx_pool_low > GENET_RX_POOL_SIZE) {
+        genet->rx_pool_low = GENET_RX_POOL_SIZE;
+    }
+    if (genet->num_rxq == 0 || genet->num_rxq > GENET_MAX_QUEUES) {
+        GENET_WARNING("rx_queues must be 1 to %d", GENET_MAX_QUEUES);
+        genet->num_rxq = 1;
+    }
+    if (genet->num_txq == 0 || genet->num_txq > GENET_MAX_QUEUES) {
+        GENET_WARNING("tx_queues must be 1 to %d", GENET_MAX_QUEUES);
+        genet->num_txq = 1;
+    }
+    if (genet->rx_budget == 0 || genet->rx_budget > GENET_RING_SIZE_MAX) {
+        genet->rx_budget = GENET_DEFAULT_RX_BUDGET;
+    }
+    if (genet->trace) {
+        /* Trace events carry the stage's cycle count */
+        genet->perf = 1;
+    }
+    if (genet->rx_coal.frames > 1 && genet->rx_coal.usecs == 0) {
+        GENET_WARNING("rx_frames=%u without rx_usecs, using %u us",
+                genet->rx_coal.frames, genet_dim_profiles[1].usecs);
+        genet->rx_coal.usecs = genet_dim_profiles[1].usecs;
+    }
+    if (genet->tx_coal.frames > 1 && genet->tx_coal.usecs == 0) {
+        GENET_WARNING("tx_frames=%u without tx_usecs, using %u us",
+                genet->tx_coal.frames, genet_dim_profiles[1].usecs);
+        genet->tx_coal.usecs = genet_dim_profiles[1].usecs;
+    }
+
+    return EOK;
+}
+
+/*
+ * Attach time configuration: the defaults, the options on top of them and
+ * the coalescing profile the rings start from.
+ */
+int genet_config(Genet *genet, const char *options)
+{
+    int err;
+
+    /* Coalescing defaults, adaptive on both rings */
+    genet->rx_adaptive = 1;
+    genet->tx_adaptive = 1;
+    genet->rx_coal.usecs = GENET_DEFAULT_RX_USECS;
+    genet->rx_coal.frames = GENET_DEFAULT_RX_FRAMES;
+    genet->tx_coal.usecs = GENET_DEFAULT_TX_USECS;
+    genet->tx_coal.frames = GENET_DEFAULT_TX_FRAMES;
+    genet->rx_budget = GENET_DEFAULT_RX_BUDGET;
+    genet->rx_pool_low = GENET_RX_POOL_LOW;
+    genet->num_rxq = 1;
+    genet->num_txq = 1;
+    genet->perf = 0;
+
+    if ((err = genet_parse_options(genet, options)) != EOK) {
+        return err;
+    }
+
+    /* Adaptive rings start from the lowest latency profile */
+    genet_dim_init(&genet->rx_dim, 0);
+    genet_dim_init(&genet->tx_dim, 0);
+    if (genet->rx_adaptive) {
+        genet->rx_coal = genet_dim_profiles[genet->rx_dim.profile];
+    }
+    if (genet->tx_adaptive) {
+        genet->tx_coal = genet_dim_profiles[genet->tx_dim.profile];
+    }
+    genet->coal_stats.rx_adaptive = genet->rx_adaptive;
+    genet->coal_stats.tx_adaptive = genet->tx_adaptive;
+    genet->coal_stats.rx_budget = genet->rx_budget;
+
+    return EOK;
+}
+
+/*
+ * Split the descriptors between the queues. Queue 0 is the default ring,
+ * queue n > 0 is priority ring n - 1.
+ */
+void genet_queues_init(Genet *genet)
+{
+    unsigned i, base, size;
+
+    for (i = 0; i < genet->num_txq; i++) {
+        genet_txq_t *txq = &genet->txq[i];
+
+        txq->genet = genet;
+        txq->index = i;
+        txq->free_idx = 0;
+        txq->prod_idx = 0;
+        txq->full = 0;
+        if (i == 0) {
+            txq->ring = GENET_DEFAULT_RING;
+            base = genet->num_txq > 1 ? GENET_RING_SIZE_MAX - GENET_MQ_DEFAULT_SIZE : 0;
+            size = genet->num_txq > 1 ? GENET_MQ_DEFAULT_SIZE : GENET_RING_SIZE_MAX;
+            txq->intr_mask = GENET_INTRL2_0_CPU_MASK_CLEAR;
+            txq->intr_bit = GENET_INTRL2_TX_DONE;
+        } else {
+            txq->ring = i - 1;
+            base = txq->ring * GENET_PRIO_RING_SIZE;
+            size = GENET_PRIO_RING_SIZE;
+            txq->intr_mask = GENET_INTRL2_1_CPU_MASK_CLEAR;
+            txq->intr_bit = GENET_INTRL2_1_TX_RING(txq->ring);
+        }
+        txq->d = &genet->tx_d[base];
+        txq->size = size;
+    }
+
+    for (i = 0; i < genet->num_rxq; i++) {
+        genet_rxq_t *rxq = &genet->rxq[i];
+
+        rxq->genet = genet;
+        rxq->index = i;
+        rxq->drops = 0;
+        rxq->polling = 0;
+        if (i == 0) {
+            rxq->ring = GENET_DEFAULT_RING;
+            base = genet->num_rxq > 1 ? GENET_RING_SIZE_MAX - GENET_MQ_DEFAULT_SIZE : 0;
+            size = genet->num_rxq > 1 ? GENET_MQ_DEFAULT_SIZE : GENET_RING_SIZE_MAX;
+            rxq->intr_mask = GENET_INTRL2_0_CPU_MASK_CLEAR;
+            rxq->intr_bit = GENET_INTRL2_RX_DONE;
+        } else {
+            rxq->ring = i - 1;
+            base = rxq->ring * GENET_PRIO_RING_SIZE;
+            size = GENET_PRIO_RING_SIZE;
+            rxq->intr_mask = GENET_INTRL2_1_CPU_MASK_CLEAR;
+            rxq->intr_bit = GENET_INTRL2_1_RX_RING(rxq->ring);
+        }
+        rxq->d = &genet->rx_d[base];
+        rxq->size = size;
+        rxq->pool_stats.size = GENET_RX_POOL_SIZE;
+        rxq->pool_stats.low_watermark = genet->rx_pool_low;
+    }
+}
+
+
+#if defined(__QNXNTO__) && defined(__USESRCVERSION)
+#include <sys/srcversion.h>
+__SRCVERSION("$URL$ $Rev$")
+#endif
@@ -0,0 +1,171 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * genet_stats.h   SIOCGDRVSPEC statistics of devnp-genet
+ *
+ * Passed with struct ifdrv, ifd_name the interface, ifd_cmd one of the
+ * commands below and ifd_len the exact size of the returned structure.
+ */
+
+#ifndef __GENET_STATS_H_INCLUDED
+#define __GENET_STATS_H_INCLUDED
+
+#include <stdint.h>
+
+/* Default ring and four priority rings */
+#define GENET_MAX_QUEUES        5
+
+/* SIOCGDRVSPEC commands */
+#define GENET_GET_COAL_STATS    0x6e01
+#define GENET_GET_RX_POOL_STATS 0x6e02  // genet_rx_pool_stats_t[GENET_MAX_QUEUES]
+#define GENET_GET_QUEUE_STATS   0x6e03
+#define GENET_GET_INTR_STATS    0x6e04
+#define GENET_GET_PERF_STATS    0x6e05
+#define GENET_CLR_PERF_STATS    0x6e06  // SIOCSDRVSPEC, no data
+
+/* Interrupt coalescing state of queue 0, returned by GENET_GET_COAL_STATS */
+typedef struct genet_coal_stats_t
+{
+    uint32_t    rx_adaptive;
+    uint32_t    tx_adaptive;
+    uint32_t    rx_usecs;       /* current RX ring timeout */
+    uint32_t    rx_frames;      /* current RX frame threshold */
+    uint32_t    tx_frames;      /* current TX frame threshold */
+    uint32_t    tx_usecs;       /* current genet_tx_flush() period */
+    uint32_t    rx_changes;     /* adaptive profile switches */
+    uint32_t    tx_changes;
+    uint32_t    rx_interrupts;
+    uint32_t    tx_interrupts;
+    uint32_t    rx_packets;
+    uint32_t    tx_packets;
+    uint64_t    rx_bytes;
+    uint64_t    tx_bytes;
+    uint32_t    rx_budget;
+    uint32_t    rx_polls;       /* rx_process_interrupt() calls */
+    uint32_t    rx_budget_exhausted; /* polls that left work behind */
+} genet_coal_stats_t;
+
+/* Per queue counters */
+typedef struct genet_q_stats_t
+{
+    uint64_t    bytes;
+    uint32_t    packets;
+    uint32_t    broadcast;
+    uint32_t    multicast;
+    uint32_t    interrupts;
+    uint32_t    polls;          /* RX only, work handler calls */
+    uint32_t    budget_exhausted; /* RX only, polls that left work behind */
+    uint32_t    ring_full;      /* TX only, genet_start() stalls */
+    uint32_t    restarts;       /* TX only, restarts after a stall */
+    uint32_t    csum;           /* TX checksums offloaded, RX checksums verified */
+    uint32_t    csum_bad;       /* RX only, TCP/UDP checksum failures */
+    uint32_t    gso;            /* TX only, TSO sends segmented by the driver */
+    uint32_t    gso_segs;       /* TX only, frames those sends were cut into */
+    uint32_t    zc_segs;        /* TX only, mbufs handed to the DMA without a copy */
+    uint32_t    hdr_frames;     /* TX only, frames with leading mbufs copied to tx_hdr */
+    uint64_t    hdr_bytes;      /* TX only, bytes copied for those */
+    uint32_t    too_long;       /* TX only, chains longer than any ring, dropped */
+    uint32_t    held;           /* TX only, frames held for a full ring while others went */
+} genet_q_stats_t;
+
+/* Returned by GENET_GET_QUEUE_STATS */
+typedef struct genet_queue_stats_t
+{
+    uint32_t        rx_queues;
+    uint32_t        tx_queues;
+    genet_q_stats_t rx[GENET_MAX_QUEUES];
+    genet_q_stats_t tx[GENET_MAX_QUEUES];
+} genet_queue_stats_t;
+
+/* INTRL2_0 interrupt counters, returned by GENET_GET_INTR_STATS */
+typedef struct genet_intr_stats_t
+{
+    uint32_t    interrupts;     /* genet_isr0() calls */
+    uint32_t    spurious;       /* nothing pending */
+    uint32_t    rx;             /* per cause, one interrupt may count several */
+    uint32_t    tx;
+    uint32_t    link;
+    uint32_t    unknown;
+    uint32_t    multi;          /* interrupts carrying more than one cause */
+    uint32_t    wakeups;        /* genet_process_interrupt() calls */
+} genet_intr_stats_t;
+
+/* RX buffer pool counters */
+typedef struct genet_rx_pool_stats_t
+{
+    uint32_t    size;
+    uint32_t    low_watermark;
+    uint32_t    count;          /* buffers currently in the pool */
+    uint32_t    refills;        /* batched refills run */
+    uint32_t    refilled;       /* buffers added by refills */
+    uint32_t    low_hits;       /* refills triggered by the low watermark */
+    uint32_t    alloc_failed;   /* cluster allocations that failed */
+    uint32_t    exhausted;      /* frames dropped with the pool empty */
+} genet_rx_pool_stats_t;
+
+/*
+ * Stage timing, in ClockCycles() units. Each counter block is written by
+ * one thread only: the ISR, or the io-pkt thread running that queue's
+ * work (io-pkt never runs one entry on two threads at once), or
+ * genet_start() under if_snd_ex. So no atomics are needed.
+ */
+typedef struct genet_stage_t
+{
+    uint32_t    calls;
+    uint32_t    max_cycles;
+    uint64_t    cycles;
+} genet_stage_t;
+
+#define GENET_PERF_HIST         8   /* buckets 0, 1, 2-3, 4-7, ... 64+ */
+
+typedef struct genet_rxq_perf_t
+{
+    genet_stage_t   poll;           /* rx_process_interrupt() */
+    uint32_t        frames[GENET_PERF_HIST]; /* frames per poll */
+    uint32_t        occ_max;        /* filled descriptors at poll start */
+    uint64_t        occ_sum;        /* divide by poll.calls */
+} genet_rxq_perf_t;
+
+typedef struct genet_txq_perf_t
+{
+    genet_stage_t   tx;             /* genet_tx(), per frame */
+    genet_stage_t   reap;           /* genet_tx_reap() with work to do */
+    uint32_t        reaped[GENET_PERF_HIST]; /* descriptors per reap */
+    uint32_t        occ_max;        /* descriptors in flight after a send */
+    uint64_t        occ_sum;        /* divide by tx.calls */
+} genet_txq_perf_t;
+
+/* Returned by GENET_GET_PERF_STATS */
+typedef struct genet_perf_stats_t
+{
+    uint64_t            timestamp;      /* ClockCycles() when read */
+    uint64_t            cycles_per_sec;
+    uint32_t            enabled;        /* perf option */
+    uint32_t            rx_queues;
+    uint32_t            tx_queues;
+    genet_stage_t       isr0;
+    genet_stage_t       isr1;
+    genet_rxq_perf_t    rx[GENET_MAX_QUEUES];
+    genet_txq_perf_t    tx[GENET_MAX_QUEUES];
+} genet_perf_stats_t;
+
+#endif
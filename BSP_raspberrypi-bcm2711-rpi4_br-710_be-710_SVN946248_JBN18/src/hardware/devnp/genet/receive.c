@@ -21,128 +21,400 @@
 
 #include "genet.h"
 #include    "bpfilter.h"
+#include <netinet/in.h>
 #if NBPFILTER > 0
 #include <net/bpf.h>
 #include <net/bpfdesc.h>
 #endif
 
+static void rx_desc_set_buf(Desc *const rxdesc, struct mbuf *m, off64_t phys)
+{
+    rxdesc->mb = m;
+
+    // Now assign the newly allocated buffer, the MSB rarely changes
+    out32(rxdesc->desc + GENET_DMA_DESC_ADDR_LSB, phys);
+    if (rxdesc->addr_hi != (uint32_t)(phys >> 32)) {
+        rxdesc->addr_hi = phys >> 32;
+        out32(rxdesc->desc + GENET_DMA_DESC_ADDR_MSB, rxdesc->addr_hi);
+    }
+}
+
 void genet_add_pkt_to_rx_desc(Genet *genet, struct mbuf *m, Desc *const rxdesc)
 {
     off64_t phys;
 
-    rxdesc->mb = m;
     phys = pool_phys(m->m_data, m->m_ext.ext_page);
 
     CACHE_INVAL(&genet->cachectl, m->m_data, phys, m->m_ext.ext_size);
 
-    // Now assign the newly allocated buffer
-    out32(rxdesc->desc + GENET_DMA_DESC_ADDR_LSB, phys);
-    out32(rxdesc->desc + GENET_DMA_DESC_ADDR_MSB, phys >> 32);
+    rxdesc->addr_hi = ~0;
+    rx_desc_set_buf(rxdesc, m, phys);
+}
+
+/*
+ * Top a queue's RX buffer pool back up. Buffers are invalidated here, in
+ * one batch away from the per-frame path, and are not touched by the CPU
+ * again until the hardware has filled them.
+ *
+ * The pool is only used by the queue's RX work handler, which io-pkt
+ * never runs on two threads at once, and by attach/cleanup.
+ */
+unsigned genet_rx_pool_refill(genet_rxq_t *rxq, struct nw_work_thread *wtp)
+{
+    Genet *genet = rxq->genet;
+    unsigned added = 0;
+    struct mbuf *m;
+    off64_t phys;
+
+    rxq->pool_stats.refills++;
+
+    while (rxq->pool_cnt < GENET_RX_POOL_SIZE) {
+        m = m_getcl_wtp(M_DONTWAIT, MT_DATA, M_PKTHDR, wtp);
+        if (m == NULL) {
+            rxq->pool_stats.alloc_failed++;
+            break;
+        }
+
+        phys = pool_phys(m->m_data, m->m_ext.ext_page);
+        CACHE_INVAL(&genet->cachectl, m->m_data, phys, m->m_ext.ext_size);
+
+        rxq->pool[rxq->pool_cnt].m = m;
+        rxq->pool[rxq->pool_cnt].phys = phys;
+        rxq->pool_cnt++;
+        added++;
+    }
+
+    rxq->pool_stats.refilled += added;
+    rxq->pool_stats.count = rxq->pool_cnt;
+
+    return added;
+}
+
+void genet_rx_pool_fini(genet_rxq_t *rxq)
+{
+    while (rxq->pool_cnt) {
+        m_freem(rxq->pool[--rxq->pool_cnt].m);
+    }
+    rxq->pool_stats.count = 0;
 }
 
-static unsigned rx_producer_index(Genet *genet, struct ifnet *ifp) {
-    uint32_t r_pidx = genet_reg_read(genet, GENET_RDMA_PRODUCER_INDEX);
+static unsigned rx_producer_index(genet_rxq_t *rxq, struct ifnet *ifp) {
+    Genet *genet = rxq->genet;
+    uint32_t r_pidx = genet_reg_read(genet, GENET_RING_REG(GENET_RDMA_PRODUCER_INDEX, rxq->ring));
     unsigned discards = r_pidx >> 16; // upper 16-bits are running discard count
 
-    if (genet->drops != discards) {
-        ifp->if_iqdrops += discards - genet->drops;
+    if (rxq->drops != discards) {
+        ifp->if_iqdrops += discards - rxq->drops;
         if (discards >= 0xf000) {
             discards = 0;
 
             // discards saturate at 0xffff; clear upper 16-bits
-            genet_reg_write(genet, GENET_RDMA_PRODUCER_INDEX, discards);
+            genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_PRODUCER_INDEX, rxq->ring), discards);
         }
-        genet->drops = discards;
+        rxq->drops = discards;
     }
 
     return (uint16_t) r_pidx;
 }
 
-int rx_process_interrupt(void *arg, struct nw_work_thread *wtp)
+/*
+ * Check a TCP/UDP checksum from the sum the RBUF left in the status block.
+ * The hardware sums everything past the Ethernet header, so for IPv4 a
+ * valid IP header adds nothing (ip_input() checks it) and the pseudo
+ * header is added. For IPv6 the fixed header already holds the pseudo
+ * header's addresses and length; only the other words are taken out and
+ * the next header added.
+ * Only untagged, unfragmented, unpadded frames are marked; anything else
+ * is left to the stack.
+ */
+static void rx_csum(genet_rxq_t *rxq, struct mbuf *m, uint32_t sb_csum, unsigned len)
 {
-    Genet           *genet = arg;
-    struct ifnet    *ifp = &genet->sc_ec.ec_if;
-    uint32_t        dma_status;
-    uint16_t        r_cidx;
-
-    r_cidx = genet_reg_read(genet, GENET_RDMA_CONSUMER_INDEX);
-    while (r_cidx != rx_producer_index(genet, ifp)) {
-        Desc *const rxdesc = &genet->rx_d[r_cidx % GENET_RING_SIZE_MAX];
-        struct mbuf *m, *m_toStack;
-        uint32_t desc_cntrl;
-        uint8_t *dptr;
-        off64_t phys;
-        unsigned len;
-
-        desc_cntrl = in32(rxdesc->desc + GENET_DMA_DESC_CNTRL);
-
-        if ((desc_cntrl & (GENET_DMA_FIRST_PKT | GENET_DMA_LAST_PKT))
-                 != (GENET_DMA_FIRST_PKT | GENET_DMA_LAST_PKT)) {
-            GENET_ERROR("Skipping fragmented packet %x", desc_cntrl);
-            ifp->if_ierrors++;
-            goto next;
+    const uint8_t *ip = mtod(m, const uint8_t *) + ETHER_HDR_LEN;
+    const uint8_t *eh = mtod(m, const uint8_t *);
+    uint32_t sum = sb_csum & GENET_SB_RX_CSUM_MASK;
+    unsigned proto;
+    int v6;
+
+    if (len < ETHER_HDR_LEN + 40) {
+        return;
+    }
+    len -= ETHER_HDR_LEN;
+
+    switch ((eh[12] << 8) | eh[13]) {
+    case ETHERTYPE_IP:
+        // whole datagrams only, fragments are checked after reassembly
+        if ((ip[0] >> 4) != 4 || ((ip[6] & 0x3F) | ip[7]) != 0) {
+            return;
+        }
+        if (((ip[2] << 8) | ip[3]) != len) {
+            return;
         }
+        proto = ip[9];
+        sum = genet_csum_add(sum, ip + 12, 8) + proto + len - ((ip[0] & 0xF) << 2);
+        v6 = 0;
+        break;
 
-        dma_status = desc_cntrl & 0xFFFF;
-        if (dma_status & (GENET_DMA_RX_CRC_ERR    | GENET_DMA_RX_LENGTH_ERR
-                         | GENET_DMA_RX_FRAME_ERR | GENET_DMA_RX_OVERRUN_ERR
-                         | GENET_DMA_RX_RXERR)) {
-            GENET_ERROR("RX packet status %x", dma_status);
-            ifp->if_ierrors++;
-            goto next;
+    case ETHERTYPE_IPV6:
+        if ((ip[0] >> 4) != 6 || ((ip[4] << 8) | ip[5]) + 40 != len) {
+            return;
         }
+        proto = ip[6];
+        // remove version/class/flow and next header/hop limit, keep the payload length
+        sum += (~((ip[0] << 8) | ip[1]) & 0xFFFF) + (~((ip[2] << 8) | ip[3]) & 0xFFFF);
+        sum += (~((ip[6] << 8) | ip[7]) & 0xFFFF) + proto;
+        v6 = 1;
+        break;
 
-        len = desc_cntrl >> GENET_DMA_BUFLEN_SHIFT;
+    default:
+        return;
+    }
 
-        m_toStack = rxdesc->mb;
-        m_toStack->m_pkthdr.len = m_toStack->m_len  = len;
-        m_toStack->m_pkthdr.rcvif = ifp; // ip_input() needs this
+    if (proto != IPPROTO_TCP && proto != IPPROTO_UDP) {
+        return;
+    }
 
-        phys = pool_phys(m_toStack->m_data, m_toStack->m_ext.ext_page);
-        CACHE_INVAL(&genet->cachectl, m_toStack->m_data, phys, len);
+    if (genet_csum_fold(sum) == 0xFFFF) {
+        rxq->stats.csum++;
+    } else {
+        rxq->stats.csum_bad++;
+        m->m_pkthdr.csum_flags |= M_CSUM_TCP_UDP_BAD;
+    }
 
-        genet->stats.octets_rxed_ok += len;
-        genet->stats.rxed_ok++;
-        ifp->if_ipackets++;
+    if (proto == IPPROTO_TCP) {
+        m->m_pkthdr.csum_flags |= v6 ? M_CSUM_TCPv6 : M_CSUM_TCPv4;
+    } else {
+        m->m_pkthdr.csum_flags |= v6 ? M_CSUM_UDPv6 : M_CSUM_UDPv4;
+    }
+}
 
-        dptr = mtod (m_toStack, uint8_t *);
-        if (dptr[0] & 1) {
-            if (IS_BROADCAST (dptr))
-                genet->stats.rxed_broadcast++;
-            else
-                genet->stats.rxed_multicast++;
-        }
+/*
+ * Hand one completed descriptor to the stack and refill it from the pool.
+ * The replacement is taken before the frame goes up: if there is none
+ * the frame is dropped and its buffer stays on the descriptor, so the
+ * ring never has a hole.
+ */
+static void rx_frame(genet_rxq_t *rxq, struct ifnet *ifp, Desc *const rxdesc,
+        struct nw_work_thread *wtp)
+{
+    Genet *genet = rxq->genet;
+    struct mbuf *m_toStack;
+    genet_rxbuf_t *buf;
+    uint32_t desc_cntrl, dma_status, sb_csum;
+    uint8_t *dptr;
+    off64_t phys;
+    unsigned len;
+
+    desc_cntrl = in32(rxdesc->desc + GENET_DMA_DESC_CNTRL);
+
+    if ((desc_cntrl & (GENET_DMA_FIRST_PKT | GENET_DMA_LAST_PKT))
+             != (GENET_DMA_FIRST_PKT | GENET_DMA_LAST_PKT)) {
+        GENET_ERROR("Skipping fragmented packet %x", desc_cntrl);
+        ifp->if_ierrors++;
+        return;
+    }
+
+    dma_status = desc_cntrl & 0xFFFF;
+    if (dma_status & (GENET_DMA_RX_CRC_ERR    | GENET_DMA_RX_LENGTH_ERR
+                     | GENET_DMA_RX_FRAME_ERR | GENET_DMA_RX_OVERRUN_ERR
+                     | GENET_DMA_RX_RXERR)) {
+        GENET_ERROR("RX packet status %x", dma_status);
+        ifp->if_ierrors++;
+        return;
+    }
+
+    len = desc_cntrl >> GENET_DMA_BUFLEN_SHIFT;
+    if (len < GENET_SB_SIZE + GENET_SB_RX_ALIGN + ETHER_HDR_LEN) {
+        ifp->if_ierrors++;
+        return;
+    }
+
+    if (rxq->pool_cnt == 0 && genet_rx_pool_refill(rxq, wtp) == 0) {
+        rxq->pool_stats.exhausted++;
+        ifp->if_iqdrops++;
+        return;
+    }
+
+    m_toStack = rxdesc->mb;
+
+    phys = pool_phys(m_toStack->m_data, m_toStack->m_ext.ext_page);
+    CACHE_INVAL(&genet->cachectl, m_toStack->m_data, phys, len);
+
+    // the length covers the status block and the 2 alignment bytes
+    memcpy(&sb_csum, mtod(m_toStack, uint8_t *) + GENET_SB_RX_CSUM, sizeof(sb_csum));
+    m_toStack->m_data += GENET_SB_SIZE + GENET_SB_RX_ALIGN;
+    len -= GENET_SB_SIZE + GENET_SB_RX_ALIGN;
+
+    m_toStack->m_pkthdr.len = m_toStack->m_len  = len;
+    m_toStack->m_pkthdr.rcvif = ifp; // ip_input() needs this
+    m_toStack->m_pkthdr.csum_flags = 0;
+    rx_csum(rxq, m_toStack, sb_csum, len);
+
+    rxq->stats.bytes += len;
+    rxq->stats.packets++;
+    ifp->if_ipackets++;
+
+    dptr = mtod (m_toStack, uint8_t *);
+    if (dptr[0] & 1) {
+        if (IS_BROADCAST (dptr))
+            rxq->stats.broadcast++;
+        else
+            rxq->stats.multicast++;
+    }
 
 #if NBPFILTER > 0
-        /* Pass this up to any BPF listeners. */
-        if (ifp->if_bpf) {
-            bpf_mtap(ifp->if_bpf, m_toStack);
-        }
+    /* Pass this up to any BPF listeners. */
+    if (ifp->if_bpf) {
+        bpf_mtap(ifp->if_bpf, m_toStack);
+    }
 #endif
 
-        /* Pass this up to the io-pkt stack. */
-        ifp->if_input(ifp, m_toStack);
+    /* Pass this up to the io-pkt stack. */
+    ifp->if_input(ifp, m_toStack);
 
-        /* Get the new buf to replace the current descriptor */
-        m = m_getcl_wtp(M_DONTWAIT, MT_DATA, M_PKTHDR, wtp);
+    /* Replace the current descriptor's buffer from the pool */
+    buf = &rxq->pool[--rxq->pool_cnt];
+    rx_desc_set_buf(rxdesc, buf->m, buf->phys);
+}
 
-        if (!m) {
-            GENET_ERROR("RX mbuf allocation failed");
-            genet->stats.rx_failed_allocs++;
-            ifp->if_ierrors++;
+/*
+ * Budgeted RX poll of one queue. The producer index is read once per
+ * batch and the consumer index written once per batch rather than per
+ * frame, as each access is a round trip over the peripheral bus.
+ *
+ * The queue's RX done bit is masked by the ISR. If the budget runs out
+ * the ring may still hold frames, so return 0 and io-pkt calls us again
+ * without unmasking; once the ring is empty return 1 and
+ * genet_rxq_enable() unmasks it.
+ */
+int rx_process_interrupt(void *arg, struct nw_work_thread *wtp)
+{
+    genet_rxq_t     *rxq = arg;
+    Genet           *genet = rxq->genet;
+    struct ifnet    *ifp = &genet->sc_ec.ec_if;
+    unsigned        budget = genet->rx_budget;
+    unsigned        done = 0;
+    uint16_t        r_cidx, avail;
+    const uint64_t  start = genet_perf_start(genet);
+
+    if (!rxq->polling) {
+        rxq->stats.interrupts++;
+    }
+    rxq->stats.polls++;
+
+    // r_cidx updated only by this queue's rx-interrupt
+    r_cidx = genet_reg_read(genet, GENET_RING_REG(GENET_RDMA_CONSUMER_INDEX, rxq->ring));
+
+    while (done < budget) {
+        avail = rx_producer_index(rxq, ifp) - r_cidx;
+        if (done == 0 && genet->perf) {
+            rxq->perf.occ_sum += avail;
+            if (avail > rxq->perf.occ_max) {
+                rxq->perf.occ_max = avail;
+            }
+        }
+        if (avail == 0) {
             break;
         }
+        if (avail > budget - done) {
+            avail = budget - done;
+        }
 
-        genet_add_pkt_to_rx_desc(genet, m, rxdesc);
+        for (; avail; avail--) {
+            rx_frame(rxq, ifp, &rxq->d[r_cidx++ & (rxq->size - 1)], wtp);
+            done++;
+        }
 
-next: // done the packet processing and update the hadware
-        //Increment RDMA consumer index
-        genet_reg_write(genet, GENET_RDMA_CONSUMER_INDEX, ++r_cidx); // r_cidx updated only by rx-interrupt
+        // done the batch, update the hardware
+        genet_reg_write(genet, GENET_RING_REG(GENET_RDMA_CONSUMER_INDEX, rxq->ring), r_cidx);
+
+        if (rxq->pool_cnt < rxq->pool_stats.low_watermark) {
+            rxq->pool_stats.low_hits++;
+            genet_rx_pool_refill(rxq, wtp);
+        }
+    }
+    rxq->pool_stats.count = rxq->pool_cnt;
+
+    if (genet->perf) {
+        rxq->perf.frames[genet_perf_bucket(done)]++;
+    }
+    genet_perf_end(genet, &rxq->perf.poll, start, GENET_TRACE_RX(rxq->index), done);
+
+    if (done == budget) {
+        rxq->polling = 1;
+        rxq->stats.budget_exhausted++;
+        return 0;
+    }
+
+    rxq->polling = 0;
+    if (rxq->index == 0) {
+        genet_rx_coal_update(genet);
     }
 
     return 1;
 }
 
+/* One HFB filter on the Ethertype word and the priority nibble after it */
+static void genet_rx_filter_set(Genet *genet, unsigned f, uint16_t type, uint32_t word7, unsigned ring)
+{
+    const unsigned shift = GENET_RDMA_INDEX2RING_SHIFT(f);
+    uint32_t reg;
+    unsigned w;
+
+    for (w = 0; w < 6; w++) {
+        genet_reg_write(genet, GENET_HFB_WORD(f, w), 0);
+    }
+    genet_reg_write(genet, GENET_HFB_WORD(f, 6), GENET_HFB_NIBBLES(0xF) | type);
+    genet_reg_write(genet, GENET_HFB_WORD(f, 7), word7);
+
+    // twice the 16 bytes the words cover, as Linux programs it; extra words are masked out
+    reg = genet_reg_read(genet, GENET_HFB_FLT_LEN(f));
+    reg &= ~(GENET_HFB_FLT_LEN_MASK << GENET_HFB_FLT_LEN_SHIFT(f));
+    reg |= (2 * 16) << GENET_HFB_FLT_LEN_SHIFT(f);
+    genet_reg_write(genet, GENET_HFB_FLT_LEN(f), reg);
+
+    reg = genet_reg_read(genet, GENET_RDMA_INDEX2RING(f));
+    reg &= ~(GENET_RDMA_INDEX2RING_MASK << shift);
+    reg |= (ring + 1) << shift;
+    genet_reg_write(genet, GENET_RDMA_INDEX2RING(f), reg);
+
+    reg = genet_reg_read(genet, GENET_HFB_FLT_ENABLE(f));
+    genet_reg_write(genet, GENET_HFB_FLT_ENABLE(f), reg | 1U << (f % 32));
+}
+
+/*
+ * Steer received frames to the priority rings the way genet_start()
+ * picks TX rings: VLAN PCP, IPv4 precedence or IPv6 traffic class
+ * precedence 2-7 go to the priority queues, everything else to the
+ * default ring. The filters compare whole nibbles, so each priority
+ * takes two filters per frame type, one per value of the bit after it.
+ */
+void genet_rx_filters_init(Genet *genet)
+{
+    const unsigned nprio = genet->num_rxq - 1;
+    unsigned prio, low, nib, ring, f = 0;
+
+    genet_reg_write(genet, GENET_HFB_CTRL, 0);
+    genet_reg_write(genet, GENET_HFB_FLT_ENABLE(0), 0);
+    genet_reg_write(genet, GENET_HFB_FLT_ENABLE(32), 0);
+    if (nprio == 0) {
+        return;
+    }
+
+    for (prio = 2; prio < 8; prio++) {
+        ring = genet->rxq[genet_prio_queue(prio, nprio)].ring;
+        for (low = 0; low < 2; low++) {
+            nib = prio << 1 | low;
+            genet_rx_filter_set(genet, f++, ETHERTYPE_VLAN,
+                    GENET_HFB_NIBBLES(0x8) | nib << 12, ring);
+            genet_rx_filter_set(genet, f++, ETHERTYPE_IP,
+                    GENET_HFB_NIBBLES(0xA) | 4 << 12 | nib << 4, ring);
+            genet_rx_filter_set(genet, f++, ETHERTYPE_IPV6,
+                    GENET_HFB_NIBBLES(0xC) | 6 << 12 | nib << 8, ring);
+        }
+    }
+
+    genet_reg_write(genet, GENET_HFB_CTRL, GENET_HFB_CTRL_EN);
+}
 
 #if defined(__QNXNTO__) && defined(__USESRCVERSION)
 #include <sys/srcversion.h>
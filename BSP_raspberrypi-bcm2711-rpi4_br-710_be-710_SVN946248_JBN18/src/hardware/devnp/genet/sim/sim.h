@@ -0,0 +1,263 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * Host stand-ins for the QNX and io-pkt interfaces used by receive.c,
+ * transmit.c, genet_dim.c, options.c and interrupt.c, so they build and
+ * run unchanged on Linux.
+ * Every QNX header those files include is generated by the Makefile as a
+ * one line wrapper around this file.
+ *
+ * Only what the data path touches is here. Register accesses go to the
+ * NIC model in sim_nic.c, mbufs and clusters come from fixed arenas in
+ * sim_os.c so the model can tell live buffers from freed ones, and the
+ * interface send lock is a flag that catches double locks and unlocks.
+ */
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#define EOK             0
+
+typedef unsigned char   uchar_t;
+
+struct nw_work_thread;
+struct _iopkt_self;
+
+struct _iopkt_inter {
+    int     (*func)(void *, struct nw_work_thread *);
+    int     (*enable)(void *);
+    void    *arg;
+};
+
+/* The event io-pkt would wake a work thread with, NULL once queued */
+const struct sigevent *interrupt_queue(struct _iopkt_self *, struct _iopkt_inter *);
+
+#define atomic_set(p, v)        ((void) (*(p) |= (v)))
+#define atomic_clr_value(p, v)  sim_atomic_clr_value(p, v)
+
+static inline unsigned sim_atomic_clr_value(volatile unsigned *p, unsigned v)
+{
+    const unsigned old = *p;
+
+    *p = old & ~v;
+    return old;
+}
+
+/* mbufs */
+#define MSIZE           256
+#define MCLBYTES        2048
+#define MHLEN           200
+
+#define M_EXT           0x0001
+#define M_PKTHDR        0x0002
+
+#define M_DONTWAIT      0
+#define M_NOWAIT        0
+#define MT_DATA         1
+
+#define M_CSUM_TCPv4        0x00000001
+#define M_CSUM_UDPv4        0x00000002
+#define M_CSUM_TCP_UDP_BAD  0x00000004
+#define M_CSUM_TCPv6        0x00000020
+#define M_CSUM_UDPv6        0x00000040
+#define M_CSUM_TSOv4        0x00000080
+
+#define M_CSUM_DATA_IPv4_IPHL(x)    ((x) >> 16)
+#define M_CSUM_DATA_IPv4_OFFSET(x)  ((x) & 0xffff)
+#define M_CSUM_DATA_IPv6_HL(x)      ((x) >> 16)
+#define M_CSUM_DATA_IPv6_OFFSET(x)  ((x) & 0xffff)
+
+struct ifnet;
+
+struct pkthdr {
+    struct ifnet    *rcvif;
+    int             len;
+    int             csum_flags;
+    uint32_t        csum_data;
+    uint16_t        segsz;
+};
+
+struct m_ext {
+    char            *ext_buf;
+    void            *ext_page;
+    size_t          ext_size;
+};
+
+struct mbuf {
+    uint32_t        m_magic;        /* SIM_MBUF_MAGIC while allocated */
+    struct mbuf     *m_next;
+    struct mbuf     *m_nextpkt;
+    char            *m_data;
+    int             m_len;
+    int             m_flags;
+    struct pkthdr   m_pkthdr;
+    struct m_ext    m_ext;
+    char            m_pktdat[MHLEN];
+};
+
+#define mtod(m, t)      ((t)((m)->m_data))
+
+#define M_LEADINGSPACE(m) \
+    ((int) ((m)->m_data - (((m)->m_flags & M_EXT) ? (m)->m_ext.ext_buf : (m)->m_pktdat)))
+
+#define MH_ALIGN(m, len) \
+    do { (m)->m_data += (MHLEN - (len)) & ~(sizeof(long) - 1); } while (0)
+
+#define MGETHDR(m, how, type)   ((m) = sim_mgethdr())
+
+struct mbuf *sim_mgethdr(void);
+struct mbuf *m_getcl(int, int, int);
+struct mbuf *m_getcl_wtp(int, int, int, struct nw_work_thread *);
+void m_freem(struct mbuf *);
+void m_copydata(struct mbuf *, int, int, caddr_t);
+struct mbuf *m_copym(struct mbuf *, int, int, int);
+
+/* Physical addresses are the host addresses, the NIC model uses them as is */
+off64_t pool_phys(void *, void *);
+off64_t mbuf_phys(struct mbuf *);
+
+struct cache_ctrl {
+    int             fd;
+};
+
+#define CACHE_INVAL(c, v, p, l) ((void) (c), (void) (v), (void) (p), (void) (l))
+#define CACHE_FLUSH(c, v, p, l) ((void) (c), (void) (v), (void) (p), (void) (l))
+
+/* Interface */
+#define IFF_RUNNING     0x0040
+#define IFF_OACTIVE     0x0400
+
+struct ifqueue {
+    struct mbuf     *ifq_head;
+    struct mbuf     *ifq_tail;
+    int             ifq_len;
+    int             ifq_maxlen;
+};
+
+#define IFQ_POLL(ifq, m)    ((m) = (ifq)->ifq_head)
+#define IFQ_DEQUEUE(ifq, m) ((m) = sim_ifq_dequeue(ifq))
+
+struct mbuf *sim_ifq_dequeue(struct ifqueue *);
+int sim_ifq_enqueue(struct ifqueue *, struct mbuf *);
+
+struct ifnet {
+    void            *if_softc;
+    char            if_xname[16];
+    int             if_flags;
+    int             if_flags_tx;
+    unsigned long   if_ipackets;
+    unsigned long   if_opackets;
+    unsigned long   if_ierrors;
+    unsigned long   if_oerrors;
+    unsigned long   if_iqdrops;
+    void            *if_bpf;
+    void            (*if_input)(struct ifnet *, struct mbuf *);
+    struct ifqueue  if_snd;
+    int             if_snd_ex;      /* held flag */
+};
+
+struct ethercom {
+    struct ifnet    ec_if;
+};
+
+struct device {
+    char            dv_xname[16];
+};
+
+#define NW_SIGLOCK_P(ex, iopkt, wtp)    ((void) (wtp), sim_siglock(ex))
+#define NW_SIGUNLOCK_P(ex, iopkt, wtp)  ((void) (wtp), sim_sigunlock(ex))
+#define WTP                             ((struct nw_work_thread *) NULL)
+
+void sim_siglock(int *);
+void sim_sigunlock(int *);
+
+#define NBPFILTER       1
+#define bpf_mtap(bpf, m)    ((void) (bpf), (void) (m))
+
+/* Ethernet */
+#define ETHER_ADDR_LEN          6
+#define ETHER_HDR_LEN           14
+#define ETHER_VLAN_ENCAP_LEN    4
+#define ETHERTYPE_IP            0x0800
+#define ETHERTYPE_ARP           0x0806
+#define ETHERTYPE_VLAN          0x8100
+#define ETHERTYPE_IPV6          0x86dd
+
+/* nicinfo, only what Genet embeds */
+#define NIC_FLAG_LINK_DOWN      0x0100
+
+typedef struct {
+    int             flags;
+    int             verbose;
+} nic_config_t;
+
+typedef struct {
+    uint64_t        octets_rxed_ok;
+    uint64_t        octets_txed_ok;
+    uint32_t        rxed_ok;
+    uint32_t        txed_ok;
+} nic_stats_t;
+
+typedef struct mdi mdi_t;
+
+/* genet-sim runs due callouts from its tick loop */
+struct callout {
+    int             c_time;         /* ticks left, 0 when not pending */
+    void            (*c_func)(void *);
+    void            *c_arg;
+};
+
+void callout_init(struct callout *);
+void callout_msec(struct callout *, int, void (*)(void *), void *);
+void callout_stop(struct callout *);
+
+struct mii_data {
+    int             mii_media_active;
+};
+
+/* Registers */
+uint32_t in32(uintptr_t);
+void out32(uintptr_t, uint32_t);
+
+/* Kernel calls */
+uint64_t ClockCycles(void);
+
+#define _NTO_TRACE_INSERTSUSEREVENT 0
+#define TraceEvent(mode, event, arg, cycles)    ((void) (event), (void) (arg), (void) (cycles))
+
+#define _SLOGC_NETWORK  0
+#define _SLOG_ERROR     2
+#define _SLOG_WARNING   3
+#define _SLOG_INFO      5
+#define _SLOG_DEBUG1    6
+
+int slogf(int, int, const char *, ...) __attribute__((format(printf, 3, 4)));
+
+#endif /* SIM_H_ */
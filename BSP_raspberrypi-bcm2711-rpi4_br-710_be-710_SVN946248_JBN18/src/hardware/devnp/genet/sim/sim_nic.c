@@ -0,0 +1,479 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "sim_nic.h"
+#include "sim_os.h"
+#include "../genet_reg.h"
+
+#define NIC_RINGS           (GENET_DEFAULT_RING + 1)
+#define NIC_FRAME_MAX       (GENET_SB_SIZE + 16384)
+#define NIC_ERRORS_SHOWN    10
+
+sim_nic_stats_t sim_nic_stats;
+
+static uint32_t nic_regs[SIM_NIC_SIZE / 4];
+
+/* TX frame being gathered from its descriptors, per ring */
+typedef struct nic_tx_frame_t
+{
+    uint8_t     buf[NIC_FRAME_MAX];
+    unsigned    len;
+    uint32_t    flags;          // first descriptor's flags
+    int         open;
+} nic_tx_frame_t;
+
+static nic_tx_frame_t nic_tx_frame[NIC_RINGS];
+
+/* TX descriptors completed since the ring last raised its done bit */
+static unsigned nic_tx_done[NIC_RINGS];
+
+#define REG(off)        nic_regs[(off) / 4]
+#define RING(reg, r)    REG(GENET_RING_REG(reg, r))
+
+void sim_nic_error(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (sim_nic_stats.errors++ < NIC_ERRORS_SHOWN) {
+        fprintf(stderr, "nic: ");
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fprintf(stderr, "\n");
+    }
+}
+
+void sim_nic_reset(void)
+{
+    memset(nic_regs, 0, sizeof(nic_regs));
+    memset(nic_tx_frame, 0, sizeof(nic_tx_frame));
+    memset(nic_tx_done, 0, sizeof(nic_tx_done));
+    memset(&sim_nic_stats, 0, sizeof(sim_nic_stats));
+}
+
+static int ring_enabled(uint32_t control, unsigned ring)
+{
+    return (control & 1) && (control & (1 << (ring + 1)));
+}
+
+/* Is off the per ring register reg of some ring? See GENET_RING_REG() */
+static int is_ring_reg(uint32_t off, uint32_t reg, unsigned *ring)
+{
+    const uint32_t below = reg - off;
+
+    if (off > reg || below % GENET_RING_CNTRL_SIZE || below / GENET_RING_CNTRL_SIZE > GENET_DEFAULT_RING) {
+        return 0;
+    }
+    *ring = GENET_DEFAULT_RING - below / GENET_RING_CNTRL_SIZE;
+    return 1;
+}
+
+uint32_t sim_nic_read(uint32_t off)
+{
+    switch (off) {
+    case GENET_INTRL2_0_CPU_SET:
+    case GENET_INTRL2_0_CPU_CLEAR:
+    case GENET_INTRL2_0_CPU_MASK_SET:
+    case GENET_INTRL2_0_CPU_MASK_CLEAR:
+    case GENET_INTRL2_1_CPU_SET:
+    case GENET_INTRL2_1_CPU_CLEAR:
+    case GENET_INTRL2_1_CPU_MASK_SET:
+    case GENET_INTRL2_1_CPU_MASK_CLEAR:
+        sim_nic_error("read of write only register 0x%x", off);
+        return 0;
+    }
+    return REG(off);
+}
+
+void sim_nic_write(uint32_t off, uint32_t val)
+{
+    unsigned ring;
+
+    switch (off) {
+    case GENET_INTRL2_0_CPU_SET:
+    case GENET_INTRL2_1_CPU_SET:
+        REG(off - 4) |= val;
+        return;
+    case GENET_INTRL2_0_CPU_CLEAR:
+    case GENET_INTRL2_1_CPU_CLEAR:
+        REG(off - 8) &= ~val;
+        return;
+    case GENET_INTRL2_0_CPU_MASK_SET:
+    case GENET_INTRL2_1_CPU_MASK_SET:
+        REG(off - 4) |= val;
+        return;
+    case GENET_INTRL2_0_CPU_MASK_CLEAR:
+    case GENET_INTRL2_1_CPU_MASK_CLEAR:
+        REG(off - 8) &= ~val;
+        return;
+    case GENET_INTRL2_0_CPU_STAT:
+    case GENET_INTRL2_1_CPU_STAT:
+    case GENET_INTRL2_0_CPU_MASK_STATUS:
+    case GENET_INTRL2_1_CPU_MASK_STATUS:
+        sim_nic_error("write of read only register 0x%x", off);
+        return;
+    }
+
+    /*
+     * Once a ring runs the DMA owns the RX producer and TX consumer
+     * indices. A producer index write then only clears the discard count
+     * in the upper half, which is how the driver resets it.
+     */
+    if (is_ring_reg(off, GENET_RDMA_PRODUCER_INDEX, &ring)
+            && ring_enabled(REG(GENET_RDMA_CONTROL), ring)) {
+        REG(off) = (REG(off) & 0xFFFF) | (val & 0xFFFF0000);
+        return;
+    }
+    if (is_ring_reg(off, GENET_TDMA_CONSUMER_INDEX, &ring)) {
+        if (ring_enabled(REG(GENET_TDMA_CONTROL), ring)) {
+            sim_nic_error("TX ring %u consumer index written while running", ring);
+            return;
+        }
+        val = SIM_NIC_TDMA_RSVD | (val & 0xFFFF);
+    }
+
+    REG(off) = val;
+}
+
+/* Ring geometry as the driver programmed it, in descriptor words */
+static void ring_window(uint32_t start_reg, uint32_t end_reg, unsigned ring,
+        uint32_t *start, uint32_t *end)
+{
+    *start = RING(start_reg, ring);
+    *end = RING(end_reg, ring);
+}
+
+static uint32_t next_ptr(uint32_t ptr, uint32_t start, uint32_t end)
+{
+    ptr += GENET_DMA_DESC_WORDS;
+    return ptr > end ? start : ptr;
+}
+
+static uint64_t desc_addr(uint32_t base, uint32_t ptr)
+{
+    return REG(base + ptr * 4 + GENET_DMA_DESC_ADDR_LSB)
+        | (uint64_t) REG(base + ptr * 4 + GENET_DMA_DESC_ADDR_MSB) << 32;
+}
+
+static void raise_rx(unsigned ring)
+{
+    if (ring == GENET_DEFAULT_RING) {
+        REG(GENET_INTRL2_0_CPU_STAT) |= GENET_INTRL2_RX_DONE;
+    } else {
+        REG(GENET_INTRL2_1_CPU_STAT) |= GENET_INTRL2_1_RX_RING(ring);
+    }
+}
+
+/* TX done is raised once MBUF_DONE_INTR_THRESH descriptors have completed */
+static void raise_tx(unsigned ring, unsigned descs)
+{
+    const unsigned thresh = RING(GENET_TDMA_MBUF_DONE_INTR_THRESH, ring) & GENET_DMA_INTR_THRESH_MASK;
+
+    nic_tx_done[ring] += descs;
+    if (nic_tx_done[ring] < (thresh ? thresh : 1)) {
+        return;
+    }
+    nic_tx_done[ring] = 0;
+
+    if (ring == GENET_DEFAULT_RING) {
+        REG(GENET_INTRL2_0_CPU_STAT) |= GENET_INTRL2_TX_DONE;
+    } else {
+        REG(GENET_INTRL2_1_CPU_STAT) |= GENET_INTRL2_1_TX_RING(ring);
+    }
+}
+
+/* 16-bit ones complement sum over big endian words */
+static uint32_t nic_sum(uint32_t sum, const uint8_t *p, unsigned len)
+{
+    for (; len > 1; p += 2, len -= 2) {
+        sum += (p[0] << 8) | p[1];
+    }
+    if (len) {
+        sum += p[0] << 8;
+    }
+    return sum;
+}
+
+static uint16_t nic_fold(uint32_t sum)
+{
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
+
+/*
+ * The ring the filter block sends a frame to: the first enabled filter
+ * whose unmasked nibbles all match over its length picks it through
+ * INDEX2RING, anything else goes to the default ring.
+ */
+unsigned sim_nic_rx_ring(const uint8_t *frame, unsigned len)
+{
+    unsigned f, w, n, words, ring;
+    uint32_t word, data;
+
+    if (!(REG(GENET_HFB_CTRL) & GENET_HFB_CTRL_EN)) {
+        return GENET_DEFAULT_RING;
+    }
+
+    for (f = 0; f < GENET_HFB_FILTERS; f++) {
+        if (!(REG(GENET_HFB_FLT_ENABLE(f)) & (1U << (f % 32)))) {
+            continue;
+        }
+        words = (REG(GENET_HFB_FLT_LEN(f)) >> GENET_HFB_FLT_LEN_SHIFT(f) & GENET_HFB_FLT_LEN_MASK) / 2;
+        if (words > GENET_HFB_FILTER_WORDS) {
+            words = GENET_HFB_FILTER_WORDS;
+        }
+        for (w = 0; w < words; w++) {
+            word = REG(GENET_HFB_WORD(f, w));
+            if (!(word >> 16 & 0xF)) {
+                continue;
+            }
+            if (2 * w + 2 > len) {
+                break;
+            }
+            data = frame[2 * w] << 8 | frame[2 * w + 1];
+            for (n = 0; n < 4; n++) {
+                if ((word >> (16 + n) & 1) && ((data ^ word) >> (4 * n) & 0xF)) {
+                    break;
+                }
+            }
+            if (n < 4) {
+                break;
+            }
+        }
+        if (w == words) {
+            ring = REG(GENET_RDMA_INDEX2RING(f)) >> GENET_RDMA_INDEX2RING_SHIFT(f) & GENET_RDMA_INDEX2RING_MASK;
+            return ring == 0 ? GENET_DEFAULT_RING : ring - 1;
+        }
+    }
+    return GENET_DEFAULT_RING;
+}
+
+/*
+ * One frame arrives from the wire. With a free descriptor it is written
+ * as the RBUF would with STATUS_64B and ALIGN_2B: the 64 byte status
+ * block with the checksum of everything past the Ethernet header, two
+ * pad bytes, then the frame. Without one the discard count in the upper
+ * half of the producer index goes up, saturating at 0xffff.
+ */
+int sim_nic_rx(unsigned ring, const uint8_t *frame, unsigned len, uint32_t status)
+{
+    const unsigned need = GENET_SB_SIZE + GENET_SB_RX_ALIGN + len;
+    uint32_t pidx, cidx, size, start, end, ptr, sum;
+    uint8_t *buf;
+    uint64_t addr;
+
+    sim_nic_stats.rx_offered++;
+
+    if (!ring_enabled(REG(GENET_RDMA_CONTROL), ring)) {
+        sim_nic_error("RX on disabled ring %u", ring);
+        return 0;
+    }
+
+    pidx = RING(GENET_RDMA_PRODUCER_INDEX, ring);
+    cidx = RING(GENET_RDMA_CONSUMER_INDEX, ring) & 0xFFFF;
+    size = RING(GENET_RDMA_RING_BUF_SIZE, ring) >> GENET_RDMA_RING_BUF_SIZE_DESC_SHIFT;
+
+    if ((uint16_t) ((pidx & 0xFFFF) - cidx) >= size) {
+        sim_nic_stats.rx_discards++;
+        if ((pidx >> 16) < 0xFFFF) {
+            sim_nic_stats.rx_counted++;
+            RING(GENET_RDMA_PRODUCER_INDEX, ring) = pidx + 0x10000;
+        }
+        return 0;
+    }
+
+    ring_window(GENET_RDMA_START_ADDRESS, GENET_RDMA_END_ADDRESS, ring, &start, &end);
+    ptr = RING(GENET_RDMA_WRITE_POINTER, ring);
+    addr = desc_addr(GENET_RDMA_REG_OFF, ptr);
+
+    if (need > (RING(GENET_RDMA_RING_BUF_SIZE, ring) & 0xFFFF)) {
+        sim_nic_error("RX frame of %u bytes does not fit a buffer", len);
+        return 0;
+    }
+    if ((buf = sim_dma_buffer(addr, need)) == NULL) {
+        sim_nic_error("RX ring %u descriptor %u: buffer 0x%llx is not a live buffer",
+                ring, ptr / GENET_DMA_DESC_WORDS, (unsigned long long) addr);
+        return 0;
+    }
+
+    sum = nic_fold(nic_sum(0, frame + 14, len - 14));
+    memset(buf, 0, GENET_SB_SIZE + GENET_SB_RX_ALIGN);
+    memcpy(buf + GENET_SB_RX_CSUM, &sum, sizeof(sum));
+    memcpy(buf + GENET_SB_SIZE + GENET_SB_RX_ALIGN, frame, len);
+
+    REG(GENET_RDMA_REG_OFF + ptr * 4 + GENET_DMA_DESC_CNTRL) =
+            need << GENET_DMA_BUFLEN_SHIFT | GENET_DMA_FIRST_PKT | GENET_DMA_LAST_PKT | status;
+
+    RING(GENET_RDMA_WRITE_POINTER, ring) = next_ptr(ptr, start, end);
+    RING(GENET_RDMA_PRODUCER_INDEX, ring) = (pidx & 0xFFFF0000) | (uint16_t) (pidx + 1);
+    sim_nic_stats.rx_ring++;
+    raise_rx(ring);
+
+    return 1;
+}
+
+/* Checksum insertion as the TBUF does it, offsets counting from the frame past the status block */
+static void tx_csum(uint8_t *sb, unsigned len)
+{
+    uint8_t *const frame = sb + GENET_SB_SIZE;
+    const unsigned flen = len - GENET_SB_SIZE;
+    uint32_t info, start, off;
+    uint16_t sum;
+
+    memcpy(&info, sb + GENET_SB_TX_CSUM_INFO, sizeof(info));
+    start = (info >> GENET_SB_TX_CSUM_START_SHIFT) & 0x7FFF;
+    off = info & 0x7FFF;
+
+    if (!(info & GENET_SB_TX_CSUM_LV)) {
+        sim_nic_error("TX checksum requested without a valid csum_info 0x%x", info);
+        return;
+    }
+    if (start < 14 || start >= flen || off + 2 > flen || off < start) {
+        sim_nic_error("TX csum_info 0x%x outside a %u byte frame", info, flen);
+        return;
+    }
+
+    sum = ~nic_fold(nic_sum(0, frame + start, flen - start));
+    if (sum == 0 && (info & GENET_SB_TX_CSUM_PROTO_UDP)) {
+        sum = 0xFFFF;
+    }
+    frame[off] = sum >> 8;
+    frame[off + 1] = sum;
+    sim_nic_stats.tx_csum++;
+}
+
+/*
+ * The TX DMA works through up to max_descs descriptors, possibly
+ * stopping inside a frame. Each buffer is read when its descriptor is
+ * consumed, so it must still be alive then; completed frames go to the
+ * sink without the status block and the appended FCS.
+ */
+unsigned sim_nic_tx(unsigned ring, unsigned max_descs, sim_nic_sink_t *sink, void *arg)
+{
+    uint32_t cidx, pidx, start, end, ptr, cntrl, blen;
+    nic_tx_frame_t *const f = &nic_tx_frame[ring];
+    unsigned n = 0, d;
+    const uint8_t *buf;
+    uint64_t addr;
+
+    if (!ring_enabled(REG(GENET_TDMA_CONTROL), ring)) {
+        return 0;
+    }
+
+    cidx = RING(GENET_TDMA_CONSUMER_INDEX, ring) & 0xFFFF;
+    pidx = RING(GENET_TDMA_PRODUCER_INDEX, ring) & 0xFFFF;
+    ring_window(GENET_TDMA_START_ADDRESS, GENET_TDMA_END_ADDRESS, ring, &start, &end);
+    ptr = RING(GENET_TDMA_READ_POINTER, ring);
+
+    if ((uint16_t) (pidx - cidx) > (RING(GENET_TDMA_RING_BUF_SIZE, ring) >> GENET_TDMA_RING_BUF_SIZE_DESC_SHIFT)) {
+        sim_nic_error("TX ring %u producer index %u is more than a ring ahead of %u",
+                ring, pidx, cidx);
+        return 0;
+    }
+
+    for (; cidx != pidx && n < max_descs; n++, cidx = (uint16_t) (cidx + 1)) {
+        d = ptr / GENET_DMA_DESC_WORDS;
+        cntrl = REG(GENET_TDMA_REG_OFF + ptr * 4 + GENET_DMA_DESC_CNTRL);
+        addr = desc_addr(GENET_TDMA_REG_OFF, ptr);
+        blen = cntrl >> GENET_DMA_BUFLEN_SHIFT;
+        ptr = next_ptr(ptr, start, end);
+        sim_nic_stats.tx_descs++;
+
+        if (cntrl & GENET_DMA_FIRST_PKT) {
+            if (f->open) {
+                sim_nic_error("TX ring %u: start of frame inside a frame", ring);
+            }
+            f->open = 1;
+            f->len = 0;
+            f->flags = cntrl;
+        } else if (!f->open) {
+            sim_nic_error("TX ring %u: segment without a start of frame", ring);
+            continue;
+        }
+
+        // the last length includes the FCS the MAC appends, not in memory
+        if (cntrl & GENET_DMA_LAST_PKT) {
+            if (!(cntrl & GENET_DMA_APPEND_CRC) || blen < 4) {
+                sim_nic_error("TX ring %u: last segment without FCS room", ring);
+                f->open = 0;
+                continue;
+            }
+            blen -= 4;
+        }
+
+        if (f->len + blen > sizeof(f->buf)) {
+            sim_nic_error("TX ring %u: frame longer than %u bytes", ring, (unsigned) sizeof(f->buf));
+            f->open = 0;
+            continue;
+        }
+        if (blen && (buf = sim_dma_buffer(addr, blen)) == NULL) {
+            sim_nic_error("TX ring %u descriptor %u: buffer 0x%llx+%u is not a live buffer",
+                    ring, d, (unsigned long long) addr, blen);
+            f->open = 0;
+            continue;
+        }
+        if (blen) {
+            memcpy(f->buf + f->len, buf, blen);
+            f->len += blen;
+        }
+
+        if (!(cntrl & GENET_DMA_LAST_PKT)) {
+            continue;
+        }
+
+        f->open = 0;
+        if (f->len < GENET_SB_SIZE + 60) {
+            sim_nic_error("TX ring %u: runt frame of %u bytes", ring, f->len - GENET_SB_SIZE);
+            continue;
+        }
+        if (f->flags & GENET_DMA_TX_DO_CSUM) {
+            tx_csum(f->buf, f->len);
+        }
+
+        sim_nic_stats.tx_frames++;
+        sim_nic_stats.tx_bytes += f->len - GENET_SB_SIZE;
+        if (sink != NULL) {
+            sink(arg, f->buf + GENET_SB_SIZE, f->len - GENET_SB_SIZE);
+        }
+    }
+
+    if (n) {
+        RING(GENET_TDMA_READ_POINTER, ring) = ptr;
+        RING(GENET_TDMA_CONSUMER_INDEX, ring) = SIM_NIC_TDMA_RSVD | cidx;
+        raise_tx(ring, n);
+    }
+
+    return n;
+}
+
+unsigned sim_nic_rx_pending(unsigned ring)
+{
+    return (uint16_t) (RING(GENET_RDMA_PRODUCER_INDEX, ring) - RING(GENET_RDMA_CONSUMER_INDEX, ring));
+}
+
+unsigned sim_nic_tx_pending(unsigned ring)
+{
+    return (uint16_t) (RING(GENET_TDMA_PRODUCER_INDEX, ring) - RING(GENET_TDMA_CONSUMER_INDEX, ring));
+}
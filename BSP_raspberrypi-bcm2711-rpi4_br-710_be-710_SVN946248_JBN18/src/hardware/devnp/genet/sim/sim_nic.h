@@ -0,0 +1,72 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * Software model of the GENET register block as the data path sees it:
+ * the descriptor RAM, the per ring DMA index and pointer registers, the
+ * two INTRL2 blocks and the filter block that picks the RX ring. The model owns its own ring positions (the DMA
+ * read/write pointers) and never uses the driver's view of the rings, so
+ * index arithmetic mistakes on either side show up as corrupted frames.
+ */
+
+#ifndef SIM_NIC_H_
+#define SIM_NIC_H_
+
+#include <stdint.h>
+
+/* The BCM2711 GENET address, never dereferenced */
+#define SIM_NIC_BASE        0xfd580000u
+#define SIM_NIC_SIZE        0x10000u
+
+/* Reserved TDMA consumer index bits, read back set so the driver must mask them */
+#define SIM_NIC_TDMA_RSVD   0xa5a50000u
+
+typedef struct sim_nic_stats_t
+{
+    uint64_t    rx_offered;     /* frames put on the wire */
+    uint64_t    rx_ring;        /* frames written to a descriptor */
+    uint64_t    rx_discards;    /* frames dropped with the ring full */
+    uint64_t    rx_counted;     /* discards the saturating counter registered */
+    uint64_t    tx_frames;      /* frames sent */
+    uint64_t    tx_descs;       /* descriptors consumed */
+    uint64_t    tx_bytes;
+    uint64_t    tx_csum;        /* frames with checksum insertion */
+    uint64_t    errors;         /* protocol violations seen by the model */
+} sim_nic_stats_t;
+
+extern sim_nic_stats_t sim_nic_stats;
+
+/* Called for every frame the TX DMA completes, without status block or FCS */
+typedef void sim_nic_sink_t(void *arg, const uint8_t *frame, unsigned len);
+
+void sim_nic_reset(void);
+uint32_t sim_nic_read(uint32_t off);
+void sim_nic_write(uint32_t off, uint32_t val);
+
+unsigned sim_nic_rx_ring(const uint8_t *frame, unsigned len);
+int sim_nic_rx(unsigned ring, const uint8_t *frame, unsigned len, uint32_t status);
+unsigned sim_nic_tx(unsigned ring, unsigned max_descs, sim_nic_sink_t *sink, void *arg);
+unsigned sim_nic_rx_pending(unsigned ring);
+unsigned sim_nic_tx_pending(unsigned ring);
+
+void sim_nic_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif /* SIM_NIC_H_ */
@@ -0,0 +1,446 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * The io-pkt and kernel services the driver calls, on the host.
+ *
+ * mbufs and clusters come from two fixed arenas rather than malloc(), so
+ * an address the driver hands to the DMA can be checked against a live
+ * buffer, and running the arena dry behaves like io-pkt running out of
+ * clusters. Built with -fsanitize=address, freed buffers are poisoned too.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include "sim.h"
+#include "sim_os.h"
+#include "sim_nic.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define SIM_POISON(p, n)    ASAN_POISON_MEMORY_REGION(p, n)
+#define SIM_UNPOISON(p, n)  ASAN_UNPOISON_MEMORY_REGION(p, n)
+#else
+#define SIM_POISON(p, n)    ((void) (p), (void) (n))
+#define SIM_UNPOISON(p, n)  ((void) (p), (void) (n))
+#endif
+
+#define SIM_MBUF_MAGIC      0x6d627566  // "mbuf"
+#define SIM_CL_MAGIC        0x636c7374  // "clst"
+#define SIM_FREE_MAGIC      0xdeadbeef
+#define SIM_DMA_REGIONS     4
+
+typedef struct sim_cluster_t
+{
+    uint32_t    magic;
+    int         refs;
+    char        buf[MCLBYTES] __attribute__((aligned(64)));
+} sim_cluster_t;
+
+sim_os_stats_t sim_os_stats;
+int sim_verbose;
+
+static sim_cluster_t *cl_arena;
+static unsigned *cl_free, cl_nfree, cl_count;
+static struct mbuf *mb_arena;
+static unsigned *mb_free, mb_nfree, mb_count;
+static unsigned fail_every, fail_count;
+
+static struct {
+    uint8_t     *p;
+    size_t      len;
+} dma_regions[SIM_DMA_REGIONS];
+
+#define MBUF_BODY   offsetof(struct mbuf, m_next)
+
+void sim_fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "genet-sim: ");
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+void sim_os_init(unsigned clusters, unsigned mbufs)
+{
+    unsigned i;
+
+    cl_arena = aligned_alloc(64, clusters * sizeof(*cl_arena));
+    cl_free = malloc(clusters * sizeof(*cl_free));
+    mb_arena = aligned_alloc(64, mbufs * sizeof(*mb_arena));
+    mb_free = malloc(mbufs * sizeof(*mb_free));
+    if (cl_arena == NULL || cl_free == NULL || mb_arena == NULL || mb_free == NULL) {
+        sim_fatal("no memory for %u clusters and %u mbufs", clusters, mbufs);
+    }
+
+    // hand out low indices first, the way a warm pool would
+    for (i = 0; i < clusters; i++) {
+        cl_arena[i].magic = SIM_FREE_MAGIC;
+        cl_free[i] = clusters - 1 - i;
+        SIM_POISON(cl_arena[i].buf, MCLBYTES);
+    }
+    for (i = 0; i < mbufs; i++) {
+        mb_arena[i].m_magic = SIM_FREE_MAGIC;
+        mb_free[i] = mbufs - 1 - i;
+        SIM_POISON((char *) &mb_arena[i] + MBUF_BODY, sizeof(struct mbuf) - MBUF_BODY);
+    }
+    cl_count = cl_nfree = clusters;
+    mb_count = mb_nfree = mbufs;
+
+    memset(&sim_os_stats, 0, sizeof(sim_os_stats));
+    memset(dma_regions, 0, sizeof(dma_regions));
+    fail_every = fail_count = 0;
+}
+
+void sim_os_fini(void)
+{
+    SIM_UNPOISON(cl_arena, cl_count * sizeof(*cl_arena));
+    SIM_UNPOISON(mb_arena, mb_count * sizeof(*mb_arena));
+    free(cl_arena);
+    free(cl_free);
+    free(mb_arena);
+    free(mb_free);
+    cl_arena = NULL;
+    mb_arena = NULL;
+}
+
+/*
+ * Fail every nth cluster allocation, 0 for never. The count carries over
+ * while injection is switched off, so turning it on around each driver
+ * call still fails every nth allocation the driver makes.
+ */
+void sim_os_fail_every(unsigned n)
+{
+    fail_every = n;
+}
+
+void sim_dma_region(void *p, size_t len)
+{
+    unsigned i;
+
+    for (i = 0; i < SIM_DMA_REGIONS; i++) {
+        if (dma_regions[i].p == NULL) {
+            dma_regions[i].p = p;
+            dma_regions[i].len = len;
+            return;
+        }
+    }
+    sim_fatal("too many DMA regions");
+}
+
+/*
+ * Returns the buffer at a DMA address if [addr, addr + len) lies inside
+ * one live cluster, one live mbuf's data or a registered region.
+ */
+uint8_t *sim_dma_buffer(uint64_t addr, unsigned len)
+{
+    const uintptr_t a = (uintptr_t) addr;
+    unsigned i;
+
+    if (a >= (uintptr_t) cl_arena && a < (uintptr_t) (cl_arena + cl_count)) {
+        sim_cluster_t *cl = &cl_arena[(a - (uintptr_t) cl_arena) / sizeof(*cl)];
+
+        if (cl->magic != SIM_CL_MAGIC || a < (uintptr_t) cl->buf
+                || a + len > (uintptr_t) (cl->buf + MCLBYTES)) {
+            return NULL;
+        }
+        return (uint8_t *) a;
+    }
+
+    if (a >= (uintptr_t) mb_arena && a < (uintptr_t) (mb_arena + mb_count)) {
+        struct mbuf *m = &mb_arena[(a - (uintptr_t) mb_arena) / sizeof(*m)];
+
+        if (m->m_magic != SIM_MBUF_MAGIC || a < (uintptr_t) m->m_pktdat
+                || a + len > (uintptr_t) (m->m_pktdat + MHLEN)) {
+            return NULL;
+        }
+        return (uint8_t *) a;
+    }
+
+    for (i = 0; i < SIM_DMA_REGIONS && dma_regions[i].p != NULL; i++) {
+        if (a >= (uintptr_t) dma_regions[i].p && a + len <= (uintptr_t) (dma_regions[i].p + dma_regions[i].len)) {
+            return (uint8_t *) a;
+        }
+    }
+
+    return NULL;
+}
+
+static struct mbuf *mbuf_get(int flags)
+{
+    struct mbuf *m;
+
+    if (mb_nfree == 0) {
+        return NULL;
+    }
+
+    m = &mb_arena[mb_free[--mb_nfree]];
+    SIM_UNPOISON((char *) m + MBUF_BODY, sizeof(*m) - MBUF_BODY);
+    m->m_magic = SIM_MBUF_MAGIC;
+    m->m_next = m->m_nextpkt = NULL;
+    m->m_data = m->m_pktdat;
+    m->m_len = 0;
+    m->m_flags = flags;
+    memset(&m->m_pkthdr, 0, sizeof(m->m_pkthdr));
+    memset(&m->m_ext, 0, sizeof(m->m_ext));
+
+    sim_os_stats.mbufs++;
+    sim_os_stats.mbufs_live++;
+    return m;
+}
+
+static void mbuf_put(struct mbuf *m)
+{
+    if ((uintptr_t) m < (uintptr_t) mb_arena || (uintptr_t) m >= (uintptr_t) (mb_arena + mb_count)
+            || m->m_magic != SIM_MBUF_MAGIC) {
+        sim_fatal("freeing an mbuf that is not allocated: %p", (void *) m);
+    }
+
+    if (m->m_flags & M_EXT) {
+        sim_cluster_t *cl = m->m_ext.ext_page;
+
+        if (cl->magic != SIM_CL_MAGIC || cl->refs <= 0) {
+            sim_fatal("freeing mbuf %p with a free cluster %p", (void *) m, (void *) cl);
+        }
+        if (--cl->refs == 0) {
+            cl->magic = SIM_FREE_MAGIC;
+            SIM_POISON(cl->buf, MCLBYTES);
+            cl_free[cl_nfree++] = cl - cl_arena;
+            sim_os_stats.clusters_live--;
+        }
+    }
+
+    m->m_magic = SIM_FREE_MAGIC;
+    SIM_POISON((char *) m + MBUF_BODY, sizeof(*m) - MBUF_BODY);
+    mb_free[mb_nfree++] = m - mb_arena;
+    sim_os_stats.mbufs_live--;
+}
+
+struct mbuf *m_getcl(int how, int type, int flags)
+{
+    struct mbuf *m;
+    sim_cluster_t *cl;
+
+    if (fail_every && ++fail_count >= fail_every) {
+        fail_count = 0;
+        sim_os_stats.failed++;
+        return NULL;
+    }
+    if (cl_nfree == 0 || (m = mbuf_get(M_EXT | (flags & M_PKTHDR))) == NULL) {
+        sim_os_stats.failed++;
+        return NULL;
+    }
+
+    cl = &cl_arena[cl_free[--cl_nfree]];
+    SIM_UNPOISON(cl->buf, MCLBYTES);
+    cl->magic = SIM_CL_MAGIC;
+    cl->refs = 1;
+
+    m->m_ext.ext_buf = cl->buf;
+    m->m_ext.ext_page = cl;
+    m->m_ext.ext_size = MCLBYTES;
+    m->m_data = cl->buf;
+
+    sim_os_stats.clusters++;
+    sim_os_stats.clusters_live++;
+    return m;
+}
+
+struct mbuf *m_getcl_wtp(int how, int type, int flags, struct nw_work_thread *wtp)
+{
+    return m_getcl(how, type, flags);
+}
+
+struct mbuf *sim_mgethdr(void)
+{
+    return mbuf_get(M_PKTHDR);
+}
+
+void m_freem(struct mbuf *m)
+{
+    struct mbuf *n;
+
+    for (; m != NULL; m = n) {
+        n = m->m_next;
+        mbuf_put(m);
+    }
+}
+
+void m_copydata(struct mbuf *m, int off, int len, caddr_t cp)
+{
+    int count;
+
+    for (; m != NULL && off >= m->m_len; m = m->m_next) {
+        off -= m->m_len;
+    }
+    for (; len > 0; m = m->m_next, off = 0) {
+        if (m == NULL) {
+            sim_fatal("m_copydata past the end of the chain");
+        }
+        count = m->m_len - off < len ? m->m_len - off : len;
+        memcpy(cp, m->m_data + off, count);
+        cp += count;
+        len -= count;
+    }
+}
+
+/* Clusters are shared by reference, small mbufs copied */
+struct mbuf *m_copym(struct mbuf *m, int off, int len, int how)
+{
+    struct mbuf *top = NULL, **tail = &top, *n;
+    int count;
+
+    for (; m != NULL && off >= m->m_len; m = m->m_next) {
+        off -= m->m_len;
+    }
+    for (; len > 0; m = m->m_next, off = 0) {
+        if (m == NULL) {
+            sim_fatal("m_copym past the end of the chain");
+        }
+        if ((n = mbuf_get(0)) == NULL) {
+            m_freem(top);
+            return NULL;
+        }
+        count = m->m_len - off < len ? m->m_len - off : len;
+        if (m->m_flags & M_EXT) {
+            n->m_flags |= M_EXT;
+            n->m_ext = m->m_ext;
+            ((sim_cluster_t *) m->m_ext.ext_page)->refs++;
+            n->m_data = m->m_data + off;
+        } else {
+            memcpy(n->m_pktdat, m->m_data + off, count);
+        }
+        n->m_len = count;
+        len -= count;
+        *tail = n;
+        tail = &n->m_next;
+    }
+
+    return top;
+}
+
+off64_t pool_phys(void *data, void *page)
+{
+    return (uintptr_t) data;
+}
+
+off64_t mbuf_phys(struct mbuf *m)
+{
+    return (uintptr_t) m->m_data;
+}
+
+int sim_ifq_enqueue(struct ifqueue *ifq, struct mbuf *m)
+{
+    if (ifq->ifq_len >= ifq->ifq_maxlen) {
+        return 0;
+    }
+    m->m_nextpkt = NULL;
+    if (ifq->ifq_tail != NULL) {
+        ifq->ifq_tail->m_nextpkt = m;
+    } else {
+        ifq->ifq_head = m;
+    }
+    ifq->ifq_tail = m;
+    ifq->ifq_len++;
+    return 1;
+}
+
+struct mbuf *sim_ifq_dequeue(struct ifqueue *ifq)
+{
+    struct mbuf *m = ifq->ifq_head;
+
+    if (m != NULL) {
+        if ((ifq->ifq_head = m->m_nextpkt) == NULL) {
+            ifq->ifq_tail = NULL;
+        }
+        m->m_nextpkt = NULL;
+        ifq->ifq_len--;
+    }
+    return m;
+}
+
+void sim_siglock(int *ex)
+{
+    if (*ex) {
+        sim_fatal("if_snd_ex locked twice");
+    }
+    *ex = 1;
+}
+
+void sim_sigunlock(int *ex)
+{
+    if (!*ex) {
+        sim_fatal("if_snd_ex unlocked while not held");
+    }
+    *ex = 0;
+}
+
+static uint32_t reg_off(uintptr_t addr)
+{
+    if (addr < SIM_NIC_BASE || addr >= SIM_NIC_BASE + SIM_NIC_SIZE || (addr & 3)) {
+        sim_fatal("register access outside GENET: 0x%lx", (unsigned long) addr);
+    }
+    return addr - SIM_NIC_BASE;
+}
+
+uint32_t in32(uintptr_t addr)
+{
+    return sim_nic_read(reg_off(addr));
+}
+
+void out32(uintptr_t addr, uint32_t val)
+{
+    sim_nic_write(reg_off(addr), val);
+}
+
+uint64_t sim_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t ClockCycles(void)
+{
+    return sim_now_ns();
+}
+
+int slogf(int opcode, int severity, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (severity <= _SLOG_ERROR) {
+        sim_os_stats.slog_errors++;
+    }
+    if (sim_verbose) {
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fprintf(stderr, "\n");
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/* Harness side of sim_os.c: buffer arenas, fault injection and checks */
+
+#ifndef SIM_OS_H_
+#define SIM_OS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct sim_os_stats_t
+{
+    uint64_t    mbufs;          /* mbufs allocated */
+    uint64_t    clusters;       /* clusters allocated */
+    uint64_t    failed;         /* cluster allocations failed, injected or arena empty */
+    unsigned    mbufs_live;
+    unsigned    clusters_live;
+    uint64_t    slog_errors;    /* GENET_ERROR() messages */
+} sim_os_stats_t;
+
+extern sim_os_stats_t sim_os_stats;
+extern int sim_verbose;
+
+void sim_os_init(unsigned clusters, unsigned mbufs);
+void sim_os_fini(void);
+void sim_os_fail_every(unsigned n);
+
+/* Memory the NIC model may DMA to or from, besides live mbufs and clusters */
+void sim_dma_region(void *p, size_t len);
+uint8_t *sim_dma_buffer(uint64_t addr, unsigned len);
+
+uint64_t sim_now_ns(void);
+void sim_fatal(const char *fmt, ...) __attribute__((format(printf, 1, 2), noreturn));
+
+#endif /* SIM_OS_H_ */
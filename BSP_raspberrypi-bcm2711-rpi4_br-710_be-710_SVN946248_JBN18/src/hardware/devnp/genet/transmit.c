@@ -21,69 +21,241 @@
 
 #include "genet.h"
 #include "bpfilter.h"
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #if NBPFILTER > 0
 #include <net/bpf.h>
 #include <net/bpfdesc.h>
 #endif
 
-int tx_process_interrupt(void *arg, struct nw_work_thread *wtp)
+/*
+ * free_idx is single producer / single consumer: only the reaper stores
+ * it and genet_start() only loads it, so no lock is needed. The release
+ * store orders the mbuf frees before the slots are seen as free.
+ */
+static inline uint16_t genet_tx_free_idx(genet_txq_t *txq)
 {
-    Genet *genet = arg;
-    uint16_t f_idx = genet->free_idx;
+    return __atomic_load_n(&txq->free_idx, __ATOMIC_ACQUIRE);
+}
+
+static inline unsigned genet_tx_avail(genet_txq_t *txq)
+{
+    return txq->size - (uint16_t) (txq->prod_idx - genet_tx_free_idx(txq));
+}
 
+/*
+ * Frees every frame the DMA has consumed since the last reap, one consumer
+ * index read per call. Each frame's chain hangs off its last descriptor.
+ * If genet_start() found this ring full, restart it.
+ */
+void genet_tx_reap(genet_txq_t *txq, struct nw_work_thread *wtp)
+{
+    Genet *genet = txq->genet;
+    struct ifnet *ifp = &genet->sc_ec.ec_if;
+    uint16_t f_idx = txq->free_idx;
+    const uint64_t start = genet_perf_start(genet);
     // ignore upper 16-bits of c_idx
-    while (f_idx != (uint16_t) genet_reg_read(genet, GENET_TDMA_CONSUMER_INDEX)) {
-        Desc *const txdesc = &genet->tx_d[f_idx++ % GENET_RING_SIZE_MAX];
-        m_free(txdesc->mb);
-        genet->free_idx = f_idx; // free_idx updated only by tx-interrupt
+    const uint16_t c_idx = genet_reg_read(genet, GENET_RING_REG(GENET_TDMA_CONSUMER_INDEX, txq->ring));
+    const uint16_t reaped = c_idx - f_idx;
+
+    if (reaped == 0) {
+        return;
+    }
+
+    while (f_idx != c_idx) {
+        Desc *const txdesc = &txq->d[f_idx++ & (txq->size - 1)];
+
+        if (txdesc->mb != NULL) {
+            m_freem(txdesc->mb);
+            txdesc->mb = NULL;
+        }
+    }
+    __atomic_store_n(&txq->free_idx, f_idx, __ATOMIC_RELEASE);
+
+    if (genet->perf) {
+        txq->perf.reaped[genet_perf_bucket(reaped)]++;
+    }
+    genet_perf_end(genet, &txq->perf.reap, start, GENET_TRACE_REAP(txq->index), reaped);
+
+    /*
+     * Pairs with the fence in genet_tx_room(): either genet_start() sees
+     * the new free_idx, or we see the ring marked full and restart it.
+     */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (txq->full) {
+        NW_SIGLOCK_P(&ifp->if_snd_ex, genet->iopkt, wtp);
+        if (txq->full) {
+            txq->full = 0;
+            ifp->if_flags_tx &= ~IFF_OACTIVE;
+            txq->stats.restarts++;
+            genet_start(ifp);   // unlocks
+        } else {
+            NW_SIGUNLOCK_P(&ifp->if_snd_ex, genet->iopkt, wtp);
+        }
+    }
+}
+
+int tx_process_interrupt(void *arg, struct nw_work_thread *wtp)
+{
+    genet_txq_t *txq = arg;
+
+    txq->stats.interrupts++;
+
+    genet_tx_reap(txq, wtp);
+
+    if (txq->index == 0) {
+        genet_tx_coal_update(txq->genet);
     }
 
     return 1;
 }
 
-static struct mbuf *genet_defrag (struct mbuf *m)
+/*
+ * Frame priority 0-7: the VLAN PCP if the frame is tagged, otherwise the
+ * IPv4 precedence or the top three bits of the IPv6 traffic class.
+ */
+static unsigned genet_tx_prio(struct mbuf *m)
+{
+    const uint8_t *dptr = mtod(m, const uint8_t *);
+    unsigned off = ETHER_ADDR_LEN * 2;
+    uint16_t type;
+
+    if (m->m_len < ETHER_HDR_LEN + 2) {
+        return 0;
+    }
+
+    type = (dptr[off] << 8) | dptr[off + 1];
+    if (type == ETHERTYPE_VLAN) {
+        return dptr[off + 2] >> 5;
+    }
+
+    off += 2;
+    if (type == ETHERTYPE_IP) {
+        return dptr[off + 1] >> 5;
+    }
+    if (type == ETHERTYPE_IPV6) {
+        return (dptr[off] >> 1) & 0x7;
+    }
+
+    return 0;
+}
+
+/*
+ * Priorities 0 (best effort) and 1 (background) use the default ring,
+ * 2-7 are spread over the priority rings with 7 on ring 0.
+ */
+static genet_txq_t *genet_tx_queue(Genet *genet, struct mbuf *m)
+{
+    const unsigned nprio = genet->num_txq - 1;
+
+    if (nprio == 0) {
+        return &genet->txq[0];
+    }
+
+    return &genet->txq[genet_prio_queue(genet_tx_prio(m), nprio)];
+}
+
+/*
+ * How a frame is laid out on the ring. Leading mbufs that together fit
+ * in GENET_TX_COPYBREAK bytes (the headers, or all of a small frame) are
+ * copied behind the status block into the slot's tx_hdr buffer, saving a
+ * descriptor and a cache flush each. Everything else is mapped in place.
+ * Without anything to copy the status block goes in front of the first
+ * mbuf if it has the room, otherwise into tx_hdr on its own.
+ */
+typedef struct genet_tx_map_t
+{
+    unsigned    parts;      // non-empty mbufs
+    unsigned    ncopy;      // leading mbufs copied to tx_hdr
+    unsigned    copylen;
+    unsigned    descs;      // descriptors the frame takes
+    int         sb_inline;
+} genet_tx_map_t;
+
+static void genet_tx_map(struct mbuf *m, genet_tx_map_t *map)
 {
     struct mbuf *m2;
 
-    MGET(m2, M_DONTWAIT, MT_DATA);
-    if (m2 == NULL)
-        return NULL;
+    map->parts = map->ncopy = map->copylen = 0;
+    for (m2 = m; m2; m2 = m2->m_next) {
+        //why are zero-length mbufs present?
+        if (m2->m_len == 0)
+            continue;
+        if (map->ncopy == map->parts && map->copylen + m2->m_len <= GENET_TX_COPYBREAK) {
+            map->ncopy++;
+            map->copylen += m2->m_len;
+        }
+        map->parts++;
+    }
+
+    map->sb_inline = map->ncopy == 0 && m->m_len != 0 && M_LEADINGSPACE(m) >= GENET_SB_SIZE;
+    map->descs = map->parts - map->ncopy + !map->sb_inline;
+}
 
-    M_COPY_PKTHDR(m2, m);
+/*
+ * Checksum offload info for the TX status block. Offsets count from the
+ * start of the frame, past the status block, as in Linux. The stack has
+ * already put the pseudo header sum in the checksum field.
+ */
+static uint32_t genet_tx_csum_info(struct mbuf *m)
+{
+    const int flags = m->m_pkthdr.csum_flags;
+    const uint8_t *eh = mtod(m, const uint8_t *);
+    uint32_t info, start, off;
 
-    MCLGET(m2, M_DONTWAIT);
-    if ((m2->m_flags & M_EXT) == 0) {
-        m_freem(m2);
-        return NULL;
+    if (!(flags & (M_CSUM_TCPv4 | M_CSUM_UDPv4 | M_CSUM_TCPv6 | M_CSUM_UDPv6))) {
+        return 0;
     }
 
-    /* jumbo packets larger than cluster? */
-    if ((size_t) m->m_pkthdr.len > m2->m_ext.ext_size) {
-        m_freem(m2);
-        return NULL;
+    start = ETHER_HDR_LEN;
+    if (((eh[12] << 8) | eh[13]) == ETHERTYPE_VLAN) {
+        start += ETHER_VLAN_ENCAP_LEN;
     }
 
-    m_copydata(m, 0, m->m_pkthdr.len, mtod(m2, caddr_t));
-    m2->m_pkthdr.len = m2->m_len = m->m_pkthdr.len;
+    if (flags & (M_CSUM_TCPv4 | M_CSUM_UDPv4)) {
+        start += M_CSUM_DATA_IPv4_IPHL(m->m_pkthdr.csum_data);
+        off = M_CSUM_DATA_IPv4_OFFSET(m->m_pkthdr.csum_data);
+    } else {
+        start += M_CSUM_DATA_IPv6_HL(m->m_pkthdr.csum_data);
+        off = M_CSUM_DATA_IPv6_OFFSET(m->m_pkthdr.csum_data);
+    }
 
-    m_freem(m);
+    info = (start << GENET_SB_TX_CSUM_START_SHIFT) | (start + off) | GENET_SB_TX_CSUM_LV;
+    // a zero UDP checksum means none, the hardware sends 0xffff instead
+    if (flags & (M_CSUM_UDPv4 | M_CSUM_UDPv6)) {
+        info |= GENET_SB_TX_CSUM_PROTO_UDP;
+    }
 
-    return m2;
+    return info;
 }
 
-static void genet_tx(Genet *genet, struct mbuf *m, unsigned parts)
+/*
+ * Queue one frame laid out by genet_tx_map(). The caller has checked the
+ * ring has map->descs free slots; they are filled in order and handed to
+ * the DMA with a single producer index write.
+ */
+static void genet_tx(Genet *genet, genet_txq_t *txq, struct mbuf *m, const genet_tx_map_t *map)
 {
     uint32_t      flags = GENET_DMA_QTAG | GENET_DMA_DO_CRC | GENET_DMA_FIRST_PKT;
-    uint16_t     r_pidx = genet_reg_read(genet, GENET_TDMA_PRODUCER_INDEX);
+    uint16_t     r_pidx = txq->prod_idx;
     struct ifnet   *ifp = &genet->sc_ec.ec_if;
     uint8_t       *dptr = mtod(m, uint8_t *);
+    const unsigned flen = m->m_pkthdr.len;
+    const unsigned  pad = flen < 60 ? 60 - flen : 0;   // minimum 60-byte frame
+    unsigned      descs = map->descs;
+    struct mbuf     *m2 = m;
+    uint32_t  csum_info;
+    const uint64_t start = genet_perf_start(genet);
+    uint16_t        occ;
 
     if (dptr[0] & 1) {
         if (IS_BROADCAST(dptr))
-            genet->stats.txed_broadcast++;
+            txq->stats.broadcast++;
         else
-            genet->stats.txed_multicast++;
+            txq->stats.multicast++;
     }
+    txq->stats.bytes += flen;
+    txq->stats.packets++;
 
 #if NBPFILTER > 0
     // Pass this up to any BPF listeners
@@ -92,48 +264,341 @@ static void genet_tx(Genet *genet, struct mbuf *m, unsigned parts)
         bpf_mtap(ifp->if_bpf, m);
 #endif
 
-    // already checked that r_pidx + parts won't cross free_idx
-    unsigned len = 0;
-    for (struct mbuf *m2 = m; m2;) {
-        len += m2->m_len;
+    csum_info = genet_tx_csum_info(m);
+    if (csum_info) {
+        flags |= GENET_DMA_TX_DO_CSUM;
+        txq->stats.csum++;
+    }
+
+    if (map->sb_inline) {
+        m->m_data -= GENET_SB_SIZE;
+        m->m_len += GENET_SB_SIZE;
+        memcpy(mtod(m, uint8_t *) + GENET_SB_TX_CSUM_INFO, &csum_info, sizeof(csum_info));
+    } else {
+        Desc *const txdesc = &txq->d[r_pidx++ & (txq->size - 1)];
+        const unsigned slot = txdesc - genet->tx_d;
+        uint8_t *const hdr = genet->tx_hdr + slot * GENET_TX_HDR_SIZE;
+        const off64_t phys = genet->tx_hdr_phys + slot * GENET_TX_HDR_SIZE;
+        unsigned len = GENET_SB_SIZE, n;
+
+        memcpy(hdr + GENET_SB_TX_CSUM_INFO, &csum_info, sizeof(csum_info));
+        for (n = map->ncopy; n; m2 = m2->m_next) {
+            if (m2->m_len) {
+                memcpy(hdr + len, mtod(m2, uint8_t *), m2->m_len);
+                len += m2->m_len;
+                n--;
+            }
+        }
+        if (map->ncopy) {
+            txq->stats.hdr_frames++;
+            txq->stats.hdr_bytes += map->copylen;
+        }
+
+        txdesc->mb = NULL;
+        out32(txdesc->desc + GENET_DMA_DESC_ADDR_LSB, phys);
+        out32(txdesc->desc + GENET_DMA_DESC_ADDR_MSB, phys >> 32);
+
+        if (--descs != 0) {
+            out32(txdesc->desc + GENET_DMA_DESC_CNTRL, len << 16 | flags);
+            flags &= ~(GENET_DMA_FIRST_PKT | GENET_DMA_TX_DO_CSUM);
+        } else {
+            // all of it was copied, pad in the buffer and free the chain now
+            memset(hdr + len, 0, pad);
+            len += pad + 4;
+            flags |= GENET_DMA_LAST_PKT | GENET_DMA_APPEND_CRC;
+            out32(txdesc->desc + GENET_DMA_DESC_CNTRL, len << 16 | flags);
+            m_freem(m);
+        }
+    }
+
+    // slots were reserved by the caller, nothing here can run out
+    for (; descs; m2 = m2->m_next) {
         if (m2->m_len == 0) {
-            m2 = m_free(m2);
             continue;
         }
 
-        Desc *const txdesc = &genet->tx_d[r_pidx++ % GENET_RING_SIZE_MAX];
+        Desc *const txdesc = &txq->d[r_pidx++ & (txq->size - 1)];
 
-        txdesc->mb = m2;
+        // the whole chain is freed once its last segment is sent
+        txdesc->mb = descs == 1 ? m : NULL;
         const off64_t phys = mbuf_phys(m2);
 
         CACHE_FLUSH(&genet->cachectl, m2->m_data, phys, m2->m_len);
+        txq->stats.zc_segs++;
 
         out32(txdesc->desc + GENET_DMA_DESC_ADDR_LSB, phys);
         out32(txdesc->desc + GENET_DMA_DESC_ADDR_MSB, phys >> 32);
 
-        if (--parts != 0) {
+        if (--descs != 0) {
             out32(txdesc->desc + GENET_DMA_DESC_CNTRL, m2->m_len << 16 | flags);
-            flags &= ~GENET_DMA_FIRST_PKT; // SOP only on first segment
+            flags &= ~(GENET_DMA_FIRST_PKT | GENET_DMA_TX_DO_CSUM); // SOP only on first segment
         } else {
-            genet->stats.octets_txed_ok += len;
-            genet->stats.txed_ok++;
             // adjust last length for minimum 60-byte frame
             // also adjust last length for appending crc
-            len = len < 60 ? 60 - (len - (unsigned) m2->m_len) + 4 : (unsigned) m2->m_len + 4;
             flags |= GENET_DMA_LAST_PKT | GENET_DMA_APPEND_CRC;
-            out32(txdesc->desc + GENET_DMA_DESC_CNTRL, len << 16 | flags);
+            out32(txdesc->desc + GENET_DMA_DESC_CNTRL, (m2->m_len + pad + 4) << 16 | flags);
         }
-        m2 = m2->m_next;
     }
 
-    genet_reg_write(genet, GENET_TDMA_PRODUCER_INDEX, r_pidx); // p_idx updated only by genet_tx
+    // tx_hdr is uncached but write buffered, drain it before the doorbell
+    genet_wmb();
+
+    // p_idx updated only by genet_tx
+    txq->prod_idx = r_pidx;
+    genet_reg_write(genet, GENET_RING_REG(GENET_TDMA_PRODUCER_INDEX, txq->ring), r_pidx);
+
+    if (genet->perf) {
+        occ = r_pidx - txq->free_idx;
+        txq->perf.occ_sum += occ;
+        if (occ > txq->perf.occ_max) {
+            txq->perf.occ_max = occ;
+        }
+    }
+    genet_perf_end(genet, &txq->perf.tx, start, GENET_TRACE_TX(txq->index), map->descs);
 }
 
+/*
+ * Driver side TSO: cut a TSOv4 send into MSS sized frames. Each frame
+ * gets a copy of the headers in its own small mbuf and references the
+ * payload clusters with m_copym(), so the payload is not copied. TCP
+ * checksums are left to the hardware; the IPv4 header sum is 20 bytes
+ * and done here. Returns the frames linked by m_nextpkt, or NULL if the
+ * send had to be dropped. The send is freed either way.
+ */
+static struct mbuf *genet_tso(struct mbuf *m)
+{
+    uint8_t hdr[GENET_TSO_HDR_MAX];
+    struct mbuf *head = NULL, **tail = &head, *n;
+    unsigned ehlen, iphlen, thlen, hlen, plen, off, seglen, mss, seg;
+    uint32_t seq, sum;
+    uint16_t id;
+    uint8_t *ip, *th, th_flags;
+
+    ehlen = ETHER_HDR_LEN;
+    mss = m->m_pkthdr.segsz;
+    if (m->m_pkthdr.len < ETHER_HDR_LEN + 40 || mss == 0) {
+        goto drop;
+    }
+
+    m_copydata(m, 0, m->m_pkthdr.len < (int) sizeof(hdr) ? m->m_pkthdr.len : (int) sizeof(hdr),
+            (caddr_t) hdr);
+    if (((hdr[12] << 8) | hdr[13]) == ETHERTYPE_VLAN) {
+        ehlen += ETHER_VLAN_ENCAP_LEN;
+    }
+    ip = hdr + ehlen;
+    iphlen = (ip[0] & 0xF) << 2;
+    if ((ip[0] >> 4) != 4 || iphlen < 20 || ip[9] != IPPROTO_TCP) {
+        goto drop;
+    }
+    th = ip + iphlen;
+    thlen = (th[12] >> 4) << 2;
+    hlen = ehlen + iphlen + thlen;
+    if (thlen < 20 || hlen > sizeof(hdr) || hlen > MHLEN || hlen > (unsigned) m->m_pkthdr.len) {
+        goto drop;
+    }
+
+    plen = m->m_pkthdr.len - hlen;
+    seq = (th[4] << 24) | (th[5] << 16) | (th[6] << 8) | th[7];
+    id = (ip[4] << 8) | ip[5];
+    th_flags = th[13];
+
+    for (off = 0, seg = 0; off < plen; off += seglen, seg++) {
+        const unsigned tot = iphlen + thlen + (seglen = plen - off < mss ? plen - off : mss);
+        uint8_t *nip, *nth;
+
+        MGETHDR(n, M_DONTWAIT, MT_DATA);
+        if (n == NULL) {
+            goto fail;
+        }
+        MH_ALIGN(n, hlen);
+        memcpy(mtod(n, uint8_t *), hdr, hlen);
+        n->m_len = hlen;
+        n->m_pkthdr.len = hlen + seglen;
+        if ((n->m_next = m_copym(m, hlen + off, seglen, M_DONTWAIT)) == NULL) {
+            m_freem(n);
+            goto fail;
+        }
+
+        nip = mtod(n, uint8_t *) + ehlen;
+        nth = nip + iphlen;
+
+        nip[2] = tot >> 8;
+        nip[3] = tot;
+        nip[4] = (id + seg) >> 8;
+        nip[5] = (id + seg);
+        nip[10] = nip[11] = 0;
+        sum = ~genet_csum_fold(genet_csum_add(0, nip, iphlen));
+        nip[10] = sum >> 8;
+        nip[11] = sum;
+
+        nth[4] = (seq + off) >> 24;
+        nth[5] = (seq + off) >> 16;
+        nth[6] = (seq + off) >> 8;
+        nth[7] = (seq + off);
+        // FIN and PSH only on the last frame, CWR only on the first
+        nth[13] = th_flags;
+        if (off + seglen < plen) {
+            nth[13] &= ~(TH_FIN | TH_PUSH);
+        }
+        if (seg) {
+            nth[13] &= ~TH_CWR;
+        }
+        // pseudo header sum, the hardware adds the segment
+        sum = genet_csum_fold(genet_csum_add(IPPROTO_TCP + thlen + seglen, nip + 12, 8));
+        nth[16] = sum >> 8;
+        nth[17] = sum;
+
+        n->m_pkthdr.csum_flags = M_CSUM_TCPv4;
+        n->m_pkthdr.csum_data = (iphlen << 16) | 16;    // th_sum
+
+        *tail = n;
+        tail = &n->m_nextpkt;
+    }
+
+    m_freem(m);
+    return head;
+
+fail:
+    while ((n = head) != NULL) {
+        head = n->m_nextpkt;
+        m_freem(n);
+    }
+drop:
+    m_freem(m);
+    return NULL;
+}
+
+/*
+ * The TX ring has no timeout to go with its frame threshold, so with
+ * tx_coal.frames > 1 the last completions of a burst would wait for the
+ * next one. While descriptors are in flight on queue 0 the tx_callout
+ * raises the TX done cause every tx_coal.usecs, at the callout's
+ * millisecond resolution, and the interrupt path reaps them as usual.
+ */
+static void genet_tx_flush(void *arg);
+
+/* Called after posting descriptors to queue 0 */
+static void genet_tx_flush_arm(Genet *genet)
+{
+    if (genet->tx_coal.frames <= 1) {
+        return;
+    }
+
+    // either we see the callout's cleared flag, or it sees our descriptors
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!genet->tx_flush_armed) {
+        genet->tx_flush_armed = 1;
+        callout_msec(&genet->tx_callout, (genet->tx_coal.usecs + 999) / 1000,
+                genet_tx_flush, genet);
+    }
+}
+
+static void genet_tx_flush(void *arg)
+{
+    Genet *genet = arg;
+    genet_txq_t *txq = &genet->txq[0];
+
+    genet->tx_flush_armed = 0;
+
+    // pairs with the fence in genet_tx_flush_arm()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (txq->free_idx != txq->prod_idx) {
+        genet_reg_write(genet, GENET_INTRL2_0_CPU_SET, GENET_INTRL2_TX_DONE);
+        genet_tx_flush_arm(genet);
+    }
+}
+
+static void genet_tx_free_list(struct mbuf *m)
+{
+    struct mbuf *n;
+
+    for (; m != NULL; m = n) {
+        n = m->m_nextpkt;
+        m->m_nextpkt = NULL;
+        m_freem(m);
+    }
+}
+
+/* Drop frames and TSO segments still waiting for ring space, with if_snd_ex held */
+void genet_tx_purge(Genet *genet)
+{
+    unsigned q;
+
+    genet_tx_free_list(genet->tx_gso);
+    genet->tx_gso = NULL;
+    for (q = 0; q < genet->num_txq; q++) {
+        genet_tx_free_list(genet->txq[q].held);
+        genet->txq[q].held = genet->txq[q].held_last = NULL;
+        genet->txq[q].held_cnt = 0;
+        genet->txq[q].full = 0;
+    }
+}
+
+/*
+ * Is there room for descs more descriptors? If not the ring is marked
+ * full for genet_tx_reap() to restart us, and checked once more in case
+ * the reaper freed slots before it could see the mark.
+ */
+static int genet_tx_room(genet_txq_t *txq, unsigned descs)
+{
+    if (descs <= genet_tx_avail(txq)) {
+        return 1;
+    }
+    if (!txq->full) {
+        txq->full = 1;
+        txq->stats.ring_full++;
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (descs > genet_tx_avail(txq)) {
+        return 0;
+    }
+    txq->full = 0;
+    return 1;
+}
+
+/* Park a frame, or the rest of a TSO send, behind those held for its ring */
+static void genet_tx_hold(genet_txq_t *txq, struct mbuf *m)
+{
+    if (txq->held == NULL) {
+        txq->held = m;
+    } else {
+        txq->held_last->m_nextpkt = m;
+    }
+    for (txq->held_cnt++; m->m_nextpkt != NULL; m = m->m_nextpkt) {
+        txq->held_cnt++;
+    }
+    txq->held_last = m;
+}
+
+static int genet_tx_all_full(Genet *genet)
+{
+    unsigned q;
+
+    for (q = 0; q < genet->num_txq; q++) {
+        if (!genet->txq[q].full) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Called with if_snd_ex held, returns with it released. A frame whose
+ * ring is full is held for that ring, so frames for the other rings keep
+ * going, and genet_tx_reap() restarts us once the ring has room. Only
+ * when every ring is full, or the head of if_snd waits for a ring that
+ * already holds GENET_TX_HELD_MAX frames, is IFF_OACTIVE set.
+ */
 void genet_start(struct ifnet *ifp)
 {
     struct nw_work_thread *wtp = WTP;
     Genet *genet = ifp->if_softc;
-    struct mbuf *m, *m2;
+    genet_txq_t *txq;
+    genet_tx_map_t map;
+    struct mbuf *m;
+    unsigned q;
+    int blocked = 0;
 
     /* Transmit only if the link is up */
     if (!(ifp->if_flags_tx & IFF_RUNNING) || (genet->cfg.flags & NIC_FLAG_LINK_DOWN)) {
@@ -141,61 +606,100 @@ void genet_start(struct ifnet *ifp)
         return;
     }
 
-    ifp->if_flags_tx |= IFF_OACTIVE;
+    // held frames go first, in the order they were queued
+    for (q = 0; q < genet->num_txq; q++) {
+        txq = &genet->txq[q];
+        while ((m = txq->held) != NULL) {
+            genet_tx_map(m, &map);
+            if (!genet_tx_room(txq, map.descs)) {
+                break;
+            }
+            if ((txq->held = m->m_nextpkt) == NULL) {
+                txq->held_last = NULL;
+            }
+            txq->held_cnt--;
+            m->m_nextpkt = NULL;
+            genet_tx(genet, txq, m, &map);
+            ifp->if_opackets++;
+        }
+    }
 
     for (;;) {
-        IFQ_POLL(&ifp->if_snd, m);
-        if (m == NULL)
-            break;
+        // finish a TSO send before taking anything new off the queue
+        if ((m = genet->tx_gso) == NULL) {
+            IFQ_POLL(&ifp->if_snd, m);
+            if (m == NULL)
+                break;
 
-        // Count the non-zero-length mbufs
-        //why are zero-length mbufs present?
-        unsigned parts = 0;
-        for (m2 = m; m2; m2 = m2->m_next) {
-            if (m2->m_len)
-                parts++;
+            if (m->m_pkthdr.csum_flags & M_CSUM_TSOv4) {
+                IFQ_DEQUEUE(&ifp->if_snd, m);
+                txq = genet_tx_queue(genet, m);
+                if ((genet->tx_gso = genet_tso(m)) == NULL) {
+                    ifp->if_oerrors++; // dropped frame
+                    continue;
+                }
+                txq->stats.gso++;
+                for (m = genet->tx_gso; m; m = m->m_nextpkt) {
+                    txq->stats.gso_segs++;
+                }
+                continue;
+            }
         }
 
-        // try brief delay before allocating new buffer and copying old buffers
-        const uint16_t p_idx = genet_reg_read(genet, GENET_TDMA_PRODUCER_INDEX);
-        unsigned tries = 10;
+        genet_tx_map(m, &map);
 
-        for (;;) {
-            uint16_t in_use = p_idx - genet->free_idx;
-            uint16_t free = GENET_RING_SIZE_MAX - in_use;
+        txq = genet_tx_queue(genet, m);
+        if (map.descs > txq->size) {
+            // too many segments for a priority ring, try the default ring
+            txq = &genet->txq[0];
+        }
 
-            if (parts > free && tries--) {
-                usleep(14); // assume 60k+ packets/second?
-            } else {
+        if (map.parts != 0 && map.descs <= txq->size
+                && (txq->held != NULL || !genet_tx_room(txq, map.descs))) {
+            // no ring to pass to, or too many held already: leave it queued
+            if (genet_tx_all_full(genet)
+                    || (txq->held_cnt >= GENET_TX_HELD_MAX && m != genet->tx_gso)) {
+                blocked = 1;
                 break;
             }
+            if (m == genet->tx_gso) {
+                genet->tx_gso = NULL;
+            } else {
+                IFQ_DEQUEUE(&ifp->if_snd, m);
+            }
+            genet_tx_hold(txq, m);
+            txq->stats.held++;
+            continue;
         }
 
         // commit to transmitting or dropping this frame
-        IFQ_DEQUEUE(&ifp->if_snd, m);
-
-        if (!tries) {
-            // defrag if after retries there is a slot free
-            uint16_t in_use = p_idx - genet->free_idx;
-            uint16_t free = GENET_RING_SIZE_MAX - in_use;
+        if (m == genet->tx_gso) {
+            genet->tx_gso = m->m_nextpkt;
+            m->m_nextpkt = NULL;
+        } else {
+            IFQ_DEQUEUE(&ifp->if_snd, m);
+        }
 
-            if (free && (m2 = genet_defrag(m))) {
-                m_freem(m);
-                m = m2;
-                parts = 1;
-            } else {
-                genet->stats.tx_failed_allocs++;
-                ifp->if_oerrors++; // dropped frame
-                m_freem(m);
-                continue;
-           }
+        if (map.parts == 0 || map.descs > txq->size) {
+            if (map.parts != 0) {
+                txq->stats.too_long++;
+            }
+            ifp->if_oerrors++; // dropped frame
+            m_freem(m);
+            continue;
         }
 
-        genet_tx(genet, m, parts);
+        genet_tx(genet, txq, m, &map);
         ifp->if_opackets++;  // for ifconfig -v
     }
 
-    ifp->if_flags_tx &= ~IFF_OACTIVE;
+    if (blocked || genet_tx_all_full(genet)) {
+        ifp->if_flags_tx |= IFF_OACTIVE;
+    }
+    if (genet->txq[0].free_idx != genet->txq[0].prod_idx) {
+        genet_tx_flush_arm(genet);
+    }
+
     NW_SIGUNLOCK_P(&ifp->if_snd_ex, genet->iopkt, wtp);
 }
 
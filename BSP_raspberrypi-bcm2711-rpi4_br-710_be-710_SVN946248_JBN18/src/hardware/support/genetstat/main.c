@@ -0,0 +1,260 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+/*
+ * Samples the devnp-genet SIOCGDRVSPEC statistics twice and prints the
+ * rates in between, for tuning the coalescing and ring sizes. Stage
+ * times are converted with the cycles_per_sec the driver returns.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/sockio.h>
+#include <net/if.h>
+#include <hw/genet_stats.h>
+
+typedef struct sample_t
+{
+    genet_perf_stats_t      perf;
+    genet_queue_stats_t     queue;
+    genet_intr_stats_t      intr;
+    genet_coal_stats_t      coal;
+    genet_rx_pool_stats_t   pool[GENET_MAX_QUEUES];
+} sample_t;
+
+static const char *ifname = "genet0";
+static int hist_flag;
+
+static int drvspec(int s, unsigned long req, unsigned long cmd, void *buf, size_t len)
+{
+    struct ifdrv    ifd;
+
+    memset(&ifd, 0, sizeof(ifd));
+    strlcpy(ifd.ifd_name, ifname, sizeof(ifd.ifd_name));
+    ifd.ifd_cmd = cmd;
+    ifd.ifd_len = len;
+    ifd.ifd_data = buf;
+
+    if (ioctl(s, req, &ifd) == -1) {
+        fprintf(stderr, "%s: drvspec 0x%lx: %s\n", ifname, cmd, strerror(errno));
+        return errno;
+    }
+    return EOK;
+}
+
+static int sample(int s, sample_t *smp)
+{
+    int status;
+
+    if ((status = drvspec(s, SIOCGDRVSPEC, GENET_GET_PERF_STATS, &smp->perf, sizeof(smp->perf))) ||
+        (status = drvspec(s, SIOCGDRVSPEC, GENET_GET_QUEUE_STATS, &smp->queue, sizeof(smp->queue))) ||
+        (status = drvspec(s, SIOCGDRVSPEC, GENET_GET_INTR_STATS, &smp->intr, sizeof(smp->intr))) ||
+        (status = drvspec(s, SIOCGDRVSPEC, GENET_GET_COAL_STATS, &smp->coal, sizeof(smp->coal))) ||
+        (status = drvspec(s, SIOCGDRVSPEC, GENET_GET_RX_POOL_STATS, smp->pool, sizeof(smp->pool)))) {
+        return status;
+    }
+    return EOK;
+}
+
+/* Counters are free running, unsigned differences survive a wrap */
+#define D32(a, b, f)    ((uint32_t)((b)->f - (a)->f))
+#define D64(a, b, f)    ((uint64_t)((b)->f - (a)->f))
+
+static double per(double n, double d)
+{
+    return d ? n / d : 0;
+}
+
+/* Average and max ns of a stage over the interval, and its share of one CPU */
+static void print_stage(const char *name, const genet_stage_t *a, const genet_stage_t *b,
+        double cps, uint64_t cycles)
+{
+    uint32_t calls = D32(a, b, calls);
+    uint64_t spent = D64(a, b, cycles);
+
+    printf("  %-8s %10.0f/s  avg %8.0f ns  max %8.0f ns  cpu %5.1f%%\n", name,
+            per(calls, cycles / cps), per(spent, calls) * 1e9 / cps,
+            b->max_cycles * 1e9 / cps, per(spent, cycles) * 100);
+}
+
+static void print_hist(const char *name, const uint32_t *a, const uint32_t *b)
+{
+    int bin;
+
+    printf("  %-8s", name);
+    for (bin = 0; bin < GENET_PERF_HIST; bin++) {
+        printf(" %s%u:%u", bin == GENET_PERF_HIST - 1 ? ">=" : "",
+                bin < 2 ? (unsigned)bin : 1U << (bin - 1), b[bin] - a[bin]);
+    }
+    printf("\n");
+}
+
+static void report(const sample_t *a, const sample_t *b)
+{
+    const genet_q_stats_t   *qa;
+    const genet_q_stats_t   *qb;
+    const genet_perf_stats_t *pa;
+    const genet_perf_stats_t *pb;
+    uint64_t                cycles;
+    double                  cps;
+    double                  secs;
+    uint32_t                wakeups;
+    unsigned                q;
+
+    pa = &a->perf;
+    pb = &b->perf;
+    cps = pb->cycles_per_sec;
+    cycles = pb->timestamp - pa->timestamp;
+    secs = cycles / cps;
+    wakeups = D32(&a->intr, &b->intr, wakeups);
+
+    printf("%s over %.2f s\n", ifname, secs);
+
+    printf("Interrupts %.0f/s  spurious %u  wakeups %.0f/s  causes per wakeup %.2f\n",
+            D32(&a->intr, &b->intr, interrupts) / secs, D32(&a->intr, &b->intr, spurious),
+            wakeups / secs, per(D32(&a->intr, &b->intr, rx) + D32(&a->intr, &b->intr, tx) +
+            D32(&a->intr, &b->intr, link), wakeups));
+
+    printf("Coalescing rx %s %u us %u frames, tx %s %u frames %u us, profile changes rx %u tx %u\n",
+            b->coal.rx_adaptive ? "adaptive" : "fixed", b->coal.rx_usecs, b->coal.rx_frames,
+            b->coal.tx_adaptive ? "adaptive" : "fixed", b->coal.tx_frames, b->coal.tx_usecs,
+            D32(&a->coal, &b->coal, rx_changes), D32(&a->coal, &b->coal, tx_changes));
+    printf("  rx %.1f frames/interrupt  tx %.1f frames/interrupt  budget %u\n",
+            per(D32(&a->coal, &b->coal, rx_packets), D32(&a->coal, &b->coal, rx_interrupts)),
+            per(D32(&a->coal, &b->coal, tx_packets), D32(&a->coal, &b->coal, tx_interrupts)),
+            b->coal.rx_budget);
+
+    for (q = 0; q < b->queue.rx_queues && q < GENET_MAX_QUEUES; q++) {
+        qa = &a->queue.rx[q];
+        qb = &b->queue.rx[q];
+        printf("RX %u  %10.0f pkts/s  %8.2f MB/s  %8.0f polls/s  %.1f frames/poll  budget exhausted %u\n",
+                q, D32(qa, qb, packets) / secs, D64(qa, qb, bytes) / secs / 1e6,
+                D32(qa, qb, polls) / secs, per(D32(qa, qb, packets), D32(qa, qb, polls)),
+                D32(qa, qb, budget_exhausted));
+        printf("  pool %u/%u  refills %u  low hits %u  exhausted %u  alloc failed %u\n",
+                b->pool[q].count, b->pool[q].size, D32(&a->pool[q], &b->pool[q], refills),
+                D32(&a->pool[q], &b->pool[q], low_hits), D32(&a->pool[q], &b->pool[q], exhausted),
+                D32(&a->pool[q], &b->pool[q], alloc_failed));
+        if (pb->enabled) {
+            print_stage("poll", &pa->rx[q].poll, &pb->rx[q].poll, cps, cycles);
+            printf("  ring     avg %.1f filled at poll, max %u\n",
+                    per(D64(&pa->rx[q], &pb->rx[q], occ_sum), D32(&pa->rx[q].poll, &pb->rx[q].poll, calls)),
+                    pb->rx[q].occ_max);
+            if (hist_flag) {
+                print_hist("frames", pa->rx[q].frames, pb->rx[q].frames);
+            }
+        }
+    }
+
+    for (q = 0; q < b->queue.tx_queues && q < GENET_MAX_QUEUES; q++) {
+        qa = &a->queue.tx[q];
+        qb = &b->queue.tx[q];
+        printf("TX %u  %10.0f pkts/s  %8.2f MB/s  ring full %u  restarts %u  held %u  dropped %u\n",
+                q, D32(qa, qb, packets) / secs, D64(qa, qb, bytes) / secs / 1e6,
+                D32(qa, qb, ring_full), D32(qa, qb, restarts), D32(qa, qb, held),
+                D32(qa, qb, too_long));
+        if (pb->enabled) {
+            print_stage("send", &pa->tx[q].tx, &pb->tx[q].tx, cps, cycles);
+            print_stage("reap", &pa->tx[q].reap, &pb->tx[q].reap, cps, cycles);
+            printf("  ring     avg %.1f in flight after a send, max %u\n",
+                    per(D64(&pa->tx[q], &pb->tx[q], occ_sum), D32(&pa->tx[q].tx, &pb->tx[q].tx, calls)),
+                    pb->tx[q].occ_max);
+            if (hist_flag) {
+                print_hist("reaped", pa->tx[q].reaped, pb->tx[q].reaped);
+            }
+        }
+    }
+
+    if (pb->enabled) {
+        printf("ISR\n");
+        print_stage("isr0", &pa->isr0, &pb->isr0, cps, cycles);
+        print_stage("isr1", &pa->isr1, &pb->isr1, cps, cycles);
+        printf("(max since the counters were last cleared)\n");
+    }
+    else {
+        printf("Stage timing off, start the driver with perf=1\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    sample_t    a;
+    sample_t    b;
+    unsigned    interval;
+    int         clear;
+    int         opt;
+    int         s;
+    int         status;
+
+    interval = 1;
+    clear = 0;
+
+    while ((opt = getopt(argc, argv, "i:rH")) != -1) {
+        switch (opt) {
+            case 'i':
+                interval = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                clear = 1;
+                break;
+            case 'H':
+                hist_flag = 1;
+                break;
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind < argc) {
+        ifname = argv[optind];
+    }
+
+    if ((s = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+        fprintf(stderr, "socket: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if ((status = sample(s, &a)) == EOK) {
+        sleep(interval ? interval : 1);
+        if ((status = sample(s, &b)) == EOK) {
+            report(&a, &b);
+        }
+    }
+
+    if (status == EOK && clear) {
+        status = drvspec(s, SIOCSDRVSPEC, GENET_CLR_PERF_STATS, NULL, 0);
+    }
+
+    close(s);
+
+    return status == EOK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#if defined(__QNXNTO__) && defined(__USESRCVERSION)
+#include <sys/srcversion.h>
+__SRCVERSION("$URL$ $Rev$")
+#endif
@@ -0,0 +1,3 @@
+define PINFO
+PINFO DESCRIPTION=GENET ethernet driver statistics utility
+endef
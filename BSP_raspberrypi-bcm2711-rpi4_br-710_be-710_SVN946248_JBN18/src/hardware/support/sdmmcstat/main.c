@@ -0,0 +1,262 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2020, QNX Software Systems.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You
+ * may not reproduce, modify or distribute this software except in
+ * compliance with the License. You may obtain a copy of the License
+ * at: http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OF ANY KIND, either express or implied.
+ *
+ * This file may contain contributions from others, either as
+ * contributors under the License or as licensors under other terms.
+ * Please review this entire file for other proprietary rights or license
+ * notices, as well as the QNX Development Suite License Guide at
+ * http://licensing.qnx.com/license-guide/ for other information.
+ * $
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <devctl.h>
+#include <sys/dcmd_cam.h>
+#include <hw/dcmd_sim_sdmmc.h>
+
+static const char *phase_names[SDMMC_PHASES] = { "queue", "setup", "xfer", "busy" };
+
+static int hist_flag;
+
+static void print_hist( const char *indent, const uint32_t *hist, int bins, uint32_t base, const char *unit )
+{
+	int		bin;
+
+	for( bin = 0; bin < bins; bin++ ) {
+		if( hist[bin] == 0 ) {
+			continue;
+		}
+		if( bin == bins - 1 ) {
+			printf( "%s%8u%s+ %10u\n", indent, base << bin, unit, hist[bin] );
+		}
+		else {
+			printf( "%s%8u%s  %10u\n", indent, base << bin, unit, hist[bin] );
+		}
+	}
+}
+
+static void print_op( const SDMMC_OP_STATS *os )
+{
+	const SDMMC_LAT_HIST	*lh;
+	int						ph;
+
+	if( os->opcode & SDMMC_OP_ACMD ) {
+		printf( "ACMD%-3u", os->opcode & ~SDMMC_OP_ACMD );
+	}
+	else {
+		printf( "CMD%-4u", os->opcode );
+	}
+	printf( " errors %u\n", os->errors );
+
+	for( ph = 0; ph < SDMMC_PHASES; ph++ ) {
+		lh = &os->lat[ph];
+		if( lh->count == 0 ) {
+			continue;
+		}
+		printf( "  %-6s count %10u  avg %8" PRIu64 " us  max %8u us\n",
+				phase_names[ph], lh->count, lh->total_us / lh->count, lh->max_us );
+		if( hist_flag ) {
+			print_hist( "          ", lh->hist, SDMMC_LAT_BINS, 1, " us" );
+		}
+	}
+
+	if( hist_flag ) {
+		printf( "  bytes (up to)\n" );
+		print_hist( "          ", os->bytes, SDMMC_BYTE_BINS, 512, "   " );
+	}
+}
+
+static int cmd_stats( int fd, uint32_t action )
+{
+	SDMMC_CMD_STATS		*cs;
+	int					idx;
+	int					status;
+
+	if( ( cs = calloc( 1, sizeof( *cs ) ) ) == NULL ) {
+		return( ENOMEM );
+	}
+
+	cs->action = action;
+	if( ( status = devctl( fd, DCMD_SDMMC_CMD_STATS, cs, sizeof( *cs ), NULL ) ) != EOK ) {
+		fprintf( stderr, "DCMD_SDMMC_CMD_STATS: %s\n", strerror( status ) );
+		free( cs );
+		return( status );
+	}
+
+	printf( "Command statistics %s\n", ( cs->flags & SDMMC_CMD_STATS_ENABLED ) ? "enabled" : "disabled" );
+	printf( "  resets %u  retunes %u  tunings %u (%u failed)  overflow %u\n\n", cs->resets, cs->retunes, cs->tunes, cs->tune_fails, cs->overflow );
+
+	for( idx = 0; idx < cs->nops && idx < SDMMC_STATS_OPS; idx++ ) {
+		print_op( &cs->ops[idx] );
+	}
+
+	free( cs );
+
+	return( EOK );
+}
+
+static int busy_stats( int fd, uint32_t action )
+{
+	SDMMC_BUSY_STATS	bs;
+	int					status;
+
+	memset( &bs, 0, sizeof( bs ) );
+	bs.action = action;
+	if( ( status = devctl( fd, DCMD_SDMMC_BUSY_STATS, &bs, sizeof( bs ), NULL ) ) != EOK ) {
+		fprintf( stderr, "DCMD_SDMMC_BUSY_STATS: %s\n", strerror( status ) );
+		return( status );
+	}
+
+	printf( "\nWrite busy (%s)\n", ( bs.flags & SDMMC_BUSY_HW ) ? "hw" : "polled" );
+	printf( "  waits %" PRIu64 "  avg %" PRIu64 " us  max %" PRIu64 " us\n",
+			bs.waits, bs.waits ? bs.total_us / bs.waits : 0, bs.max_us );
+
+	return( EOK );
+}
+
+static int ra_stats( int fd, uint32_t action )
+{
+	SDMMC_RA_STATS		rs;
+	int					status;
+
+	memset( &rs, 0, sizeof( rs ) );
+	rs.action = action;
+	if( ( status = devctl( fd, DCMD_SDMMC_RA_STATS, &rs, sizeof( rs ), NULL ) ) != EOK ) {
+		fprintf( stderr, "DCMD_SDMMC_RA_STATS: %s\n", strerror( status ) );
+		return( status );
+	}
+
+	printf( "\nRead-ahead %u x %u bytes, %u now\n", rs.nbufs, rs.buf_size, rs.cur_size );
+	printf( "  hits %" PRIu64 " (%" PRIu64 " bytes)  misses %" PRIu64 "  fills %" PRIu64 " (%" PRIu64 " bytes)  invalidates %" PRIu64 "  backoffs %" PRIu64 "\n",
+			rs.hits, rs.hit_bytes, rs.misses, rs.fills, rs.fill_bytes, rs.invalidates, rs.backoffs );
+
+	return( EOK );
+}
+
+static int discard_stats( int fd, uint32_t action )
+{
+	SDMMC_DISCARD_STATS	ds;
+	int					status;
+
+	memset( &ds, 0, sizeof( ds ) );
+	ds.action = action;
+	if( ( status = devctl( fd, DCMD_SDMMC_DISCARD_STATS, &ds, sizeof( ds ), NULL ) ) != EOK ) {
+		fprintf( stderr, "DCMD_SDMMC_DISCARD_STATS: %s\n", strerror( status ) );
+		return( status );
+	}
+
+	printf( "\nDiscard (%s)\n", ( ds.flags & SDMMC_DISCARD_DEFERRED ) ? "deferred" : "immediate" );
+	printf( "  pending %u (%" PRIu64 " blocks)  deferred %" PRIu64 "  merged %" PRIu64 "  clipped %" PRIu64 "\n",
+			ds.pending, ds.pending_blks, ds.ranges, ds.merged, ds.clipped );
+	printf( "  erases %" PRIu64 " (%" PRIu64 " blocks)  avg %" PRIu64 " us  max %" PRIu64 " us\n",
+			ds.erases, ds.erase_blks, ds.erases ? ds.erase_us / ds.erases : 0, ds.max_us );
+	printf( "  preempted %" PRIu64 "  flushed %" PRIu64 "  overflows %" PRIu64 "  errors %" PRIu64 "\n",
+			ds.preempted, ds.flushed, ds.overflows, ds.errors );
+
+	return( EOK );
+}
+
+int main( int argc, char *argv[] )
+{
+	const char		*path;
+	uint32_t		action;
+	int				busy;
+	int				ra;
+	int				discard;
+	int				fd;
+	int				opt;
+	int				status;
+	SDMMC_CMD_STATS	cs;
+
+	action	= SDMMC_STATS_ACTION_GET;
+	busy	= 0;
+	ra		= 0;
+	discard	= 0;
+
+	while( ( opt = getopt( argc, argv, "edrHbat" ) ) != -1 ) {
+		switch( opt ) {
+			case 'e':
+				action = SDMMC_STATS_ACTION_ENABLE;
+				break;
+			case 'd':
+				action = SDMMC_STATS_ACTION_DISABLE;
+				break;
+			case 'r':
+				action = SDMMC_STATS_ACTION_RESET;
+				break;
+			case 'H':
+				hist_flag = 1;
+				break;
+			case 'b':
+				busy = 1;
+				break;
+			case 'a':
+				ra = 1;
+				break;
+			case 't':
+				discard = 1;
+				break;
+			default:
+				return( EXIT_FAILURE );
+		}
+	}
+
+	path = ( optind < argc ) ? argv[optind] : "/dev/hd0";
+
+	if( ( fd = open( path, O_RDONLY ) ) == -1 ) {
+		fprintf( stderr, "%s: %s\n", path, strerror( errno ) );
+		return( EXIT_FAILURE );
+	}
+
+	if( action == SDMMC_STATS_ACTION_ENABLE || action == SDMMC_STATS_ACTION_DISABLE ) {
+		memset( &cs, 0, sizeof( cs ) );
+		cs.action = action;
+		if( ( status = devctl( fd, DCMD_SDMMC_CMD_STATS, &cs, sizeof( cs ), NULL ) ) != EOK ) {
+			fprintf( stderr, "DCMD_SDMMC_CMD_STATS: %s\n", strerror( status ) );
+		}
+		else {
+			printf( "Command statistics %s\n", ( cs.flags & SDMMC_CMD_STATS_ENABLED ) ? "enabled" : "disabled" );
+		}
+		close( fd );
+		return( status == EOK ? EXIT_SUCCESS : EXIT_FAILURE );
+	}
+
+	status = cmd_stats( fd, action );
+
+	if( status == EOK && busy ) {
+		status = busy_stats( fd, action );
+	}
+
+	if( status == EOK && ra ) {
+		status = ra_stats( fd, action );
+	}
+
+	if( status == EOK && discard ) {
+		status = discard_stats( fd, action );
+	}
+
+	close( fd );
+
+	return( status == EOK ? EXIT_SUCCESS : EXIT_FAILURE );
+}
+
+#if defined(__QNXNTO__) && defined(__USESRCVERSION)
+#include <sys/srcversion.h>
+__SRCVERSION("$URL$ $Rev$")
+#endif
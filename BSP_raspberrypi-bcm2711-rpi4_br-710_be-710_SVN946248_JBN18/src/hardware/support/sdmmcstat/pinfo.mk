@@ -0,0 +1,3 @@
+define PINFO
+PINFO DESCRIPTION=SD/MMC command latency statistics utility
+endef
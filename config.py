@@ -6,7 +6,15 @@ config.read('config.ini')
 seed_len_128f = int(config['Signing']['seed_len_128f'])
 seed_len_192f = int(config['Signing']['seed_len_192f'])
 seed_len_256f = int(config['Signing']['seed_len_256f'])
+sign_mode = config['Signing']['mode']
+prehash_chunk_size = int(config['Signing']['prehash_chunk_size'])
+prehash_workers = int(config['Signing']['prehash_workers'])
+threads = int(config['Signing']['threads'])
 pem_key_folder = config['Paths']['pem_key_folder']
+cache_enabled = config['Cache'].getboolean('enabled')
+cache_db_path = config['Cache']['db_path']
+cache_key_path = config['Cache']['key_path']
+cache_ttl = int(config['Cache']['ttl'])
 
 menu:str = """
 SPHINCS SIGNATURE GENERATOR
@@ -1,135 +1,221 @@
 import config
+import contextlib
+import hashlib
+import mmap
 import os
-import pyspx.shake_128f
-import pyspx.shake_192f
-import pyspx.shake_256f
-import pyspx.sha2_128f
-import pyspx.sha2_192f
-import pyspx.sha2_256f
-import pyspx.haraka_128f
-import pyspx.haraka_192f
-import pyspx.haraka_256f
+import prehash
+import spx_native
+import stat
 import secrets
+import verify_cache
+from concurrent.futures import ThreadPoolExecutor
 
 
-def prepare_signature(message: bytes, type: str):
-    seed = ' '
-
-    public_key, secret_key, signature = ' ', ' ', ' '
-    if type=='shake_128f':
-        seed = secrets.token_bytes(config.seed_len_128f)
-        public_key, secret_key = pyspx.shake_128f.generate_keypair(seed)
-        signature = pyspx.shake_128f.sign(message, secret_key)
-    elif type == 'shake_192f':
-        seed = secrets.token_bytes(config.seed_len_192f)
-        public_key, secret_key = pyspx.shake_192f.generate_keypair(seed)
-        signature = pyspx.shake_192f.sign(message, secret_key)
-    elif type == 'shake_256f':
-        seed = secrets.token_bytes(config.seed_len_256f)
-        public_key, secret_key = pyspx.shake_256f.generate_keypair(seed)
-        signature = pyspx.shake_256f.sign(message, secret_key)
-    elif type == 'sha2_128f':
-        seed = secrets.token_bytes(config.seed_len_128f)
-        public_key, secret_key = pyspx.sha2_128f.generate_keypair(seed)
-        signature = pyspx.sha2_128f.sign(message, secret_key)
-    elif type == 'sha2_192f':
-        seed = secrets.token_bytes(config.seed_len_192f)
-        public_key, secret_key = pyspx.sha2_192f.generate_keypair(seed)
-        signature = pyspx.sha2_192f.sign(message, secret_key)
-    elif type == 'sha2_256f':
-        seed = secrets.token_bytes(config.seed_len_256f)
-        public_key, secret_key = pyspx.sha2_256f.generate_keypair(seed)
-        signature = pyspx.sha2_256f.sign(message, secret_key)
-    elif type == 'haraka_128f':
-        seed = secrets.token_bytes(config.seed_len_128f)
-        public_key, secret_key = pyspx.haraka_128f.generate_keypair(seed)
-        signature = pyspx.haraka_128f.sign(message, secret_key)
-    elif type == 'haraka_192f':
-        seed = secrets.token_bytes(config.seed_len_192f)
-        public_key, secret_key = pyspx.haraka_192f.generate_keypair(seed)
-        signature = pyspx.haraka_192f.sign(message, secret_key)
-    elif type == 'haraka_256f':
-        seed = secrets.token_bytes(config.seed_len_256f)
-        public_key, secret_key = pyspx.haraka_256f.generate_keypair(seed)
-        signature = pyspx.haraka_256f.sign(message, secret_key)
+# Parameter set name -> seed length
+SEED_LEN = {
+    'shake_128f': config.seed_len_128f,
+    'shake_192f': config.seed_len_192f,
+    'shake_256f': config.seed_len_256f,
+    'sha2_128f': config.seed_len_128f,
+    'sha2_192f': config.seed_len_192f,
+    'sha2_256f': config.seed_len_256f,
+    'haraka_128f': config.seed_len_128f,
+    'haraka_192f': config.seed_len_192f,
+    'haraka_256f': config.seed_len_256f,
+}
+
+_bindings = {}
+
+
+def spx_for(type: str):
+    """Returns the (cached) bindings for a parameter set."""
+    if type not in _bindings:
+        if type not in SEED_LEN:
+            raise ValueError(f"Unknown parameter set '{type}'")
+        _bindings[type] = spx_native.load(type)
+    return _bindings[type]
+
+
+@contextlib.contextmanager
+def open_message(file_path):
+    """
+    Yields a read-only buffer over the contents of file_path.
+
+    Regular files are mapped rather than read so the message is never copied
+    into a Python bytes object; the pages are only faulted in as the hash
+    walks over them. Pipes, FIFOs, character devices and empty files cannot
+    be mapped and fall back to a plain read().
+    """
+    with open(file_path, 'rb') as file:
+        st = os.fstat(file.fileno())
+        if not stat.S_ISREG(st.st_mode) or st.st_size == 0:
+            yield file.read()
+            return
+
+        mm = mmap.mmap(file.fileno(), 0, access=mmap.ACCESS_READ)
+        try:
+            # Each signature walks the message front to back, so let the
+            # kernel read ahead aggressively and drop pages behind us.
+            if hasattr(mmap, 'MADV_SEQUENTIAL'):
+                mm.madvise(mmap.MADV_SEQUENTIAL)
+            yield mm
+        finally:
+            mm.close()
+
+
+def generate_keypair(type: str):
+    seed = secrets.token_bytes(SEED_LEN[type])
+    return spx_for(type).generate_keypair(seed)
+
+
+def sign_message(message, secret_key: bytes, type: str) -> bytes:
+    """
+    Returns a detached signature over message, which may be any object
+    supporting the buffer protocol (bytes, mmap, memoryview).
+
+    Calls crypto_sign_signature directly instead of pyspx's sign(), which
+    only accepts bytes and goes through crypto_sign, copying the message
+    into the signed-message buffer first.
+    """
+    spx = spx_for(type)
+    if len(secret_key) != spx.crypto_sign_SECRETKEYBYTES:
+        raise MemoryError('Secret key is of length {}, expected {}'
+                          .format(len(secret_key), spx.crypto_sign_SECRETKEYBYTES))
+
+    sig = spx.ffi.new("uint8_t[]", spx.crypto_sign_BYTES)
+    siglen = spx.ffi.new("size_t *")
+    with spx.ffi.from_buffer(message) as m:
+        spx.lib.crypto_sign_signature(sig, siglen, m, len(m), secret_key)
+    return bytes(spx.ffi.buffer(sig, siglen[0]))
+
+
+def verify_message(message, signature: bytes, public_key: bytes, type: str) -> bool:
+    """
+    Verifies a detached signature over message without concatenating the
+    signature and message first, as pyspx's verify() does.
+    """
+    spx = spx_for(type)
+    if len(public_key) != spx.crypto_sign_PUBLICKEYBYTES:
+        raise MemoryError('Public key is of length {}, expected {}'
+                          .format(len(public_key), spx.crypto_sign_PUBLICKEYBYTES))
+    if len(signature) != spx.crypto_sign_BYTES:
+        return False
+
+    with spx.ffi.from_buffer(message) as m:
+        return spx.lib.crypto_sign_verify(signature, len(signature), m, len(m), public_key) == 0
+
+
+def prepare_signature(message, type: str, mode: str = 'raw'):
+    public_key, secret_key = generate_keypair(type)
+    if mode == 'prehash':
+        message = prehash.digest_message(message, type)
+    signature = sign_message(message, secret_key, type)
 
     return public_key, signature
 
-def batch_process(path_to_files, type='shake_128f'):
+def sign_file(file_path, type, mode):
+    try:
+        with open_message(file_path) as message:
+            pk, sign = prepare_signature(message, type, mode)
+
+        pem_path = file_path + '.pem'
+        with open(pem_path, 'wb') as pem:
+            pem.write(sign)
+            print(f"PEM generated for '{file_path}'.")
+
+        pub_path = file_path + '.pub'
+        with open(pub_path, 'wb') as pem:
+            pem.write(pk)
+            print(f"PUB generated for '{file_path}'.")
+
+    except PermissionError:
+        print(f"Permission denied for file '{file_path}'.")
+    except IOError as e:
+        print(f"An I/O error occurred for file '{file_path}': {e}")
+    except Exception as e:
+        print(f"An unexpected error occurred for file '{file_path}': {e}")
+
+def run_parallel(fn, items):
+    """
+    Runs fn over items on config.threads worker threads. The SPHINCS+ calls
+    drop the GIL, so this signs or verifies several files at once.
+    """
+    workers = config.threads or os.cpu_count() or 1
+    if workers == 1:
+        for item in items:
+            fn(item)
+        return
+    with ThreadPoolExecutor(max_workers=workers) as pool:
+        for _ in pool.map(fn, items):
+            pass
+
+def batch_process(path_to_files, type='shake_128f', mode=config.sign_mode):
     if not os.path.exists(path_to_files):
         print(f"Error: Directory '{path_to_files}' does not exist.")
         return
 
+    file_paths = []
     for root, _, files in os.walk(path_to_files):
         for file_name in files:
             if not (file_name.startswith('.') or file_name.endswith('.pem') or file_name.endswith('.pub')):  # Reject hidden files and other PEMs
-                file_path = os.path.join(root, file_name)
-                try:
-                    with open(file_path, 'rb') as file:
-                        file_bytes = file.read()
-                        pk, sign = prepare_signature(file_bytes, type)
-
-                        pem_path = file_path + '.pem'
-                        with open(pem_path, 'wb') as pem:
-                            pem.write(sign)
-                            print(f"PEM generated for '{file_path}'.")
-
-                        pub_path = file_path + '.pub'
-                        with open(pub_path, 'wb') as pem:
-                            pem.write(pk)
-                            print(f"PUB generated for '{file_path}'.")
-
-                except PermissionError:
-                    print(f"Permission denied for file '{file_path}'.")
-                except IOError as e:
-                    print(f"An I/O error occurred for file '{file_path}': {e}")
-                except Exception as e:
-                    print(f"An unexpected error occurred for file '{file_path}': {e}")
-
-def batch_verify(path_to_files, type='shake_128f'):
+                file_paths.append(os.path.join(root, file_name))
+
+    run_parallel(lambda file_path: sign_file(file_path, type, mode), file_paths)
+
+def verify_file(message, signature: bytes, public_key: bytes, type: str, mode: str, cache=None) -> bool:
+    """
+    Verifies a file's signature, consulting the verification cache first.
+    On a cache hit the only work done is one SHA-256 pass over the file.
+    """
+    if cache is not None:
+        kid = verify_cache.key_id(public_key)
+        content_hash = hashlib.sha256(message).digest()
+        if cache.lookup(kid, content_hash, signature, type, mode):
+            return True
+
+    if mode == 'prehash':
+        message = prehash.digest_message(message, type)
+    result = verify_message(message, signature, public_key, type)
+
+    if result and cache is not None:
+        cache.record(kid, content_hash, signature, type, mode)
+    return result
+
+def verify_path(file_path, type, mode, cache):
+    try:
+        with open(file_path + '.pub', 'rb') as pub_file:
+            pub_bytes = pub_file.read()
+        with open(file_path + '.pem', 'rb') as pem_file:
+            pem_bytes = pem_file.read()
+
+        with open_message(file_path) as message:
+            result = verify_file(message, pem_bytes, pub_bytes, type, mode, cache)
+        print(f"Verification using '{file_path}' is: {result}")
+
+    except PermissionError:
+        print(f"Permission denied for file '{file_path}'.")
+    except IOError as e:
+        print(f"An I/O error occurred for file '{file_path}': {e}")
+    except Exception as e:
+        print(f"An unexpected error occurred for file '{file_path}': {e}")
+
+def batch_verify(path_to_files, type='shake_128f', mode=config.sign_mode, use_cache=config.cache_enabled):
     if not os.path.exists(path_to_files):
         print(f"Error: Directory '{path_to_files}' does not exist.")
         return
 
+    file_paths = []
     for root, _, files in os.walk(path_to_files):
         for file_name in files:
             if file_name.endswith('.pub'):
-                file_path_pub = os.path.join(root, file_name)
-                try:
-                    with open(file_path_pub, 'rb') as pub_file:
-                        pub_bytes = pub_file.read()
-                        pem_path = os.path.join(root, file_name[:-4]+".pem")
-                        with open(pem_path, 'rb') as pem_file:
-                            pem_bytes = pem_file.read()
-                            file_path = os.path.join(root, file_name[:-4])
-                            with open(file_path, 'rb') as file:
-                                file_bytes = file.read()
-
-                                if type == 'shake_128f':
-                                    print(f"Verification using '{file_path}' is: {pyspx.shake_128f.verify(file_bytes, pem_bytes, pub_bytes)}")
-                                elif type == 'shake_192f':
-                                    print(f"Verification using '{file_path}' is: {pyspx.shake_192f.verify(file_bytes, pem_bytes, pub_bytes)}")
-                                elif type == 'shake_256f':
-                                    print(f"Verification using '{file_path}' is: {pyspx.shake_256f.verify(file_bytes, pem_bytes, pub_bytes)}")
-                                elif type == 'haraka_128f':
-                                    print(f"Verification using '{file_path}' is: {pyspx.haraka_128f.verify(file_bytes, pem_bytes, pub_bytes)}")
-                                elif type == 'haraka_192f':
-                                    print(f"Verification using '{file_path}' is: {pyspx.haraka_192f.verify(file_bytes, pem_bytes, pub_bytes)}")
-                                elif type == 'haraka_256f':
-                                    print(f"Verification using '{file_path}' is: {pyspx.haraka_256f.verify(file_bytes, pem_bytes, pub_bytes)}")
-                                elif type == 'sha2_128f':
-                                    print(f"Verification using '{file_path}' is: {pyspx.sha2_128f.verify(file_bytes, pem_bytes, pub_bytes)}")
-                                elif type == 'sha2_192f':
-                                    print(f"Verification using '{file_path}' is: {pyspx.sha2_192f.verify(file_bytes, pem_bytes, pub_bytes)}")
-                                elif type == 'sha2_256f':
-                                    print(f"Verification using '{file_path}' is: {pyspx.sha2_256f.verify(file_bytes, pem_bytes, pub_bytes)}")
-
-                except PermissionError:
-                    print(f"Permission denied for file '{file_path}'.")
-                except IOError as e:
-                    print(f"An I/O error occurred for file '{file_path}': {e}")
-                except Exception as e:
-                    print(f"An unexpected error occurred for file '{file_path}': {e}")
+                file_paths.append(os.path.join(root, file_name[:-4]))
+
+    cache = verify_cache.VerifyCache() if use_cache else None
+    try:
+        run_parallel(lambda file_path: verify_path(file_path, type, mode, cache), file_paths)
+    finally:
+        if cache is not None:
+            cache.close()
 
 if __name__ == '__main__':
     print(config.menu)
@@ -2,116 +2,222 @@
 # Carleton University
 # COMP4900 E
 # April 2024
-
+#
+# Benchmark harness for the signing tool.
+#
+# Every run works on fixed synthetic corpora generated from a seed, so two
+# runs on different commits hash and sign exactly the same bytes. Each phase
+# (I/O, keygen, sign, verify) is timed separately with a monotonic clock,
+# warmup runs are discarded, and the process can be pinned to one CPU.
+# Results are reported as median / p95 / stddev and can be exported as JSON
+# or CSV for tracking across commits.
+
+import argparse
+import csv
+import gc
+import json
+import os
+import platform
+import random
+import statistics
+import subprocess
+import sys
 import time
-import numpy as np
-import matplotlib.pyplot as plt
 
 import main
 
 
-def graph():
-    nRuns = 10
-    nAlgs = 9
-    process_times = np.zeros([nAlgs, nRuns])
-    verify_times = np.zeros([nAlgs, nRuns])
-    processAvgs = np.zeros([nAlgs])
-    verifyAvgs = np.zeros([nAlgs])
-
-    for i in range(nRuns):
-        startTime = time.time()
-        main.batch_process('./test', 'shake_128f')
-        process_times[0][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_verify('./test', 'shake_128f')
-        verify_times[0][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_process('./test', 'shake_192f')
-        process_times[1][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_verify('./test', 'shake_192f')
-        verify_times[1][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_process('./test', 'shake_256f')
-        process_times[2][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_verify('./test', 'shake_256f')
-        verify_times[2][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_process('./test', 'haraka_128f')
-        process_times[3][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_verify('./test', 'haraka_128f')
-        verify_times[3][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_process('./test', 'haraka_192f')
-        process_times[4][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_verify('./test', 'haraka_192f')
-        verify_times[4][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_process('./test', 'haraka_256f')
-        process_times[5][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_verify('./test', 'haraka_256f')
-        verify_times[5][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_process('./test', 'sha2_128f')
-        process_times[6][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_verify('./test', 'sha2_128f')
-        verify_times[6][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_process('./test', 'sha2_192f')
-        process_times[7][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_verify('./test', 'sha2_192f')
-        verify_times[7][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_process('./test', 'sha2_256f')
-        process_times[8][i] = time.time() - startTime
-
-        startTime = time.time()
-        main.batch_verify('./test', 'sha2_256f')
-        verify_times[8][i] = time.time() - startTime
-
-    for i in range(nAlgs):
-        processAvgs[i] = np.average(process_times[i])
-        verifyAvgs[i] = np.average(verify_times[i])
-
-
-    labels= ['Shake128', 'Shake192', 'Shake256', 'Haraka128', 'Haraka192', 'Haraka256', 'Sha2-128', 'Sha2-192', 'Sha2-256']
-
-    plt.figure(figsize=(10, 5))
-    plt.bar(labels, processAvgs, color='red', width=0.7)
-    plt.ylabel("Time taken (Sec)")
-    plt.title("Time vs Signing with SPHINCS+")
-    plt.savefig('sign_plot.png')
-    plt.close()
-
-    plt.figure(figsize=(11, 5))
-    plt.bar(labels, verifyAvgs, color='blue', width=0.7)
-    plt.ylabel("Time taken (Sec)")
-    plt.title("Time vs Verifying with SPHINCS+")
-    plt.savefig('verify_plot.png')
-    plt.close()
+# Corpus name -> (file count, file size in bytes)
+CORPORA = {
+    'tiny': (256, 1024),
+    'huge': (2, 64 * 1024 * 1024),
+}
+
+PHASES = ['io', 'keygen', 'sign', 'verify']
+
+
+def build_corpus(corpus_dir, name, seed):
+    """
+    Creates (or reuses) the synthetic corpus `name` under corpus_dir and
+    returns the list of file paths. Contents depend only on the seed and the
+    corpus shape, and are rebuilt if a previous corpus has the wrong size.
+    """
+    count, size = CORPORA[name]
+    path = os.path.join(corpus_dir, f'{name}-{seed}')
+    os.makedirs(path, exist_ok=True)
+
+    files = []
+    for i in range(count):
+        file_path = os.path.join(path, f'{i:05d}.bin')
+        if not (os.path.exists(file_path) and os.path.getsize(file_path) == size):
+            rng = random.Random(f'{seed}:{name}:{i}')
+            with open(file_path, 'wb') as file:
+                file.write(rng.randbytes(size))
+        files.append(file_path)
+    return files
+
+
+def run_once(files, type):
+    """
+    Signs and verifies every file once and returns the time spent in each
+    phase, in seconds.
+
+    Files are opened through main.open_message(), as the signer does, so
+    'io' is the cost of opening and mapping a file and the page faults of a
+    mapped file fall into the first phase that walks the message (sign).
+    """
+    totals = dict.fromkeys(PHASES, 0)
+
+    for file_path in files:
+        start = time.perf_counter_ns()
+        with main.open_message(file_path) as message:
+            totals['io'] += time.perf_counter_ns() - start
+
+            start = time.perf_counter_ns()
+            pk, sk = main.generate_keypair(type)
+            totals['keygen'] += time.perf_counter_ns() - start
+
+            start = time.perf_counter_ns()
+            signature = main.sign_message(message, sk, type)
+            totals['sign'] += time.perf_counter_ns() - start
+
+            start = time.perf_counter_ns()
+            ok = main.verify_message(message, signature, pk, type)
+            totals['verify'] += time.perf_counter_ns() - start
+
+        if not ok:
+            raise RuntimeError(f"Verification failed for '{file_path}' with {type}")
+
+    return {phase: ns / 1e9 for phase, ns in totals.items()}
+
+
+def percentile(samples, p):
+    """Nearest-rank percentile."""
+    ordered = sorted(samples)
+    rank = max(1, -(-len(ordered) * p // 100))
+    return ordered[int(rank) - 1]
+
+
+def summarize(samples):
+    return {
+        'median': statistics.median(samples),
+        'p95': percentile(samples, 95),
+        'stddev': statistics.stdev(samples) if len(samples) > 1 else 0.0,
+        'min': min(samples),
+        'max': max(samples),
+        'runs': len(samples),
+    }
+
+
+def pin_cpu(cpu):
+    if cpu is None:
+        return None
+    if not hasattr(os, 'sched_setaffinity'):
+        print('Warning: CPU pinning is not supported on this platform.')
+        return None
+    os.sched_setaffinity(0, {cpu})
+    return cpu
+
+
+def git_revision():
+    try:
+        return subprocess.run(['git', 'rev-parse', 'HEAD'], capture_output=True,
+                              text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def benchmark(algs, corpora, runs, warmup, corpus_dir, seed):
+    results = []
+    for corpus in corpora:
+        files = build_corpus(corpus_dir, corpus, seed)
+        for type in algs:
+            for _ in range(warmup):
+                run_once(files, type)
+
+            samples = {phase: [] for phase in PHASES}
+            for _ in range(runs):
+                gc.collect()
+                gc.disable()
+                try:
+                    timings = run_once(files, type)
+                finally:
+                    gc.enable()
+                for phase in PHASES:
+                    samples[phase].append(timings[phase])
+
+            for phase in PHASES:
+                row = {'alg': type, 'corpus': corpus, 'phase': phase}
+                row.update(summarize(samples[phase]))
+                row['samples'] = samples[phase]
+                results.append(row)
+                print(f"{type:12} {corpus:5} {phase:7} median {row['median']:.6f}s "
+                      f"p95 {row['p95']:.6f}s stddev {row['stddev']:.6f}s")
+    return results
+
+
+def write_json(path, results, meta):
+    with open(path, 'w') as out:
+        json.dump({'meta': meta, 'results': results}, out, indent=2)
+
+
+def write_csv(path, results, meta):
+    fields = ['commit', 'alg', 'corpus', 'phase', 'median', 'p95', 'stddev', 'min', 'max', 'runs']
+    with open(path, 'w', newline='') as out:
+        writer = csv.DictWriter(out, fieldnames=fields, extrasaction='ignore')
+        writer.writeheader()
+        for row in results:
+            writer.writerow(dict(row, commit=meta['commit']))
+
+
+def graph(results, corpus):
+    import matplotlib.pyplot as plt
+
+    for phase, color in (('sign', 'red'), ('verify', 'blue')):
+        rows = [r for r in results if r['corpus'] == corpus and r['phase'] == phase]
+        plt.figure(figsize=(11, 5))
+        plt.bar([r['alg'] for r in rows], [r['median'] for r in rows], color=color, width=0.7)
+        plt.ylabel("Median time (Sec)")
+        plt.title(f"Time vs {phase.capitalize()} with SPHINCS+ ({corpus} corpus)")
+        plt.savefig(f'{phase}_plot_{corpus}.png')
+        plt.close()
+
+
+def parse_args(argv):
+    parser = argparse.ArgumentParser(description='SPHINCS+ signing benchmark')
+    parser.add_argument('--algs', nargs='+', default=list(main.SEED_LEN), choices=list(main.SEED_LEN))
+    parser.add_argument('--corpora', nargs='+', default=list(CORPORA), choices=list(CORPORA))
+    parser.add_argument('--runs', type=int, default=10)
+    parser.add_argument('--warmup', type=int, default=1)
+    parser.add_argument('--seed', type=int, default=4900)
+    parser.add_argument('--cpu', type=int, default=None, help='pin the benchmark to this CPU')
+    parser.add_argument('--corpus-dir', default='bench_corpus')
+    parser.add_argument('--json', dest='json_path', default=None)
+    parser.add_argument('--csv', dest='csv_path', default=None)
+    parser.add_argument('--plot', action='store_true', help='save bar charts of the medians')
+    return parser.parse_args(argv)
 
 
 if __name__ == '__main__':
-    graph()
\ No newline at end of file
+    args = parse_args(sys.argv[1:])
+    meta = {
+        'commit': git_revision(),
+        'python': platform.python_version(),
+        'machine': platform.machine(),
+        'system': platform.system(),
+        'cpu': pin_cpu(args.cpu),
+        'runs': args.runs,
+        'warmup': args.warmup,
+        'seed': args.seed,
+        'corpora': {name: CORPORA[name] for name in args.corpora},
+    }
+
+    results = benchmark(args.algs, args.corpora, args.runs, args.warmup, args.corpus_dir, args.seed)
+
+    if args.json_path:
+        write_json(args.json_path, results, meta)
+    if args.csv_path:
+        write_csv(args.csv_path, results, meta)
+    if args.plot:
+        for corpus in args.corpora:
+            graph(results, corpus)
@@ -0,0 +1,167 @@
+"""
+Builds first-party cffi bindings around the SPHINCS+ code in the startup
+library, replacing the prebuilt pyspx wheel.
+
+Each parameter set becomes an extension module _spx_native_<paramset> in
+the repository root exposing the NIST API from api.h plus the batch entry
+points in spx_batch.h. The modules are built in cffi API mode, which drops
+the GIL around every C call, and inputs are passed with ffi.from_buffer so
+bytes, mmap and memoryview objects are all accepted without copying.
+
+The startup library only carries the sources the boot loader needs
+(haraka-128s, sign/verify). Anything it is missing (fors.c, wots.c, ...) and
+any further parameter sets are taken from a SPHINCS+ reference tree:
+
+    python3 native/build.py --ref path/to/sphincsplus/ref
+"""
+
+import argparse
+import glob
+import os
+import re
+import shutil
+import sys
+from pathlib import Path
+
+from cffi import FFI
+
+
+ROOT = Path(__file__).resolve().parent.parent
+NATIVE_DIR = ROOT / "native"
+STARTUP_LIB = ROOT / "BSP_raspberrypi-bcm2711-rpi4_br-710_be-710_SVN946248_JBN18" / "src" / "hardware" / "startup" / "lib"
+BUILD_DIR = ROOT / "native" / "build"
+
+SOURCES = [
+    "address.c",
+    "randombytes.c",
+    "merkle.c",
+    "wots.c",
+    "wotsx1.c",
+    "utils.c",
+    "utilsx1.c",
+    "fors.c",
+    "sign.c",
+]
+
+HEADERS = [
+    "address.h",
+    "randombytes.h",
+    "merkle.h",
+    "wots.h",
+    "wotsx1.h",
+    "utils.h",
+    "utilsx1.h",
+    "fors.h",
+    "api.h",
+    "hash.h",
+    "thash.h",
+    "context.h",
+]
+
+PARAM_SETS_SOURCES = {
+    "sha2": {
+        "sources": ["sha2.c", "hash_sha2.c", "thash_sha2_robust.c"],
+        "headers": ["sha2.h", "sha2_offsets.h"],
+    },
+    "shake": {
+        "sources": ["fips202.c", "hash_shake.c", "thash_shake_robust.c"],
+        "headers": ["fips202.h", "shake_offsets.h"],
+    },
+    "haraka": {
+        "sources": ["haraka.c", "hash_haraka.c", "thash_haraka_robust.c"],
+        "headers": ["haraka.h", "haraka_offsets.h"],
+    },
+}
+
+CDEF = """
+unsigned long long crypto_sign_secretkeybytes(void);
+unsigned long long crypto_sign_publickeybytes(void);
+unsigned long long crypto_sign_bytes(void);
+unsigned long long crypto_sign_seedbytes(void);
+int crypto_sign_seed_keypair(unsigned char *pk, unsigned char *sk,
+                             const unsigned char *seed);
+int crypto_sign_signature(uint8_t *sig, size_t *siglen,
+                          const uint8_t *m, size_t mlen, const uint8_t *sk);
+int crypto_sign_verify(const uint8_t *sig, size_t siglen,
+                       const uint8_t *m, size_t mlen, const uint8_t *pk);
+int crypto_sign_signature_batch(uint8_t *sigs,
+                                const uint8_t *const *ms, const size_t *mlens,
+                                const uint8_t *const *sks, size_t count);
+size_t crypto_sign_verify_batch(int *results, const uint8_t *const *sigs,
+                                const uint8_t *const *ms, const size_t *mlens,
+                                const uint8_t *const *pks, size_t count);
+"""
+
+
+def find_source(name, ref_dir):
+    """Prefers the startup library's copy of a file over the reference tree."""
+    for directory in (STARTUP_LIB, ref_dir):
+        if directory is not None and (directory / name).exists():
+            return directory / name
+    raise FileNotFoundError(f"'{name}' is not in the startup library; pass --ref")
+
+
+def paramsets(ref_dir):
+    pattern = re.compile(r"params-sphincs-([a-zA-Z-][a-zA-Z0-9-]*)\.h")
+    found = {}
+    for directory in (ref_dir / "params" if ref_dir else None, STARTUP_LIB):
+        if directory is None or not directory.exists():
+            continue
+        for paramfile in os.listdir(directory):
+            match = pattern.fullmatch(paramfile)
+            if match:
+                found[match.group(1).replace('-', '_')] = directory / paramfile
+    return found
+
+
+def make_ffi(paramset, paramfile, ref_dir):
+    ffi = FFI()
+    ffi.cdef(CDEF)
+
+    sources = SOURCES.copy()
+    headers = HEADERS.copy()
+    for hash_algo, files in PARAM_SETS_SOURCES.items():
+        if hash_algo in paramset:
+            sources += files["sources"]
+            headers += files["headers"]
+
+    # Same layout trick as pyspx: every instance gets its own copy of the
+    # sources next to a params.h that includes the instance's parameters,
+    # since the sources include "params.h" relative to themselves.
+    inst_dir = BUILD_DIR / paramset
+    inst_param_dir = inst_dir / "params"
+    os.makedirs(inst_param_dir, exist_ok=True)
+
+    for name in sources + headers:
+        shutil.copy(find_source(name, ref_dir), inst_dir)
+    shutil.copy(NATIVE_DIR / "spx_batch.c", inst_dir)
+    shutil.copy(NATIVE_DIR / "spx_batch.h", inst_dir)
+    shutil.copy(paramfile, inst_param_dir / "params.h")
+    with open(inst_dir / "params.h", "w") as f:
+        f.write('#include "params/params.h"\n')
+
+    ffi.set_source("_spx_native_{}".format(paramset),
+                   '#include "api.h"\n#include "spx_batch.h"\n',
+                   sources=sorted(glob.glob(str(inst_dir / "*.c"))),
+                   include_dirs=[str(inst_dir)],
+                   extra_compile_args=["-O3"])
+    return ffi
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Build the native SPHINCS+ bindings')
+    parser.add_argument('--ref', type=Path, default=None,
+                        help='SPHINCS+ reference implementation (sphincsplus/ref)')
+    parser.add_argument('--params', nargs='*', default=None,
+                        help='parameter sets to build, e.g. shake_128f (default: all found)')
+    args = parser.parse_args()
+
+    available = paramsets(args.ref)
+    wanted = args.params or sorted(available)
+    for paramset in wanted:
+        if paramset not in available:
+            sys.exit(f"Unknown parameter set '{paramset}'")
+        print(f"Building _spx_native_{paramset}")
+        module = make_ffi(paramset, available[paramset], args.ref).compile(
+            tmpdir=str(BUILD_DIR), verbose=False)
+        shutil.copy(module, ROOT)
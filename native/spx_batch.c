@@ -0,0 +1,48 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "api.h"
+#include "spx_batch.h"
+
+/**
+ * Signs count messages, message i under secret key sks[i].
+ */
+int crypto_sign_signature_batch(uint8_t *sigs,
+                                const uint8_t *const *ms, const size_t *mlens,
+                                const uint8_t *const *sks, size_t count)
+{
+    size_t i;
+    size_t siglen;
+    int ret;
+
+    for (i = 0; i < count; i++) {
+        ret = crypto_sign_signature(sigs + i*CRYPTO_BYTES, &siglen,
+                                    ms[i], mlens[i], sks[i]);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Verifies count detached signatures under their own public keys.
+ */
+size_t crypto_sign_verify_batch(int *results, const uint8_t *const *sigs,
+                                const uint8_t *const *ms, const size_t *mlens,
+                                const uint8_t *const *pks, size_t count)
+{
+    size_t i;
+    size_t failed = 0;
+
+    for (i = 0; i < count; i++) {
+        results[i] = crypto_sign_verify(sigs[i], CRYPTO_BYTES,
+                                        ms[i], mlens[i], pks[i]);
+        if (results[i]) {
+            failed++;
+        }
+    }
+
+    return failed;
+}
@@ -0,0 +1,25 @@
+#ifndef SPX_BATCH_H
+#define SPX_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Signs count messages, message i under secret key sks[i].
+ * Signature i is written to sigs + i*CRYPTO_BYTES.
+ * Returns 0 on success, or the non-zero status of the first failing call.
+ */
+int crypto_sign_signature_batch(uint8_t *sigs,
+                                const uint8_t *const *ms, const size_t *mlens,
+                                const uint8_t *const *sks, size_t count);
+
+/**
+ * Verifies count detached signatures, signature i over message i under
+ * public key pks[i]. results[i] is set to the crypto_sign_verify status.
+ * Returns the number of signatures that failed to verify.
+ */
+size_t crypto_sign_verify_batch(int *results, const uint8_t *const *sigs,
+                                const uint8_t *const *ms, const size_t *mlens,
+                                const uint8_t *const *pks, size_t count);
+
+#endif
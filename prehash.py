@@ -0,0 +1,73 @@
+"""
+Hash-once pre-hash mode for large artifacts.
+
+In raw mode SPHINCS+ walks the whole message twice per signature, once for
+PRF_msg (gen_message_random) and once for H_msg (hash_message), and both
+passes are serial. In pre-hash mode the file is hashed once with a two-level
+SHAKE256 tree whose leaves are hashed in parallel, and only a short,
+domain-separated encoding of the root is signed and verified.
+
+Tree layout (all integers big-endian):
+    leaf_i = SHAKE256(0x00 || u64(i) || chunk_i, 32)
+    root   = SHAKE256(0x01 || u64(total_len) || u64(chunk_size) || leaf_0 || ... , 64)
+
+The signed message is
+    PREHASH_DOMAIN || type || 0x00 || root
+so a pre-hash signature can never be confused with a raw signature over a
+message that happens to look like a digest, nor with one made under another
+parameter set.
+
+Raw mode remains the default and is what the boot loader verifies.
+"""
+
+import hashlib
+import os
+from concurrent.futures import ThreadPoolExecutor
+
+import config
+
+
+PREHASH_DOMAIN = b'PQC_Signing/prehash/v1\x00'
+LEAF_BYTES = 32
+ROOT_BYTES = 64
+
+
+def _leaf(view, index, chunk_size):
+    with view[index * chunk_size:(index + 1) * chunk_size] as chunk:
+        h = hashlib.shake_256(b'\x00' + index.to_bytes(8, 'big'))
+        h.update(chunk)
+        return h.digest(LEAF_BYTES)
+
+
+def tree_hash(message, chunk_size=None, workers=None) -> bytes:
+    """
+    Returns the 64-byte tree hash of message, which may be any object
+    supporting the buffer protocol. Leaves are hashed on a thread pool;
+    hashlib drops the GIL while hashing large buffers, so the leaves are
+    hashed on all cores.
+    """
+    chunk_size = chunk_size or config.prehash_chunk_size
+    workers = workers or config.prehash_workers or os.cpu_count() or 1
+
+    with memoryview(message).cast('B') as view:
+        total_len = len(view)
+        count = max(1, -(-total_len // chunk_size))
+
+        if count == 1 or workers == 1:
+            leaves = [_leaf(view, i, chunk_size) for i in range(count)]
+        else:
+            with ThreadPoolExecutor(max_workers=min(workers, count)) as pool:
+                leaves = list(pool.map(lambda i: _leaf(view, i, chunk_size), range(count)))
+
+    root = hashlib.shake_256(b'\x01' + total_len.to_bytes(8, 'big') + chunk_size.to_bytes(8, 'big'))
+    for leaf in leaves:
+        root.update(leaf)
+    return root.digest(ROOT_BYTES)
+
+
+def digest_message(message, type: str) -> bytes:
+    """
+    Returns the domain-separated message that is actually signed in pre-hash
+    mode for the given parameter set.
+    """
+    return PREHASH_DOMAIN + type.encode('ascii') + b'\x00' + tree_hash(message)
@@ -0,0 +1,129 @@
+"""
+Python side of the first-party SPHINCS+ bindings built by native/build.py.
+
+Exposes the same interface as pyspx's PySPXBindings, but every input may be
+any buffer-protocol object (bytes, mmap, memoryview) and is handed to C
+without copying. The C calls run with the GIL released, so several threads
+can sign or verify at once.
+"""
+
+import importlib
+
+
+class NativeBindings(object):
+
+    def __init__(self, ffi, lib):
+        self.ffi = ffi
+        self.lib = lib
+        self.crypto_sign_BYTES = lib.crypto_sign_bytes()
+        self.crypto_sign_SECRETKEYBYTES = lib.crypto_sign_secretkeybytes()
+        self.crypto_sign_PUBLICKEYBYTES = lib.crypto_sign_publickeybytes()
+        self.crypto_sign_SEEDBYTES = lib.crypto_sign_seedbytes()
+
+    def generate_keypair(self, seed):
+        if len(seed) != self.crypto_sign_SEEDBYTES:
+            raise MemoryError('Seed is of length {}, expected {}'
+                              .format(len(seed), self.crypto_sign_SEEDBYTES))
+        pk = self.ffi.new("unsigned char[]", self.crypto_sign_PUBLICKEYBYTES)
+        sk = self.ffi.new("unsigned char[]", self.crypto_sign_SECRETKEYBYTES)
+        with self.ffi.from_buffer(seed) as s:
+            self.lib.crypto_sign_seed_keypair(pk, sk, s)
+        return bytes(self.ffi.buffer(pk)), bytes(self.ffi.buffer(sk))
+
+    def sign(self, message, secretkey):
+        if len(secretkey) != self.crypto_sign_SECRETKEYBYTES:
+            raise MemoryError('Secret key is of length {}, expected {}'
+                              .format(len(secretkey), self.crypto_sign_SECRETKEYBYTES))
+        sig = self.ffi.new("uint8_t[]", self.crypto_sign_BYTES)
+        siglen = self.ffi.new("size_t *")
+        with self.ffi.from_buffer(message) as m, self.ffi.from_buffer(secretkey) as sk:
+            self.lib.crypto_sign_signature(sig, siglen, m, len(m), sk)
+        return bytes(self.ffi.buffer(sig, siglen[0]))
+
+    def verify(self, message, signature, publickey):
+        if len(publickey) != self.crypto_sign_PUBLICKEYBYTES:
+            raise MemoryError('Public key is of length {}, expected {}'
+                              .format(len(publickey), self.crypto_sign_PUBLICKEYBYTES))
+        if len(signature) != self.crypto_sign_BYTES:
+            return False
+        with self.ffi.from_buffer(message) as m, self.ffi.from_buffer(signature) as s, \
+                self.ffi.from_buffer(publickey) as pk:
+            return self.lib.crypto_sign_verify(s, len(s), m, len(m), pk) == 0
+
+    def _pointers(self, buffers):
+        """Returns the cdata buffers and a uint8_t*[] over them; keep both alive."""
+        views = [self.ffi.from_buffer(b) for b in buffers]
+        return views, self.ffi.new("const uint8_t *[]", views)
+
+    def _release(self, views):
+        for view in views:
+            self.ffi.release(view)
+
+    def sign_batch(self, messages, secretkeys):
+        """
+        Signs messages[i] under secretkeys[i] in a single C call, so many
+        small files cost one GIL release instead of one each.
+        """
+        count = len(messages)
+        if len(secretkeys) != count:
+            raise ValueError('Expected one secret key per message')
+        for sk in secretkeys:
+            if len(sk) != self.crypto_sign_SECRETKEYBYTES:
+                raise MemoryError('Secret key is of length {}, expected {}'
+                                  .format(len(sk), self.crypto_sign_SECRETKEYBYTES))
+
+        sigs = self.ffi.new("uint8_t[]", count * self.crypto_sign_BYTES)
+        mviews, ms = self._pointers(messages)
+        kviews, sks = self._pointers(secretkeys)
+        try:
+            mlens = self.ffi.new("size_t[]", [len(m) for m in mviews])
+            if self.lib.crypto_sign_signature_batch(sigs, ms, mlens, sks, count):
+                raise RuntimeError('crypto_sign_signature_batch failed')
+        finally:
+            self._release(mviews + kviews)
+
+        out = bytes(self.ffi.buffer(sigs))
+        n = self.crypto_sign_BYTES
+        return [out[i*n:(i+1)*n] for i in range(count)]
+
+    def verify_batch(self, messages, signatures, publickeys):
+        """Verifies signatures[i] over messages[i] under publickeys[i] in a single C call."""
+        count = len(messages)
+        if not (len(signatures) == len(publickeys) == count):
+            raise ValueError('Expected one signature and public key per message')
+
+        results = [False] * count
+        valid = [i for i in range(count)
+                 if len(signatures[i]) == self.crypto_sign_BYTES
+                 and len(publickeys[i]) == self.crypto_sign_PUBLICKEYBYTES]
+        if not valid:
+            return results
+
+        mviews, ms = self._pointers([messages[i] for i in valid])
+        sviews, sigs = self._pointers([signatures[i] for i in valid])
+        kviews, pks = self._pointers([publickeys[i] for i in valid])
+        try:
+            mlens = self.ffi.new("size_t[]", [len(m) for m in mviews])
+            status = self.ffi.new("int[]", len(valid))
+            self.lib.crypto_sign_verify_batch(status, sigs, ms, mlens, pks, len(valid))
+        finally:
+            self._release(mviews + sviews + kviews)
+
+        for j, i in enumerate(valid):
+            results[i] = status[j] == 0
+        return results
+
+    def __repr__(self):  # pragma: no cover
+        return repr(self.lib).replace("Lib", "NativeBindings")
+
+
+def load(paramset):
+    """
+    Returns the bindings for a parameter set: the first-party module if it
+    has been built, otherwise the pyspx wheel.
+    """
+    try:
+        module = importlib.import_module('_spx_native_' + paramset)
+    except ImportError:
+        return importlib.import_module('pyspx.' + paramset)
+    return NativeBindings(module.ffi, module.lib)
@@ -0,0 +1,149 @@
+"""
+Verification result cache.
+
+batch_verify() is run over the same, unchanged files on every agent start.
+A successful verification is recorded here keyed by (key ID, content
+SHA-256, signature SHA-256, parameter set, mode), so a repeat check only
+has to rehash the file instead of running SPHINCS+ verification again.
+
+Every row carries an HMAC-SHA256 under a host-local key, so a tampered or
+copied database simply misses. Entries expire after a configurable TTL and
+are dropped as soon as their key is revoked. Only successful verifications
+are ever cached.
+
+    python3 verify_cache.py revoke <key id>
+    python3 verify_cache.py purge
+"""
+
+import hashlib
+import hmac
+import os
+import secrets
+import sqlite3
+import sys
+import threading
+import time
+
+import config
+
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS verified (
+    key_id       BLOB NOT NULL,
+    content_hash BLOB NOT NULL,
+    sig_hash     BLOB NOT NULL,
+    type         TEXT NOT NULL,
+    mode         TEXT NOT NULL,
+    verified_at  INTEGER NOT NULL,
+    mac          BLOB NOT NULL,
+    PRIMARY KEY (key_id, content_hash, sig_hash, type, mode)
+) WITHOUT ROWID;
+CREATE TABLE IF NOT EXISTS revoked (
+    key_id       BLOB PRIMARY KEY
+) WITHOUT ROWID;
+"""
+
+
+def key_id(public_key: bytes) -> bytes:
+    """Returns the identifier under which a public key is cached and revoked."""
+    return hashlib.sha256(public_key).digest()
+
+
+def _load_mac_key(path):
+    try:
+        with open(path, 'rb') as file:
+            key = file.read()
+        if len(key) == 32:
+            return key
+    except FileNotFoundError:
+        pass
+
+    key = secrets.token_bytes(32)
+    fd = os.open(path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o600)
+    with os.fdopen(fd, 'wb') as file:
+        file.write(key)
+    return key
+
+
+class VerifyCache:
+
+    def __init__(self, db_path=None, key_path=None, ttl=None):
+        self.ttl = config.cache_ttl if ttl is None else ttl
+        self.mac_key = _load_mac_key(key_path or config.cache_key_path)
+        self.lock = threading.Lock()
+        self.db = sqlite3.connect(db_path or config.cache_db_path, check_same_thread=False)
+        self.db.executescript(SCHEMA)
+        self.hits = 0
+        self.misses = 0
+
+    def _mac(self, kid, content_hash, sig_hash, type, mode, verified_at):
+        msg = b''.join([kid, content_hash, sig_hash, type.encode(), b'\x00',
+                        mode.encode(), b'\x00', verified_at.to_bytes(8, 'big')])
+        return hmac.new(self.mac_key, msg, hashlib.sha256).digest()
+
+    def lookup(self, kid, content_hash, signature, type, mode):
+        """Returns True if this exact (key, content, signature) was verified within the TTL."""
+        sig_hash = hashlib.sha256(signature).digest()
+        with self.lock:
+            row = self.db.execute(
+                'SELECT verified_at, mac FROM verified WHERE key_id=? AND content_hash=? '
+                'AND sig_hash=? AND type=? AND mode=? '
+                'AND key_id NOT IN (SELECT key_id FROM revoked)',
+                (kid, content_hash, sig_hash, type, mode)).fetchone()
+
+            if row is not None:
+                verified_at, mac = row
+                fresh = self.ttl <= 0 or time.time() - verified_at < self.ttl
+                valid = hmac.compare_digest(mac, self._mac(kid, content_hash, sig_hash, type, mode, verified_at))
+                if fresh and valid:
+                    self.hits += 1
+                    return True
+                self.db.execute('DELETE FROM verified WHERE key_id=? AND content_hash=? AND sig_hash=? '
+                                'AND type=? AND mode=?', (kid, content_hash, sig_hash, type, mode))
+                self.db.commit()
+
+            self.misses += 1
+            return False
+
+    def record(self, kid, content_hash, signature, type, mode):
+        """Records a successful verification."""
+        sig_hash = hashlib.sha256(signature).digest()
+        verified_at = int(time.time())
+        mac = self._mac(kid, content_hash, sig_hash, type, mode, verified_at)
+        with self.lock:
+            if self.db.execute('SELECT 1 FROM revoked WHERE key_id=?', (kid,)).fetchone():
+                return
+            self.db.execute('INSERT OR REPLACE INTO verified VALUES (?, ?, ?, ?, ?, ?, ?)',
+                            (kid, content_hash, sig_hash, type, mode, verified_at, mac))
+            self.db.commit()
+
+    def revoke(self, kid):
+        """Drops every entry for a key and refuses to cache it again."""
+        with self.lock:
+            self.db.execute('INSERT OR IGNORE INTO revoked VALUES (?)', (kid,))
+            self.db.execute('DELETE FROM verified WHERE key_id=?', (kid,))
+            self.db.commit()
+
+    def purge(self):
+        """Removes expired entries."""
+        with self.lock:
+            if self.ttl > 0:
+                self.db.execute('DELETE FROM verified WHERE verified_at < ?', (int(time.time()) - self.ttl,))
+            self.db.execute('VACUUM')
+            self.db.commit()
+
+    def close(self):
+        self.db.close()
+
+
+if __name__ == '__main__':
+    if len(sys.argv) == 3 and sys.argv[1] == 'revoke':
+        cache = VerifyCache()
+        cache.revoke(bytes.fromhex(sys.argv[2]))
+        print(f"Key '{sys.argv[2]}' revoked.")
+    elif len(sys.argv) == 2 and sys.argv[1] == 'purge':
+        cache = VerifyCache()
+        cache.purge()
+        print('Expired entries removed.')
+    else:
+        print('Usage: verify_cache.py revoke <key id> | purge')